@@ -0,0 +1,108 @@
+#ifndef _MJOELNIR_ALLOCATOR_H
+#define _MJOELNIR_ALLOCATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "log.hpp"
+
+// Size classes for pooled allocations, anything bigger (or more aligned) goes to malloc.
+const uint32_t HOST_ALLOCATOR_CLASS_COUNT = 7;
+const size_t HOST_ALLOCATOR_MIN_CLASS = 16;
+const size_t HOST_ALLOCATOR_MAX_CLASS = HOST_ALLOCATOR_MIN_CLASS << (HOST_ALLOCATOR_CLASS_COUNT - 1);
+const size_t HOST_ALLOCATOR_SLAB_SIZE = 64 * 1024;
+// Every allocation is preceded by a header of this size, which is also the alignment pooled blocks get.
+const size_t HOST_ALLOCATOR_HEADER_SIZE = 16;
+
+const uint32_t HOST_ALLOCATION_SCOPE_COUNT = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+
+struct HostAllocationStats {
+    uint64_t liveBytes;
+    uint64_t peakBytes;
+    uint64_t liveAllocations;
+    uint64_t totalAllocations;
+    // Allocations the driver made itself and only told us about.
+    uint64_t internalBytes;
+};
+
+// VkAllocationCallbacks that count the driver's host allocations per allocation scope and serve
+// small ones from size class pools instead of the global malloc.
+// Opt-in: callbacks() returns nullptr until enable() has been called, so nothing changes for the
+// driver unless asked to. Has to outlive every Vulkan object created with its callbacks.
+class HostAllocator {
+private:
+    struct SizeClass {
+        std::mutex mutex;
+        void* freeList = nullptr;
+        std::vector<void*> slabs;
+    };
+
+    struct ScopeCounters {
+        std::atomic<uint64_t> liveBytes{0};
+        std::atomic<uint64_t> peakBytes{0};
+        std::atomic<uint64_t> liveAllocations{0};
+        std::atomic<uint64_t> totalAllocations{0};
+        std::atomic<uint64_t> internalBytes{0};
+    };
+
+    VkAllocationCallbacks vulkanCallbacks{};
+    bool enabled = false;
+
+    SizeClass sizeClasses[HOST_ALLOCATOR_CLASS_COUNT];
+    ScopeCounters scopes[HOST_ALLOCATION_SCOPE_COUNT];
+
+    uint64_t allocationsAtFrameStart = 0;
+    uint64_t lastFrameAllocations = 0;
+    uint64_t maxFrameAllocations = 0;
+
+    void* allocate(size_t size, size_t alignment, VkSystemAllocationScope scope);
+    void* reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+    void release(void* memory);
+    void* allocateFromClass(uint32_t sizeClass);
+    void track(VkSystemAllocationScope scope, int64_t bytes);
+    uint64_t totalAllocations() const;
+
+    static void* VKAPI_PTR allocationCallback(void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope);
+    static void* VKAPI_PTR reallocationCallback(void* userData, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+    static void VKAPI_PTR freeCallback(void* userData, void* memory);
+    static void VKAPI_PTR internalAllocationCallback(void* userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+    static void VKAPI_PTR internalFreeCallback(void* userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+public:
+    HostAllocator();
+    ~HostAllocator();
+
+    HostAllocator(const HostAllocator&) = delete;
+    HostAllocator& operator=(const HostAllocator&) = delete;
+
+    // Must happen before the instance is created, objects have to be destroyed with the callbacks they were created with.
+    void enable() {
+        enabled = true;
+    }
+
+    const VkAllocationCallbacks* callbacks() const {
+        return enabled ? &vulkanCallbacks : nullptr;
+    }
+
+    HostAllocationStats stats(VkSystemAllocationScope scope) const;
+
+    // Call right before the first frame, so what startup allocated isn't counted as part of it.
+    void beginFrames();
+
+    // Call once per frame, keeps track of how many allocations happen inside the frame loop.
+    void endFrame();
+
+    uint64_t frameAllocations() const {
+        return lastFrameAllocations;
+    }
+
+    // Writes live and peak numbers per scope to the log.
+    void report(Logger& logger) const;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef _MJOELNIR_COMPONENTS_H
+#define _MJOELNIR_COMPONENTS_H
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include <stdint.h>
+
+// Components the renderer extracts from the world each frame.
+
+struct Transform {
+    glm::mat4 world;
+};
+
+struct MeshRef {
+    uint32_t mesh;
+    uint32_t material;
+};
+
+// World space axis aligned bounding box.
+struct Bounds {
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+// Lights are placed by the entity's Transform, spot lights shine along its -Z axis.
+// Colors are linear and include the intensity, the light fades out completely at range.
+struct PointLight {
+    glm::vec3 color;
+    float range;
+};
+
+struct SpotLight {
+    glm::vec3 color;
+    float range;
+    // Half angles in radians, full intensity inside the inner one, none outside the outer one.
+    float innerAngle;
+    float outerAngle;
+};
+
+// Flattened copy of the above, this is what the renderer works with after extraction.
+struct RenderObject {
+    glm::mat4 model;
+    Bounds bounds;
+    uint32_t mesh;
+    uint32_t material;
+};
+
+#endif
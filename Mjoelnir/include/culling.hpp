@@ -0,0 +1,127 @@
+#ifndef _MJOELNIR_CULLING_H
+#define _MJOELNIR_CULLING_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "components.hpp"
+
+struct Frustum {
+    // xyz is the inward facing normal, w the distance. Order: left, right, bottom, top, near, far.
+    glm::vec4 planes[6];
+
+    // Extracts the planes from a (Vulkan style, 0..1 depth) view projection matrix.
+    static Frustum fromMatrix(const glm::mat4& viewProjection);
+};
+
+// Bounding volume hierarchy over the scene's objects, four children per node.
+// Every node stores the bounds of its four children as SoA arrays, so culling tests all four boxes
+// against a frustum plane with a single SIMD operation.
+// Moving objects only refits the paths above them, the tree is rebuilt once refitting has made it
+// noticeably worse than it was right after the last build.
+class Bvh {
+private:
+    struct alignas(16) Node {
+        float minX[4];
+        float minY[4];
+        float minZ[4];
+        float maxX[4];
+        float maxY[4];
+        float maxZ[4];
+        // count == 0: child is an internal node index (UINT32_MAX for an empty slot).
+        // count > 0: child is the first index into objectOrder of a leaf with count objects.
+        uint32_t child[4];
+        uint32_t count[4];
+        uint32_t parent;
+        uint32_t parentSlot;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<Bounds> objectBounds;
+    // Objects sorted so that each leaf is a contiguous range.
+    std::vector<uint32_t> objectOrder;
+    // Node of the leaf holding each object, refit() recomputes every slot of a dirty node.
+    std::vector<uint32_t> objectNodes;
+    std::vector<uint8_t> dirtyNodes;
+    bool anyDirty = false;
+
+    // Summed surface area of every child box, kept up to date by refit().
+    float currentCost = 0.0f;
+    // The same sum divided by the root's surface area, right after the last build.
+    float builtCost = 0.0f;
+
+    void rebuild();
+    uint32_t buildNode(uint32_t begin, uint32_t end, uint32_t parent, uint32_t parentSlot);
+    void setChildBounds(Node& node, uint32_t slot, const Bounds& bounds);
+    Bounds childBounds(const Node& node, uint32_t slot) const;
+    Bounds nodeBounds(uint32_t node) const;
+    float computeCost() const;
+    float rootArea() const;
+    void appendSubtree(uint32_t node, std::vector<uint32_t>& visible) const;
+    void appendChild(const Node& node, uint32_t slot, std::vector<uint32_t>& visible) const;
+public:
+    void build(const Bounds* bounds, uint32_t count);
+
+    // Updates an object's bounds, refit() propagates the change up the tree. Unchanged bounds are ignored.
+    void setBounds(uint32_t object, const Bounds& bounds);
+    void refit();
+
+    // Appends the index of every object whose bounds intersect the frustum.
+    void cull(const Frustum& frustum, std::vector<uint32_t>& visible) const;
+
+    uint32_t size() const {
+        return static_cast<uint32_t>(objectBounds.size());
+    }
+
+    // Tree cost relative to right after the last build, 1.0 is as good as it gets.
+    float degradation() const;
+};
+
+// Occlusion culling runs on the GPU in two phases. The first draws what was visible last frame, a
+// depth pyramid is built from the result and the second phase tests everything against it, draws
+// what became visible and records the visibility for the next frame. Objects that come into view
+// show up in the same frame, so nothing pops in.
+
+// Have to match local_size_x/y in shaders/occlusion_cull.comp and shaders/depth_reduce.comp.
+const uint32_t OCCLUSION_GROUP_SIZE = 64;
+const uint32_t DEPTH_REDUCE_GROUP_SIZE = 8;
+
+// Per instance input of the culling shader, in draw order.
+struct OcclusionInstance {
+    // World space, w is unused.
+    glm::vec4 boundsMin;
+    glm::vec4 boundsMax;
+    // DrawBatch the instance belongs to.
+    uint32_t batch;
+    // Index into the visibility buffer, the object's index as long as the world's structure stays the same.
+    uint32_t object;
+    uint32_t padding[2];
+};
+
+// Push constants of the culling shader.
+struct OcclusionConstants {
+    glm::mat4 viewProjection;
+    // Size of the pyramid's first level.
+    glm::vec2 pyramidSize;
+    uint32_t instanceCount;
+    uint32_t batchCount;
+    // Where the instances' matrices start in the instance buffer.
+    uint32_t matrixOffset;
+    // 0 draws what was visible last frame, 1 tests everything against the depth pyramid.
+    uint32_t phase;
+};
+
+// Push constants of the depth reduction. The first level only reduces the render area of the
+// depth buffer (see resolution.hpp), so the pyramid always covers exactly what was rendered.
+struct DepthReduceConstants {
+    uint32_t sourceWidth;
+    uint32_t sourceHeight;
+};
+
+// The pyramid's first level is the largest power of two that fits into the depth buffer, so every
+// level after it exactly halves the one before.
+uint32_t depthPyramidSize(uint32_t size);
+uint32_t depthPyramidLevels(uint32_t width, uint32_t height);
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef _MJOELNIR_DELETION_H
+#define _MJOELNIR_DELETION_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <deque>
+#include <functional>
+
+#include <vulkan/vulkan.h>
+
+#include "memory.hpp"
+
+enum class DeletionType : uint8_t {
+    Buffer,
+    DeviceMemory,
+    Image,
+    ImageView,
+    Sampler,
+    Framebuffer,
+    RenderPass,
+    Pipeline,
+    PipelineLayout,
+    ShaderModule,
+    DescriptorPool,
+    DescriptorSetLayout,
+    QueryPool,
+    Swapchain,
+    Function,
+};
+
+// Defers destroying Vulkan objects until the GPU can no longer be using them.
+// Every object is tagged with the last frame that used it, once that frame's fence has been waited on
+// collect() destroys it. Tags are expected to be (more or less) increasing, so the queue stays sorted
+// and collect() only ever looks at the front. Destruction is capped per call to keep frame times flat
+// when a lot of objects are released at once.
+class DeletionQueue {
+private:
+    struct Entry {
+        uint64_t frame;
+        DeletionType type;
+        uint64_t handle;
+        std::function<void()> function;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    // Device memory is freed through the tracker so its statistics stay correct.
+    GpuMemoryTracker* memoryTracker = nullptr;
+    const VkAllocationCallbacks* allocationCallbacks = nullptr;
+    std::deque<Entry> entries;
+
+    void push(Entry&& entry);
+    void destroy(Entry& entry);
+public:
+    void init(VkDevice device, GpuMemoryTracker* memoryTracker, const VkAllocationCallbacks* allocationCallbacks) {
+        this->device = device;
+        this->memoryTracker = memoryTracker;
+        this->allocationCallbacks = allocationCallbacks;
+    }
+
+    template<typename T>
+    void push(uint64_t lastUsedFrame, DeletionType type, T handle) {
+        // Non-dispatchable handles are pointers on 64 bit platforms and uint64_t on 32 bit ones.
+        static_assert(sizeof(T) <= sizeof(uint64_t), "Not a Vulkan handle");
+        uint64_t bits = 0;
+        memcpy(&bits, &handle, sizeof(T));
+        push({lastUsedFrame, type, bits, nullptr});
+    }
+
+    // For anything that is not a single handle, e.g. unmapping and freeing memory.
+    void push(uint64_t lastUsedFrame, std::function<void()> function) {
+        push({lastUsedFrame, DeletionType::Function, 0, std::move(function)});
+    }
+
+    // Destroys at most maxCount objects that were last used in or before retiredFrame.
+    uint32_t collect(uint64_t retiredFrame, uint32_t maxCount);
+
+    // Destroys everything, only call once the device is idle.
+    void flush();
+
+    size_t size() const {
+        return entries.size();
+    }
+};
+
+#endif
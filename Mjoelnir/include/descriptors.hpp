@@ -0,0 +1,106 @@
+#ifndef _MJOELNIR_DESCRIPTORS_H
+#define _MJOELNIR_DESCRIPTORS_H
+
+#include <stdint.h>
+
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// Descriptor set and pipeline layouts are built from reflected shaders (see reflection.hpp) and
+// shared: two pipelines asking for the same bindings get the same VkDescriptorSetLayout, and with it
+// the same VkPipelineLayout, so sets bound for one stay compatible with the other.
+
+// The core descriptor types, VK_DESCRIPTOR_TYPE_SAMPLER through VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT.
+const uint32_t DESCRIPTOR_TYPE_COUNT = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT + 1;
+
+// Descriptors of every type that one set of a layout takes from a pool.
+struct DescriptorCounts {
+    uint32_t count[DESCRIPTOR_TYPE_COUNT] = {};
+};
+
+struct LayoutCacheStats {
+    uint32_t setLayouts;
+    uint32_t pipelineLayouts;
+    uint64_t requests;
+    uint64_t hits;
+};
+
+class LayoutCache {
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    const VkAllocationCallbacks* allocationCallbacks = nullptr;
+
+    // Layouts are requested from several startup jobs at once, creating them is cheap enough to do
+    // under the lock.
+    std::mutex mutex;
+    // Keyed by binding, type, count and stages of every binding.
+    std::map<std::vector<uint32_t>, VkDescriptorSetLayout> setLayouts;
+    // Keyed by the set layout handles followed by the push constant stages and size.
+    std::map<std::vector<uint64_t>, VkPipelineLayout> pipelineLayouts;
+    std::unordered_map<VkDescriptorSetLayout, DescriptorCounts> layoutCounts;
+    uint64_t requests = 0;
+    uint64_t hits = 0;
+public:
+    void init(VkDevice device, const VkAllocationCallbacks* allocationCallbacks) {
+        this->device = device;
+        this->allocationCallbacks = allocationCallbacks;
+    }
+
+    VkDescriptorSetLayout setLayout(std::vector<VkDescriptorSetLayoutBinding> bindings);
+    // pushConstants may be null.
+    VkPipelineLayout pipelineLayout(const std::vector<VkDescriptorSetLayout>& layouts, const VkPushConstantRange* pushConstants);
+
+    // Only known for layouts that came from setLayout().
+    DescriptorCounts descriptorCounts(VkDescriptorSetLayout layout);
+
+    LayoutCacheStats stats();
+
+    // Destroys every layout, only call once nothing uses them anymore.
+    void destroy();
+};
+
+// Hands out descriptor sets that live for a single frame. Sets come from pools sized by
+// DESCRIPTOR_POOL_RATIOS, a new pool is added whenever one runs out, and reset() hands all of them
+// back at once instead of freeing sets one by one. Keep one per frame in flight and reset it once
+// that frame's fence has been waited on.
+// The device is Vulkan 1.0 without VK_KHR_maintenance1, where allocating from a pool that is too
+// full is invalid rather than VK_ERROR_OUT_OF_POOL_MEMORY. So what is left in the current pool is
+// counted, and the allocator moves on before a set wouldn't fit.
+class DescriptorAllocator {
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    LayoutCache* layouts = nullptr;
+    const VkAllocationCallbacks* allocationCallbacks = nullptr;
+
+    std::vector<VkDescriptorPool> pools;
+    // Pools before this one are full.
+    size_t current = 0;
+    uint32_t remainingSets = 0;
+    DescriptorCounts remaining;
+    // Counts of the layouts seen so far, so allocating doesn't go through the cache's lock.
+    std::vector<std::pair<VkDescriptorSetLayout, DescriptorCounts>> knownLayouts;
+
+    VkDescriptorPool createPool();
+    const DescriptorCounts& layoutCounts(VkDescriptorSetLayout layout);
+    void fillRemaining();
+public:
+    void init(VkDevice device, LayoutCache* layouts, const VkAllocationCallbacks* allocationCallbacks) {
+        this->device = device;
+        this->layouts = layouts;
+        this->allocationCallbacks = allocationCallbacks;
+    }
+
+    VkDescriptorSet allocate(VkDescriptorSetLayout layout);
+    void reset();
+    void destroy();
+
+    size_t poolCount() const {
+        return pools.size();
+    }
+};
+
+#endif
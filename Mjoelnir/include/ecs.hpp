@@ -0,0 +1,378 @@
+#ifndef _MJOELNIR_ECS_H
+#define _MJOELNIR_ECS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <bitset>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "jobs.hpp"
+
+// Archetype based entity component system.
+// Entities with the exact same set of components live in the same archetype, which stores them in
+// fixed size chunks. Inside a chunk every component gets its own tightly packed array (SoA), so a query
+// touching two components only streams those two arrays through the cache.
+
+const uint32_t MAX_COMPONENT_TYPES = 64;
+const size_t ECS_CHUNK_SIZE = 16 * 1024;
+const size_t ECS_CHUNK_ALIGNMENT = 64;
+
+struct Entity {
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+
+    bool isValid() const {
+        return index != UINT32_MAX;
+    }
+
+    bool operator==(const Entity& other) const {
+        return index == other.index && generation == other.generation;
+    }
+
+    bool operator!=(const Entity& other) const {
+        return !(*this == other);
+    }
+};
+
+typedef uint32_t ComponentId;
+typedef std::bitset<MAX_COMPONENT_TYPES> ComponentMask;
+
+struct ComponentInfo {
+    size_t size;
+    size_t alignment;
+};
+
+class ComponentRegistry {
+public:
+    static ComponentId registerComponent(size_t size, size_t alignment);
+    static const ComponentInfo& info(ComponentId id);
+
+    template<typename T>
+    static ComponentId id() {
+        // Rows are moved between chunks with memcpy and chunks are freed without running destructors.
+        static_assert(std::is_trivially_copyable<T>::value, "Components must be trivially copyable");
+        static const ComponentId componentId = registerComponent(sizeof(T), alignof(T));
+        return componentId;
+    }
+};
+
+template<typename... Ts>
+ComponentMask componentMask() {
+    ComponentMask mask;
+    (mask.set(ComponentRegistry::id<Ts>()), ...);
+    return mask;
+}
+
+struct Chunk {
+    std::byte* data;
+    uint32_t count = 0;
+
+    Chunk() {
+        data = static_cast<std::byte*>(::operator new(ECS_CHUNK_SIZE, std::align_val_t(ECS_CHUNK_ALIGNMENT)));
+    }
+
+    ~Chunk() {
+        ::operator delete(data, std::align_val_t(ECS_CHUNK_ALIGNMENT));
+    }
+
+    Chunk(const Chunk&) = delete;
+    Chunk& operator=(const Chunk&) = delete;
+};
+
+class Archetype {
+public:
+    ComponentMask mask;
+    std::vector<ComponentId> components;
+    // Byte offset of each component array inside a chunk, indexed the same way as components.
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> sizes;
+    // Component id -> index into components, -1 when the archetype does not have it.
+    int8_t columns[MAX_COMPONENT_TYPES];
+    uint32_t capacity;
+    // Chunks are always full except for the last one.
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    // Cached transitions to the archetype with one component added/removed.
+    uint32_t addEdges[MAX_COMPONENT_TYPES];
+    uint32_t removeEdges[MAX_COMPONENT_TYPES];
+
+    explicit Archetype(const ComponentMask& mask);
+
+    Entity* entities(Chunk& chunk) {
+        return reinterpret_cast<Entity*>(chunk.data);
+    }
+
+    void* column(Chunk& chunk, uint32_t column) {
+        return chunk.data + offsets[column];
+    }
+
+    template<typename T>
+    T* column(Chunk& chunk) {
+        return reinterpret_cast<T*>(column(chunk, columns[ComponentRegistry::id<T>()]));
+    }
+
+    void* component(uint32_t chunk, uint32_t row, uint32_t column) {
+        return chunks[chunk]->data + offsets[column] + static_cast<size_t>(row) * sizes[column];
+    }
+
+    uint32_t size() const;
+};
+
+class World;
+
+// Records structural changes (create/destroy/add/remove) so they can be issued while a query is
+// iterating chunks and applied later at a sync point with World::sync().
+class CommandBuffer {
+private:
+    enum class Op : uint8_t {
+        Create,
+        Destroy,
+        Add,
+        Remove,
+    };
+
+    struct Command {
+        Op op;
+        // An invalid entity refers to the last entity created by this buffer.
+        Entity entity;
+        ComponentId component;
+        uint32_t dataOffset;
+    };
+
+    std::vector<Command> commands;
+    std::vector<std::byte> data;
+
+    template<typename T>
+    void pushAdd(Entity entity, const T& value) {
+        uint32_t offset = static_cast<uint32_t>(data.size());
+        data.resize(data.size() + sizeof(T));
+        memcpy(data.data() + offset, &value, sizeof(T));
+        commands.push_back({Op::Add, entity, ComponentRegistry::id<T>(), offset});
+    }
+
+    friend class World;
+public:
+    template<typename... Ts>
+    void createEntity(const Ts&... components) {
+        commands.push_back({Op::Create, Entity{}, 0, 0});
+        (pushAdd(Entity{}, components), ...);
+    }
+
+    void destroyEntity(Entity entity) {
+        commands.push_back({Op::Destroy, entity, 0, 0});
+    }
+
+    template<typename T>
+    void addComponent(Entity entity, const T& value) {
+        pushAdd(entity, value);
+    }
+
+    template<typename T>
+    void removeComponent(Entity entity) {
+        commands.push_back({Op::Remove, entity, ComponentRegistry::id<T>(), 0});
+    }
+
+    bool empty() const {
+        return commands.empty();
+    }
+
+    void clear() {
+        commands.clear();
+        data.clear();
+    }
+
+    void reserve(size_t commandCount, size_t dataSize) {
+        commands.reserve(commandCount);
+        data.reserve(dataSize);
+    }
+};
+
+class World {
+private:
+    struct EntityRecord {
+        uint32_t archetype;
+        uint32_t chunk;
+        uint32_t row;
+        uint32_t generation;
+    };
+
+    JobSystem* jobs;
+    std::vector<EntityRecord> records;
+    std::vector<uint32_t> freeIndices;
+    uint32_t aliveCount = 0;
+    uint64_t structureChanges = 0;
+    std::vector<std::unique_ptr<Archetype>> archetypes;
+    std::unordered_map<ComponentMask, uint32_t> archetypeLookup;
+    // One per job system worker, indexed by JobSystem::threadIndex() - 1, so parallel queries can
+    // record without locking.
+    std::vector<CommandBuffer> commandBuffers;
+    // Threads outside the job system (main, render, ...) get one each the first time they ask,
+    // found by their id under threadBuffersMutex.
+    std::vector<std::thread::id> bufferThreads;
+    std::vector<std::unique_ptr<CommandBuffer>> threadBuffers;
+    std::mutex threadBuffersMutex;
+    // Most commands and bytes of component data recorded between two syncs, rounded up to a power
+    // of two, every buffer is kept big enough for all of it. Which worker records what changes from frame to frame, this way a
+    // frame that records no more than the ones before doesn't allocate however it lands.
+    size_t commandsHighWater = 0;
+    size_t dataHighWater = 0;
+
+    uint32_t findOrCreateArchetype(const ComponentMask& mask);
+    uint32_t archetypeWith(uint32_t archetype, ComponentId component);
+    uint32_t archetypeWithout(uint32_t archetype, ComponentId component);
+    void allocateRow(uint32_t archetype, EntityRecord& record, Entity entity);
+    void freeRow(const EntityRecord& record);
+    void moveEntity(Entity entity, uint32_t targetArchetype);
+    void applyCommands(CommandBuffer& buffer);
+    Entity createEntityWithMask(const ComponentMask& mask);
+    void* addComponent(Entity entity, ComponentId component, const void* value);
+    void removeComponent(Entity entity, ComponentId component);
+    void* getComponent(Entity entity, ComponentId component);
+public:
+    explicit World(JobSystem* jobs = nullptr);
+
+    World(const World&) = delete;
+    World& operator=(const World&) = delete;
+
+    Entity createEntity() {
+        return createEntityWithMask(ComponentMask());
+    }
+
+    template<typename... Ts>
+    Entity createEntity(const Ts&... components) {
+        Entity entity = createEntityWithMask(componentMask<Ts...>());
+        (setComponent(entity, components), ...);
+        return entity;
+    }
+
+    void destroyEntity(Entity entity);
+    bool isAlive(Entity entity) const;
+
+    uint32_t entityCount() const {
+        return aliveCount;
+    }
+
+    // Bumped by every structural change. As long as it stays the same, chunk iteration visits
+    // entities in the same order.
+    uint64_t structureVersion() const {
+        return structureChanges;
+    }
+
+    uint32_t archetypeCount() const {
+        return static_cast<uint32_t>(archetypes.size());
+    }
+
+    // Adds the component, or overwrites it if the entity already has one.
+    template<typename T>
+    T* setComponent(Entity entity, const T& value) {
+        return static_cast<T*>(addComponent(entity, ComponentRegistry::id<T>(), &value));
+    }
+
+    template<typename T>
+    void removeComponent(Entity entity) {
+        removeComponent(entity, ComponentRegistry::id<T>());
+    }
+
+    template<typename T>
+    T* getComponent(Entity entity) {
+        return static_cast<T*>(getComponent(entity, ComponentRegistry::id<T>()));
+    }
+
+    template<typename T>
+    bool hasComponent(Entity entity) const {
+        if (!isAlive(entity)) {
+            return false;
+        }
+        return archetypes[records[entity.index].archetype]->columns[ComponentRegistry::id<T>()] >= 0;
+    }
+
+    // Calls function(count, entities, Ts*...) once per non-empty chunk that has all of Ts.
+    // Structural changes are not allowed while iterating, record them with commands() instead.
+    template<typename... Ts, typename F>
+    void eachChunk(F&& function) {
+        ComponentMask required = componentMask<Ts...>();
+        for (auto& archetype : archetypes) {
+            if ((archetype->mask & required) != required) {
+                continue;
+            }
+
+            for (auto& chunk : archetype->chunks) {
+                if (chunk->count == 0) {
+                    continue;
+                }
+                function(chunk->count, archetype->entities(*chunk), archetype->column<Ts>(*chunk)...);
+            }
+        }
+    }
+
+    // Calls function(entity, Ts&...) for every entity that has all of Ts.
+    template<typename... Ts, typename F>
+    void each(F&& function) {
+        eachChunk<Ts...>([&function](uint32_t count, Entity* entities, Ts*... components) {
+            for (uint32_t i = 0; i < count; i++) {
+                function(entities[i], components[i]...);
+            }
+        });
+    }
+
+    // Same as eachChunk() but chunks are spread over the job system.
+    // function runs concurrently, it may only write to the components it was handed.
+    template<typename... Ts, typename F>
+    void parallelEachChunk(F&& function) {
+        if (jobs == nullptr) {
+            eachChunk<Ts...>(function);
+            return;
+        }
+
+        // One job per chunk, addressed by archetype and chunk index instead of a list of chunks, so a
+        // query doesn't allocate. The calling thread runs jobs itself while it waits.
+        auto runChunk = [this, &function](uint32_t archetypeIndex, uint32_t chunkIndex) {
+            Archetype* archetype = archetypes[archetypeIndex].get();
+            Chunk& chunk = *archetype->chunks[chunkIndex];
+            function(chunk.count, archetype->entities(chunk), archetype->column<Ts>(chunk)...);
+        };
+
+        ComponentMask required = componentMask<Ts...>();
+        JobCounter counter;
+        for (uint32_t a = 0; a < archetypes.size(); a++) {
+            if ((archetypes[a]->mask & required) != required) {
+                continue;
+            }
+
+            for (uint32_t c = 0; c < archetypes[a]->chunks.size(); c++) {
+                if (archetypes[a]->chunks[c]->count > 0) {
+                    jobs->submitIndexed(counter, runChunk, a, c);
+                }
+            }
+        }
+
+        jobs->wait(counter);
+    }
+
+    template<typename... Ts, typename F>
+    void parallelEach(F&& function) {
+        parallelEachChunk<Ts...>([&function](uint32_t count, Entity* entities, Ts*... components) {
+            for (uint32_t i = 0; i < count; i++) {
+                function(entities[i], components[i]...);
+            }
+        });
+    }
+
+    // Command buffer for the calling thread, safe to use from inside parallel queries. Every thread
+    // owns its own, threads outside the job system take a lock the first time they record.
+    CommandBuffer& commands();
+
+    // Sync point: applies every recorded command buffer, those of threads outside the job system
+    // in the order they first recorded, then the workers'. Nothing may record while it runs.
+    void sync();
+};
+
+#endif
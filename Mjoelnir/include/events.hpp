@@ -0,0 +1,90 @@
+#ifndef _MJOELNIR_EVENTS_H
+#define _MJOELNIR_EVENTS_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+
+// The main thread only pumps OS events, rendering happens on a thread of its own. Window callbacks
+// turn events into WindowEvents and push them into a WindowEventQueue, the render thread drains it
+// at the start of every frame. Neither side ever blocks the other.
+
+const uint32_t WINDOW_EVENT_QUEUE_SIZE = 1024;
+
+enum class WindowEventType : uint8_t {
+    Key,
+    MouseButton,
+    CursorPosition,
+    Scroll,
+    FramebufferResize,
+    Focus,
+};
+
+struct WindowEvent {
+    WindowEventType type;
+    // Profiler::now() when the main thread received it.
+    uint64_t timestamp;
+    // 0 for the main window, otherwise what Mjoelnir::addWindow() returned.
+    uint32_t window;
+    union {
+        // GLFW key, scancode, action and modifiers.
+        struct {
+            int32_t key;
+            int32_t scancode;
+            int32_t action;
+            int32_t mods;
+        } key;
+        struct {
+            int32_t button;
+            int32_t action;
+            int32_t mods;
+        } mouseButton;
+        // Screen coordinates for the cursor, offsets for scrolling.
+        struct {
+            double x;
+            double y;
+        } position;
+        // Pixels.
+        struct {
+            uint32_t width;
+            uint32_t height;
+        } size;
+        bool focused;
+    };
+};
+
+typedef std::function<void(const WindowEvent& event)> WindowEventCallback;
+
+// Single producer (the main thread), single consumer (the render thread).
+class WindowEventQueue {
+private:
+    alignas(64) std::atomic<uint32_t> head{0};
+    alignas(64) std::atomic<uint32_t> tail{0};
+    alignas(64) WindowEvent events[WINDOW_EVENT_QUEUE_SIZE];
+    std::atomic<uint64_t> dropped{0};
+public:
+    // Drops the event when the render thread has fallen this far behind.
+    bool push(const WindowEvent& event);
+    bool pop(WindowEvent& event);
+
+    uint64_t droppedEvents() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+};
+
+// The framebuffer size travels as a single atomic word, so the render thread never sees the width
+// of one resize together with the height of another.
+inline uint64_t packFramebufferSize(uint32_t width, uint32_t height) {
+    return (static_cast<uint64_t>(width) << 32) | height;
+}
+
+inline uint32_t framebufferWidth(uint64_t size) {
+    return static_cast<uint32_t>(size >> 32);
+}
+
+inline uint32_t framebufferHeight(uint64_t size) {
+    return static_cast<uint32_t>(size);
+}
+
+#endif
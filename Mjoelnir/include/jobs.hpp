@@ -0,0 +1,110 @@
+#ifndef _MJOELNIR_JOBS_H
+#define _MJOELNIR_JOBS_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Tracks a group of submitted jobs, wait() on it to block until all of them have finished.
+struct JobCounter {
+    std::atomic<uint32_t> pending{0};
+    // The first exception one of the jobs threw, wait() rethrows it.
+    std::exception_ptr error;
+    std::mutex errorMutex;
+};
+
+// Jobs the queue has room for up front, it doubles whenever more are queued at once.
+const uint32_t JOB_QUEUE_CAPACITY = 1024;
+
+// Non-owning reference to a callable taking two indices, unlike std::function it never allocates.
+// Whatever it refers to has to outlive the jobs running it.
+class JobFunction {
+private:
+    void* callable = nullptr;
+    void (*invoke)(void* callable, uint32_t first, uint32_t second) = nullptr;
+public:
+    JobFunction() = default;
+
+    template<typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, JobFunction>::value>>
+    JobFunction(F&& function) :
+        callable(const_cast<void*>(static_cast<const void*>(std::addressof(function)))),
+        invoke([](void* callable, uint32_t first, uint32_t second) {
+            (*static_cast<std::remove_reference_t<F>*>(callable))(first, second);
+        }) {}
+
+    void operator()(uint32_t first, uint32_t second) const {
+        invoke(callable, first, second);
+    }
+
+    explicit operator bool() const {
+        return invoke != nullptr;
+    }
+};
+
+// Small fixed-size worker pool.
+// The thread calling wait()/parallelFor() helps out with queued jobs instead of sleeping,
+// so it is fine to nest parallelFor() inside a job.
+class JobSystem {
+private:
+    struct Job {
+        // Set by submit(), otherwise indexed is called with first and second.
+        std::function<void()> function;
+        JobFunction indexed;
+        uint32_t first = 0;
+        uint32_t second = 0;
+        JobCounter* counter = nullptr;
+    };
+
+    std::vector<std::thread> workers;
+    // Ring buffer that only ever grows, so queueing jobs doesn't allocate once it is big enough.
+    std::vector<Job> queue;
+    size_t queueHead = 0;
+    size_t queueSize = 0;
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    bool stopping = false;
+
+    // Both with queueMutex held.
+    void push(Job&& job);
+    Job pop();
+    bool runOne();
+    static void run(Job& job);
+    void workerLoop(uint32_t index);
+public:
+    // threadCount == 0 picks hardware_concurrency() - 1 workers.
+    explicit JobSystem(uint32_t threadCount = 0);
+    ~JobSystem();
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    void submit(JobCounter& counter, std::function<void()> function);
+    // Runs function(begin, end) on the range [begin, end) without copying it, it has to stay alive
+    // until counter is waited on. Unlike submit() with a capture too big for std::function, it
+    // doesn't allocate unless more than JOB_QUEUE_CAPACITY jobs are queued at once.
+    void submitRange(JobCounter& counter, JobFunction function, uint32_t begin, uint32_t end);
+    // Same as submitRange() for a job addressed by two indices rather than a range, say an
+    // archetype and one of its chunks, function(first, second) runs once.
+    void submitIndexed(JobCounter& counter, JobFunction function, uint32_t first, uint32_t second);
+    // Rethrows the first exception a job of counter threw, once all of them have finished.
+    void wait(JobCounter& counter);
+
+    // Splits [0, count) into ranges of at most grainSize and runs them across the pool.
+    void parallelFor(uint32_t count, uint32_t grainSize, JobFunction function);
+
+    // Number of threads that can execute jobs, including the calling thread.
+    uint32_t threadCount() const { return static_cast<uint32_t>(workers.size()) + 1; }
+
+    // 0 for any thread that is not a worker (usually the main thread), 1..N for workers.
+    static uint32_t threadIndex();
+};
+
+#endif
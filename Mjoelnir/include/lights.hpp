@@ -0,0 +1,84 @@
+#ifndef _MJOELNIR_LIGHTS_H
+#define _MJOELNIR_LIGHTS_H
+
+#include <stdint.h>
+
+#include "components.hpp"
+#include "culling.hpp"
+
+// Clustered forward lighting. The view frustum is split into CLUSTER_TILES_X * CLUSTER_TILES_Y
+// screen tiles and CLUSTER_SLICES depth slices, spaced exponentially for perspective projections.
+// Every frame a compute pass (shaders/light_cull.comp) tests every light's bounding sphere against
+// every cluster's view space bounding box and writes the lights that reach it into the cluster's
+// slot of the light list. The mesh fragment shader then only loops over the lights of the cluster
+// it falls into, so the cost of shading follows how many lights are nearby rather than how many
+// there are. Cluster bounds only depend on the projection and are rebuilt when it changes.
+
+// Have to match shaders/lights.glsl.
+const uint32_t CLUSTER_TILES_X = 16;
+const uint32_t CLUSTER_TILES_Y = 9;
+const uint32_t CLUSTER_SLICES = 24;
+const uint32_t CLUSTER_COUNT = CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES;
+// Lights past this many in one cluster are dropped.
+const uint32_t CLUSTER_MAX_LIGHTS = 128;
+const uint32_t LIGHT_CULL_GROUP_SIZE = 64;
+// Where the last slice ends for projections with an infinite far plane, relative to the near plane.
+// Anything further away is shaded with the lights of the last slice.
+const float CLUSTER_MAX_DEPTH_RATIO = 10000.0f;
+
+const uint32_t INITIAL_LIGHT_CAPACITY = 1024;
+
+// Storage buffer layout, see shaders/lights.glsl. Everything is in view space.
+struct GpuLight {
+    // w is the range.
+    glm::vec4 positionRange;
+    // w is the cone offset, see direction.
+    glm::vec4 color;
+    // The spot axis, w is the cone scale. A fragment gets clamp(dot(axis, -toLight) * scale + offset)
+    // of the light, point lights have a scale of 0 and an offset of 1.
+    glm::vec4 direction;
+    // Sphere around everything the light reaches, what clusters are tested against.
+    glm::vec4 bounds;
+};
+
+struct ClusterBounds {
+    glm::vec4 min;
+    glm::vec4 max;
+};
+
+// How a depth buffer value z turns into a slice:
+//   depth = (linearize.x * z + linearize.y) / (linearize.z * z + linearize.w)
+//   slice = (logarithmic ? log2(depth) : depth) * sliceScale + sliceBias
+struct ClusterDepth {
+    glm::vec4 linearize;
+    float sliceScale;
+    float sliceBias;
+    bool logarithmic;
+};
+
+// Uniform buffer of the mesh shaders and light culling, std140.
+struct FrameUniforms {
+    glm::mat4 view;
+    glm::mat4 viewProjection;
+    // rgb, w is unused.
+    glm::vec4 ambient;
+    glm::vec4 depthLinearize;
+    // Clusters per pixel.
+    glm::vec2 tileScale;
+    float sliceScale;
+    float sliceBias;
+    uint32_t logarithmicSlices;
+    uint32_t lightCount;
+    uint32_t padding[2];
+};
+
+ClusterDepth clusterDepth(const glm::mat4& projection);
+
+// Writes CLUSTER_COUNT bounds, x fastest, then y, then the slice.
+void buildClusterBounds(const glm::mat4& projection, const ClusterDepth& depth, ClusterBounds* bounds);
+
+// False if the light can't reach anything inside the frustum.
+bool packPointLight(const PointLight& light, const glm::mat4& world, const glm::mat4& view, const Frustum& frustum, GpuLight& packed);
+bool packSpotLight(const SpotLight& light, const glm::mat4& world, const glm::mat4& view, const Frustum& frustum, GpuLight& packed);
+
+#endif
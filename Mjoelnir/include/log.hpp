@@ -0,0 +1,164 @@
+#ifndef _MJOELNIR_LOG_H
+#define _MJOELNIR_LOG_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Asynchronous engine log.
+// Every thread that logs gets its own single producer/single consumer ring, so writing a message is a
+// filter check, a vsnprintf into the ring slot and a release store, without locks or allocations.
+// A background thread drains the rings, writes to stderr and optionally to a binary log file.
+// When a ring is full the message is dropped and counted instead of blocking the caller.
+
+enum class LogSeverity : uint8_t {
+    Verbose,
+    Info,
+    Warning,
+    Error,
+};
+
+enum class LogCategory : uint8_t {
+    General,
+    Validation,
+    Performance,
+    Engine,
+    Count,
+};
+
+const uint32_t LOG_MAX_THREADS = 64;
+const uint32_t LOG_RING_SIZE = 256;
+const uint32_t LOG_MAX_MESSAGE = 488;
+
+// Validation messages with the same id are let through at most this many times per window.
+const uint32_t LOG_REPEAT_LIMIT = 4;
+const uint64_t LOG_REPEAT_WINDOW_NS = 1000000000ull;
+const uint32_t LOG_REPEAT_TABLE_SIZE = 128;
+
+// Binary log layout, everything little endian:
+//     header: "MJLOG" 0x00, uint16_t version
+//     record: uint64_t timestamp (ns), uint8_t severity, uint8_t category, uint16_t length,
+//             int32_t messageId, then length bytes of text (not null terminated)
+const char LOG_BINARY_MAGIC[6] = {'M', 'J', 'L', 'O', 'G', '\0'};
+const uint16_t LOG_BINARY_VERSION = 1;
+
+struct LogRecord {
+    uint64_t timestamp;
+    int32_t messageId;
+    uint16_t length;
+    LogSeverity severity;
+    LogCategory category;
+    char text[LOG_MAX_MESSAGE];
+};
+
+class Logger {
+private:
+    struct RepeatCounter {
+        int32_t messageId;
+        uint32_t count;
+        uint32_t suppressed;
+        uint64_t windowStart;
+    };
+
+    struct Ring {
+        alignas(64) std::atomic<uint32_t> head{0};
+        alignas(64) std::atomic<uint32_t> tail{0};
+        alignas(64) LogRecord records[LOG_RING_SIZE];
+        // Only touched by the owning thread.
+        RepeatCounter repeats[LOG_REPEAT_TABLE_SIZE] = {};
+        std::thread::id owner = std::this_thread::get_id();
+    };
+
+    // Lets threads tell a new logger apart from a destroyed one that lived at the same address.
+    uint64_t id;
+    std::atomic<Ring*> rings[LOG_MAX_THREADS] = {};
+    std::atomic<uint32_t> ringCount{0};
+    std::atomic<uint64_t> droppedMessages{0};
+
+    std::atomic<uint8_t> minSeverity{static_cast<uint8_t>(LogSeverity::Verbose)};
+    std::atomic<uint32_t> categoryMask{~0u};
+
+    struct Pending {
+        uint64_t timestamp;
+        // Keeps messages with the same timestamp in ring order, std::stable_sort would allocate.
+        uint32_t sequence;
+        const LogRecord* record;
+    };
+    // Only used by drain(), kept around so draining doesn't allocate.
+    std::vector<Pending> pending;
+
+    std::atomic<bool> colors{true};
+    std::atomic<bool> running{true};
+    std::atomic<uint32_t> drainRequests{0};
+    std::atomic<uint32_t> drainsCompleted{0};
+    std::thread drainThread;
+
+    // Only held by the drain thread while writing and by openBinaryLog().
+    std::mutex fileMutex;
+    FILE* binaryFile = nullptr;
+
+    Ring* threadRing();
+    bool allowRepeat(Ring& ring, int32_t messageId, uint64_t timestamp, uint32_t& suppressed);
+    void push(Ring& ring, LogSeverity severity, LogCategory category, int32_t messageId, uint64_t timestamp, const char* format, va_list args);
+    void pushFormatted(Ring& ring, LogSeverity severity, LogCategory category, int32_t messageId, uint64_t timestamp, const char* format, ...);
+    bool drain();
+    void write(const LogRecord& record, FILE* text, bool useColors);
+    void drainLoop();
+public:
+    Logger();
+    ~Logger();
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    void setMinSeverity(LogSeverity severity) {
+        minSeverity.store(static_cast<uint8_t>(severity), std::memory_order_relaxed);
+    }
+
+    void setCategoryEnabled(LogCategory category, bool enabled) {
+        if (enabled) {
+            categoryMask.fetch_or(1u << static_cast<uint32_t>(category), std::memory_order_relaxed);
+        } else {
+            categoryMask.fetch_and(~(1u << static_cast<uint32_t>(category)), std::memory_order_relaxed);
+        }
+    }
+
+    void setColors(bool enabled) {
+        colors.store(enabled, std::memory_order_relaxed);
+    }
+
+    // Checked before anything is formatted, so filtered messages cost next to nothing.
+    bool enabled(LogSeverity severity, LogCategory category) const {
+        return static_cast<uint8_t>(severity) >= minSeverity.load(std::memory_order_relaxed) &&
+            (categoryMask.load(std::memory_order_relaxed) & (1u << static_cast<uint32_t>(category))) != 0;
+    }
+
+    void log(LogSeverity severity, LogCategory category, const char* format, ...)
+#if defined(__GNUC__) || defined(__clang__)
+        __attribute__((format(printf, 4, 5)))
+#endif
+        ;
+
+    // Same as log() but rate limited and deduplicated by messageId, for validation layer output.
+    void logMessage(LogSeverity severity, LogCategory category, int32_t messageId, const char* message);
+
+    // Also writes every following message to path in the binary format above, nullptr closes the file.
+    void openBinaryLog(const char* path);
+
+    // Blocks until everything logged before the call has been written out.
+    void flush();
+
+    uint64_t dropped() const {
+        return droppedMessages.load(std::memory_order_relaxed);
+    }
+
+    // Converts a binary log back into text, returns false if the file is not a binary log.
+    static bool decodeBinaryLog(const char* path, FILE* output);
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef _MJOELNIR_MEMORY_H
+#define _MJOELNIR_MEMORY_H
+
+#include <stdint.h>
+
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+enum class MemoryCategory : uint8_t {
+    Buffer,
+    Image,
+    Staging,
+    Other,
+    Count,
+};
+
+enum class MemoryPressure : uint8_t {
+    None,
+    // Good time to start evicting things that are cheap to bring back.
+    Moderate,
+    // Evict aggressively, the driver is about to start paging.
+    High,
+    // Allocations are failing or about to.
+    Critical,
+};
+
+// Fraction of a heap's budget at which each pressure level starts.
+const float MEMORY_PRESSURE_MODERATE = 0.75f;
+const float MEMORY_PRESSURE_HIGH = 0.9f;
+const float MEMORY_PRESSURE_CRITICAL = 0.97f;
+// A level is only left once usage is this much of the budget below where it starts, so usage
+// hovering around a threshold doesn't make the pressure flap.
+const float MEMORY_PRESSURE_HYSTERESIS = 0.05f;
+// After a failed allocation the heap stays Critical until usage has dropped this much below what it
+// was when the failure was noticed.
+const float MEMORY_FAILURE_RELEASE = 0.1f;
+
+// Without VK_EXT_memory_budget we assume this much of a heap can be used before things get slow.
+const float MEMORY_FALLBACK_BUDGET = 0.8f;
+
+// Frames between asking the driver for the budget, our own allocations are tracked in between.
+const uint32_t MEMORY_BUDGET_REFRESH_INTERVAL = 30;
+
+struct MemoryHeapStats {
+    VkDeviceSize size;
+    VkDeviceSize budget;
+    // Usage of the whole process as reported by the driver, plus our allocations since the last report.
+    VkDeviceSize usage;
+    // Memory allocated through the tracker.
+    VkDeviceSize allocated[static_cast<uint32_t>(MemoryCategory::Count)];
+    uint32_t allocationCount;
+    bool deviceLocal;
+    MemoryPressure pressure;
+};
+
+typedef std::function<void(uint32_t heap, const MemoryHeapStats& stats)> MemoryPressureCallback;
+
+// Tracks device memory per heap and category and compares it against the driver's budget.
+// Allocations go through allocate()/free() and may happen on any thread. update() runs once per
+// frame: it refreshes the budget every few frames, takes a snapshot that stats() copies out, and
+// calls the pressure callbacks whenever a heap's pressure level changes.
+class GpuMemoryTracker {
+private:
+    struct Allocation {
+        uint32_t heap;
+        VkDeviceSize size;
+        MemoryCategory category;
+    };
+
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    const VkAllocationCallbacks* allocationCallbacks = nullptr;
+    // Only set when VK_EXT_memory_budget is enabled.
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2 = nullptr;
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+
+    // Also guards the snapshot.
+    mutable std::mutex allocationMutex;
+    std::unordered_map<VkDeviceMemory, Allocation> allocations;
+    VkDeviceSize allocated[VK_MAX_MEMORY_HEAPS][static_cast<uint32_t>(MemoryCategory::Count)] = {};
+    uint32_t allocationCounts[VK_MAX_MEMORY_HEAPS] = {};
+    bool allocationFailed[VK_MAX_MEMORY_HEAPS] = {};
+    // Usage when update() first saw the failure, 0 while there is none.
+    VkDeviceSize failureUsage[VK_MAX_MEMORY_HEAPS] = {};
+
+    // Last values from the driver and how much we had allocated at that point.
+    VkDeviceSize driverBudget[VK_MAX_MEMORY_HEAPS] = {};
+    VkDeviceSize driverUsage[VK_MAX_MEMORY_HEAPS] = {};
+    VkDeviceSize allocatedAtRefresh[VK_MAX_MEMORY_HEAPS] = {};
+    uint32_t framesSinceRefresh = 0;
+
+    MemoryHeapStats snapshot[VK_MAX_MEMORY_HEAPS] = {};
+    std::vector<MemoryPressureCallback> callbacks;
+
+    void refreshBudget();
+    VkDeviceSize totalAllocated(uint32_t heap) const;
+public:
+    void init(VkInstance instance, VkPhysicalDevice physicalDevice, bool budgetExtension, const VkAllocationCallbacks* allocationCallbacks);
+
+    VkResult allocate(VkDevice device, const VkMemoryAllocateInfo& allocateInfo, MemoryCategory category, VkDeviceMemory* memory);
+    void free(VkDevice device, VkDeviceMemory memory);
+
+    void addPressureCallback(MemoryPressureCallback callback) {
+        callbacks.push_back(std::move(callback));
+    }
+
+    void update();
+
+    uint32_t heapCount() const {
+        return memoryProperties.memoryHeapCount;
+    }
+
+    // As of the last update(), safe to call from any thread.
+    MemoryHeapStats stats(uint32_t heap) const;
+
+    bool hasDriverBudget() const {
+        return getMemoryProperties2 != nullptr;
+    }
+};
+
+#endif
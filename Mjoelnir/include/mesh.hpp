@@ -0,0 +1,140 @@
+#ifndef _MJOELNIR_MESH_H
+#define _MJOELNIR_MESH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "components.hpp"
+
+// Entries in the post transform vertex cache the optimizer plans for. Real hardware differs and
+// isn't strictly FIFO, but 16 is a good fit for most of it.
+const uint32_t VERTEX_CACHE_SIZE = 16;
+
+const uint32_t PACKED_VERTEX_ATTRIBUTE_COUNT = 3;
+
+const uint32_t MESH_MAX_LODS = 4;
+// Every LOD aims for this fraction of the previous one's triangles.
+const float MESH_LOD_REDUCTION = 0.5f;
+// A LOD that doesn't get below this fraction of the previous one isn't worth keeping.
+const float MESH_LOD_MIN_REDUCTION = 0.9f;
+
+// What mesh loaders produce.
+struct MeshVertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 uv;
+};
+
+// What the GPU reads, 16 instead of 32 bytes per vertex.
+struct PackedVertex {
+    // Normalized to the mesh's bounds, w is padding.
+    uint16_t position[4];
+    // Octahedral encoding, snorm.
+    int16_t normal[2];
+    // Half floats.
+    uint16_t uv[2];
+};
+
+// Turns a packed position back into a mesh space one: position * scale + offset.
+// Laid out for a push constant block.
+struct MeshQuantization {
+    glm::vec4 offset;
+    glm::vec4 scale;
+};
+
+// Specialization constant ids of the mesh shaders, see ShaderVariant.
+// Colors meshes by their normals instead of their UVs.
+const uint32_t MESH_SHADER_SHOW_NORMALS = 0;
+
+// Index range of one level of detail, all of them share the mesh's vertices.
+struct MeshLod {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    // How far (in mesh space) the simplified surface may be off from the original.
+    float error;
+};
+
+struct MeshStats {
+    size_t sourceVertexBytes;
+    size_t packedVertexBytes;
+    size_t sourceIndexBytes;
+    size_t packedIndexBytes;
+    // Size of encodeIndexBuffer()'s output, what the mesh takes up on disk.
+    size_t compressedIndexBytes;
+    // Average cache miss ratio, vertex shader invocations per triangle.
+    float acmrBefore;
+    float acmrAfter;
+};
+
+struct ProcessedMesh {
+    std::vector<PackedVertex> vertices;
+    // Raw index data of every LOD back to back, 16 bit whenever the vertex count allows it.
+    std::vector<uint8_t> indices;
+    VkIndexType indexType;
+    uint32_t indexCount;
+    // Finest first.
+    std::vector<MeshLod> lods;
+    MeshQuantization quantization;
+    // Mesh space.
+    Bounds bounds;
+    MeshStats stats;
+};
+
+// Reorders triangles for the post transform cache (Tipsify). When clusters isn't null it receives
+// the index offsets where the cache was flushed anyway, triangles can be reordered between those
+// without hurting the cache much.
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>* clusters);
+
+// Sorts the clusters from optimizeVertexCache() so the ones on the outside facing away from the
+// center come first, they are the most likely to occlude the rest.
+void optimizeOverdraw(uint32_t* indices, size_t indexCount, const MeshVertex* vertices, const std::vector<uint32_t>& clusters);
+
+// Reorders vertices in the order the indices first use them, so fetching them walks through memory
+// linearly. Unreferenced vertices are dropped. Returns the new vertex count.
+size_t optimizeVertexFetch(MeshVertex* destination, uint32_t* indices, size_t indexCount, const MeshVertex* vertices, size_t vertexCount);
+
+// Average cache miss ratio of a FIFO cache with cacheSize entries.
+float vertexCacheMissRatio(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize);
+
+MeshQuantization computeQuantization(const Bounds& bounds);
+PackedVertex quantizeVertex(const MeshVertex& vertex, const Bounds& bounds);
+
+// Delta and varint coded indices for storage, the GPU still gets plain ones.
+std::vector<uint8_t> encodeIndexBuffer(const uint32_t* indices, size_t indexCount);
+bool decodeIndexBuffer(const uint8_t* data, size_t size, uint32_t* indices, size_t indexCount);
+
+// Quadric error metric edge collapse. Vertices are only ever collapsed onto other vertices, so the
+// result indexes into the same vertex buffer. Vertices on borders and attribute seams stay where
+// they are. Returns the number of indices written to destination (at most indexCount), error
+// receives the largest deviation introduced in mesh space units.
+size_t simplifyMesh(uint32_t* destination, const uint32_t* indices, size_t indexCount, const MeshVertex* vertices, size_t vertexCount, size_t targetIndexCount, float* error);
+
+// Coarsest LOD whose error stays under maxPixelError, errorScale turns mesh space units into
+// pixels at the instance's distance.
+uint32_t selectLod(const std::vector<MeshLod>& lods, float errorScale, float maxPixelError);
+
+// Runs all of the above and generates up to MESH_MAX_LODS levels of detail.
+ProcessedMesh processMesh(const MeshVertex* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount);
+
+// Vertex input layout matching PackedVertex.
+VkVertexInputBindingDescription packedVertexBinding(uint32_t binding);
+void packedVertexAttributes(uint32_t binding, uint32_t firstLocation, VkVertexInputAttributeDescription* attributes);
+
+// A processed mesh uploaded to device local memory.
+struct GpuMesh {
+    VkBuffer vertexBuffer;
+    VkDeviceMemory vertexBufferMemory;
+    VkBuffer indexBuffer;
+    VkDeviceMemory indexBufferMemory;
+    uint32_t indexCount;
+    VkIndexType indexType;
+    std::vector<MeshLod> lods;
+    MeshQuantization quantization;
+    Bounds bounds;
+};
+
+#endif
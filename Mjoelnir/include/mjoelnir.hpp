@@ -20,12 +20,44 @@
 #include <stdint.h>
 #include <limits.h>
 
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <optional>
 
+#include "allocator.hpp"
+#include "components.hpp"
+#include "culling.hpp"
+#include "deletion.hpp"
+#include "descriptors.hpp"
+#include "ecs.hpp"
+#include "events.hpp"
+#include "jobs.hpp"
+#include "lights.hpp"
+#include "log.hpp"
+#include "memory.hpp"
+#include "mesh.hpp"
+#include "particles.hpp"
+#include "pipelines.hpp"
+#include "presentation.hpp"
+#include "profiler.hpp"
+#include "readback.hpp"
+#include "reflection.hpp"
+#include "resolution.hpp"
+#include "scratch.hpp"
+#include "sprites.hpp"
+#include "timestep.hpp"
+#include "transforms.hpp"
+
 struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
+    // A compute family without graphics, work submitted to it can run next to the graphics queue.
+    std::optional<uint32_t> computeFamily;
 
     bool isComplete() {
         return graphicsFamily.has_value() && presentFamily.has_value();
@@ -34,12 +66,47 @@ struct QueueFamilyIndices {
 
 struct SwapChainSupportDetails {
     VkSurfaceCapabilitiesKHR capabilities;
-    std::vector<VkSurfaceFormatKHR> formats;
-    std::vector<VkPresentModeKHR> presentModes;
+    ScratchVector<VkSurfaceFormatKHR> formats;
+    ScratchVector<VkPresentModeKHR> presentModes;
+
+    explicit SwapChainSupportDetails(ScratchArena& scratch)
+        : formats(ScratchAllocator<VkSurfaceFormatKHR>(scratch)), presentModes(ScratchAllocator<VkPresentModeKHR>(scratch)) {}
+};
+
+struct StartupPhase {
+    const char* name;
+    uint64_t begin;
+    uint64_t end;
+    // JobSystem::threadIndex() of the thread it ran on.
+    uint32_t thread;
+};
+
+// Instances of one mesh drawn at the same level of detail.
+struct DrawBatch {
+    uint32_t mesh;
+    uint32_t lod;
+    uint32_t firstInstance;
+    uint32_t instanceCount;
+};
+
+// A buffer per frame in flight that is recreated when it has to grow, which is only done once the
+// frame's fence has signaled.
+struct FrameLocalBuffer {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    // nullptr unless host visible.
+    void* mapped = nullptr;
+    VkDeviceSize size = 0;
 };
 
 class Mjoelnir {
 private:
+    // First so it outlives everything that might still log during destruction.
+    Logger logger;
+    HostAllocator hostAllocator;
+    // nullptr unless host allocation tracking is enabled, passed to every vkCreate*/vkDestroy* call.
+    const VkAllocationCallbacks* allocationCallbacks = nullptr;
+
     GLFWwindow* window;
     VkInstance instance;
     VkDebugUtilsMessengerEXT debugMessenger;
@@ -47,14 +114,49 @@ private:
     VkDevice device;
     VkQueue graphicsQueue;
     VkQueue presentQueue;
-    VkSwapchainKHR swapChain;
+    // Light culling and the particle simulation run here when there is a dedicated compute family and
+    // timeline semaphores, otherwise they are recorded into the graphics command buffer.
+    bool asyncComputeEnabled = false;
+    // Whether the frame being recorded uses the compute queue. Only differs from asyncComputeEnabled
+    // while the particle benchmark compares against the graphics queue.
+    bool asyncComputeActive = false;
+    // asyncComputeActive of every frame in flight, its compute timestamps only exist if it was set.
+    std::vector<bool> frameAsyncCompute;
+    VkQueue computeQueue = VK_NULL_HANDLE;
+    uint32_t graphicsQueueFamily = 0;
+    uint32_t computeQueueFamily = 0;
+    VkSwapchainKHR swapChain = VK_NULL_HANDLE;
     std::vector<VkImage> swapChainImages;
     VkFormat swapChainImageFormat;
     VkExtent2D swapChainExtent;
     std::vector<VkImageView> swapChainImageViews;
+    // Clears and draws what was visible last frame.
     VkRenderPass renderPass;
+    // Compatible with renderPass, loads its results and draws the rest.
+    VkRenderPass lateRenderPass;
+    // Upscales the scene into the swap chain image and draws sprites on top.
+    VkRenderPass presentRenderPass;
+    VkFormat depthFormat;
+    VkImage depthImage = VK_NULL_HANDLE;
+    VkDeviceMemory depthImageMemory = VK_NULL_HANDLE;
+    VkImageView depthImageView = VK_NULL_HANDLE;
     VkPipelineLayout pipelineLayout;
-    VkPipeline graphicsPipeline;
+    GraphicsPipeline graphicsPipeline;
+    // What graphicsPipeline was requested with, its variant follows showNormals.
+    PipelineDescription meshPipelineDescription;
+    std::atomic<bool> showNormals{false};
+    // Owns every graphics pipeline, see pipelines.hpp.
+    PipelineCache pipelineCache;
+    // Owns every descriptor set and pipeline layout, see descriptors.hpp.
+    LayoutCache layoutCache;
+    // Cull mode, front face, topology and the depth test are set while recording when supported.
+    bool extendedDynamicStateSupported = false;
+    PFN_vkCmdSetCullModeEXT cmdSetCullMode = nullptr;
+    PFN_vkCmdSetFrontFaceEXT cmdSetFrontFace = nullptr;
+    PFN_vkCmdSetPrimitiveTopologyEXT cmdSetPrimitiveTopology = nullptr;
+    PFN_vkCmdSetDepthTestEnableEXT cmdSetDepthTestEnable = nullptr;
+    PFN_vkCmdSetDepthWriteEnableEXT cmdSetDepthWriteEnable = nullptr;
+    PFN_vkCmdSetDepthCompareOpEXT cmdSetDepthCompareOp = nullptr;
     std::vector<VkFramebuffer> swapChainFramebuffers;
     VkCommandPool commandPool;
     std::vector<VkCommandBuffer> commandBuffers;
@@ -63,9 +165,261 @@ private:
     std::vector<VkSemaphore> renderFinishedSemaphores;
     std::vector<VkFence> inFlightFences;
 
-    bool framebufferResized = false;
+    // Only with async compute. Every frame signals both with frameNumber + 1 once its work on that
+    // queue is done.
+    VkCommandPool computeCommandPool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> lightCullCommandBuffers;
+    std::vector<VkCommandBuffer> particleCommandBuffers;
+    VkSemaphore graphicsTimeline = VK_NULL_HANDLE;
+    VkSemaphore computeTimeline = VK_NULL_HANDLE;
+
+    // Written by the main thread whenever the framebuffer changes size, see events.hpp.
+    std::atomic<uint64_t> framebufferSize{0};
+    // The framebufferSize the swap chain was last created for.
+    uint64_t swapChainFramebufferSize = 0;
+
+    // Every other window, see presentation.hpp. Only added to before run().
+    std::vector<std::unique_ptr<ViewportWindow>> viewportWindows;
+    // The smaller of maxViewportDimensions, a zoomed in view stretches its viewport past the window.
+    float maxViewportDimension = 4096.0f;
+    FrameSubmission frameSubmission;
+
+    // Frames are rendered on renderThread while the main thread pumps window events.
+    std::thread renderThread;
+    std::atomic<bool> rendering{false};
+    // Rethrown on the main thread once the render thread has stopped.
+    std::exception_ptr renderError;
+    WindowEventQueue windowEvents;
+    WindowEventCallback windowEventCallback;
+
+    // Fixed step simulation, see timestep.hpp.
+    SimulationCallback simulationCallback;
+    FixedTimestep simulationClock;
+    // World matrices of every render object before the last tick, in extraction order.
+    std::vector<glm::mat4> previousModels;
+    uint64_t previousModelsVersion = UINT64_MAX;
+    FrameLimiter frameLimiter;
+    // Nanoseconds between frames, 0 for no limit. May be changed from any thread.
+    std::atomic<uint64_t> frameInterval{0};
 
     uint32_t currentFrame = 0;
+    // Frames submitted so far, the tag used by the deletion queue.
+    uint64_t frameNumber = 0;
+    DeletionQueue deletionQueue;
+    // Temporary CPU memory, one arena per frame in flight that is reset once the frame's fence has signaled.
+    std::vector<ScratchArena> frameScratch;
+    // Descriptor sets that only live for a frame, reset along with frameScratch.
+    std::vector<DescriptorAllocator> frameDescriptors;
+
+    GpuMemoryTracker memoryTracker;
+    bool memoryBudgetSupported = false;
+
+    JobSystem jobs;
+
+    // Startup runs independent steps as jobs, every step is timed relative to the start of run().
+    uint64_t startupBegin = 0;
+    std::vector<StartupPhase> startupPhases;
+    std::mutex startupMutex;
+    // Rethrows the first exception of a startup step when it is waited on.
+    JobCounter startupJobs;
+    uint64_t timeToFirstFrame = 0;
+
+    World world{&jobs};
+    std::vector<RenderObject> renderObjects;
+
+    // Indexed by MeshRef::mesh.
+    std::vector<GpuMesh> meshes;
+
+    // Set from any thread through setCamera() and setAmbientLight(), copied once at the start of every frame.
+    std::mutex cameraMutex;
+    glm::mat4 cameraView = glm::mat4(1.0f);
+    glm::mat4 cameraProjection = glm::mat4(1.0f);
+    // White keeps unlit scenes looking the way they did before there were lights.
+    glm::vec3 cameraAmbient = glm::vec3(1.0f);
+    // The camera of the frame being rendered.
+    glm::mat4 viewMatrix = glm::mat4(1.0f);
+    glm::mat4 projectionMatrix = glm::mat4(1.0f);
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+    glm::vec3 ambientLight = glm::vec3(1.0f);
+    Bvh sceneBvh;
+    uint64_t sceneBvhVersion = UINT64_MAX;
+    std::vector<Bounds> sceneBounds;
+    // Indices into renderObjects that survived culling.
+    std::vector<uint32_t> visibleObjects;
+
+    // Visible objects sorted by mesh and LOD (key << 32 | object), and the batches made from them.
+    std::vector<uint64_t> drawOrder;
+    std::vector<DrawBatch> drawBatches;
+    std::vector<glm::mat4> drawInstances;
+    std::vector<OcclusionInstance> drawOcclusion;
+
+    // Hierarchical depth for occlusion culling, every texel holds the farthest depth below it.
+    VkImage depthPyramid = VK_NULL_HANDLE;
+    VkDeviceMemory depthPyramidMemory = VK_NULL_HANDLE;
+    VkImageView depthPyramidView = VK_NULL_HANDLE;
+    std::vector<VkImageView> depthPyramidMips;
+    uint32_t depthPyramidWidth = 0;
+    uint32_t depthPyramidHeight = 0;
+    uint32_t depthPyramidLevelCount = 0;
+    VkSampler depthPyramidSampler;
+    VkDescriptorSetLayout depthReduceSetLayout;
+    VkPipelineLayout depthReduceLayout;
+    VkPipeline depthReducePipeline;
+    // One set per pyramid level, recreated with the pyramid.
+    VkDescriptorPool depthReduceDescriptorPool = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> depthReduceSets;
+    VkDescriptorSetLayout occlusionSetLayout;
+    VkPipelineLayout occlusionLayout;
+    VkPipeline occlusionCullPipeline;
+    // Allocated from frameDescriptors every frame.
+    std::vector<VkDescriptorSet> occlusionSets;
+    std::vector<FrameLocalBuffer> occlusionInstanceBuffers;
+    // Indirect draws of both phases, one per batch each.
+    std::vector<FrameLocalBuffer> drawCommandBuffers;
+    // Matrices of the instances that survived culling.
+    std::vector<FrameLocalBuffer> culledInstanceBuffers;
+    // Whether every object was visible last frame, indexed by OcclusionInstance::object.
+    VkBuffer visibilityBuffer;
+    VkDeviceMemory visibilityBufferMemory;
+    uint32_t visibilityCapacity = 0;
+    uint64_t visibilityVersion = UINT64_MAX;
+    bool visibilityCleared = false;
+
+    // GPU particles, see particles.hpp. Everything but the emission rate stays on the GPU.
+    ParticleEmitter particleEmitter;
+    uint32_t particleCapacity = PARTICLE_CAPACITY;
+    VkBuffer particleBuffer;
+    VkDeviceMemory particleBufferMemory;
+    VkBuffer particleDeadListBuffer;
+    VkDeviceMemory particleDeadListBufferMemory;
+    VkBuffer particleAliveListBuffer;
+    VkDeviceMemory particleAliveListBufferMemory;
+    VkBuffer particleCounterBuffer;
+    VkDeviceMemory particleCounterBufferMemory;
+    VkDescriptorSetLayout particleDescriptorSetLayout;
+    VkDescriptorPool particleDescriptorPool;
+    VkDescriptorSet particleDescriptorSet;
+    VkPipelineLayout particleComputeLayout;
+    VkPipeline particleKickoffPipeline;
+    VkPipeline particleEmitPipeline;
+    VkPipeline particleSimulatePipeline;
+    VkPipelineLayout particleDrawLayout;
+    GraphicsPipeline particleDrawPipeline;
+    ParticleSimulationConstants particleConstants{};
+    // Which of the two alive lists the next recorded frame reads.
+    uint32_t particleParity = 0;
+    // Fractional particles carried over to the next frame.
+    float particleEmitRemainder = 0.0f;
+    ParticleBenchmark particleBenchmark;
+
+    // 2D sprites, see sprites.hpp. Drawn on top of everything else.
+    SpriteCallback spriteCallback;
+    SpriteBatch spriteBatch;
+    SpriteAtlas spriteAtlas;
+    // Images added since the last frame, copied into the atlas by the next one.
+    std::mutex spriteUploadMutex;
+    std::vector<SpriteUpload> spriteUploads;
+    // Copies from this frame's staging buffer, recorded before the frame's render passes.
+    std::vector<VkBufferImageCopy> spriteCopies;
+    VkImage spriteAtlasImage;
+    VkDeviceMemory spriteAtlasMemory;
+    VkImageView spriteAtlasView;
+    // Whether the atlas has been written to, it starts out undefined.
+    bool spriteAtlasInitialized = false;
+    VkSampler spriteSampler;
+    VkDescriptorSetLayout spriteSetLayout;
+    VkDescriptorPool spriteDescriptorPool;
+    VkDescriptorSet spriteDescriptorSet;
+    VkPipelineLayout spriteLayout;
+    GraphicsPipeline spritePipelines[static_cast<size_t>(SpriteBlend::Count)];
+    std::vector<FrameLocalBuffer> spriteInstanceBuffers;
+    std::vector<FrameLocalBuffer> spriteStagingBuffers;
+
+    // Clustered forward lighting, see lights.hpp.
+    // Lights that reach the frustum, in view space.
+    std::vector<GpuLight> frameLights;
+    // Cluster bounds only change with the projection, every frame's buffer is rewritten once after that.
+    glm::mat4 clusterProjection = glm::mat4(1.0f);
+    ClusterDepth clusterDepthParameters{};
+    std::vector<ClusterBounds> clusterBounds;
+    uint64_t clusterBoundsVersion = 0;
+    std::vector<uint64_t> clusterBoundsUploaded;
+    std::vector<FrameLocalBuffer> frameUniformBuffers;
+    std::vector<FrameLocalBuffer> lightBuffers;
+    std::vector<FrameLocalBuffer> clusterBoundsBuffers;
+    // Written by light culling and read by the mesh shaders of the same frame. One per frame in flight,
+    // so culling on the compute queue never waits for the previous frame's fragment shaders.
+    std::vector<FrameLocalBuffer> clusterCountBuffers;
+    std::vector<FrameLocalBuffer> clusterLightBuffers;
+    // Set 0 of pipelineLayout.
+    VkDescriptorSetLayout meshSetLayout;
+    VkDescriptorSetLayout lightCullSetLayout;
+    VkPipelineLayout lightCullLayout;
+    VkPipeline lightCullPipeline;
+    // Allocated from frameDescriptors every frame.
+    std::vector<VkDescriptorSet> meshSets;
+    std::vector<VkDescriptorSet> lightCullSets;
+
+    // Dynamic resolution, see resolution.hpp. renderPass and lateRenderPass draw into sceneFramebuffer,
+    // which has the size of the swap chain, but only into renderExtent of it.
+    VkImage sceneColorImage = VK_NULL_HANDLE;
+    VkDeviceMemory sceneColorMemory = VK_NULL_HANDLE;
+    VkImageView sceneColorView = VK_NULL_HANDLE;
+    VkFramebuffer sceneFramebuffer = VK_NULL_HANDLE;
+    VkExtent2D renderExtent{};
+    ResolutionController resolutionController;
+    // Nanoseconds, 0 renders at full resolution. May be changed from any thread.
+    std::atomic<uint64_t> gpuFrameBudget{0};
+    // The render scale every frame in flight was recorded with, for when its timestamps come back.
+    std::vector<float> frameRenderScales;
+    VkSampler upscaleSampler;
+    VkDescriptorSetLayout upscaleSetLayout;
+    VkPipelineLayout upscaleLayout;
+    GraphicsPipeline upscalePipeline;
+    // Allocated from frameDescriptors every frame.
+    std::vector<VkDescriptorSet> upscaleSets;
+
+    // CPU time between the last two frames and GPU time of the last frame that finished, in nanoseconds.
+    uint64_t lastFrameBegin = 0;
+    uint64_t cpuFrameTime = 0;
+    uint64_t gpuFrameTime = 0;
+    // Compute queue time of the last frame that finished, 0 if its compute work was on the graphics queue.
+    uint64_t gpuComputeTime = 0;
+
+    // Frame capture, see readback.hpp. Only recorded while there is a callback.
+    FrameCaptureCallback frameCaptureCallback;
+    std::vector<ReadbackSlot> readbackSlots;
+    // Whether the swap chain images can be copied from.
+    bool swapChainReadable = false;
+
+    TransformHierarchy transforms;
+    TransformNode sceneRoot;
+
+    // Per-instance world matrices, one persistently mapped buffer per frame in flight.
+    std::vector<VkBuffer> instanceBuffers;
+    std::vector<VkDeviceMemory> instanceBuffersMemory;
+    std::vector<void*> instanceBuffersMapped;
+    std::vector<uint32_t> instanceBufferCapacities;
+    std::vector<uint64_t> instanceBufferVersions;
+
+    // GPU side of the profiler: a start and end timestamp for every frame in flight, followed by
+    // a start and end for its light culling and particle simulation when they run on the compute queue.
+    VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+    float timestampPeriod = 1.0f;
+    uint64_t timestampMask = UINT64_MAX;
+    // 6 when the compute queue has timestamps of its own.
+    uint32_t timestampsPerFrame = 2;
+    uint64_t computeTimestampMask = UINT64_MAX;
+    std::vector<bool> timestampsPending;
+    std::vector<uint64_t> frameSubmitTimes;
+    // Only set when the device has a device and a host time domain, see chooseHostTimeDomain().
+    bool calibratedTimestampsSupported = false;
+    VkTimeDomainEXT hostTimeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+    PFN_vkGetCalibratedTimestampsEXT getCalibratedTimestamps = nullptr;
+    // Profiler time = GPU time in nanoseconds + gpuClockOffset.
+    int64_t gpuClockOffset = 0;
+    bool gpuClockCalibrated = false;
+    uint32_t framesSinceCalibration = 0;
 
     // There are platform specific surfaces if necessary
     VkSurfaceKHR surface;
@@ -74,33 +428,205 @@ private:
     void initWindow();
     void cleanup();
     void drawFrame();
-    SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device);
+    SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device, VkSurfaceKHR targetSurface);
     void createInstance();
     void setupDebugMessenger();
     QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
-    VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities);
+    // size is the window's framebuffer size, see events.hpp.
+    VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities, uint64_t size);
     bool isDeviceSuitable(VkPhysicalDevice device);
     void pickPhysicalDevice();
     void createLogicalDevice();
     void createSurface();
     void createSwapChain();
     void cleanupSwapChain();
+    void retireSwapChain();
     void recreateSwapChain();
+    // Replaces the window's swap chain, the old one goes through the deletion queue.
+    void createViewportSwapChain(ViewportWindow& viewport);
+    void retireViewportSwapChain(ViewportWindow& viewport);
+    // Acquires an image from every other window that can show one this frame.
+    void acquireViewportImages();
+    void recordViewportWindows(VkCommandBuffer commandBuffer);
     void createImageViews();
+    VkFormat findDepthFormat();
     void createRenderPass();
+    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t arrayLayers, VkFormat format, VkImageUsageFlags usage, VkImage& image, VkDeviceMemory& imageMemory);
+    VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect, uint32_t baseMipLevel, uint32_t levelCount);
+    void createDepthResources();
+    void retireDepthResources();
+    void createSceneTarget();
+    void retireSceneTarget();
+    void createUpscalePipeline();
+    void updateRenderResolution();
+    void recordUpscale(VkCommandBuffer commandBuffer);
+    void createDepthPyramidDescriptors();
+    void createOcclusionPipelines();
+    void createVisibilityBuffer(uint32_t capacity);
+    void ensureFrameLocalBuffer(FrameLocalBuffer& buffer, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties);
+    void destroyFrameLocalBuffer(FrameLocalBuffer& buffer);
+    void updateOcclusionBuffers();
+    void recordOcclusionCulling(VkCommandBuffer commandBuffer, uint32_t phase);
+    void recordDepthPyramid(VkCommandBuffer commandBuffer);
+    VkPipeline createPipeline(const PipelineDescription& description);
+    GraphicsPipeline requestPipeline(const PipelineDescription& description);
+    void bindPipeline(VkCommandBuffer commandBuffer, const GraphicsPipeline& pipeline);
+    void reportPipelineCache();
+    // A set layout for every set the reflected shaders use, from layoutCache.
+    std::vector<VkDescriptorSetLayout> reflectedSetLayouts(const ShaderReflection& reflection);
+    // pushConstantSize is the size of the struct pushed, it may be padded past the block the shaders declare.
+    VkPipelineLayout reflectedPipelineLayout(const std::vector<VkDescriptorSetLayout>& setLayouts, const ShaderReflection& reflection, uint32_t pushConstantSize);
     void createGraphicsPipeline();
+    void updateMeshPipeline();
+    VkPipeline createComputePipeline(const char* path, VkPipelineLayout layout);
+    void createParticlePipelines();
+    void createParticleBuffers();
+    void createParticleDescriptors();
+    void destroyParticles();
+    void updateParticles(float deltaTime);
+    void recordParticleSimulation(VkCommandBuffer commandBuffer);
+    void recordParticleDraw(VkCommandBuffer commandBuffer);
+    void createSpritePipelines();
+    void createSpriteResources();
+    void createSpriteDescriptors();
+    void destroySprites();
+    void updateSprites();
+    void recordSpriteUploads(VkCommandBuffer commandBuffer);
+    void recordSpriteDraw(VkCommandBuffer commandBuffer);
+    void createLightPipelines();
+    void createLightResources();
+    void destroyLights();
+    void updateLights();
+    void recordLightCulling(VkCommandBuffer commandBuffer);
+    // Records this frame's light culling and particle simulation into the compute command buffers
+    // and submits them, the graphics submit waits on computeTimeline.
+    void submitAsyncCompute();
     void createFramebuffers();
     void createCommandPool();
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, MemoryCategory category, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+    void uploadBuffer(VkBuffer buffer, const void* data, VkDeviceSize size);
+    uint32_t uploadMesh(const ProcessedMesh& processed);
+    void destroyMesh(GpuMesh& mesh);
+    void createMeshes();
+    void createInstanceBuffer(uint32_t frame, uint32_t capacity);
+    void destroyInstanceBuffer(uint32_t frame);
+    void createInstanceBuffers();
+    void updateTransforms();
     void createCommandBuffers();
+    void snapshotTransforms();
+    void runSimulation();
+    void updateCamera();
+    void extractRenderables();
+    void extractLights();
+    void cullRenderables();
+    void selectLods();
     void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+    void createTimestampQueries();
+    void calibrateGpuClock();
+    void readGpuTimestamps(uint32_t frame);
+    void createReadbackSlot(ReadbackSlot& slot, VkDeviceSize size);
+    void destroyReadbackSlot(ReadbackSlot& slot);
+    void recordReadback(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+    void deliverReadback(uint32_t frame);
     void createSyncObjects();
+    void startupPhase(const char* name, const std::function<void()>& step);
+    void submitStartupPhase(const char* name, std::function<void()> step);
+    void waitForStartupPhases();
+    void reportStartup();
     void initVulkan();
-    VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
-    VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes);
+    VkSurfaceFormatKHR chooseSwapSurfaceFormat(const ScratchVector<VkSurfaceFormatKHR>& availableFormats);
+    VkPresentModeKHR chooseSwapPresentMode(const ScratchVector<VkPresentModeKHR>& availablePresentModes);
     static void framebufferResizeCallback(GLFWwindow* window, int width, int height);
+    static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
+    static void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
+    static void cursorPositionCallback(GLFWwindow* window, double x, double y);
+    static void scrollCallback(GLFWwindow* window, double x, double y);
+    static void windowFocusCallback(GLFWwindow* window, int focused);
+    // 0 for the main window, see WindowEvent::window.
+    uint32_t windowIndex(GLFWwindow* window) const;
+    void pushWindowEvent(GLFWwindow* window, WindowEvent& event);
+    void dispatchWindowEvents();
+    void stopRendering();
+    void renderLoop();
     void mainLoop();
 public:
     void run();
+
+    // Nanoseconds from run() until the first frame was handed to the presentation engine, 0 before that.
+    uint64_t timeToFirstFrameNs() const {
+        return timeToFirstFrame;
+    }
+
+    // Opens another window that shows the scene as well, letterboxed to its size, with the sprites on
+    // top. Its events carry the returned index in WindowEvent::window. Has to be called before run().
+    uint32_t addWindow(const char* title, uint32_t width, uint32_t height);
+
+    // Has the window returned by addWindow() show only the rectangle of the main window's image at
+    // x, y of width by height, in fractions of its size, see WindowView. Called from any thread,
+    // it takes effect with the next frame recorded.
+    void setWindowView(uint32_t window, float x, float y, float width, float height);
+
+    // Called with every rendered frame once the GPU is done with it, on the render thread.
+    // Has to be set before run(), capturing costs a copy of the frame.
+    void setFrameCaptureCallback(FrameCaptureCallback callback) {
+        frameCaptureCallback = std::move(callback);
+    }
+
+    // Called on the render thread at the start of every frame, once for every window event since the
+    // last one. Has to be set before run().
+    void setWindowEventCallback(WindowEventCallback callback) {
+        windowEventCallback = std::move(callback);
+    }
+
+    // Called on the render thread every SIMULATION_TICK_NS of simulated time, rendering interpolates
+    // between the last two ticks. It may spread its work over jobs, what it throws is rethrown by
+    // run(). Has to be set before run().
+    void setSimulationCallback(SimulationCallback callback) {
+        simulationCallback = std::move(callback);
+    }
+
+    // Called on the render thread every frame to fill the frame's sprite batch. Has to be set before run().
+    void setSpriteCallback(SpriteCallback callback) {
+        spriteCallback = std::move(callback);
+    }
+
+    // Packs an RGBA8 image into the sprite atlas, false if there is no room left. May be called from
+    // any thread once run() has started, the image can be drawn from the next frame on.
+    bool addSpriteImage(const uint8_t* pixels, uint32_t width, uint32_t height, SpriteImage& image);
+
+    // World to view space and view to clip space (depth from 0 to 1), used for drawing, culling
+    // and light clustering. May be called from any thread, takes effect from the next frame on.
+    void setCamera(const glm::mat4& view, const glm::mat4& projection) {
+        std::lock_guard<std::mutex> lock(cameraMutex);
+        cameraView = view;
+        cameraProjection = projection;
+    }
+
+    // Light every surface gets regardless of PointLight and SpotLight components. May be called
+    // from any thread, takes effect from the next frame on.
+    void setAmbientLight(const glm::vec3& color) {
+        std::lock_guard<std::mutex> lock(cameraMutex);
+        cameraAmbient = color;
+    }
+
+    // Colors meshes by their normals instead of their UVs. May be called from any thread, takes
+    // effect from the next frame on.
+    void setShowNormals(bool show) {
+        showNormals.store(show, std::memory_order_relaxed);
+    }
+
+    // GPU time a frame may take. The scene's resolution is lowered down to MIN_RENDER_SCALE of the
+    // window's to stay within it, 0 always renders at full resolution. Needs GPU timestamps.
+    // May be called from any thread.
+    void setGpuFrameBudget(double milliseconds) {
+        gpuFrameBudget.store(milliseconds > 0.0 ? static_cast<uint64_t>(milliseconds * 1e6) : 0, std::memory_order_relaxed);
+    }
+
+    // Upper bound on the frame rate, 0 removes it. Presentation may limit it further.
+    void setFrameRateLimit(double framesPerSecond) {
+        frameInterval.store(framesPerSecond > 0.0 ? static_cast<uint64_t>(1e9 / framesPerSecond) : 0, std::memory_order_relaxed);
+    }
 };
 
 #endif
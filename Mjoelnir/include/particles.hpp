@@ -0,0 +1,154 @@
+#ifndef _MJOELNIR_PARTICLES_H
+#define _MJOELNIR_PARTICLES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "components.hpp"
+#include "log.hpp"
+
+// Particles live entirely on the GPU. Every frame three compute passes run over them:
+//   kickoff:  clamps the requested emission to the free particles and writes the indirect
+//             dispatch arguments of the next two passes.
+//   emit:     pops indices off the dead list and appends them to the alive list.
+//   simulate: integrates every alive particle and compacts the survivors into the other alive
+//             list, the expired ones go back onto the dead list.
+// The survivors are then drawn with an indirect draw whose instance count the simulation wrote, so
+// the CPU never touches a particle after startup.
+
+// Has to match PARTICLE_GROUP_SIZE in shaders/particles.glsl.
+const uint32_t PARTICLE_GROUP_SIZE = 256;
+
+const uint32_t PARTICLE_CAPACITY = 1 << 20;
+
+// Vertices of the camera facing quad every particle is drawn as.
+const uint32_t PARTICLE_QUAD_VERTICES = 6;
+
+// Particle counts the benchmark sweeps through, every one of them is held for
+// PARTICLE_BENCHMARK_FRAMES frames once the population has had a lifetime to fill up. With a compute
+// queue every count is run twice, with and without it.
+const uint32_t PARTICLE_BENCHMARK_COUNTS[] = {1 << 14, 1 << 16, 1 << 18, 1 << 20, 1 << 21, 1 << 22};
+const uint32_t PARTICLE_BENCHMARK_FRAMES = 240;
+
+// Storage buffer layout, see shaders/particles.glsl.
+struct GpuParticle {
+    // w is the remaining life in seconds.
+    glm::vec4 position;
+    // w is the life the particle started with.
+    glm::vec4 velocity;
+};
+
+// Counters of the particle lists and the indirect arguments derived from them, all in one buffer
+// so the kickoff pass can write them in one go.
+struct ParticleCounters {
+    // Entries in the alive list the frame reads, emission appends to it.
+    uint32_t aliveCount;
+    uint32_t deadCount;
+    // Particles actually emitted this frame.
+    uint32_t emitCount;
+    // Entries in the alive list the frame writes, becomes aliveCount next frame.
+    uint32_t aliveAfterSimulation;
+    VkDispatchIndirectCommand emitDispatch;
+    VkDispatchIndirectCommand simulateDispatch;
+    VkDrawIndirectCommand draw;
+};
+
+// Push constants of the compute passes.
+struct ParticleSimulationConstants {
+    // w is the emission speed.
+    glm::vec4 emitterPosition;
+    // w is the cosine of the emission cone's half angle.
+    glm::vec4 emitterDirection;
+    // w is the life of new particles.
+    glm::vec4 gravity;
+    float deltaTime;
+    uint32_t emitCount;
+    // Offsets of the alive list read and the one written this frame, they swap every frame.
+    uint32_t readOffset;
+    uint32_t writeOffset;
+    uint32_t seed;
+};
+
+// Push constants of the particle draw.
+struct ParticleDrawConstants {
+    glm::mat4 viewProjection;
+    // Half extent of a particle's quad in clip space at a w of 1.
+    glm::vec2 size;
+    uint32_t aliveOffset;
+    uint32_t padding;
+};
+
+struct ParticleEmitter {
+    glm::vec3 position = glm::vec3(0.0f, 0.5f, 0.5f);
+    glm::vec3 direction = glm::vec3(0.0f, -1.0f, 0.0f);
+    glm::vec3 gravity = glm::vec3(0.0f, 1.0f, 0.0f);
+    // Particles per second.
+    float rate = 100000.0f;
+    float speed = 1.0f;
+    // Cosine of the half angle of the cone particles are emitted into.
+    float spread = 0.8f;
+    // Seconds.
+    float lifetime = 2.0f;
+    float size = 0.004f;
+};
+
+struct ParticleBenchmarkResult {
+    uint32_t particleCount;
+    // Whether light culling and the particle simulation ran on the compute queue.
+    bool asyncCompute;
+    uint32_t frames;
+    // Time between frames, what async compute is supposed to bring down.
+    double cpuFrameMs;
+    // 0 when there were no GPU timestamps.
+    double gpuFrameMs;
+    // Work on the compute queue, 0 when it ran on the graphics queue.
+    double computeMs;
+};
+
+// Steps through a list of particle counts and averages the frame times of every one of them. When
+// asked to compare, every count is run with async compute and then without, and the report shows
+// the difference.
+class ParticleBenchmark {
+private:
+    std::vector<uint32_t> counts;
+    std::vector<ParticleBenchmarkResult> results;
+    // 2 when comparing async compute against the graphics queue, 1 otherwise.
+    uint32_t passes = 1;
+    size_t step = 0;
+    // Time the population gets to reach the new count before anything is measured.
+    uint64_t warmUp = 0;
+    uint64_t stepBegin = 0;
+    uint32_t frames = 0;
+    uint32_t gpuFrames = 0;
+    uint64_t cpuTotal = 0;
+    uint64_t gpuTotal = 0;
+    uint64_t computeTotal = 0;
+public:
+    void start(const uint32_t* particleCounts, size_t count, bool compareAsyncCompute, uint64_t warmUpNs, uint64_t now);
+
+    bool running() const {
+        return step < counts.size() * passes;
+    }
+
+    // Particles alive at the current step.
+    uint32_t particleCount() const {
+        return running() ? counts[step / passes] : 0;
+    }
+
+    // Whether the current step wants the compute queue, only false on the comparison runs.
+    bool asyncCompute() const {
+        return step % passes == 0;
+    }
+
+    // gpuFrameNs is 0 when the GPU time of the frame isn't known, computeNs is 0 when the compute work
+    // was on the graphics queue.
+    void frame(uint64_t now, uint64_t cpuFrameNs, uint64_t gpuFrameNs, uint64_t computeNs);
+
+    void report(Logger& logger) const;
+};
+
+#endif
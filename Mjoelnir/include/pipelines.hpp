@@ -0,0 +1,139 @@
+#ifndef _MJOELNIR_PIPELINES_H
+#define _MJOELNIR_PIPELINES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// Graphics pipelines are requested by describing them. Descriptions are hashed and identical ones
+// share a single VkPipeline. With VK_EXT_extended_dynamic_state the state that can be set while
+// recording is left out of the comparison (see PipelineDescription::dynamicKey()), so pipelines
+// that only differ in it collapse into one and bindPipeline() sets that state instead.
+
+const uint32_t MAX_PIPELINE_VERTEX_BINDINGS = 4;
+const uint32_t MAX_PIPELINE_VERTEX_ATTRIBUTES = 16;
+// Independent locks, pipelines are created from several startup jobs at once.
+const uint32_t PIPELINE_CACHE_SHARDS = 16;
+const uint32_t MAX_SHADER_VARIANT_CONSTANTS = 8;
+
+enum class PipelineBlend : uint8_t {
+    Opaque,
+    // Straight alpha.
+    Alpha,
+    // Source scaled by its alpha, added to what is there.
+    Additive,
+};
+
+// Values for the specialization constants (constant_id) of a pipeline's shaders. One SPIR-V module
+// gives a pipeline per variant and the driver compiles out whatever a constant turns off, instead of
+// every permutation being a shader of its own. Constants that aren't set keep the shader's default,
+// setting one neither stage declares is an error (see Mjoelnir::createPipeline()).
+struct ShaderVariant {
+    uint32_t count = 0;
+    // Sorted by id, so the order constants are set in doesn't make for a different pipeline.
+    uint32_t ids[MAX_SHADER_VARIANT_CONSTANTS] = {};
+    uint32_t values[MAX_SHADER_VARIANT_CONSTANTS] = {};
+
+    // For int and uint constants, throws when full.
+    void setValue(uint32_t id, uint32_t value);
+
+    // For bool constants, which are 32 bits wide like VkBool32.
+    void setFeature(uint32_t id, bool enabled) {
+        setValue(id, enabled ? VK_TRUE : VK_FALSE);
+    }
+
+    bool operator==(const ShaderVariant& other) const;
+};
+
+struct PipelineDescription {
+    // Paths of the SPIR-V to load, compared by content. Have to outlive the cache.
+    const char* vertexShader = nullptr;
+    const char* fragmentShader = nullptr;
+    // Shared by both stages.
+    ShaderVariant variant;
+
+    uint32_t bindingCount = 0;
+    VkVertexInputBindingDescription bindings[MAX_PIPELINE_VERTEX_BINDINGS] = {};
+    uint32_t attributeCount = 0;
+    VkVertexInputAttributeDescription attributes[MAX_PIPELINE_VERTEX_ATTRIBUTES] = {};
+
+    VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    VkCullModeFlags cullMode = VK_CULL_MODE_NONE;
+    VkFrontFace frontFace = VK_FRONT_FACE_CLOCKWISE;
+
+    PipelineBlend blend = PipelineBlend::Opaque;
+
+    bool depthTest = false;
+    bool depthWrite = false;
+    VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS;
+
+    // The render target, the pipeline works with every render pass compatible with it.
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    uint32_t subpass = 0;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+
+    void addBinding(const VkVertexInputBindingDescription& binding);
+    void addAttribute(const VkVertexInputAttributeDescription& attribute);
+
+    // The same description with everything extended dynamic state covers reset, topologies only
+    // down to their class.
+    PipelineDescription dynamicKey() const;
+
+    bool operator==(const PipelineDescription& other) const;
+};
+
+struct PipelineDescriptionHash {
+    size_t operator()(const PipelineDescription& description) const;
+};
+
+// What recording needs to use a pipeline: the pipeline and the state it was requested with.
+struct GraphicsPipeline {
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    VkCullModeFlags cullMode = VK_CULL_MODE_NONE;
+    VkFrontFace frontFace = VK_FRONT_FACE_CLOCKWISE;
+    bool depthTest = false;
+    bool depthWrite = false;
+    VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS;
+};
+
+struct PipelineCacheStats {
+    uint32_t pipelines;
+    uint64_t requests;
+    uint64_t hits;
+};
+
+class PipelineCache {
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<PipelineDescription, VkPipeline, PipelineDescriptionHash> pipelines;
+    };
+
+    Shard shards[PIPELINE_CACHE_SHARDS];
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> hits{0};
+
+    Shard& shard(const PipelineDescription& key);
+public:
+    // VK_NULL_HANDLE if there is no pipeline for the key yet, counts as a request.
+    VkPipeline find(const PipelineDescription& key);
+
+    // Adds a pipeline created after find() missed. Returns the one that ended up in the cache, which
+    // is a different one if another thread added the same key in the meantime. The caller then has
+    // to destroy its own.
+    VkPipeline insert(const PipelineDescription& key, VkPipeline pipeline);
+
+    PipelineCacheStats stats();
+
+    // Empties the cache, returning every pipeline for the caller to destroy.
+    std::vector<VkPipeline> release();
+};
+
+#endif
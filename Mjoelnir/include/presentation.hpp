@@ -0,0 +1,105 @@
+#ifndef _MJOELNIR_PRESENTATION_H
+#define _MJOELNIR_PRESENTATION_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+struct GLFWwindow;
+
+// The rectangle of the main window's image that another window shows, in fractions of its size.
+struct WindowView {
+    float x;
+    float y;
+    float width;
+    float height;
+};
+
+// A view travels as a single atomic word of four 16 bit fractions, so the render thread never sees
+// half of a change. Clamped to the image, and to at least MIN_WINDOW_VIEW of it.
+const float MIN_WINDOW_VIEW = 1.0f / 64.0f;
+uint64_t packWindowView(float x, float y, float width, float height);
+WindowView unpackWindowView(uint64_t view);
+
+// Several windows share the device, its queues, pipelines and resources. The scene is rendered
+// once, for the main window, and every other window shows a rectangle of it, its view, letterboxed
+// to its own size with the sprites on top. A window doesn't have a camera of its own, that would
+// take culling, light clusters and a depth pyramid per view. All of it is recorded into the frame's one command buffer, submitted with one
+// vkQueueSubmit and handed to every swap chain with one vkQueuePresentKHR.
+
+// A window besides the main one, see Mjoelnir::addWindow().
+struct ViewportWindow {
+    std::string title;
+    uint32_t width;
+    uint32_t height;
+
+    GLFWwindow* window = nullptr;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
+    // Created on the render thread the first time the window has a framebuffer.
+    VkSwapchainKHR swapChain = VK_NULL_HANDLE;
+    VkExtent2D extent{};
+    std::vector<VkImage> images;
+    std::vector<VkImageView> imageViews;
+    std::vector<VkFramebuffer> framebuffers;
+    // One of each per frame in flight.
+    std::vector<VkSemaphore> imageAvailableSemaphores;
+    std::vector<VkSemaphore> renderFinishedSemaphores;
+
+    // Written by the main thread, see events.hpp.
+    std::atomic<uint64_t> framebufferSize{0};
+    // The framebufferSize the swap chain was created for, 0 has it recreated.
+    uint64_t swapChainFramebufferSize = 0;
+    // Cleared by the main thread when the window is closed, it is hidden rather than destroyed.
+    std::atomic<bool> open{true};
+    // See Mjoelnir::setWindowView(), packed by packWindowView().
+    std::atomic<uint64_t> view{packWindowView(0.0f, 0.0f, 1.0f, 1.0f)};
+
+    // Whether the frame being recorded got an image, and which.
+    bool acquired = false;
+    uint32_t imageIndex = 0;
+};
+
+// The semaphores and swap chains of a frame, gathered for its one submit and one present. The
+// vectors keep their capacity, filling it in every frame doesn't allocate.
+class FrameSubmission {
+private:
+    std::vector<VkSemaphore> waitSemaphores;
+    std::vector<VkPipelineStageFlags> waitStages;
+    std::vector<uint64_t> waitValues;
+    std::vector<VkSemaphore> signalSemaphores;
+    std::vector<uint64_t> signalValues;
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+
+    std::vector<VkSemaphore> presentSemaphores;
+    std::vector<VkSwapchainKHR> swapChains;
+    std::vector<uint32_t> imageIndices;
+    std::vector<VkResult> results;
+public:
+    void clear();
+
+    // Binary semaphores ignore value.
+    void wait(VkSemaphore semaphore, VkPipelineStageFlags stages, uint64_t value = 0);
+    void signal(VkSemaphore semaphore, uint64_t value = 0);
+
+    // The submit waits for the image to be acquired and signals renderFinished, which the present waits on.
+    void present(VkSwapchainKHR swapChain, uint32_t imageIndex, VkSemaphore imageAvailable, VkSemaphore renderFinished);
+
+    // Points submitInfo at the semaphores. The values are chained in with timelineSemaphores only,
+    // VkTimelineSemaphoreSubmitInfo needs the extension.
+    void fillSubmit(VkSubmitInfo& submitInfo, bool timelineSemaphores);
+    void fillPresent(VkPresentInfoKHR& presentInfo);
+
+    // The result of the index-th present() of the frame, once it was presented.
+    VkResult presentResult(uint32_t index) const {
+        return results[index];
+    }
+};
+
+// The largest rectangle with the aspect ratio of content that fits into target, centered.
+VkRect2D letterbox(VkExtent2D content, VkExtent2D target);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef _MJOELNIR_PROFILER_H
+#define _MJOELNIR_PROFILER_H
+
+#include <stdint.h>
+
+#include <chrono>
+
+// Timeline profiler.
+// PROFILE_ZONE("name") measures the enclosing scope. Every thread appends its zones to its own buffer,
+// so recording a zone is two clock reads and a store. Everything is exported as Chrome trace JSON,
+// which chrome://tracing and ui.perfetto.dev both open.
+// Zones only exist when MJOELNIR_PROFILE is defined, otherwise the macros expand to nothing.
+// Zone names have to outlive the profiler, in practice they are string literals.
+
+struct ProfileEvent {
+    const char* name;
+    uint64_t begin;
+    uint64_t end;
+};
+
+class Profiler {
+public:
+    // Nanoseconds on the profiler's timeline.
+    static uint64_t now() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()
+        ).count());
+    }
+
+    static void record(const char* name, uint64_t begin, uint64_t end);
+
+    // GPU spans that have already been converted to the profiler's timeline. Only call from one thread.
+    static void recordGpu(const char* name, uint64_t begin, uint64_t end);
+
+    static void setThreadName(const char* name);
+
+    // Safe to call while other threads keep recording, zones still being written are left out.
+    static bool exportChromeTrace(const char* path);
+};
+
+struct ProfileZone {
+    const char* name;
+    uint64_t begin;
+
+    explicit ProfileZone(const char* name) : name(name), begin(Profiler::now()) {}
+
+    ~ProfileZone() {
+        Profiler::record(name, begin, Profiler::now());
+    }
+};
+
+#ifdef MJOELNIR_PROFILE
+    #define PROFILE_CONCAT_INNER(a, b) a##b
+    #define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+    #define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+    #define PROFILE_THREAD_NAME(name) Profiler::setThreadName(name)
+#else
+    #define PROFILE_ZONE(name)
+    #define PROFILE_THREAD_NAME(name)
+#endif
+
+#endif
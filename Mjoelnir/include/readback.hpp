@@ -0,0 +1,48 @@
+#ifndef _MJOELNIR_READBACK_H
+#define _MJOELNIR_READBACK_H
+
+#include <stdint.h>
+
+#include <functional>
+
+#include <vulkan/vulkan.h>
+
+// Rendered frames are copied into host visible buffers, one per frame in flight. The copy is
+// recorded at the end of the frame's command buffer and handed to the capture callback once that
+// frame's fence has signaled, which the next use of the same frame slot waits for anyway. Nothing
+// ever waits for the device to go idle, the only cost is the copy itself.
+
+struct FrameCapture {
+    // Only valid during the callback, copy what has to outlive it.
+    const void* pixels;
+    uint32_t width;
+    uint32_t height;
+    // Bytes between the start of two rows, rows are tightly packed.
+    uint32_t rowPitch;
+    VkFormat format;
+    // Number of the frame that was captured, counting from 0.
+    uint64_t frame;
+};
+
+typedef std::function<void(const FrameCapture& capture)> FrameCaptureCallback;
+
+// Host visible copy of one frame in flight's rendered image.
+struct ReadbackSlot {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    void* mapped = nullptr;
+    VkDeviceSize size = 0;
+    // Cached memory is much faster to read from, but may have to be invalidated first.
+    bool coherent = true;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    uint64_t frame = 0;
+    // A copy was recorded and hasn't been handed to the callback yet.
+    bool pending = false;
+};
+
+// Bytes per texel of the color formats frames can be captured in, 0 for anything else.
+uint32_t readbackTexelSize(VkFormat format);
+
+#endif
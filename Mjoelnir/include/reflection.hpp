@@ -0,0 +1,53 @@
+#ifndef _MJOELNIR_REFLECTION_H
+#define _MJOELNIR_REFLECTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// The interface of a shader, read straight from its SPIR-V: the descriptors it binds, the size of
+// its push constants, the specialization constants it declares and, for vertex shaders, the inputs
+// it reads. Descriptor set and pipeline
+// layouts are built from this instead of by hand, see descriptors.hpp.
+
+struct ReflectedBinding {
+    uint32_t set;
+    uint32_t binding;
+    VkDescriptorType type;
+    uint32_t count;
+    VkShaderStageFlags stages;
+};
+
+struct ReflectedInput {
+    uint32_t location;
+    VkFormat format;
+};
+
+struct ShaderReflection {
+    VkShaderStageFlags stages = 0;
+    // Sorted by set, then binding.
+    std::vector<ReflectedBinding> bindings;
+    // Stages that declare push constants, and the size of the largest block.
+    VkShaderStageFlags pushConstantStages = 0;
+    uint32_t pushConstantSize = 0;
+    // Vertex shader inputs without builtins, a matrix takes one location per column.
+    std::vector<ReflectedInput> inputs;
+    // Ids of the specialization constants, sorted.
+    std::vector<uint32_t> specializationConstants;
+
+    // Adds the interface of another shader, a binding used by both gets both stages.
+    // Throws if the two disagree on the type of a binding.
+    void merge(const ShaderReflection& other);
+
+    // One past the highest set used.
+    uint32_t setCount() const;
+    std::vector<VkDescriptorSetLayoutBinding> setBindings(uint32_t set) const;
+};
+
+// Throws on SPIR-V that can't be read.
+ShaderReflection reflectShader(const uint32_t* code, size_t wordCount);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef _MJOELNIR_RESOLUTION_H
+#define _MJOELNIR_RESOLUTION_H
+
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+#include "components.hpp"
+
+// Dynamic resolution. The scene is rendered into an offscreen target the size of the swap chain,
+// but only into its top left corner, scaled down by the render scale. A final pass upscales that
+// corner into the swap chain image, sprites are drawn on top at full resolution. Changing the scale
+// only changes the render area, nothing has to be recreated.
+//
+// The controller picks the scale that keeps the GPU frame time within a budget. Most of a frame's
+// GPU time follows the number of pixels shaded, which goes with the square of the scale, so every
+// measured time is turned into what the frame would have cost at full resolution. The scale that
+// fits the budget is then sqrt(budget / that).
+
+const float MIN_RENDER_SCALE = 0.5f;
+const float MAX_RENDER_SCALE = 1.0f;
+// Fraction of the budget aimed for, leaves room for spikes.
+const float RENDER_SCALE_HEADROOM = 0.9f;
+// Weight of the newest frame in the running average of the full resolution time.
+const float RENDER_SCALE_SMOOTHING = 0.1f;
+// Largest change per frame, so the image doesn't visibly jump around.
+const float RENDER_SCALE_MAX_STEP = 0.05f;
+// Smaller changes are ignored, noise in the timings would otherwise never let the scale settle.
+const float RENDER_SCALE_MIN_STEP = 0.02f;
+
+// Push constants of shaders/upscale.frag.
+struct UpscaleConstants {
+    // Render area over the size of the target.
+    glm::vec2 uvScale;
+    // Center of the render area's last texel, bilinear filtering mustn't reach past it.
+    glm::vec2 uvMax;
+};
+
+class ResolutionController {
+private:
+    float scale = MAX_RENDER_SCALE;
+    // Nanoseconds, 0 before the first frame.
+    float averageFullTime = 0.0f;
+public:
+    // Feeds the GPU time of a finished frame and the scale it was rendered at. A budget of 0 goes
+    // back to full resolution.
+    void update(uint64_t gpuTimeNs, float renderedScale, uint64_t budgetNs);
+
+    float renderScale() const {
+        return scale;
+    }
+};
+
+// Never empty, and never larger than extent.
+VkExtent2D scaledExtent(VkExtent2D extent, float scale);
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef _MJOELNIR_SCRATCH_H
+#define _MJOELNIR_SCRATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <new>
+#include <vector>
+
+// Smallest chunk an arena allocates, bigger requests get a chunk of their own size.
+const size_t SCRATCH_CHUNK_SIZE = 64 * 1024;
+
+// Bump allocator for memory that only lives until the next reset(), usually one frame.
+// Allocation is a pointer increment and freeing is a no-op. When a chunk runs out a new one is
+// added, reset() then merges them into a single chunk big enough for the whole frame, so after a
+// few frames of warm up the arena stops touching the global heap altogether.
+// Not thread safe, every frame in flight (or thread) gets its own.
+class ScratchArena {
+private:
+    struct Chunk {
+        std::unique_ptr<uint8_t[]> memory;
+        size_t size;
+    };
+
+    std::vector<Chunk> chunks;
+    // Offset into the last chunk.
+    size_t offset = 0;
+    // Bytes in the chunks before the last one.
+    size_t usedBefore = 0;
+    size_t highWater = 0;
+    uint64_t chunkAllocations = 0;
+
+    void* allocateSlow(size_t size, size_t alignment);
+public:
+    ScratchArena() = default;
+    ScratchArena(ScratchArena&&) = default;
+    ScratchArena& operator=(ScratchArena&&) = default;
+
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+
+    void* allocate(size_t size, size_t alignment) {
+        if (!chunks.empty()) {
+            Chunk& chunk = chunks.back();
+            uintptr_t base = reinterpret_cast<uintptr_t>(chunk.memory.get());
+            uintptr_t address = (base + offset + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+            if (address + size <= base + chunk.size) {
+                offset = address + size - base;
+                return reinterpret_cast<void*>(address);
+            }
+        }
+
+        return allocateSlow(size, alignment);
+    }
+
+    // Gives the memory of the most recent allocation back, anything else stays until reset(). A
+    // growing vector allocates its new storage before freeing the old one, so the old one stays.
+    void release(void* memory, size_t size) {
+        if (!chunks.empty() && static_cast<uint8_t*>(memory) + size == chunks.back().memory.get() + offset) {
+            offset -= size;
+        }
+    }
+
+    // Everything allocated so far is gone after this.
+    void reset();
+
+    size_t used() const {
+        return usedBefore + offset;
+    }
+
+    size_t capacity() const;
+
+    // Most bytes in use between two resets.
+    size_t peak() const {
+        return highWater;
+    }
+
+    // How often the arena had to go to the global heap, stays constant once the arena is warm.
+    uint64_t heapAllocations() const {
+        return chunkAllocations;
+    }
+};
+
+// Lets standard containers allocate from an arena. Deallocation only gives memory back if it was
+// the last allocation, everything else is reclaimed with the arena's reset().
+template<typename T>
+class ScratchAllocator {
+public:
+    typedef T value_type;
+
+    ScratchArena* arena;
+
+    explicit ScratchAllocator(ScratchArena& arena) : arena(&arena) {}
+
+    template<typename U>
+    ScratchAllocator(const ScratchAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t count) {
+        void* memory = arena->allocate(count * sizeof(T), alignof(T));
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(memory);
+    }
+
+    void deallocate(T* memory, size_t count) {
+        arena->release(memory, count * sizeof(T));
+    }
+
+    template<typename U>
+    bool operator==(const ScratchAllocator<U>& other) const {
+        return arena == other.arena;
+    }
+
+    template<typename U>
+    bool operator!=(const ScratchAllocator<U>& other) const {
+        return arena != other.arena;
+    }
+};
+
+template<typename T>
+using ScratchVector = std::vector<T, ScratchAllocator<T>>;
+
+#endif
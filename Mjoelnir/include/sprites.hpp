@@ -0,0 +1,167 @@
+#ifndef _MJOELNIR_SPRITES_H
+#define _MJOELNIR_SPRITES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "components.hpp"
+
+// 2D sprites are drawn in screen space on top of the scene. Every frame the sprites are written
+// into a persistently mapped instance buffer, one per frame in flight, sorted by layer, blend mode
+// and atlas page. Every run of sprites that share all three is a single instanced draw. Sorting is
+// stable, so sprites within such a run keep the order they were submitted in.
+//
+// Sprite images live in an atlas, a 2D array image with one layer per page. Images are packed into
+// the pages with a skyline packer as they are added.
+
+const uint32_t SPRITE_ATLAS_PAGE_SIZE = 1024;
+const uint32_t SPRITE_ATLAS_MAX_PAGES = 8;
+// Empty texels around every image, keeps linear filtering from picking up a neighbor.
+const uint32_t SPRITE_ATLAS_PADDING = 1;
+
+// Vertices of a sprite's quad, generated in the vertex shader.
+const uint32_t SPRITE_QUAD_VERTICES = 6;
+
+const uint32_t INITIAL_SPRITE_CAPACITY = 4096;
+
+enum class SpriteBlend : uint8_t {
+    Alpha,
+    Additive,
+    Count,
+};
+
+// Where an image ended up in the atlas.
+struct SpriteImage {
+    uint32_t page;
+    // u0, v0, u1, v1 as unorm.
+    uint16_t uv[4];
+};
+
+struct Sprite {
+    // Center and size in pixels, the origin is the top left corner of the window.
+    glm::vec2 position;
+    glm::vec2 size;
+    SpriteImage image;
+    // RGBA8, multiplied with the image.
+    uint32_t color = 0xffffffff;
+    // Radians, around the center.
+    float rotation = 0.0f;
+    // Higher layers are drawn on top of lower ones.
+    uint16_t layer = 0;
+    SpriteBlend blend = SpriteBlend::Alpha;
+};
+
+// Per instance vertex data, 32 bytes.
+struct SpriteInstance {
+    glm::vec2 position;
+    glm::vec2 size;
+    uint16_t uv[4];
+    uint32_t color;
+    float rotation;
+};
+
+// Push constants of the sprite pipelines.
+struct SpriteConstants {
+    // 2 / the window's size in pixels.
+    glm::vec2 screenScale;
+    uint32_t page;
+    uint32_t padding;
+};
+
+// An image waiting to be copied into its place in the atlas.
+struct SpriteUpload {
+    uint32_t page;
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> pixels;
+};
+
+// One instanced draw.
+struct SpriteDraw {
+    SpriteBlend blend;
+    uint32_t page;
+    uint32_t firstInstance;
+    uint32_t instanceCount;
+};
+
+class SpriteBatch {
+private:
+    std::vector<SpriteInstance> instances;
+    // (layer, blend, page) << 32 | submission index.
+    std::vector<uint64_t> order;
+    std::vector<uint64_t> sortScratch;
+    std::vector<SpriteDraw> batchDraws;
+
+    void sort();
+public:
+    void clear() {
+        instances.clear();
+        order.clear();
+        batchDraws.clear();
+    }
+
+    void draw(const Sprite& sprite) {
+        uint64_t key = (static_cast<uint64_t>(sprite.layer) << 16) | (static_cast<uint64_t>(sprite.blend) << 8) | sprite.image.page;
+        order.push_back((key << 32) | static_cast<uint32_t>(instances.size()));
+        instances.push_back({sprite.position, sprite.size, {sprite.image.uv[0], sprite.image.uv[1], sprite.image.uv[2], sprite.image.uv[3]}, sprite.color, sprite.rotation});
+    }
+
+    uint32_t size() const {
+        return static_cast<uint32_t>(instances.size());
+    }
+
+    // Sorts the sprites, writes them to output in draw order and works out the draws.
+    void build(SpriteInstance* output);
+
+    const std::vector<SpriteDraw>& draws() const {
+        return batchDraws;
+    }
+};
+
+// Skyline bottom left packing: the used area is described by its top edge, a list of horizontal
+// segments. A rectangle goes wherever it ends up lowest, which keeps the wasted space below the
+// skyline small and inserting cheap.
+class SkylinePacker {
+private:
+    struct Segment {
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+    };
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<Segment> skyline;
+
+    // Lowest y a rectangle of the given width can sit at when its left edge is at segment index,
+    // UINT32_MAX if it doesn't fit.
+    uint32_t fit(size_t index, uint32_t rectWidth, uint32_t rectHeight) const;
+public:
+    void reset(uint32_t packerWidth, uint32_t packerHeight);
+    bool insert(uint32_t rectWidth, uint32_t rectHeight, uint32_t& x, uint32_t& y);
+};
+
+class SpriteAtlas {
+private:
+    std::vector<SkylinePacker> pages;
+public:
+    // Finds room for an image, opening a new page when none of the open ones has space left.
+    // x and y are the texel position of the image in its page.
+    bool allocate(uint32_t width, uint32_t height, SpriteImage& image, uint32_t& x, uint32_t& y);
+
+    uint32_t pageCount() const {
+        return static_cast<uint32_t>(pages.size());
+    }
+};
+
+// Called on the render thread every frame with the frame's empty batch and the window's size.
+typedef std::function<void(SpriteBatch& batch, uint32_t width, uint32_t height)> SpriteCallback;
+
+#endif
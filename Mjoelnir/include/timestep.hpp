@@ -0,0 +1,69 @@
+#ifndef _MJOELNIR_TIMESTEP_H
+#define _MJOELNIR_TIMESTEP_H
+
+#include <stdint.h>
+
+#include <functional>
+
+#include "components.hpp"
+
+class World;
+class JobSystem;
+
+// The simulation advances in fixed ticks no matter how fast frames are rendered, so it behaves the
+// same under load. Every frame runs the ticks that are due and renders the state between the last
+// two, interpolated by how far into the next tick the frame is.
+
+const uint64_t SIMULATION_TICK_NS = 1000000000ull / 60;
+
+// A long hitch only catches up this many ticks, the rest of the time is dropped. Otherwise slow
+// ticks would make the next frame even slower.
+const uint32_t MAX_SIMULATION_TICKS_PER_FRAME = 8;
+
+// The frame limiter sleeps until this long before the deadline and spins for the rest, sleeps are
+// only as precise as the OS scheduler.
+const uint64_t FRAME_LIMIT_SPIN_NS = 2000000;
+
+typedef std::function<void(World& world, JobSystem& jobs, float deltaTime)> SimulationCallback;
+
+class FixedTimestep {
+private:
+    uint64_t tick;
+    uint64_t accumulator = 0;
+    uint64_t lastTime = 0;
+    uint64_t ticks = 0;
+public:
+    explicit FixedTimestep(uint64_t tickNs = SIMULATION_TICK_NS) : tick(tickNs) {}
+
+    // Adds the time since the last call and returns how many ticks are due.
+    uint32_t advance(uint64_t now);
+
+    // How far the current time is between the last tick and the next one, from 0 to 1.
+    float alpha() const {
+        return static_cast<float>(accumulator) / static_cast<float>(tick);
+    }
+
+    float tickSeconds() const {
+        return static_cast<float>(tick) / 1e9f;
+    }
+
+    // Ticks run so far.
+    uint64_t tickCount() const {
+        return ticks;
+    }
+};
+
+// Caps the frame rate, deadlines follow each other so the average rate is exact.
+class FrameLimiter {
+private:
+    uint64_t deadline = 0;
+public:
+    // Blocks until intervalNs after the last frame's deadline, 0 returns right away.
+    void wait(uint64_t intervalNs);
+};
+
+// Blends the world matrices of two consecutive ticks. Per element, which is close enough for the
+// little an object moves and turns in one tick.
+glm::mat4 interpolateTransform(const glm::mat4& previous, const glm::mat4& current, float alpha);
+
+#endif
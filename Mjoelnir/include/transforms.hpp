@@ -0,0 +1,77 @@
+#ifndef _MJOELNIR_TRANSFORMS_H
+#define _MJOELNIR_TRANSFORMS_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "components.hpp"
+#include "jobs.hpp"
+
+#include <glm/gtc/quaternion.hpp>
+
+typedef uint32_t TransformNode;
+const TransformNode INVALID_TRANSFORM_NODE = UINT32_MAX;
+
+// Parent/child transform hierarchy.
+// Nodes are stored breadth-first in flat arrays so that every parent comes before its children and all
+// nodes of one depth are contiguous. update() walks the levels in order, only recomputing nodes whose
+// local transform changed or whose parent was recomputed, and each level is split across the job system.
+// A node's position in the arrays is also its instance index in the per-instance buffers.
+class TransformHierarchy {
+private:
+    // Indexed by node handle.
+    std::vector<uint32_t> slotOfNode;
+    std::vector<TransformNode> parentOfNode;
+    std::vector<bool> aliveNodes;
+    std::vector<TransformNode> freeNodes;
+
+    // Indexed by slot, breadth-first order.
+    std::vector<TransformNode> nodeOfSlot;
+    std::vector<uint32_t> parentSlots;
+    std::vector<glm::vec3> localPositions;
+    std::vector<glm::quat> localRotations;
+    std::vector<glm::vec3> localScales;
+    std::vector<glm::mat4> worldMatrices;
+    std::vector<uint8_t> dirty;
+    // Update in which the world matrix last changed, compared against the version of an output buffer.
+    std::vector<uint64_t> versions;
+
+    // First slot of every depth level, plus one past the end.
+    std::vector<uint32_t> levelOffsets;
+
+    bool orderDirty = false;
+    uint64_t updateCount = 0;
+
+    void rebuildOrder();
+    void updateRange(uint32_t begin, uint32_t end, glm::mat4* output, uint64_t outputVersion);
+public:
+    TransformNode createNode(TransformNode parent = INVALID_TRANSFORM_NODE);
+    // Destroys the node and its whole subtree.
+    void destroyNode(TransformNode node);
+    void setParent(TransformNode node, TransformNode parent);
+    void setLocal(TransformNode node, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale);
+    void setLocalPosition(TransformNode node, const glm::vec3& position);
+
+    const glm::mat4& world(TransformNode node) const;
+
+    // Slot of the node in the instance buffers, only stable until the next structural change.
+    uint32_t instanceIndex(TransformNode node) const {
+        return slotOfNode[node];
+    }
+
+    uint32_t size() const {
+        return static_cast<uint32_t>(nodeOfSlot.size());
+    }
+
+    uint32_t depth() const {
+        return levelOffsets.empty() ? 0 : static_cast<uint32_t>(levelOffsets.size() - 1);
+    }
+
+    // Recomputes dirty world matrices and writes every matrix the output buffer has not seen yet into it.
+    // outputVersion is owned by the caller (one per buffer) and updated here, so it is fine to rotate
+    // between several persistently mapped buffers. output must hold at least size() matrices.
+    void update(JobSystem* jobs, glm::mat4* output, uint64_t& outputVersion);
+};
+
+#endif
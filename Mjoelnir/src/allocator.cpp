@@ -0,0 +1,281 @@
+#include "allocator.hpp"
+#include <stdlib.h>
+#include <string.h>
+
+// Stored right in front of every allocation handed to the driver.
+struct AllocationHeader {
+    uint64_t size;
+    // Distance from the start of the underlying block to the returned pointer.
+    uint32_t offset;
+    uint8_t sizeClass;
+    uint8_t scope;
+    uint16_t unused;
+};
+
+static_assert(sizeof(AllocationHeader) == HOST_ALLOCATOR_HEADER_SIZE, "Allocation header has to fill the header space exactly");
+
+const uint8_t HOST_ALLOCATOR_UNPOOLED = 0xFF;
+
+static const char* SCOPE_NAMES[HOST_ALLOCATION_SCOPE_COUNT] = {
+    "command",
+    "object",
+    "cache",
+    "device",
+    "instance",
+};
+
+// Scopes the driver passes that we don't know about are counted as object scope.
+static uint32_t scopeIndex(VkSystemAllocationScope scope) {
+    uint32_t index = static_cast<uint32_t>(scope);
+    return index < HOST_ALLOCATION_SCOPE_COUNT ? index : static_cast<uint32_t>(VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+}
+
+static size_t classSize(uint32_t sizeClass) {
+    return HOST_ALLOCATOR_MIN_CLASS << sizeClass;
+}
+
+static AllocationHeader* headerOf(void* memory) {
+    return reinterpret_cast<AllocationHeader*>(static_cast<uint8_t*>(memory) - HOST_ALLOCATOR_HEADER_SIZE);
+}
+
+HostAllocator::HostAllocator() {
+    vulkanCallbacks.pUserData = this;
+    vulkanCallbacks.pfnAllocation = allocationCallback;
+    vulkanCallbacks.pfnReallocation = reallocationCallback;
+    vulkanCallbacks.pfnFree = freeCallback;
+    vulkanCallbacks.pfnInternalAllocation = internalAllocationCallback;
+    vulkanCallbacks.pfnInternalFree = internalFreeCallback;
+}
+
+HostAllocator::~HostAllocator() {
+    for (auto& sizeClass : sizeClasses) {
+        for (void* slab : sizeClass.slabs) {
+            ::free(slab);
+        }
+    }
+}
+
+void HostAllocator::track(VkSystemAllocationScope scope, int64_t bytes) {
+    ScopeCounters& counters = scopes[scopeIndex(scope)];
+
+    if (bytes > 0) {
+        uint64_t live = counters.liveBytes.fetch_add(static_cast<uint64_t>(bytes), std::memory_order_relaxed) + static_cast<uint64_t>(bytes);
+        counters.liveAllocations.fetch_add(1, std::memory_order_relaxed);
+        counters.totalAllocations.fetch_add(1, std::memory_order_relaxed);
+
+        uint64_t peak = counters.peakBytes.load(std::memory_order_relaxed);
+        while (live > peak && !counters.peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+        }
+    } else {
+        counters.liveBytes.fetch_sub(static_cast<uint64_t>(-bytes), std::memory_order_relaxed);
+        counters.liveAllocations.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void* HostAllocator::allocateFromClass(uint32_t index) {
+    SizeClass& sizeClass = sizeClasses[index];
+    std::lock_guard<std::mutex> lock(sizeClass.mutex);
+
+    if (sizeClass.freeList == nullptr) {
+        size_t stride = classSize(index) + HOST_ALLOCATOR_HEADER_SIZE;
+        uint8_t* slab = static_cast<uint8_t*>(malloc(HOST_ALLOCATOR_SLAB_SIZE));
+        if (slab == nullptr) {
+            return nullptr;
+        }
+        sizeClass.slabs.push_back(slab);
+
+        // Thread every block of the new slab onto the free list, the link lives in the block itself.
+        for (size_t offset = 0; offset + stride <= HOST_ALLOCATOR_SLAB_SIZE; offset += stride) {
+            void* block = slab + offset;
+            memcpy(block, &sizeClass.freeList, sizeof(void*));
+            sizeClass.freeList = block;
+        }
+    }
+
+    void* block = sizeClass.freeList;
+    memcpy(&sizeClass.freeList, block, sizeof(void*));
+
+    return block;
+}
+
+void* HostAllocator::allocate(size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    if (size == 0) {
+        return nullptr;
+    }
+
+    uint8_t* memory;
+    uint8_t sizeClass = HOST_ALLOCATOR_UNPOOLED;
+    uint32_t offset;
+
+    if (size <= HOST_ALLOCATOR_MAX_CLASS && alignment <= HOST_ALLOCATOR_HEADER_SIZE) {
+        sizeClass = 0;
+        while (classSize(sizeClass) < size) {
+            sizeClass++;
+        }
+
+        uint8_t* block = static_cast<uint8_t*>(allocateFromClass(sizeClass));
+        if (block == nullptr) {
+            return nullptr;
+        }
+
+        offset = HOST_ALLOCATOR_HEADER_SIZE;
+        memory = block + offset;
+    } else {
+        if (alignment < HOST_ALLOCATOR_HEADER_SIZE) {
+            alignment = HOST_ALLOCATOR_HEADER_SIZE;
+        }
+
+        uint8_t* block = static_cast<uint8_t*>(malloc(size + alignment + HOST_ALLOCATOR_HEADER_SIZE));
+        if (block == nullptr) {
+            return nullptr;
+        }
+
+        uintptr_t address = reinterpret_cast<uintptr_t>(block) + HOST_ALLOCATOR_HEADER_SIZE;
+        address = (address + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+        memory = reinterpret_cast<uint8_t*>(address);
+        offset = static_cast<uint32_t>(memory - block);
+    }
+
+    AllocationHeader* header = headerOf(memory);
+    header->size = size;
+    header->offset = offset;
+    header->sizeClass = sizeClass;
+    header->scope = static_cast<uint8_t>(scope);
+
+    track(scope, static_cast<int64_t>(size));
+
+    return memory;
+}
+
+void HostAllocator::release(void* memory) {
+    if (memory == nullptr) {
+        return;
+    }
+
+    AllocationHeader* header = headerOf(memory);
+    track(static_cast<VkSystemAllocationScope>(header->scope), -static_cast<int64_t>(header->size));
+
+    uint8_t* block = static_cast<uint8_t*>(memory) - header->offset;
+    if (header->sizeClass == HOST_ALLOCATOR_UNPOOLED) {
+        ::free(block);
+        return;
+    }
+
+    SizeClass& sizeClass = sizeClasses[header->sizeClass];
+    std::lock_guard<std::mutex> lock(sizeClass.mutex);
+    memcpy(block, &sizeClass.freeList, sizeof(void*));
+    sizeClass.freeList = block;
+}
+
+void* HostAllocator::reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    if (original == nullptr) {
+        return allocate(size, alignment, scope);
+    }
+
+    if (size == 0) {
+        release(original);
+        return nullptr;
+    }
+
+    AllocationHeader* header = headerOf(original);
+    if (header->sizeClass != HOST_ALLOCATOR_UNPOOLED && size <= classSize(header->sizeClass) &&
+        alignment <= HOST_ALLOCATOR_HEADER_SIZE && header->scope == scope) {
+        // Still fits into its block.
+        track(scope, -static_cast<int64_t>(header->size));
+        track(scope, static_cast<int64_t>(size));
+        header->size = size;
+        return original;
+    }
+
+    // On failure the original has to stay valid.
+    void* memory = allocate(size, alignment, scope);
+    if (memory == nullptr) {
+        return nullptr;
+    }
+
+    memcpy(memory, original, header->size < size ? header->size : size);
+    release(original);
+
+    return memory;
+}
+
+void* VKAPI_PTR HostAllocator::allocationCallback(void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    return static_cast<HostAllocator*>(userData)->allocate(size, alignment, scope);
+}
+
+void* VKAPI_PTR HostAllocator::reallocationCallback(void* userData, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    return static_cast<HostAllocator*>(userData)->reallocate(original, size, alignment, scope);
+}
+
+void VKAPI_PTR HostAllocator::freeCallback(void* userData, void* memory) {
+    static_cast<HostAllocator*>(userData)->release(memory);
+}
+
+void VKAPI_PTR HostAllocator::internalAllocationCallback(void* userData, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope) {
+    HostAllocator* allocator = static_cast<HostAllocator*>(userData);
+    allocator->scopes[scopeIndex(scope)].internalBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void VKAPI_PTR HostAllocator::internalFreeCallback(void* userData, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope) {
+    HostAllocator* allocator = static_cast<HostAllocator*>(userData);
+    allocator->scopes[scopeIndex(scope)].internalBytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+HostAllocationStats HostAllocator::stats(VkSystemAllocationScope scope) const {
+    const ScopeCounters& counters = scopes[scope];
+
+    HostAllocationStats stats;
+    stats.liveBytes = counters.liveBytes.load(std::memory_order_relaxed);
+    stats.peakBytes = counters.peakBytes.load(std::memory_order_relaxed);
+    stats.liveAllocations = counters.liveAllocations.load(std::memory_order_relaxed);
+    stats.totalAllocations = counters.totalAllocations.load(std::memory_order_relaxed);
+    stats.internalBytes = counters.internalBytes.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
+uint64_t HostAllocator::totalAllocations() const {
+    uint64_t total = 0;
+    for (const auto& counters : scopes) {
+        total += counters.totalAllocations.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void HostAllocator::beginFrames() {
+    allocationsAtFrameStart = totalAllocations();
+}
+
+void HostAllocator::endFrame() {
+    uint64_t total = totalAllocations();
+
+    lastFrameAllocations = total - allocationsAtFrameStart;
+    if (lastFrameAllocations > maxFrameAllocations) {
+        maxFrameAllocations = lastFrameAllocations;
+    }
+    allocationsAtFrameStart = total;
+}
+
+void HostAllocator::report(Logger& logger) const {
+    for (uint32_t scope = 0; scope < HOST_ALLOCATION_SCOPE_COUNT; scope++) {
+        HostAllocationStats scopeStats = stats(static_cast<VkSystemAllocationScope>(scope));
+        logger.log(
+            LogSeverity::Info,
+            LogCategory::Engine,
+            "Host allocations (%s): %llu bytes live in %llu allocations, peak %llu bytes, %llu allocations in total, %llu bytes internal",
+            SCOPE_NAMES[scope],
+            static_cast<unsigned long long>(scopeStats.liveBytes),
+            static_cast<unsigned long long>(scopeStats.liveAllocations),
+            static_cast<unsigned long long>(scopeStats.peakBytes),
+            static_cast<unsigned long long>(scopeStats.totalAllocations),
+            static_cast<unsigned long long>(scopeStats.internalBytes)
+        );
+    }
+
+    logger.log(
+        LogSeverity::Info,
+        LogCategory::Engine,
+        "Host allocations: at most %llu in a single frame",
+        static_cast<unsigned long long>(maxFrameAllocations)
+    );
+}
@@ -0,0 +1,411 @@
+#include "culling.hpp"
+#include <float.h>
+#include <string.h>
+#include <algorithm>
+#include <numeric>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86)
+#include <xmmintrin.h>
+
+typedef __m128 float4;
+
+static inline float4 load4(const float* values) { return _mm_load_ps(values); }
+static inline float4 splat4(float value) { return _mm_set1_ps(value); }
+static inline float4 add4(float4 a, float4 b) { return _mm_add_ps(a, b); }
+static inline float4 mul4(float4 a, float4 b) { return _mm_mul_ps(a, b); }
+// Bit i is set when lane i is below zero.
+static inline uint32_t negativeMask4(float4 a) { return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmplt_ps(a, _mm_setzero_ps()))); }
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+
+typedef float32x4_t float4;
+
+static inline float4 load4(const float* values) { return vld1q_f32(values); }
+static inline float4 splat4(float value) { return vdupq_n_f32(value); }
+static inline float4 add4(float4 a, float4 b) { return vaddq_f32(a, b); }
+static inline float4 mul4(float4 a, float4 b) { return vmulq_f32(a, b); }
+static inline uint32_t negativeMask4(float4 a) {
+    static const uint32_t bits[4] = {1, 2, 4, 8};
+    return vaddvq_u32(vandq_u32(vcltq_f32(a, vdupq_n_f32(0.0f)), vld1q_u32(bits)));
+}
+#else
+struct float4 {
+    float v[4];
+};
+
+static inline float4 load4(const float* values) { return {{values[0], values[1], values[2], values[3]}}; }
+static inline float4 splat4(float value) { return {{value, value, value, value}}; }
+static inline float4 add4(float4 a, float4 b) { return {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}}; }
+static inline float4 mul4(float4 a, float4 b) { return {{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}}; }
+static inline uint32_t negativeMask4(float4 a) {
+    return (a.v[0] < 0.0f ? 1 : 0) | (a.v[1] < 0.0f ? 2 : 0) | (a.v[2] < 0.0f ? 4 : 0) | (a.v[3] < 0.0f ? 8 : 0);
+}
+#endif
+
+const uint32_t BVH_LEAF_SIZE = 4;
+const uint32_t BVH_MAX_STACK = 256;
+// Refitting stretches boxes as objects wander off, past this point a rebuild pays for itself.
+const float BVH_REBUILD_THRESHOLD = 1.5f;
+
+Frustum Frustum::fromMatrix(const glm::mat4& m) {
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    Frustum frustum;
+    frustum.planes[0] = row3 + row0;
+    frustum.planes[1] = row3 - row0;
+    frustum.planes[2] = row3 + row1;
+    frustum.planes[3] = row3 - row1;
+    // Depth is 0..1 in Vulkan, so the near plane is just the third row.
+    frustum.planes[4] = row2;
+    frustum.planes[5] = row3 - row2;
+
+    for (auto& plane : frustum.planes) {
+        plane = plane / glm::length(glm::vec3(plane));
+    }
+
+    return frustum;
+}
+
+static float surfaceArea(const Bounds& bounds) {
+    glm::vec3 extent = glm::max(bounds.max - bounds.min, glm::vec3(0.0f));
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+static Bounds emptyBounds() {
+    return {glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX)};
+}
+
+static Bounds merge(const Bounds& a, const Bounds& b) {
+    return {glm::min(a.min, b.min), glm::max(a.max, b.max)};
+}
+
+static bool intersects(const Frustum& frustum, const Bounds& bounds) {
+    for (const auto& plane : frustum.planes) {
+        glm::vec3 positive(
+            plane.x >= 0.0f ? bounds.max.x : bounds.min.x,
+            plane.y >= 0.0f ? bounds.max.y : bounds.min.y,
+            plane.z >= 0.0f ? bounds.max.z : bounds.min.z
+        );
+
+        if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Bvh::setChildBounds(Node& node, uint32_t slot, const Bounds& bounds) {
+    node.minX[slot] = bounds.min.x;
+    node.minY[slot] = bounds.min.y;
+    node.minZ[slot] = bounds.min.z;
+    node.maxX[slot] = bounds.max.x;
+    node.maxY[slot] = bounds.max.y;
+    node.maxZ[slot] = bounds.max.z;
+}
+
+Bounds Bvh::childBounds(const Node& node, uint32_t slot) const {
+    return {
+        glm::vec3(node.minX[slot], node.minY[slot], node.minZ[slot]),
+        glm::vec3(node.maxX[slot], node.maxY[slot], node.maxZ[slot])
+    };
+}
+
+Bounds Bvh::nodeBounds(uint32_t index) const {
+    const Node& node = nodes[index];
+
+    Bounds bounds = emptyBounds();
+    for (uint32_t slot = 0; slot < 4; slot++) {
+        if (node.count[slot] > 0 || node.child[slot] != UINT32_MAX) {
+            bounds = merge(bounds, childBounds(node, slot));
+        }
+    }
+
+    return bounds;
+}
+
+float Bvh::computeCost() const {
+    float cost = 0.0f;
+    for (const auto& node : nodes) {
+        for (uint32_t slot = 0; slot < 4; slot++) {
+            if (node.count[slot] > 0 || node.child[slot] != UINT32_MAX) {
+                cost += surfaceArea(childBounds(node, slot));
+            }
+        }
+    }
+
+    return cost;
+}
+
+float Bvh::rootArea() const {
+    return nodes.empty() ? 0.0f : surfaceArea(nodeBounds(0));
+}
+
+float Bvh::degradation() const {
+    float area = rootArea();
+    if (builtCost <= 0.0f || area <= 0.0f) {
+        return 1.0f;
+    }
+
+    return (currentCost / area) / builtCost;
+}
+
+uint32_t Bvh::buildNode(uint32_t begin, uint32_t end, uint32_t parent, uint32_t parentSlot) {
+    uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    Node& node = nodes[index];
+    node.parent = parent;
+    node.parentSlot = parentSlot;
+    for (uint32_t slot = 0; slot < 4; slot++) {
+        // Empty slots get inverted bounds, they then fail every plane test without special casing.
+        setChildBounds(node, slot, emptyBounds());
+        node.child[slot] = UINT32_MAX;
+        node.count[slot] = 0;
+    }
+
+    // Keep halving the biggest range along its longest axis until there are four children.
+    uint32_t rangeBegin[4] = {begin};
+    uint32_t rangeEnd[4] = {end};
+    uint32_t rangeCount = 1;
+    while (rangeCount < 4) {
+        uint32_t largest = 0;
+        for (uint32_t i = 1; i < rangeCount; i++) {
+            if (rangeEnd[i] - rangeBegin[i] > rangeEnd[largest] - rangeBegin[largest]) {
+                largest = i;
+            }
+        }
+
+        uint32_t first = rangeBegin[largest];
+        uint32_t last = rangeEnd[largest];
+        if (last - first <= BVH_LEAF_SIZE) {
+            break;
+        }
+
+        Bounds centroids = emptyBounds();
+        for (uint32_t i = first; i < last; i++) {
+            glm::vec3 centroid = (objectBounds[objectOrder[i]].min + objectBounds[objectOrder[i]].max) * 0.5f;
+            centroids.min = glm::min(centroids.min, centroid);
+            centroids.max = glm::max(centroids.max, centroid);
+        }
+
+        glm::vec3 extent = centroids.max - centroids.min;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+        uint32_t middle = first + (last - first) / 2;
+        std::nth_element(
+            objectOrder.begin() + first,
+            objectOrder.begin() + middle,
+            objectOrder.begin() + last,
+            [this, axis](uint32_t a, uint32_t b) {
+                return objectBounds[a].min[axis] + objectBounds[a].max[axis] < objectBounds[b].min[axis] + objectBounds[b].max[axis];
+            }
+        );
+
+        rangeEnd[largest] = middle;
+        rangeBegin[rangeCount] = middle;
+        rangeEnd[rangeCount] = last;
+        rangeCount++;
+    }
+
+    for (uint32_t slot = 0; slot < rangeCount; slot++) {
+        Bounds bounds = emptyBounds();
+        for (uint32_t i = rangeBegin[slot]; i < rangeEnd[slot]; i++) {
+            bounds = merge(bounds, objectBounds[objectOrder[i]]);
+        }
+
+        uint32_t count = rangeEnd[slot] - rangeBegin[slot];
+        if (count <= BVH_LEAF_SIZE) {
+            nodes[index].child[slot] = rangeBegin[slot];
+            nodes[index].count[slot] = count;
+            for (uint32_t i = rangeBegin[slot]; i < rangeEnd[slot]; i++) {
+                objectNodes[objectOrder[i]] = index;
+            }
+        } else {
+            // Recursing grows nodes, so no references into it may be held across this call.
+            uint32_t child = buildNode(rangeBegin[slot], rangeEnd[slot], index, slot);
+            nodes[index].child[slot] = child;
+        }
+
+        setChildBounds(nodes[index], slot, bounds);
+    }
+
+    return index;
+}
+
+void Bvh::rebuild() {
+    uint32_t count = static_cast<uint32_t>(objectBounds.size());
+
+    objectOrder.resize(count);
+    std::iota(objectOrder.begin(), objectOrder.end(), 0);
+    objectNodes.resize(count);
+
+    nodes.clear();
+    if (count > 0) {
+        nodes.reserve(count / 2 + 1);
+        buildNode(0, count, UINT32_MAX, 0);
+    }
+
+    dirtyNodes.assign(nodes.size(), 0);
+    anyDirty = false;
+
+    currentCost = computeCost();
+    float area = rootArea();
+    builtCost = area > 0.0f ? currentCost / area : 0.0f;
+}
+
+void Bvh::build(const Bounds* bounds, uint32_t count) {
+    objectBounds.assign(bounds, bounds + count);
+    rebuild();
+}
+
+void Bvh::setBounds(uint32_t object, const Bounds& bounds) {
+    if (memcmp(&objectBounds[object], &bounds, sizeof(Bounds)) == 0) {
+        return;
+    }
+
+    objectBounds[object] = bounds;
+    dirtyNodes[objectNodes[object]] = 1;
+    anyDirty = true;
+}
+
+void Bvh::refit() {
+    if (!anyDirty) {
+        return;
+    }
+
+    // Children always have a higher index than their parent, so walking backwards sees every child
+    // before the node that contains it.
+    for (uint32_t i = static_cast<uint32_t>(nodes.size()); i-- > 0;) {
+        if (!dirtyNodes[i]) {
+            continue;
+        }
+        dirtyNodes[i] = 0;
+
+        Node& node = nodes[i];
+        for (uint32_t slot = 0; slot < 4; slot++) {
+            Bounds bounds;
+            if (node.count[slot] > 0) {
+                bounds = emptyBounds();
+                for (uint32_t o = node.child[slot]; o < node.child[slot] + node.count[slot]; o++) {
+                    bounds = merge(bounds, objectBounds[objectOrder[o]]);
+                }
+            } else if (node.child[slot] != UINT32_MAX) {
+                bounds = nodeBounds(node.child[slot]);
+            } else {
+                continue;
+            }
+
+            currentCost += surfaceArea(bounds) - surfaceArea(childBounds(node, slot));
+            setChildBounds(node, slot, bounds);
+        }
+
+        if (node.parent != UINT32_MAX) {
+            dirtyNodes[node.parent] = 1;
+        }
+    }
+
+    anyDirty = false;
+
+    if (degradation() > BVH_REBUILD_THRESHOLD) {
+        rebuild();
+    }
+}
+
+void Bvh::appendChild(const Node& node, uint32_t slot, std::vector<uint32_t>& visible) const {
+    if (node.count[slot] > 0) {
+        visible.insert(visible.end(), objectOrder.begin() + node.child[slot], objectOrder.begin() + node.child[slot] + node.count[slot]);
+    } else if (node.child[slot] != UINT32_MAX) {
+        appendSubtree(node.child[slot], visible);
+    }
+}
+
+void Bvh::appendSubtree(uint32_t index, std::vector<uint32_t>& visible) const {
+    for (uint32_t slot = 0; slot < 4; slot++) {
+        appendChild(nodes[index], slot, visible);
+    }
+}
+
+void Bvh::cull(const Frustum& frustum, std::vector<uint32_t>& visible) const {
+    if (nodes.empty()) {
+        return;
+    }
+
+    uint32_t stack[BVH_MAX_STACK];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+        const Node& node = nodes[stack[--stackSize]];
+
+        float4 minX = load4(node.minX);
+        float4 minY = load4(node.minY);
+        float4 minZ = load4(node.minZ);
+        float4 maxX = load4(node.maxX);
+        float4 maxY = load4(node.maxY);
+        float4 maxZ = load4(node.maxZ);
+
+        // All four child boxes against one plane at a time.
+        // The corner furthest along the normal decides if a box is outside, the nearest one if it
+        // is fully inside or straddles the plane.
+        uint32_t outsideMask = 0;
+        uint32_t straddleMask = 0;
+        for (const auto& plane : frustum.planes) {
+            float4 nx = splat4(plane.x);
+            float4 ny = splat4(plane.y);
+            float4 nz = splat4(plane.z);
+            float4 w = splat4(plane.w);
+
+            float4 farthest = add4(add4(mul4(plane.x >= 0.0f ? maxX : minX, nx), mul4(plane.y >= 0.0f ? maxY : minY, ny)), add4(mul4(plane.z >= 0.0f ? maxZ : minZ, nz), w));
+            float4 nearest = add4(add4(mul4(plane.x >= 0.0f ? minX : maxX, nx), mul4(plane.y >= 0.0f ? minY : maxY, ny)), add4(mul4(plane.z >= 0.0f ? minZ : maxZ, nz), w));
+
+            outsideMask |= negativeMask4(farthest);
+            straddleMask |= negativeMask4(nearest);
+        }
+
+        for (uint32_t slot = 0; slot < 4; slot++) {
+            if (outsideMask & (1 << slot)) {
+                continue;
+            }
+
+            if (!(straddleMask & (1 << slot))) {
+                appendChild(node, slot, visible);
+            } else if (node.count[slot] > 0) {
+                for (uint32_t o = node.child[slot]; o < node.child[slot] + node.count[slot]; o++) {
+                    if (intersects(frustum, objectBounds[objectOrder[o]])) {
+                        visible.push_back(objectOrder[o]);
+                    }
+                }
+            } else if (node.child[slot] != UINT32_MAX) {
+                // A degenerate tree can be deeper than the stack allows, its subtrees are then
+                // accepted untested. Drawing too much beats losing visible objects.
+                if (stackSize < BVH_MAX_STACK) {
+                    stack[stackSize++] = node.child[slot];
+                } else {
+                    appendChild(node, slot, visible);
+                }
+            }
+        }
+    }
+}
+
+uint32_t depthPyramidSize(uint32_t size) {
+    uint32_t result = 1;
+    while (result * 2 <= size) {
+        result *= 2;
+    }
+    return result;
+}
+
+uint32_t depthPyramidLevels(uint32_t width, uint32_t height) {
+    uint32_t levels = 1;
+    while (width > 1 || height > 1) {
+        width = std::max(width / 2, 1u);
+        height = std::max(height / 2, 1u);
+        levels++;
+    }
+    return levels;
+}
@@ -0,0 +1,90 @@
+#include "deletion.hpp"
+
+template<typename T>
+static T handleFromBits(uint64_t bits) {
+    T handle;
+    memcpy(&handle, &bits, sizeof(T));
+    return handle;
+}
+
+void DeletionQueue::push(Entry&& entry) {
+    // An object tagged older than the back of the queue just waits a little longer than it has to,
+    // that keeps the queue sorted without searching.
+    if (!entries.empty() && entry.frame < entries.back().frame) {
+        entry.frame = entries.back().frame;
+    }
+
+    entries.push_back(std::move(entry));
+}
+
+void DeletionQueue::destroy(Entry& entry) {
+    switch (entry.type) {
+        case DeletionType::Buffer:
+            vkDestroyBuffer(device, handleFromBits<VkBuffer>(entry.handle), allocationCallbacks);
+            break;
+        case DeletionType::DeviceMemory:
+            if (memoryTracker != nullptr) {
+                memoryTracker->free(device, handleFromBits<VkDeviceMemory>(entry.handle));
+            } else {
+                vkFreeMemory(device, handleFromBits<VkDeviceMemory>(entry.handle), allocationCallbacks);
+            }
+            break;
+        case DeletionType::Image:
+            vkDestroyImage(device, handleFromBits<VkImage>(entry.handle), allocationCallbacks);
+            break;
+        case DeletionType::ImageView:
+            vkDestroyImageView(device, handleFromBits<VkImageView>(entry.handle), allocationCallbacks);
+            break;
+        case DeletionType::Sampler:
+            vkDestroySampler(device, handleFromBits<VkSampler>(entry.handle), allocationCallbacks);
+            break;
+        case DeletionType::Framebuffer:
+            vkDestroyFramebuffer(device, handleFromBits<VkFramebuffer>(entry.handle), allocationCallbacks);
+            break;
+        case DeletionType::RenderPass:
+            vkDestroyRenderPass(device, handleFromBits<VkRenderPass>(entry.handle), allocationCallbacks);
+            break;
+        case DeletionType::Pipeline:
+            vkDestroyPipeline(device, handleFromBits<VkPipeline>(entry.handle), allocationCallbacks);
+            break;
+        case DeletionType::PipelineLayout:
+            vkDestroyPipelineLayout(device, handleFromBits<VkPipelineLayout>(entry.handle), allocationCallbacks);
+            break;
+        case DeletionType::ShaderModule:
+            vkDestroyShaderModule(device, handleFromBits<VkShaderModule>(entry.handle), allocationCallbacks);
+            break;
+        case DeletionType::DescriptorPool:
+            vkDestroyDescriptorPool(device, handleFromBits<VkDescriptorPool>(entry.handle), allocationCallbacks);
+            break;
+        case DeletionType::DescriptorSetLayout:
+            vkDestroyDescriptorSetLayout(device, handleFromBits<VkDescriptorSetLayout>(entry.handle), allocationCallbacks);
+            break;
+        case DeletionType::QueryPool:
+            vkDestroyQueryPool(device, handleFromBits<VkQueryPool>(entry.handle), allocationCallbacks);
+            break;
+        case DeletionType::Swapchain:
+            vkDestroySwapchainKHR(device, handleFromBits<VkSwapchainKHR>(entry.handle), allocationCallbacks);
+            break;
+        case DeletionType::Function:
+            entry.function();
+            break;
+    }
+}
+
+uint32_t DeletionQueue::collect(uint64_t retiredFrame, uint32_t maxCount) {
+    uint32_t destroyed = 0;
+    while (destroyed < maxCount && !entries.empty() && entries.front().frame <= retiredFrame) {
+        destroy(entries.front());
+        entries.pop_front();
+        destroyed++;
+    }
+
+    return destroyed;
+}
+
+void DeletionQueue::flush() {
+    for (Entry& entry : entries) {
+        destroy(entry);
+    }
+    entries.clear();
+}
@@ -0,0 +1,243 @@
+#include "descriptors.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+// Sets a pool holds, and descriptors of each type per set.
+static const uint32_t DESCRIPTOR_POOL_SETS = 64;
+static const struct {
+    VkDescriptorType type;
+    uint32_t perSet;
+} DESCRIPTOR_POOL_RATIOS[] = {
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 6},
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2},
+    {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4},
+    {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2},
+    {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1},
+    {VK_DESCRIPTOR_TYPE_SAMPLER, 1},
+};
+
+VkDescriptorSetLayout LayoutCache::setLayout(std::vector<VkDescriptorSetLayoutBinding> bindings) {
+    std::sort(bindings.begin(), bindings.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) {
+        return a.binding < b.binding;
+    });
+
+    std::vector<uint32_t> key;
+    key.reserve(bindings.size() * 4);
+    for (const VkDescriptorSetLayoutBinding& binding : bindings) {
+        if (binding.pImmutableSamplers != nullptr) {
+            throw std::runtime_error("Immutable samplers can't be cached");
+        }
+        key.push_back(binding.binding);
+        key.push_back(static_cast<uint32_t>(binding.descriptorType));
+        key.push_back(binding.descriptorCount);
+        key.push_back(binding.stageFlags);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    requests++;
+
+    auto it = setLayouts.find(key);
+    if (it != setLayouts.end()) {
+        hits++;
+        return it->second;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    VkDescriptorSetLayout layout;
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, allocationCallbacks, &layout) != VK_SUCCESS) {
+        throw std::runtime_error("Unable to create descriptor set layout");
+    }
+
+    DescriptorCounts counts;
+    for (const VkDescriptorSetLayoutBinding& binding : bindings) {
+        if (static_cast<uint32_t>(binding.descriptorType) >= DESCRIPTOR_TYPE_COUNT) {
+            throw std::runtime_error("Unable to pool descriptors of an extension type");
+        }
+        counts.count[binding.descriptorType] += binding.descriptorCount;
+    }
+
+    setLayouts.emplace(std::move(key), layout);
+    layoutCounts.emplace(layout, counts);
+    return layout;
+}
+
+VkPipelineLayout LayoutCache::pipelineLayout(const std::vector<VkDescriptorSetLayout>& layouts, const VkPushConstantRange* pushConstants) {
+    std::vector<uint64_t> key;
+    key.reserve(layouts.size() + 2);
+    for (VkDescriptorSetLayout layout : layouts) {
+        key.push_back((uint64_t)layout);
+    }
+    if (pushConstants != nullptr) {
+        key.push_back(pushConstants->stageFlags);
+        key.push_back(pushConstants->size);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    requests++;
+
+    auto it = pipelineLayouts.find(key);
+    if (it != pipelineLayouts.end()) {
+        hits++;
+        return it->second;
+    }
+
+    VkPipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount = static_cast<uint32_t>(layouts.size());
+    layoutInfo.pSetLayouts = layouts.data();
+    layoutInfo.pushConstantRangeCount = pushConstants != nullptr ? 1 : 0;
+    layoutInfo.pPushConstantRanges = pushConstants;
+
+    VkPipelineLayout layout;
+    if (vkCreatePipelineLayout(device, &layoutInfo, allocationCallbacks, &layout) != VK_SUCCESS) {
+        throw std::runtime_error("Unable to create pipeline layout");
+    }
+
+    pipelineLayouts.emplace(std::move(key), layout);
+    return layout;
+}
+
+DescriptorCounts LayoutCache::descriptorCounts(VkDescriptorSetLayout layout) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = layoutCounts.find(layout);
+    if (it == layoutCounts.end()) {
+        throw std::runtime_error("Unable to find descriptor set layout in the layout cache");
+    }
+    return it->second;
+}
+
+LayoutCacheStats LayoutCache::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    LayoutCacheStats stats{};
+    stats.setLayouts = static_cast<uint32_t>(setLayouts.size());
+    stats.pipelineLayouts = static_cast<uint32_t>(pipelineLayouts.size());
+    stats.requests = requests;
+    stats.hits = hits;
+    return stats;
+}
+
+void LayoutCache::destroy() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (const auto& entry : pipelineLayouts) {
+        vkDestroyPipelineLayout(device, entry.second, allocationCallbacks);
+    }
+    for (const auto& entry : setLayouts) {
+        vkDestroyDescriptorSetLayout(device, entry.second, allocationCallbacks);
+    }
+    pipelineLayouts.clear();
+    setLayouts.clear();
+    layoutCounts.clear();
+}
+
+VkDescriptorPool DescriptorAllocator::createPool() {
+    std::vector<VkDescriptorPoolSize> sizes;
+    for (const auto& ratio : DESCRIPTOR_POOL_RATIOS) {
+        sizes.push_back({ratio.type, ratio.perSet * DESCRIPTOR_POOL_SETS});
+    }
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = DESCRIPTOR_POOL_SETS;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(sizes.size());
+    poolInfo.pPoolSizes = sizes.data();
+
+    VkDescriptorPool pool;
+    if (vkCreateDescriptorPool(device, &poolInfo, allocationCallbacks, &pool) != VK_SUCCESS) {
+        throw std::runtime_error("Unable to create descriptor pool");
+    }
+    return pool;
+}
+
+const DescriptorCounts& DescriptorAllocator::layoutCounts(VkDescriptorSetLayout layout) {
+    for (const auto& known : knownLayouts) {
+        if (known.first == layout) {
+            return known.second;
+        }
+    }
+
+    knownLayouts.emplace_back(layout, layouts->descriptorCounts(layout));
+    return knownLayouts.back().second;
+}
+
+void DescriptorAllocator::fillRemaining() {
+    remainingSets = DESCRIPTOR_POOL_SETS;
+    remaining = DescriptorCounts();
+    for (const auto& ratio : DESCRIPTOR_POOL_RATIOS) {
+        remaining.count[ratio.type] = ratio.perSet * DESCRIPTOR_POOL_SETS;
+    }
+}
+
+VkDescriptorSet DescriptorAllocator::allocate(VkDescriptorSetLayout layout) {
+    const DescriptorCounts& counts = layoutCounts(layout);
+
+    for (;;) {
+        bool fresh = current == pools.size();
+        if (fresh) {
+            pools.push_back(createPool());
+            fillRemaining();
+        }
+
+        bool fits = remainingSets > 0;
+        for (uint32_t type = 0; type < DESCRIPTOR_TYPE_COUNT && fits; type++) {
+            fits = counts.count[type] <= remaining.count[type];
+        }
+
+        if (fits) {
+            break;
+        }
+
+        // An empty pool that is already too small won't get better with another one.
+        if (fresh) {
+            throw std::runtime_error("Unable to allocate descriptor set, its layout needs more than a pool holds");
+        }
+        current++;
+        if (current < pools.size()) {
+            fillRemaining();
+        }
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = pools[current];
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
+
+    VkDescriptorSet set;
+    if (vkAllocateDescriptorSets(device, &allocInfo, &set) != VK_SUCCESS) {
+        throw std::runtime_error("Unable to allocate descriptor set");
+    }
+
+    remainingSets--;
+    for (uint32_t type = 0; type < DESCRIPTOR_TYPE_COUNT; type++) {
+        remaining.count[type] -= counts.count[type];
+    }
+
+    return set;
+}
+
+void DescriptorAllocator::reset() {
+    for (size_t i = 0; i < pools.size() && i <= current; i++) {
+        vkResetDescriptorPool(device, pools[i], 0);
+    }
+    current = 0;
+    if (!pools.empty()) {
+        fillRemaining();
+    }
+}
+
+void DescriptorAllocator::destroy() {
+    for (VkDescriptorPool pool : pools) {
+        vkDestroyDescriptorPool(device, pool, allocationCallbacks);
+    }
+    pools.clear();
+    current = 0;
+    knownLayouts.clear();
+}
@@ -0,0 +1,373 @@
+#include "ecs.hpp"
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+
+// Ids are handed out lazily by ComponentRegistry::id<T>(), which can first run on a job thread.
+// The array never moves, so info() reads an id it was given without taking the lock.
+static ComponentInfo componentInfos[MAX_COMPONENT_TYPES];
+static uint32_t componentCount = 0;
+static std::mutex componentMutex;
+
+ComponentId ComponentRegistry::registerComponent(size_t size, size_t alignment) {
+    std::lock_guard<std::mutex> lock(componentMutex);
+    if (componentCount >= MAX_COMPONENT_TYPES) {
+        throw std::runtime_error("Too many component types registered");
+    }
+
+    componentInfos[componentCount] = {size, alignment};
+    return static_cast<ComponentId>(componentCount++);
+}
+
+const ComponentInfo& ComponentRegistry::info(ComponentId id) {
+    return componentInfos[id];
+}
+
+static size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+Archetype::Archetype(const ComponentMask& mask) : mask(mask) {
+    for (uint32_t i = 0; i < MAX_COMPONENT_TYPES; i++) {
+        columns[i] = -1;
+        addEdges[i] = UINT32_MAX;
+        removeEdges[i] = UINT32_MAX;
+    }
+
+    size_t rowSize = sizeof(Entity);
+    for (ComponentId id = 0; id < MAX_COMPONENT_TYPES; id++) {
+        if (!mask.test(id)) {
+            continue;
+        }
+
+        columns[id] = static_cast<int8_t>(components.size());
+        components.push_back(id);
+        sizes.push_back(static_cast<uint32_t>(ComponentRegistry::info(id).size));
+        rowSize += ComponentRegistry::info(id).size;
+    }
+
+    offsets.resize(components.size());
+
+    // Start from the ideal row count and back off until the padding needed to align every array fits.
+    capacity = static_cast<uint32_t>(ECS_CHUNK_SIZE / rowSize);
+    while (capacity > 0) {
+        size_t offset = sizeof(Entity) * capacity;
+        for (size_t i = 0; i < components.size(); i++) {
+            offset = alignUp(offset, ComponentRegistry::info(components[i]).alignment);
+            offsets[i] = static_cast<uint32_t>(offset);
+            offset += static_cast<size_t>(sizes[i]) * capacity;
+        }
+
+        if (offset <= ECS_CHUNK_SIZE) {
+            break;
+        }
+        capacity--;
+    }
+
+    if (capacity == 0) {
+        throw std::runtime_error("Archetype does not fit in a single chunk");
+    }
+}
+
+uint32_t Archetype::size() const {
+    uint32_t total = 0;
+    for (const auto& chunk : chunks) {
+        total += chunk->count;
+    }
+    return total;
+}
+
+World::World(JobSystem* jobs) : jobs(jobs) {
+    commandBuffers.resize(jobs != nullptr ? jobs->threadCount() - 1 : 0);
+
+    // Archetype 0 is always the empty one.
+    findOrCreateArchetype(ComponentMask());
+}
+
+uint32_t World::findOrCreateArchetype(const ComponentMask& mask) {
+    auto it = archetypeLookup.find(mask);
+    if (it != archetypeLookup.end()) {
+        return it->second;
+    }
+
+    uint32_t index = static_cast<uint32_t>(archetypes.size());
+    archetypes.push_back(std::make_unique<Archetype>(mask));
+    archetypeLookup.emplace(mask, index);
+
+    return index;
+}
+
+uint32_t World::archetypeWith(uint32_t archetype, ComponentId component) {
+    if (archetypes[archetype]->addEdges[component] == UINT32_MAX) {
+        ComponentMask mask = archetypes[archetype]->mask;
+        mask.set(component);
+        archetypes[archetype]->addEdges[component] = findOrCreateArchetype(mask);
+    }
+
+    return archetypes[archetype]->addEdges[component];
+}
+
+uint32_t World::archetypeWithout(uint32_t archetype, ComponentId component) {
+    if (archetypes[archetype]->removeEdges[component] == UINT32_MAX) {
+        ComponentMask mask = archetypes[archetype]->mask;
+        mask.reset(component);
+        archetypes[archetype]->removeEdges[component] = findOrCreateArchetype(mask);
+    }
+
+    return archetypes[archetype]->removeEdges[component];
+}
+
+void World::allocateRow(uint32_t archetypeIndex, EntityRecord& record, Entity entity) {
+    Archetype& archetype = *archetypes[archetypeIndex];
+
+    if (archetype.chunks.empty() || archetype.chunks.back()->count == archetype.capacity) {
+        archetype.chunks.push_back(std::make_unique<Chunk>());
+    }
+
+    Chunk& chunk = *archetype.chunks.back();
+    record.archetype = archetypeIndex;
+    record.chunk = static_cast<uint32_t>(archetype.chunks.size() - 1);
+    record.row = chunk.count++;
+
+    archetype.entities(chunk)[record.row] = entity;
+}
+
+void World::freeRow(const EntityRecord& record) {
+    Archetype& archetype = *archetypes[record.archetype];
+
+    // Fill the hole with the very last row so every chunk but the last stays full.
+    uint32_t lastChunk = static_cast<uint32_t>(archetype.chunks.size() - 1);
+    Chunk& last = *archetype.chunks[lastChunk];
+    uint32_t lastRow = last.count - 1;
+
+    if (record.chunk != lastChunk || record.row != lastRow) {
+        Entity moved = archetype.entities(last)[lastRow];
+        archetype.entities(*archetype.chunks[record.chunk])[record.row] = moved;
+
+        for (uint32_t column = 0; column < archetype.components.size(); column++) {
+            memcpy(
+                archetype.component(record.chunk, record.row, column),
+                archetype.component(lastChunk, lastRow, column),
+                archetype.sizes[column]
+            );
+        }
+
+        records[moved.index].chunk = record.chunk;
+        records[moved.index].row = record.row;
+    }
+
+    last.count--;
+    if (last.count == 0 && archetype.chunks.size() > 1) {
+        archetype.chunks.pop_back();
+    }
+}
+
+void World::moveEntity(Entity entity, uint32_t targetArchetype) {
+    EntityRecord previous = records[entity.index];
+    if (previous.archetype == targetArchetype) {
+        return;
+    }
+
+    EntityRecord& record = records[entity.index];
+    allocateRow(targetArchetype, record, entity);
+
+    Archetype& source = *archetypes[previous.archetype];
+    Archetype& target = *archetypes[targetArchetype];
+    for (uint32_t column = 0; column < source.components.size(); column++) {
+        int targetColumn = target.columns[source.components[column]];
+        if (targetColumn < 0) {
+            continue;
+        }
+
+        memcpy(
+            target.component(record.chunk, record.row, targetColumn),
+            source.component(previous.chunk, previous.row, column),
+            source.sizes[column]
+        );
+    }
+
+    freeRow(previous);
+    structureChanges++;
+}
+
+Entity World::createEntityWithMask(const ComponentMask& mask) {
+    uint32_t archetype = findOrCreateArchetype(mask);
+
+    uint32_t index;
+    if (!freeIndices.empty()) {
+        index = freeIndices.back();
+        freeIndices.pop_back();
+    } else {
+        index = static_cast<uint32_t>(records.size());
+        records.push_back({0, 0, 0, 0});
+    }
+
+    Entity entity = {index, records[index].generation};
+    allocateRow(archetype, records[index], entity);
+    aliveCount++;
+    structureChanges++;
+
+    return entity;
+}
+
+void World::destroyEntity(Entity entity) {
+    if (!isAlive(entity)) {
+        return;
+    }
+
+    EntityRecord record = records[entity.index];
+    freeRow(record);
+
+    records[entity.index].generation++;
+    freeIndices.push_back(entity.index);
+    aliveCount--;
+    structureChanges++;
+}
+
+bool World::isAlive(Entity entity) const {
+    return entity.index < records.size() && records[entity.index].generation == entity.generation;
+}
+
+void* World::addComponent(Entity entity, ComponentId component, const void* value) {
+    if (!isAlive(entity)) {
+        throw std::runtime_error("Unable to add component to a destroyed entity");
+    }
+
+    EntityRecord& record = records[entity.index];
+    if (archetypes[record.archetype]->columns[component] < 0) {
+        moveEntity(entity, archetypeWith(record.archetype, component));
+    }
+
+    Archetype& archetype = *archetypes[record.archetype];
+    void* destination = archetype.component(record.chunk, record.row, archetype.columns[component]);
+    memcpy(destination, value, ComponentRegistry::info(component).size);
+
+    return destination;
+}
+
+void World::removeComponent(Entity entity, ComponentId component) {
+    if (!isAlive(entity)) {
+        return;
+    }
+
+    uint32_t archetype = records[entity.index].archetype;
+    if (archetypes[archetype]->columns[component] < 0) {
+        return;
+    }
+
+    moveEntity(entity, archetypeWithout(archetype, component));
+}
+
+void* World::getComponent(Entity entity, ComponentId component) {
+    if (!isAlive(entity)) {
+        return nullptr;
+    }
+
+    const EntityRecord& record = records[entity.index];
+    Archetype& archetype = *archetypes[record.archetype];
+    if (archetype.columns[component] < 0) {
+        return nullptr;
+    }
+
+    return archetype.component(record.chunk, record.row, archetype.columns[component]);
+}
+
+CommandBuffer& World::commands() {
+    uint32_t index = JobSystem::threadIndex();
+    if (index > 0) {
+        if (index > commandBuffers.size()) {
+            throw std::runtime_error("Command buffer requested from a worker of another job system");
+        }
+        return commandBuffers[index - 1];
+    }
+
+    std::thread::id thread = std::this_thread::get_id();
+    std::lock_guard<std::mutex> lock(threadBuffersMutex);
+    for (size_t i = 0; i < bufferThreads.size(); i++) {
+        if (bufferThreads[i] == thread) {
+            return *threadBuffers[i];
+        }
+    }
+
+    bufferThreads.push_back(thread);
+    threadBuffers.push_back(std::make_unique<CommandBuffer>());
+    threadBuffers.back()->reserve(commandsHighWater, dataHighWater);
+    return *threadBuffers.back();
+}
+
+// A frame that records a little more than any before shouldn't grow every buffer again.
+static size_t roundUpToPowerOfTwo(size_t value) {
+    size_t rounded = 1;
+    while (rounded < value) {
+        rounded <<= 1;
+    }
+    return rounded;
+}
+
+void World::sync() {
+    std::lock_guard<std::mutex> lock(threadBuffersMutex);
+
+    size_t commandCount = 0;
+    size_t dataSize = 0;
+    for (const auto& buffer : threadBuffers) {
+        commandCount += buffer->commands.size();
+        dataSize += buffer->data.size();
+    }
+    for (const auto& buffer : commandBuffers) {
+        commandCount += buffer.commands.size();
+        dataSize += buffer.data.size();
+    }
+
+    for (auto& buffer : threadBuffers) {
+        applyCommands(*buffer);
+    }
+    for (auto& buffer : commandBuffers) {
+        applyCommands(buffer);
+    }
+
+    if (commandCount > commandsHighWater || dataSize > dataHighWater) {
+        commandsHighWater = std::max(commandsHighWater, roundUpToPowerOfTwo(commandCount));
+        dataHighWater = std::max(dataHighWater, roundUpToPowerOfTwo(dataSize));
+        for (auto& buffer : threadBuffers) {
+            buffer->reserve(commandsHighWater, dataHighWater);
+        }
+        for (auto& buffer : commandBuffers) {
+            buffer.reserve(commandsHighWater, dataHighWater);
+        }
+    }
+}
+
+void World::applyCommands(CommandBuffer& buffer) {
+    const std::vector<CommandBuffer::Command>& commands = buffer.commands;
+    Entity created;
+
+    for (size_t i = 0; i < commands.size(); i++) {
+        const CommandBuffer::Command& command = commands[i];
+        Entity target = command.entity.isValid() ? command.entity : created;
+
+        switch (command.op) {
+            case CommandBuffer::Op::Create: {
+                // Look ahead at the components recorded with it so the entity lands in its final archetype directly.
+                ComponentMask mask;
+                for (size_t j = i + 1; j < commands.size() && commands[j].op == CommandBuffer::Op::Add && !commands[j].entity.isValid(); j++) {
+                    mask.set(commands[j].component);
+                }
+                created = createEntityWithMask(mask);
+                break;
+            }
+            case CommandBuffer::Op::Destroy:
+                destroyEntity(target);
+                break;
+            case CommandBuffer::Op::Add:
+                if (isAlive(target)) {
+                    addComponent(target, command.component, buffer.data.data() + command.dataOffset);
+                }
+                break;
+            case CommandBuffer::Op::Remove:
+                removeComponent(target, command.component);
+                break;
+        }
+    }
+
+    buffer.clear();
+}
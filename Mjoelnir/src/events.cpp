@@ -0,0 +1,24 @@
+#include "events.hpp"
+
+bool WindowEventQueue::push(const WindowEvent& event) {
+    uint32_t position = head.load(std::memory_order_relaxed);
+    if (position - tail.load(std::memory_order_acquire) >= WINDOW_EVENT_QUEUE_SIZE) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    events[position % WINDOW_EVENT_QUEUE_SIZE] = event;
+    head.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool WindowEventQueue::pop(WindowEvent& event) {
+    uint32_t position = tail.load(std::memory_order_relaxed);
+    if (position == head.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    event = events[position % WINDOW_EVENT_QUEUE_SIZE];
+    tail.store(position + 1, std::memory_order_release);
+    return true;
+}
@@ -0,0 +1,196 @@
+#include "jobs.hpp"
+#include "profiler.hpp"
+
+#include <string>
+
+static thread_local uint32_t currentThreadIndex = 0;
+
+JobSystem::JobSystem(uint32_t threadCount) : queue(JOB_QUEUE_CAPACITY) {
+    if (threadCount == 0) {
+        uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    }
+
+    workers.reserve(threadCount);
+    for (uint32_t i = 0; i < threadCount; i++) {
+        workers.emplace_back(&JobSystem::workerLoop, this, i + 1);
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueCondition.notify_all();
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+uint32_t JobSystem::threadIndex() {
+    return currentThreadIndex;
+}
+
+void JobSystem::push(Job&& job) {
+    if (queueSize == queue.size()) {
+        std::vector<Job> grown(queue.size() * 2);
+        for (size_t i = 0; i < queueSize; i++) {
+            grown[i] = std::move(queue[(queueHead + i) % queue.size()]);
+        }
+        queue.swap(grown);
+        queueHead = 0;
+    }
+
+    queue[(queueHead + queueSize) % queue.size()] = std::move(job);
+    queueSize++;
+}
+
+JobSystem::Job JobSystem::pop() {
+    Job job = std::move(queue[queueHead]);
+    queue[queueHead].function = nullptr;
+    queueHead = (queueHead + 1) % queue.size();
+    queueSize--;
+    return job;
+}
+
+void JobSystem::run(Job& job) {
+    try {
+        PROFILE_ZONE("Job");
+        if (job.function) {
+            job.function();
+        } else {
+            job.indexed(job.first, job.second);
+        }
+    } catch (...) {
+        // An exception must not escape a worker, wait() rethrows it on the thread waiting instead.
+        std::lock_guard<std::mutex> lock(job.counter->errorMutex);
+        if (!job.counter->error) {
+            job.counter->error = std::current_exception();
+        }
+    }
+    job.counter->pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void JobSystem::submit(JobCounter& counter, std::function<void()> function) {
+    counter.pending.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        Job job;
+        job.function = std::move(function);
+        job.counter = &counter;
+        push(std::move(job));
+    }
+    queueCondition.notify_one();
+}
+
+void JobSystem::submitRange(JobCounter& counter, JobFunction function, uint32_t begin, uint32_t end) {
+    submitIndexed(counter, function, begin, end);
+}
+
+void JobSystem::submitIndexed(JobCounter& counter, JobFunction function, uint32_t first, uint32_t second) {
+    counter.pending.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        Job job;
+        job.indexed = function;
+        job.first = first;
+        job.second = second;
+        job.counter = &counter;
+        push(std::move(job));
+    }
+    queueCondition.notify_one();
+}
+
+bool JobSystem::runOne() {
+    Job job;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (queueSize == 0) {
+            return false;
+        }
+        job = pop();
+    }
+
+    run(job);
+
+    return true;
+}
+
+void JobSystem::wait(JobCounter& counter) {
+    while (counter.pending.load(std::memory_order_acquire) > 0) {
+        if (!runOne()) {
+            std::this_thread::yield();
+        }
+    }
+
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(counter.errorMutex);
+        std::swap(error, counter.error);
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void JobSystem::parallelFor(uint32_t count, uint32_t grainSize, JobFunction function) {
+    if (count == 0) {
+        return;
+    }
+
+    if (grainSize == 0) {
+        grainSize = 1;
+    }
+
+    if (count <= grainSize || workers.empty()) {
+        function(0, count);
+        return;
+    }
+
+    JobCounter counter;
+    // Keep the first range for the calling thread, there is no point in queueing it.
+    for (uint32_t begin = grainSize; begin < count; begin += grainSize) {
+        uint32_t end = begin + grainSize < count ? begin + grainSize : count;
+        submitRange(counter, function, begin, end);
+    }
+
+    std::exception_ptr error;
+    try {
+        function(0, grainSize);
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    // The queued ranges point at counter, they have to finish even if the first one threw.
+    if (error) {
+        try {
+            wait(counter);
+        } catch (...) {
+        }
+        std::rethrow_exception(error);
+    }
+    wait(counter);
+}
+
+void JobSystem::workerLoop(uint32_t index) {
+    currentThreadIndex = index;
+    PROFILE_THREAD_NAME(("Worker " + std::to_string(index)).c_str());
+
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueCondition.wait(lock, [this]() { return stopping || queueSize > 0; });
+
+            if (stopping && queueSize == 0) {
+                return;
+            }
+
+            job = pop();
+        }
+
+        run(job);
+    }
+}
@@ -0,0 +1,138 @@
+#include "lights.hpp"
+
+#include <math.h>
+
+#include <algorithm>
+
+static float linearDepth(const glm::vec4& linearize, float z) {
+    return (linearize.x * z + linearize.y) / (linearize.z * z + linearize.w);
+}
+
+// The inverse of linearDepth().
+static float bufferDepth(const glm::vec4& linearize, float depth) {
+    return (linearize.y - linearize.w * depth) / (linearize.z * depth - linearize.x);
+}
+
+ClusterDepth clusterDepth(const glm::mat4& projection) {
+    glm::mat4 inverse = glm::inverse(projection);
+
+    // View space z and w of a point on the view axis, negated since the camera looks down -Z.
+    ClusterDepth depth{};
+    depth.linearize = glm::vec4(-inverse[2][2], -inverse[3][2], inverse[2][3], inverse[3][3]);
+
+    // Either order, reversed depth has the far plane at 0.
+    float first = linearDepth(depth.linearize, 0.0f);
+    float last = linearDepth(depth.linearize, 1.0f);
+    float nearPlane = std::min(first, last);
+    float farPlane = std::max(first, last);
+
+    // Only perspective projections have w depend on z, and log2() needs a near plane in front of the camera.
+    depth.logarithmic = projection[2][3] != 0.0f && nearPlane > 0.0f;
+    if (depth.logarithmic) {
+        if (!std::isfinite(farPlane) || farPlane > nearPlane * CLUSTER_MAX_DEPTH_RATIO) {
+            farPlane = nearPlane * CLUSTER_MAX_DEPTH_RATIO;
+        }
+        depth.sliceScale = static_cast<float>(CLUSTER_SLICES) / log2f(farPlane / nearPlane);
+        depth.sliceBias = -log2f(nearPlane) * depth.sliceScale;
+    } else {
+        depth.sliceScale = static_cast<float>(CLUSTER_SLICES) / std::max(farPlane - nearPlane, 1e-6f);
+        depth.sliceBias = -nearPlane * depth.sliceScale;
+    }
+
+    return depth;
+}
+
+void buildClusterBounds(const glm::mat4& projection, const ClusterDepth& depth, ClusterBounds* bounds) {
+    glm::mat4 inverse = glm::inverse(projection);
+
+    // Depth buffer values the slices start at.
+    float sliceStarts[CLUSTER_SLICES + 1];
+    for (uint32_t slice = 0; slice <= CLUSTER_SLICES; slice++) {
+        float value = (static_cast<float>(slice) - depth.sliceBias) / depth.sliceScale;
+        sliceStarts[slice] = bufferDepth(depth.linearize, depth.logarithmic ? exp2f(value) : value);
+    }
+
+    for (uint32_t slice = 0; slice < CLUSTER_SLICES; slice++) {
+        for (uint32_t y = 0; y < CLUSTER_TILES_Y; y++) {
+            for (uint32_t x = 0; x < CLUSTER_TILES_X; x++) {
+                float x0 = -1.0f + 2.0f * static_cast<float>(x) / static_cast<float>(CLUSTER_TILES_X);
+                float x1 = -1.0f + 2.0f * static_cast<float>(x + 1) / static_cast<float>(CLUSTER_TILES_X);
+                float y0 = -1.0f + 2.0f * static_cast<float>(y) / static_cast<float>(CLUSTER_TILES_Y);
+                float y1 = -1.0f + 2.0f * static_cast<float>(y + 1) / static_cast<float>(CLUSTER_TILES_Y);
+
+                glm::vec3 minimum(INFINITY);
+                glm::vec3 maximum(-INFINITY);
+                for (uint32_t corner = 0; corner < 8; corner++) {
+                    glm::vec4 ndc(
+                        corner & 1 ? x1 : x0,
+                        corner & 2 ? y1 : y0,
+                        corner & 4 ? sliceStarts[slice + 1] : sliceStarts[slice],
+                        1.0f
+                    );
+                    glm::vec4 view = inverse * ndc;
+                    glm::vec3 point = glm::vec3(view) / view.w;
+                    minimum = glm::min(minimum, point);
+                    maximum = glm::max(maximum, point);
+                }
+
+                ClusterBounds& cluster = bounds[x + CLUSTER_TILES_X * (y + CLUSTER_TILES_Y * slice)];
+                cluster.min = glm::vec4(minimum, 0.0f);
+                cluster.max = glm::vec4(maximum, 0.0f);
+            }
+        }
+    }
+}
+
+static bool intersectsFrustum(const Frustum& frustum, const glm::vec3& center, float radius) {
+    for (const glm::vec4& plane : frustum.planes) {
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool packPointLight(const PointLight& light, const glm::mat4& world, const glm::mat4& view, const Frustum& frustum, GpuLight& packed) {
+    glm::vec3 position(world[3]);
+    if (!intersectsFrustum(frustum, position, light.range)) {
+        return false;
+    }
+
+    glm::vec3 viewPosition(view * glm::vec4(position, 1.0f));
+    packed.positionRange = glm::vec4(viewPosition, light.range);
+    packed.color = glm::vec4(light.color, 1.0f);
+    packed.direction = glm::vec4(0.0f);
+    packed.bounds = glm::vec4(viewPosition, light.range);
+    return true;
+}
+
+bool packSpotLight(const SpotLight& light, const glm::mat4& world, const glm::mat4& view, const Frustum& frustum, GpuLight& packed) {
+    glm::vec3 position(world[3]);
+    glm::vec3 axis = -glm::normalize(glm::vec3(world[2]));
+
+    // Smallest sphere around the cone: wide cones are bounded by their cap, narrow ones by a
+    // sphere through the apex and the cap's rim.
+    float cosOuter = cosf(light.outerAngle);
+    glm::vec3 center;
+    float radius;
+    if (light.outerAngle > 0.785398163f) {
+        center = position + axis * (light.range * cosOuter);
+        radius = light.range * sinf(light.outerAngle);
+    } else {
+        radius = light.range / (2.0f * cosOuter);
+        center = position + axis * radius;
+    }
+
+    if (!intersectsFrustum(frustum, center, radius)) {
+        return false;
+    }
+
+    float cosInner = cosf(light.innerAngle);
+    float coneScale = 1.0f / std::max(cosInner - cosOuter, 1e-4f);
+
+    packed.positionRange = glm::vec4(glm::vec3(view * glm::vec4(position, 1.0f)), light.range);
+    packed.color = glm::vec4(light.color, -cosOuter * coneScale);
+    packed.direction = glm::vec4(glm::normalize(glm::vec3(view * glm::vec4(axis, 0.0f))), coneScale);
+    packed.bounds = glm::vec4(glm::vec3(view * glm::vec4(center, 1.0f)), radius);
+    return true;
+}
@@ -0,0 +1,380 @@
+#include "log.hpp"
+#include "profiler.hpp"
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+
+// How long the drain thread sleeps when every ring was empty.
+const std::chrono::microseconds LOG_IDLE_SLEEP(1000);
+// Loggers a thread remembers its ring for, the rest find it by scanning their rings.
+const uint32_t LOG_THREAD_RING_CACHE = 4;
+
+static std::atomic<uint64_t> nextLoggerId{1};
+
+struct ThreadRingCache {
+    uint64_t loggerId;
+    void* ring;
+};
+
+static thread_local ThreadRingCache ringCache[LOG_THREAD_RING_CACHE] = {};
+static thread_local uint32_t ringCacheNext = 0;
+
+static const char* SEVERITY_COLORS[] = {
+    "\033[2m",
+    "\033[2m\033[38;5;45m",
+    "\033[1m\033[38;5;11m",
+    "\033[1m\033[38;5;9m",
+};
+
+static const char* SEVERITY_NAMES[] = {
+    "verbose",
+    "info",
+    "warning",
+    "error",
+};
+
+static const char* CATEGORY_NAMES[] = {
+    "General",
+    "Validation",
+    "Performance",
+    "Engine",
+};
+
+static uint64_t timestampNow() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count());
+}
+
+Logger::Logger() : id(nextLoggerId.fetch_add(1, std::memory_order_relaxed)) {
+    drainThread = std::thread(&Logger::drainLoop, this);
+}
+
+Logger::~Logger() {
+    running.store(false, std::memory_order_release);
+    drainThread.join();
+
+    if (binaryFile != nullptr) {
+        fclose(binaryFile);
+    }
+
+    for (uint32_t i = 0; i < LOG_MAX_THREADS; i++) {
+        delete rings[i].load(std::memory_order_relaxed);
+    }
+}
+
+Logger::Ring* Logger::threadRing() {
+    for (const ThreadRingCache& entry : ringCache) {
+        if (entry.loggerId == id) {
+            return static_cast<Ring*>(entry.ring);
+        }
+    }
+
+    // Not cached, but the thread may have logged here before switching between loggers. Only this
+    // thread publishes rings it owns, so a ring that is still being published isn't ours.
+    Ring* ring = nullptr;
+    std::thread::id self = std::this_thread::get_id();
+    uint32_t count = std::min(ringCount.load(std::memory_order_acquire), LOG_MAX_THREADS);
+    for (uint32_t i = 0; i < count && ring == nullptr; i++) {
+        Ring* candidate = rings[i].load(std::memory_order_acquire);
+        if (candidate != nullptr && candidate->owner == self) {
+            ring = candidate;
+        }
+    }
+
+    if (ring == nullptr) {
+        uint32_t index = ringCount.fetch_add(1, std::memory_order_relaxed);
+        if (index >= LOG_MAX_THREADS) {
+            // Out of rings, this thread's messages are dropped.
+            ringCount.fetch_sub(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        ring = new Ring();
+        rings[index].store(ring, std::memory_order_release);
+    }
+
+    ringCache[ringCacheNext] = {id, ring};
+    ringCacheNext = (ringCacheNext + 1) % LOG_THREAD_RING_CACHE;
+
+    return ring;
+}
+
+bool Logger::allowRepeat(Ring& ring, int32_t messageId, uint64_t timestamp, uint32_t& suppressed) {
+    uint32_t hash = static_cast<uint32_t>(messageId) * 2654435761u;
+    RepeatCounter* counter = &ring.repeats[hash % LOG_REPEAT_TABLE_SIZE];
+    if (counter->messageId != messageId || counter->count == 0) {
+        // Collisions simply evict the previous id, worst case it gets through a few more times.
+        *counter = {messageId, 0, 0, timestamp};
+    }
+
+    if (timestamp - counter->windowStart >= LOG_REPEAT_WINDOW_NS) {
+        counter->windowStart = timestamp;
+        counter->count = 0;
+    }
+
+    counter->count++;
+    if (counter->count > LOG_REPEAT_LIMIT) {
+        counter->suppressed++;
+        return false;
+    }
+
+    suppressed = counter->suppressed;
+    counter->suppressed = 0;
+
+    return true;
+}
+
+void Logger::push(Ring& ring, LogSeverity severity, LogCategory category, int32_t messageId, uint64_t timestamp, const char* format, va_list args) {
+    uint32_t head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) >= LOG_RING_SIZE) {
+        droppedMessages.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    LogRecord& record = ring.records[head % LOG_RING_SIZE];
+    int length = vsnprintf(record.text, LOG_MAX_MESSAGE, format, args);
+    if (length < 0) {
+        length = 0;
+    }
+
+    record.timestamp = timestamp;
+    record.messageId = messageId;
+    record.length = static_cast<uint16_t>(std::min<uint32_t>(static_cast<uint32_t>(length), LOG_MAX_MESSAGE - 1));
+    record.severity = severity;
+    record.category = category;
+
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void Logger::pushFormatted(Ring& ring, LogSeverity severity, LogCategory category, int32_t messageId, uint64_t timestamp, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    push(ring, severity, category, messageId, timestamp, format, args);
+    va_end(args);
+}
+
+void Logger::log(LogSeverity severity, LogCategory category, const char* format, ...) {
+    if (!enabled(severity, category)) {
+        return;
+    }
+
+    Ring* ring = threadRing();
+    if (ring == nullptr) {
+        droppedMessages.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    push(*ring, severity, category, 0, timestampNow(), format, args);
+    va_end(args);
+}
+
+void Logger::logMessage(LogSeverity severity, LogCategory category, int32_t messageId, const char* message) {
+    if (!enabled(severity, category)) {
+        return;
+    }
+
+    Ring* ring = threadRing();
+    if (ring == nullptr) {
+        droppedMessages.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    uint64_t timestamp = timestampNow();
+    uint32_t suppressed = 0;
+
+    // Id 0 is used by layers for all kinds of unrelated messages, those are never merged.
+    if (messageId != 0 && !allowRepeat(*ring, messageId, timestamp, suppressed)) {
+        return;
+    }
+
+    if (suppressed > 0) {
+        pushFormatted(*ring, severity, category, messageId, timestamp, "(%u similar messages suppressed) %s", suppressed, message);
+    } else {
+        pushFormatted(*ring, severity, category, messageId, timestamp, "%s", message);
+    }
+}
+
+void Logger::write(const LogRecord& record, FILE* text, bool useColors) {
+    uint32_t severity = static_cast<uint32_t>(record.severity);
+    fprintf(
+        text,
+        "%s%s: %.*s%s\n",
+        useColors ? SEVERITY_COLORS[severity] : "",
+        CATEGORY_NAMES[static_cast<uint32_t>(record.category)],
+        static_cast<int>(record.length),
+        record.text,
+        useColors ? "\033[0m" : ""
+    );
+
+    if (binaryFile != nullptr) {
+        uint8_t severityByte = static_cast<uint8_t>(record.severity);
+        uint8_t categoryByte = static_cast<uint8_t>(record.category);
+        fwrite(&record.timestamp, sizeof(record.timestamp), 1, binaryFile);
+        fwrite(&severityByte, 1, 1, binaryFile);
+        fwrite(&categoryByte, 1, 1, binaryFile);
+        fwrite(&record.length, sizeof(record.length), 1, binaryFile);
+        fwrite(&record.messageId, sizeof(record.messageId), 1, binaryFile);
+        fwrite(record.text, 1, record.length, binaryFile);
+    }
+}
+
+bool Logger::drain() {
+    // Snapshot every ring first so messages from different threads come out in time order.
+    uint32_t heads[LOG_MAX_THREADS];
+    pending.clear();
+
+    uint32_t count = std::min(ringCount.load(std::memory_order_acquire), LOG_MAX_THREADS);
+    for (uint32_t i = 0; i < count; i++) {
+        Ring* ring = rings[i].load(std::memory_order_acquire);
+        if (ring == nullptr) {
+            // Claimed but not published yet, picked up on the next pass.
+            heads[i] = 0;
+            continue;
+        }
+
+        heads[i] = ring->head.load(std::memory_order_acquire);
+        for (uint32_t position = ring->tail.load(std::memory_order_relaxed); position != heads[i]; position++) {
+            const LogRecord& record = ring->records[position % LOG_RING_SIZE];
+            pending.push_back({record.timestamp, static_cast<uint32_t>(pending.size()), &record});
+        }
+    }
+
+    if (pending.empty()) {
+        return false;
+    }
+
+    std::sort(pending.begin(), pending.end(), [](const Pending& a, const Pending& b) {
+        return a.timestamp < b.timestamp || (a.timestamp == b.timestamp && a.sequence < b.sequence);
+    });
+
+    {
+        std::lock_guard<std::mutex> lock(fileMutex);
+        bool useColors = colors.load(std::memory_order_relaxed);
+        for (const Pending& entry : pending) {
+            write(*entry.record, stderr, useColors);
+        }
+        fflush(stderr);
+        if (binaryFile != nullptr) {
+            fflush(binaryFile);
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        Ring* ring = rings[i].load(std::memory_order_relaxed);
+        if (ring != nullptr) {
+            ring->tail.store(heads[i], std::memory_order_release);
+        }
+    }
+
+    return true;
+}
+
+void Logger::drainLoop() {
+    PROFILE_THREAD_NAME("Log");
+
+    while (running.load(std::memory_order_acquire)) {
+        uint32_t requests = drainRequests.load(std::memory_order_acquire);
+        bool drained = drain();
+        drainsCompleted.store(requests, std::memory_order_release);
+
+        if (!drained) {
+            std::this_thread::sleep_for(LOG_IDLE_SLEEP);
+        }
+    }
+
+    // Whatever was logged before shutdown still goes out.
+    while (drain()) {
+    }
+}
+
+void Logger::flush() {
+    uint32_t request = drainRequests.fetch_add(1, std::memory_order_acq_rel) + 1;
+    while (running.load(std::memory_order_acquire) && static_cast<int32_t>(drainsCompleted.load(std::memory_order_acquire) - request) < 0) {
+        std::this_thread::yield();
+    }
+}
+
+void Logger::openBinaryLog(const char* path) {
+    flush();
+
+    std::lock_guard<std::mutex> lock(fileMutex);
+    if (binaryFile != nullptr) {
+        fclose(binaryFile);
+        binaryFile = nullptr;
+    }
+
+    if (path == nullptr) {
+        return;
+    }
+
+    binaryFile = fopen(path, "wb");
+    if (binaryFile == nullptr) {
+        throw std::runtime_error("Failed to open binary log file");
+    }
+
+    fwrite(LOG_BINARY_MAGIC, 1, sizeof(LOG_BINARY_MAGIC), binaryFile);
+    fwrite(&LOG_BINARY_VERSION, sizeof(LOG_BINARY_VERSION), 1, binaryFile);
+}
+
+bool Logger::decodeBinaryLog(const char* path, FILE* output) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    char magic[sizeof(LOG_BINARY_MAGIC)];
+    uint16_t version = 0;
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, LOG_BINARY_MAGIC, sizeof(magic)) != 0 ||
+        fread(&version, sizeof(version), 1, file) != 1 || version != LOG_BINARY_VERSION) {
+        fclose(file);
+        return false;
+    }
+
+    uint64_t firstTimestamp = 0;
+    bool first = true;
+    char text[LOG_MAX_MESSAGE];
+
+    while (true) {
+        uint64_t timestamp;
+        uint8_t severity;
+        uint8_t category;
+        uint16_t length;
+        int32_t messageId;
+
+        if (fread(&timestamp, sizeof(timestamp), 1, file) != 1 ||
+            fread(&severity, 1, 1, file) != 1 ||
+            fread(&category, 1, 1, file) != 1 ||
+            fread(&length, sizeof(length), 1, file) != 1 ||
+            fread(&messageId, sizeof(messageId), 1, file) != 1 ||
+            length >= LOG_MAX_MESSAGE ||
+            fread(text, 1, length, file) != length) {
+            break;
+        }
+
+        if (first) {
+            firstTimestamp = timestamp;
+            first = false;
+        }
+
+        fprintf(
+            output,
+            "[%12.6f] %-7s %s (0x%08x): %.*s\n",
+            static_cast<double>(timestamp - firstTimestamp) / 1e9,
+            severity <= static_cast<uint8_t>(LogSeverity::Error) ? SEVERITY_NAMES[severity] : "?",
+            category < static_cast<uint8_t>(LogCategory::Count) ? CATEGORY_NAMES[category] : "?",
+            static_cast<uint32_t>(messageId),
+            static_cast<int>(length),
+            text
+        );
+    }
+
+    fclose(file);
+
+    return true;
+}
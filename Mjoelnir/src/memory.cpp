@@ -0,0 +1,184 @@
+#include "memory.hpp"
+
+#include <algorithm>
+
+static MemoryPressure pressureLevel(float fraction) {
+    if (fraction >= MEMORY_PRESSURE_CRITICAL) {
+        return MemoryPressure::Critical;
+    } else if (fraction >= MEMORY_PRESSURE_HIGH) {
+        return MemoryPressure::High;
+    } else if (fraction >= MEMORY_PRESSURE_MODERATE) {
+        return MemoryPressure::Moderate;
+    }
+    return MemoryPressure::None;
+}
+
+void GpuMemoryTracker::init(VkInstance instance, VkPhysicalDevice physicalDevice, bool budgetExtension, const VkAllocationCallbacks* allocationCallbacks) {
+    this->physicalDevice = physicalDevice;
+    this->allocationCallbacks = allocationCallbacks;
+
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    if (budgetExtension) {
+        // The instance is 1.0 with VK_KHR_get_physical_device_properties2, so the KHR entry point it is.
+        getMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR) vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+    }
+
+    refreshBudget();
+    update();
+}
+
+VkDeviceSize GpuMemoryTracker::totalAllocated(uint32_t heap) const {
+    VkDeviceSize total = 0;
+    for (uint32_t category = 0; category < static_cast<uint32_t>(MemoryCategory::Count); category++) {
+        total += allocated[heap][category];
+    }
+    return total;
+}
+
+void GpuMemoryTracker::refreshBudget() {
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+    budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    if (getMemoryProperties2 != nullptr) {
+        VkPhysicalDeviceMemoryProperties2 properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        properties.pNext = &budgetProperties;
+        getMemoryProperties2(physicalDevice, &properties);
+    }
+
+    std::lock_guard<std::mutex> lock(allocationMutex);
+    for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; heap++) {
+        if (getMemoryProperties2 != nullptr) {
+            driverBudget[heap] = budgetProperties.heapBudget[heap];
+            driverUsage[heap] = budgetProperties.heapUsage[heap];
+        } else {
+            driverBudget[heap] = static_cast<VkDeviceSize>(static_cast<double>(memoryProperties.memoryHeaps[heap].size) * MEMORY_FALLBACK_BUDGET);
+            driverUsage[heap] = totalAllocated(heap);
+        }
+        allocatedAtRefresh[heap] = totalAllocated(heap);
+    }
+
+    framesSinceRefresh = 0;
+}
+
+VkResult GpuMemoryTracker::allocate(VkDevice device, const VkMemoryAllocateInfo& allocateInfo, MemoryCategory category, VkDeviceMemory* memory) {
+    uint32_t heap = memoryProperties.memoryTypes[allocateInfo.memoryTypeIndex].heapIndex;
+
+    VkResult result = vkAllocateMemory(device, &allocateInfo, allocationCallbacks, memory);
+
+    std::lock_guard<std::mutex> lock(allocationMutex);
+    if (result != VK_SUCCESS) {
+        if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY) {
+            allocationFailed[heap] = true;
+        }
+        return result;
+    }
+
+    allocations[*memory] = {heap, allocateInfo.allocationSize, category};
+    allocated[heap][static_cast<uint32_t>(category)] += allocateInfo.allocationSize;
+    allocationCounts[heap]++;
+
+    return result;
+}
+
+void GpuMemoryTracker::free(VkDevice device, VkDeviceMemory memory) {
+    if (memory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    vkFreeMemory(device, memory, allocationCallbacks);
+
+    std::lock_guard<std::mutex> lock(allocationMutex);
+    auto it = allocations.find(memory);
+    if (it == allocations.end()) {
+        return;
+    }
+
+    allocated[it->second.heap][static_cast<uint32_t>(it->second.category)] -= it->second.size;
+    allocationCounts[it->second.heap]--;
+    allocations.erase(it);
+}
+
+void GpuMemoryTracker::update() {
+    bool failed = false;
+    {
+        std::lock_guard<std::mutex> lock(allocationMutex);
+        for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; heap++) {
+            failed = failed || (allocationFailed[heap] && failureUsage[heap] == 0);
+        }
+    }
+
+    // A new failed allocation means our numbers are off, ask the driver right away.
+    if (++framesSinceRefresh >= MEMORY_BUDGET_REFRESH_INTERVAL || failed) {
+        refreshBudget();
+    }
+
+    uint32_t changedHeaps[VK_MAX_MEMORY_HEAPS];
+    MemoryHeapStats changedStats[VK_MAX_MEMORY_HEAPS];
+    uint32_t changedCount = 0;
+    {
+        std::lock_guard<std::mutex> lock(allocationMutex);
+        for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; heap++) {
+            MemoryHeapStats& stats = snapshot[heap];
+            MemoryPressure previous = stats.pressure;
+
+            VkDeviceSize total = totalAllocated(heap);
+            VkDeviceSize usage = driverUsage[heap];
+            if (total >= allocatedAtRefresh[heap]) {
+                usage += total - allocatedAtRefresh[heap];
+            } else {
+                VkDeviceSize released = allocatedAtRefresh[heap] - total;
+                usage = released < usage ? usage - released : 0;
+            }
+
+            stats.size = memoryProperties.memoryHeaps[heap].size;
+            stats.budget = driverBudget[heap];
+            stats.usage = usage;
+            for (uint32_t category = 0; category < static_cast<uint32_t>(MemoryCategory::Count); category++) {
+                stats.allocated[category] = allocated[heap][category];
+            }
+            stats.allocationCount = allocationCounts[heap];
+            stats.deviceLocal = (memoryProperties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+
+            // Rising pressure is reported right away, falling pressure only once usage is clearly
+            // below the level's threshold.
+            float fraction = stats.budget > 0 ? static_cast<float>(static_cast<double>(usage) / static_cast<double>(stats.budget)) : 1.0f;
+            MemoryPressure pressure = pressureLevel(fraction);
+            if (pressure < previous) {
+                pressure = std::min(previous, pressureLevel(fraction + MEMORY_PRESSURE_HYSTERESIS));
+            }
+
+            // A failed allocation holds the heap at Critical until memory has actually been given back.
+            if (allocationFailed[heap]) {
+                if (failureUsage[heap] == 0) {
+                    failureUsage[heap] = std::max<VkDeviceSize>(usage, 1);
+                } else if (static_cast<double>(usage) <= static_cast<double>(failureUsage[heap]) * (1.0 - MEMORY_FAILURE_RELEASE)) {
+                    allocationFailed[heap] = false;
+                    failureUsage[heap] = 0;
+                }
+            }
+            if (allocationFailed[heap]) {
+                pressure = MemoryPressure::Critical;
+            }
+            stats.pressure = pressure;
+
+            if (stats.pressure != previous) {
+                changedStats[changedCount] = stats;
+                changedHeaps[changedCount++] = heap;
+            }
+        }
+    }
+
+    // Outside the lock, callbacks are expected to free memory.
+    for (uint32_t i = 0; i < changedCount; i++) {
+        for (const auto& callback : callbacks) {
+            callback(changedHeaps[i], changedStats[i]);
+        }
+    }
+}
+
+MemoryHeapStats GpuMemoryTracker::stats(uint32_t heap) const {
+    std::lock_guard<std::mutex> lock(allocationMutex);
+    return snapshot[heap];
+}
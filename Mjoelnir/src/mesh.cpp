@@ -0,0 +1,723 @@
+#include "mesh.hpp"
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+static const uint32_t NO_VERTEX = UINT32_MAX;
+
+struct TriangleAdjacency {
+    // Triangles using vertex v are triangles[offsets[v]] to triangles[offsets[v] + counts[v]].
+    std::vector<uint32_t> counts;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> triangles;
+};
+
+static void buildAdjacency(TriangleAdjacency& adjacency, const uint32_t* indices, size_t indexCount, size_t vertexCount) {
+    adjacency.counts.assign(vertexCount, 0);
+    adjacency.offsets.assign(vertexCount, 0);
+    adjacency.triangles.resize(indexCount);
+
+    for (size_t i = 0; i < indexCount; i++) {
+        adjacency.counts[indices[i]]++;
+    }
+
+    uint32_t offset = 0;
+    for (size_t v = 0; v < vertexCount; v++) {
+        adjacency.offsets[v] = offset;
+        offset += adjacency.counts[v];
+    }
+
+    std::vector<uint32_t> cursor = adjacency.offsets;
+    for (size_t i = 0; i < indexCount; i++) {
+        adjacency.triangles[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+}
+
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>* clusters) {
+    if (clusters != nullptr) {
+        clusters->clear();
+    }
+
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    TriangleAdjacency adjacency;
+    buildAdjacency(adjacency, indices, indexCount, vertexCount);
+
+    // Triangles not emitted yet per vertex.
+    std::vector<uint32_t> liveTriangles = adjacency.counts;
+    std::vector<uint32_t> cacheTime(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> deadEnd;
+    std::vector<uint32_t> candidates;
+
+    std::vector<uint32_t> result;
+    result.reserve(indexCount);
+
+    uint32_t time = VERTEX_CACHE_SIZE + 1;
+    uint32_t cursor = 0;
+    uint32_t fanning = 0;
+    while (fanning < vertexCount && liveTriangles[fanning] == 0) {
+        fanning++;
+    }
+
+    if (clusters != nullptr) {
+        clusters->push_back(0);
+    }
+
+    while (fanning != NO_VERTEX && fanning < vertexCount) {
+        candidates.clear();
+
+        // Emit every remaining triangle around the fanning vertex.
+        uint32_t begin = adjacency.offsets[fanning];
+        for (uint32_t i = begin; i < begin + adjacency.counts[fanning]; i++) {
+            uint32_t triangle = adjacency.triangles[i];
+            if (emitted[triangle]) {
+                continue;
+            }
+
+            for (uint32_t corner = 0; corner < 3; corner++) {
+                uint32_t vertex = indices[triangle * 3 + corner];
+                result.push_back(vertex);
+                deadEnd.push_back(vertex);
+                candidates.push_back(vertex);
+                liveTriangles[vertex]--;
+
+                if (time - cacheTime[vertex] > VERTEX_CACHE_SIZE) {
+                    cacheTime[vertex] = time;
+                    time++;
+                }
+            }
+
+            emitted[triangle] = true;
+        }
+
+        // Next fanning vertex: the candidate that stays in the cache the longest while we fan around it.
+        uint32_t next = NO_VERTEX;
+        int32_t bestPriority = -1;
+        for (uint32_t vertex : candidates) {
+            if (liveTriangles[vertex] == 0) {
+                continue;
+            }
+
+            int32_t priority = 0;
+            if (time - cacheTime[vertex] + 2 * liveTriangles[vertex] <= VERTEX_CACHE_SIZE) {
+                priority = static_cast<int32_t>(time - cacheTime[vertex]);
+            }
+
+            if (priority > bestPriority) {
+                bestPriority = priority;
+                next = vertex;
+            }
+        }
+
+        if (next == NO_VERTEX) {
+            // Dead end, go back through recently used vertices and then fall back to the first unused one.
+            while (!deadEnd.empty() && next == NO_VERTEX) {
+                uint32_t vertex = deadEnd.back();
+                deadEnd.pop_back();
+                if (liveTriangles[vertex] > 0) {
+                    next = vertex;
+                }
+            }
+
+            while (next == NO_VERTEX && cursor < vertexCount) {
+                if (liveTriangles[cursor] > 0) {
+                    next = cursor;
+                }
+                cursor++;
+            }
+
+            // Whatever is in the cache by now is of little use to what comes next.
+            if (clusters != nullptr && next != NO_VERTEX && result.size() < indexCount) {
+                clusters->push_back(static_cast<uint32_t>(result.size()));
+            }
+        }
+
+        fanning = next;
+    }
+
+    std::copy(result.begin(), result.end(), indices);
+}
+
+void optimizeOverdraw(uint32_t* indices, size_t indexCount, const MeshVertex* vertices, const std::vector<uint32_t>& clusters) {
+    if (clusters.size() < 2) {
+        return;
+    }
+
+    struct ClusterSort {
+        uint32_t begin;
+        uint32_t end;
+        float key;
+    };
+
+    glm::vec3 meshCenter(0.0f);
+    float meshArea = 0.0f;
+
+    std::vector<ClusterSort> sorted(clusters.size());
+    std::vector<glm::vec3> centers(clusters.size());
+    std::vector<glm::vec3> normals(clusters.size());
+
+    for (size_t cluster = 0; cluster < clusters.size(); cluster++) {
+        uint32_t begin = clusters[cluster];
+        uint32_t end = cluster + 1 < clusters.size() ? clusters[cluster + 1] : static_cast<uint32_t>(indexCount);
+
+        glm::vec3 center(0.0f);
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+        for (uint32_t i = begin; i < end; i += 3) {
+            glm::vec3 a = vertices[indices[i]].position;
+            glm::vec3 b = vertices[indices[i + 1]].position;
+            glm::vec3 c = vertices[indices[i + 2]].position;
+
+            // Twice the area, it's only used as a weight.
+            glm::vec3 n = glm::cross(b - a, c - a);
+            float triangleArea = glm::length(n);
+
+            center += (a + b + c) * (triangleArea / 3.0f);
+            normal += n;
+            area += triangleArea;
+        }
+
+        meshCenter += center;
+        meshArea += area;
+
+        centers[cluster] = area > 0.0f ? center / area : center;
+        normals[cluster] = normal;
+        sorted[cluster] = {begin, end, 0.0f};
+    }
+
+    if (meshArea > 0.0f) {
+        meshCenter = meshCenter / meshArea;
+    }
+
+    for (size_t cluster = 0; cluster < clusters.size(); cluster++) {
+        float length = glm::length(normals[cluster]);
+        sorted[cluster].key = length > 0.0f ? glm::dot(centers[cluster] - meshCenter, normals[cluster] / length) : 0.0f;
+    }
+
+    std::stable_sort(sorted.begin(), sorted.end(), [](const ClusterSort& a, const ClusterSort& b) {
+        return a.key > b.key;
+    });
+
+    std::vector<uint32_t> result;
+    result.reserve(indexCount);
+    for (const ClusterSort& cluster : sorted) {
+        result.insert(result.end(), indices + cluster.begin, indices + cluster.end);
+    }
+
+    std::copy(result.begin(), result.end(), indices);
+}
+
+size_t optimizeVertexFetch(MeshVertex* destination, uint32_t* indices, size_t indexCount, const MeshVertex* vertices, size_t vertexCount) {
+    std::vector<uint32_t> remap(vertexCount, NO_VERTEX);
+    uint32_t next = 0;
+
+    for (size_t i = 0; i < indexCount; i++) {
+        uint32_t& target = remap[indices[i]];
+        if (target == NO_VERTEX) {
+            destination[next] = vertices[indices[i]];
+            target = next++;
+        }
+        indices[i] = target;
+    }
+
+    return next;
+}
+
+float vertexCacheMissRatio(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize) {
+    if (indexCount < 3) {
+        return 0.0f;
+    }
+
+    // Timestamp at which each vertex entered the FIFO, it's still in there while within cacheSize misses.
+    std::vector<uint32_t> entered(vertexCount, 0);
+    uint32_t misses = 0;
+
+    for (size_t i = 0; i < indexCount; i++) {
+        uint32_t vertex = indices[i];
+        if (entered[vertex] == 0 || misses + 1 - entered[vertex] > cacheSize) {
+            misses++;
+            entered[vertex] = misses;
+        }
+    }
+
+    return static_cast<float>(misses) / static_cast<float>(indexCount / 3);
+}
+
+MeshQuantization computeQuantization(const Bounds& bounds) {
+    glm::vec3 extent = bounds.max - bounds.min;
+
+    MeshQuantization quantization;
+    quantization.offset = glm::vec4(bounds.min, 0.0f);
+    // Flat meshes still need a scale, whatever ends up in that axis is 0 anyway.
+    quantization.scale = glm::vec4(
+        extent.x > 0.0f ? extent.x : 1.0f,
+        extent.y > 0.0f ? extent.y : 1.0f,
+        extent.z > 0.0f ? extent.z : 1.0f,
+        1.0f
+    );
+
+    return quantization;
+}
+
+static int16_t packSnorm(float value) {
+    return static_cast<int16_t>(glm::packSnorm1x16(value));
+}
+
+PackedVertex quantizeVertex(const MeshVertex& vertex, const Bounds& bounds) {
+    MeshQuantization quantization = computeQuantization(bounds);
+
+    PackedVertex packed;
+    for (int axis = 0; axis < 3; axis++) {
+        packed.position[axis] = glm::packUnorm1x16((vertex.position[axis] - quantization.offset[axis]) / quantization.scale[axis]);
+    }
+    packed.position[3] = 0;
+
+    // Project onto the octahedron and fold the lower half over the upper one.
+    glm::vec3 n = vertex.normal;
+    float sum = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    float x = sum > 0.0f ? n.x / sum : 0.0f;
+    float y = sum > 0.0f ? n.y / sum : 0.0f;
+    if (n.z < 0.0f) {
+        float foldedX = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float foldedY = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+    packed.normal[0] = packSnorm(x);
+    packed.normal[1] = packSnorm(y);
+
+    packed.uv[0] = glm::packHalf1x16(vertex.uv.x);
+    packed.uv[1] = glm::packHalf1x16(vertex.uv.y);
+
+    return packed;
+}
+
+std::vector<uint8_t> encodeIndexBuffer(const uint32_t* indices, size_t indexCount) {
+    std::vector<uint8_t> data;
+    data.reserve(indexCount * 2);
+
+    uint32_t previous = 0;
+    for (size_t i = 0; i < indexCount; i++) {
+        // Zigzag so small negative steps stay small too.
+        int32_t delta = static_cast<int32_t>(indices[i] - previous);
+        uint32_t value = (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31);
+        previous = indices[i];
+
+        while (value >= 0x80) {
+            data.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        data.push_back(static_cast<uint8_t>(value));
+    }
+
+    return data;
+}
+
+bool decodeIndexBuffer(const uint8_t* data, size_t size, uint32_t* indices, size_t indexCount) {
+    size_t position = 0;
+    uint32_t previous = 0;
+
+    for (size_t i = 0; i < indexCount; i++) {
+        uint32_t value = 0;
+        uint32_t shift = 0;
+        while (true) {
+            if (position >= size || shift > 28) {
+                return false;
+            }
+
+            uint8_t byte = data[position++];
+            value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+            shift += 7;
+            if ((byte & 0x80) == 0) {
+                break;
+            }
+        }
+
+        int32_t delta = static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+        previous += static_cast<uint32_t>(delta);
+        indices[i] = previous;
+    }
+
+    return position == size;
+}
+
+// Symmetric 4x4 matrix of a sum of squared plane distances, weighted by area.
+struct Quadric {
+    float a2, b2, c2, d2;
+    float ab, ac, ad;
+    float bc, bd, cd;
+    float weight;
+};
+
+static void addPlane(Quadric& quadric, const glm::vec3& normal, float d, float weight) {
+    quadric.a2 += normal.x * normal.x * weight;
+    quadric.b2 += normal.y * normal.y * weight;
+    quadric.c2 += normal.z * normal.z * weight;
+    quadric.d2 += d * d * weight;
+    quadric.ab += normal.x * normal.y * weight;
+    quadric.ac += normal.x * normal.z * weight;
+    quadric.ad += normal.x * d * weight;
+    quadric.bc += normal.y * normal.z * weight;
+    quadric.bd += normal.y * d * weight;
+    quadric.cd += normal.z * d * weight;
+    quadric.weight += weight;
+}
+
+static void addQuadric(Quadric& quadric, const Quadric& other) {
+    quadric.a2 += other.a2;
+    quadric.b2 += other.b2;
+    quadric.c2 += other.c2;
+    quadric.d2 += other.d2;
+    quadric.ab += other.ab;
+    quadric.ac += other.ac;
+    quadric.ad += other.ad;
+    quadric.bc += other.bc;
+    quadric.bd += other.bd;
+    quadric.cd += other.cd;
+    quadric.weight += other.weight;
+}
+
+// Weighted sum of squared distances from p to the quadric's planes.
+static float quadricError(const Quadric& q, const glm::vec3& p) {
+    float rx = q.a2 * p.x + q.ab * p.y + q.ac * p.z + q.ad;
+    float ry = q.ab * p.x + q.b2 * p.y + q.bc * p.z + q.bd;
+    float rz = q.ac * p.x + q.bc * p.y + q.c2 * p.z + q.cd;
+    float rw = q.ad * p.x + q.bd * p.y + q.cd * p.z + q.d2;
+
+    float error = rx * p.x + ry * p.y + rz * p.z + rw;
+    return error > 0.0f ? error : 0.0f;
+}
+
+// Moving vertex from onto to must not turn any of from's remaining triangles around.
+static bool collapseFlips(const TriangleAdjacency& adjacency, const std::vector<uint32_t>& indices, const MeshVertex* vertices, uint32_t from, uint32_t to) {
+    uint32_t begin = adjacency.offsets[from];
+    for (uint32_t i = begin; i < begin + adjacency.counts[from]; i++) {
+        const uint32_t* triangle = &indices[adjacency.triangles[i] * 3];
+        if (triangle[0] == to || triangle[1] == to || triangle[2] == to) {
+            // Degenerates and goes away.
+            continue;
+        }
+
+        glm::vec3 before[3];
+        glm::vec3 after[3];
+        for (uint32_t corner = 0; corner < 3; corner++) {
+            before[corner] = vertices[triangle[corner]].position;
+            after[corner] = triangle[corner] == from ? vertices[to].position : before[corner];
+        }
+
+        glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+        glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+        if (glm::dot(normalBefore, normalAfter) <= 0.0f) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+size_t simplifyMesh(uint32_t* destination, const uint32_t* indices, size_t indexCount, const MeshVertex* vertices, size_t vertexCount, size_t targetIndexCount, float* error) {
+    struct Collapse {
+        uint32_t from;
+        uint32_t to;
+        float cost;
+    };
+
+    std::vector<uint32_t> current(indices, indices + indexCount);
+    std::vector<bool> locked(vertexCount, false);
+    float maxError = 0.0f;
+
+    // Vertices sharing a position are seams (UVs or normals differ), collapsing them would tear the mesh open.
+    std::vector<uint32_t> byPosition(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; v++) {
+        byPosition[v] = v;
+    }
+    auto positionLess = [vertices](uint32_t a, uint32_t b) {
+        const glm::vec3& pa = vertices[a].position;
+        const glm::vec3& pb = vertices[b].position;
+        if (pa.x != pb.x) {
+            return pa.x < pb.x;
+        }
+        if (pa.y != pb.y) {
+            return pa.y < pb.y;
+        }
+        return pa.z < pb.z;
+    };
+    std::sort(byPosition.begin(), byPosition.end(), positionLess);
+    for (size_t i = 1; i < vertexCount; i++) {
+        if (!positionLess(byPosition[i - 1], byPosition[i])) {
+            locked[byPosition[i - 1]] = true;
+            locked[byPosition[i]] = true;
+        }
+    }
+
+    // Same for open borders, an edge used by a single triangle.
+    std::vector<uint64_t> edges;
+    edges.reserve(indexCount);
+    for (size_t i = 0; i < indexCount; i += 3) {
+        for (uint32_t corner = 0; corner < 3; corner++) {
+            uint32_t a = current[i + corner];
+            uint32_t b = current[i + (corner + 1) % 3];
+            edges.push_back(a < b ? (static_cast<uint64_t>(a) << 32) | b : (static_cast<uint64_t>(b) << 32) | a);
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    for (size_t i = 0; i < edges.size(); ) {
+        size_t end = i;
+        while (end < edges.size() && edges[end] == edges[i]) {
+            end++;
+        }
+        if (end - i == 1) {
+            locked[edges[i] >> 32] = true;
+            locked[edges[i] & UINT32_MAX] = true;
+        }
+        i = end;
+    }
+
+    std::vector<Quadric> quadrics(vertexCount, Quadric{});
+    for (size_t i = 0; i < indexCount; i += 3) {
+        glm::vec3 a = vertices[current[i]].position;
+        glm::vec3 b = vertices[current[i + 1]].position;
+        glm::vec3 c = vertices[current[i + 2]].position;
+
+        glm::vec3 normal = glm::cross(b - a, c - a);
+        float area = glm::length(normal);
+        if (area == 0.0f) {
+            continue;
+        }
+        normal = normal / area;
+
+        for (uint32_t corner = 0; corner < 3; corner++) {
+            addPlane(quadrics[current[i + corner]], normal, -glm::dot(normal, a), area);
+        }
+    }
+
+    TriangleAdjacency adjacency;
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<bool> touched(vertexCount);
+
+    while (current.size() > targetIndexCount) {
+        buildAdjacency(adjacency, current.data(), current.size(), vertexCount);
+
+        // Cheapest direction of every edge, each edge shows up once per triangle using it.
+        collapses.clear();
+        for (size_t i = 0; i < current.size(); i += 3) {
+            for (uint32_t corner = 0; corner < 3; corner++) {
+                uint32_t a = current[i + corner];
+                uint32_t b = current[i + (corner + 1) % 3];
+                if (a > b) {
+                    // The other triangle on this edge lists it the other way round.
+                    continue;
+                }
+
+                Quadric combined = quadrics[a];
+                addQuadric(combined, quadrics[b]);
+                float weight = combined.weight > 0.0f ? combined.weight : 1.0f;
+
+                float costAB = locked[a] ? INFINITY : quadricError(combined, vertices[b].position) / weight;
+                float costBA = locked[b] ? INFINITY : quadricError(combined, vertices[a].position) / weight;
+                if (costAB == INFINITY && costBA == INFINITY) {
+                    continue;
+                }
+
+                collapses.push_back(costAB <= costBA ? Collapse{a, b, costAB} : Collapse{b, a, costBA});
+            }
+        }
+
+        if (collapses.empty()) {
+            break;
+        }
+
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) {
+            return x.cost < y.cost;
+        });
+
+        for (uint32_t v = 0; v < vertexCount; v++) {
+            remap[v] = v;
+        }
+        std::fill(touched.begin(), touched.end(), false);
+
+        // Every collapse removes about two triangles, stop once the target would be reached.
+        size_t trianglesToRemove = (current.size() - targetIndexCount) / 3;
+        size_t performed = 0;
+        for (const Collapse& collapse : collapses) {
+            if (performed * 2 >= trianglesToRemove) {
+                break;
+            }
+            if (touched[collapse.from] || touched[collapse.to]) {
+                continue;
+            }
+            if (collapseFlips(adjacency, current, vertices, collapse.from, collapse.to)) {
+                continue;
+            }
+
+            remap[collapse.from] = collapse.to;
+            addQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+
+            // The flip test reads current, which doesn't know about this pass's collapses. Locking
+            // the whole ring of from keeps a later collapse from testing its triangles with a
+            // corner that has already moved.
+            uint32_t begin = adjacency.offsets[collapse.from];
+            for (uint32_t t = begin; t < begin + adjacency.counts[collapse.from]; t++) {
+                const uint32_t* triangle = &current[adjacency.triangles[t] * 3];
+                touched[triangle[0]] = true;
+                touched[triangle[1]] = true;
+                touched[triangle[2]] = true;
+            }
+            touched[collapse.to] = true;
+
+            if (collapse.cost > maxError) {
+                maxError = collapse.cost;
+            }
+            performed++;
+        }
+
+        if (performed == 0) {
+            break;
+        }
+
+        size_t write = 0;
+        for (size_t i = 0; i < current.size(); i += 3) {
+            uint32_t a = remap[current[i]];
+            uint32_t b = remap[current[i + 1]];
+            uint32_t c = remap[current[i + 2]];
+            if (a != b && b != c && a != c) {
+                current[write++] = a;
+                current[write++] = b;
+                current[write++] = c;
+            }
+        }
+        current.resize(write);
+    }
+
+    std::copy(current.begin(), current.end(), destination);
+    if (error != nullptr) {
+        *error = std::sqrt(maxError);
+    }
+
+    return current.size();
+}
+
+uint32_t selectLod(const std::vector<MeshLod>& lods, float errorScale, float maxPixelError) {
+    uint32_t selected = 0;
+    for (uint32_t lod = 1; lod < lods.size(); lod++) {
+        if (lods[lod].error * errorScale > maxPixelError) {
+            break;
+        }
+        selected = lod;
+    }
+
+    return selected;
+}
+
+ProcessedMesh processMesh(const MeshVertex* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount) {
+    ProcessedMesh mesh;
+    mesh.stats.sourceVertexBytes = vertexCount * sizeof(MeshVertex);
+    mesh.stats.sourceIndexBytes = indexCount * sizeof(uint32_t);
+    mesh.stats.acmrBefore = vertexCacheMissRatio(indices, indexCount, vertexCount, VERTEX_CACHE_SIZE);
+
+    // Every LOD is simplified from the previous one and optimized on its own, then they all go
+    // into one index buffer.
+    std::vector<uint32_t> lodIndices(indices, indices + indexCount);
+    std::vector<uint32_t> allIndices;
+    std::vector<uint32_t> simplified(indexCount);
+    std::vector<uint32_t> clusters;
+    float lodError = 0.0f;
+
+    for (uint32_t lod = 0; lod < MESH_MAX_LODS; lod++) {
+        if (lod > 0) {
+            size_t target = static_cast<size_t>(static_cast<float>(lodIndices.size() / 3) * MESH_LOD_REDUCTION) * 3;
+            float error = 0.0f;
+            size_t count = simplifyMesh(simplified.data(), lodIndices.data(), lodIndices.size(), vertices, vertexCount, target, &error);
+            if (count == 0 || static_cast<float>(count) > static_cast<float>(lodIndices.size()) * MESH_LOD_MIN_REDUCTION) {
+                break;
+            }
+
+            lodIndices.assign(simplified.begin(), simplified.begin() + count);
+            // Errors of consecutive simplifications add up at worst.
+            lodError += error;
+        }
+
+        optimizeVertexCache(lodIndices.data(), lodIndices.size(), vertexCount, &clusters);
+        optimizeOverdraw(lodIndices.data(), lodIndices.size(), vertices, clusters);
+
+        mesh.lods.push_back({static_cast<uint32_t>(allIndices.size()), static_cast<uint32_t>(lodIndices.size()), lodError});
+        allIndices.insert(allIndices.end(), lodIndices.begin(), lodIndices.end());
+    }
+
+    // The finest LOD comes first, so vertices end up in the order it uses them.
+    size_t totalIndices = allIndices.size();
+    std::vector<MeshVertex> optimizedVertices(vertexCount);
+    size_t usedVertices = optimizeVertexFetch(optimizedVertices.data(), allIndices.data(), totalIndices, vertices, vertexCount);
+    optimizedVertices.resize(usedVertices);
+
+    mesh.stats.acmrAfter = vertexCacheMissRatio(allIndices.data(), indexCount, usedVertices, VERTEX_CACHE_SIZE);
+
+    mesh.bounds.min = glm::vec3(INFINITY);
+    mesh.bounds.max = glm::vec3(-INFINITY);
+    for (const MeshVertex& vertex : optimizedVertices) {
+        mesh.bounds.min = glm::min(mesh.bounds.min, vertex.position);
+        mesh.bounds.max = glm::max(mesh.bounds.max, vertex.position);
+    }
+    if (optimizedVertices.empty()) {
+        mesh.bounds.min = glm::vec3(0.0f);
+        mesh.bounds.max = glm::vec3(0.0f);
+    }
+
+    mesh.quantization = computeQuantization(mesh.bounds);
+    mesh.vertices.resize(usedVertices);
+    for (size_t i = 0; i < usedVertices; i++) {
+        mesh.vertices[i] = quantizeVertex(optimizedVertices[i], mesh.bounds);
+    }
+
+    mesh.indexCount = static_cast<uint32_t>(totalIndices);
+    if (usedVertices <= UINT16_MAX) {
+        mesh.indexType = VK_INDEX_TYPE_UINT16;
+        mesh.indices.resize(totalIndices * sizeof(uint16_t));
+        uint16_t* shortIndices = reinterpret_cast<uint16_t*>(mesh.indices.data());
+        for (size_t i = 0; i < totalIndices; i++) {
+            shortIndices[i] = static_cast<uint16_t>(allIndices[i]);
+        }
+    } else {
+        mesh.indexType = VK_INDEX_TYPE_UINT32;
+        mesh.indices.resize(totalIndices * sizeof(uint32_t));
+        std::copy(allIndices.begin(), allIndices.end(), reinterpret_cast<uint32_t*>(mesh.indices.data()));
+    }
+
+    mesh.stats.packedVertexBytes = mesh.vertices.size() * sizeof(PackedVertex);
+    mesh.stats.packedIndexBytes = mesh.indices.size();
+    mesh.stats.compressedIndexBytes = encodeIndexBuffer(allIndices.data(), totalIndices).size();
+
+    return mesh;
+}
+
+VkVertexInputBindingDescription packedVertexBinding(uint32_t binding) {
+    VkVertexInputBindingDescription description{};
+    description.binding = binding;
+    description.stride = sizeof(PackedVertex);
+    description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    return description;
+}
+
+void packedVertexAttributes(uint32_t binding, uint32_t firstLocation, VkVertexInputAttributeDescription* attributes) {
+    attributes[0].binding = binding;
+    attributes[0].location = firstLocation;
+    attributes[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+    attributes[0].offset = offsetof(PackedVertex, position);
+
+    attributes[1].binding = binding;
+    attributes[1].location = firstLocation + 1;
+    attributes[1].format = VK_FORMAT_R16G16_SNORM;
+    attributes[1].offset = offsetof(PackedVertex, normal);
+
+    attributes[2].binding = binding;
+    attributes[2].location = firstLocation + 2;
+    attributes[2].format = VK_FORMAT_R16G16_SFLOAT;
+    attributes[2].offset = offsetof(PackedVertex, uv);
+}
@@ -4,18 +4,66 @@
 #include <set>
 #include <limits>
 #include <algorithm>
+#include <chrono>
 
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
 
 const int MAX_FRAMES_IN_FLIGHT = 2;
 
+const uint32_t INITIAL_INSTANCE_CAPACITY = 1024;
+
+// Upper bound on deferred destructions per frame, the rest waits for the next one.
+const uint32_t MAX_DELETIONS_PER_FRAME = 32;
+
+// Viewport and scissor, the dynamic states every pipeline has. createPipeline() lists them first.
+const uint32_t BASE_DYNAMIC_STATE_COUNT = 2;
+
+// Frames a retired swap chain outlives the frame that retired it, see retireSwapChain().
+const uint64_t SWAP_CHAIN_RETIRE_FRAMES = 1;
+
+// The GPU and CPU clocks drift apart, so the offset between them is measured again every so often.
+const uint32_t GPU_CLOCK_CALIBRATION_INTERVAL = 512;
+
+// A coarser LOD is used as long as its simplification error stays below this many pixels on screen.
+const float LOD_PIXEL_ERROR = 1.0f;
+
+// Longest step the particle simulation takes, a hitch shouldn't turn into one huge burst.
+const float MAX_PARTICLE_DELTA_TIME = 0.1f;
+
+// How often the render thread checks whether a minimized window got its framebuffer back.
+const std::chrono::milliseconds MINIMIZED_POLL_INTERVAL(10);
+
 #ifndef NDEBUG
     const bool enableValidationLayers = true;
 #else
     const bool enableValidationLayers = false;
 #endif
 
+#ifdef MJOELNIR_PROFILE
+    const bool enableProfiling = true;
+#else
+    const bool enableProfiling = false;
+#endif
+
+#ifdef MJOELNIR_TRACK_HOST_ALLOCATIONS
+    const bool enableHostAllocationTracking = true;
+#else
+    const bool enableHostAllocationTracking = false;
+#endif
+
+#ifdef MJOELNIR_PARTICLE_BENCHMARK
+    const bool enableParticleBenchmark = true;
+#else
+    const bool enableParticleBenchmark = false;
+#endif
+
+#ifdef MJOELNIR_NO_ASYNC_COMPUTE
+    const bool enableAsyncCompute = false;
+#else
+    const bool enableAsyncCompute = true;
+#endif
+
 std::vector<const char*> validationLayers = {
     "VK_LAYER_KHRONOS_validation",
 };
@@ -64,24 +112,67 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
             objectCount: Number of objects in array
      */
 
+    // Runs on whatever thread made the Vulkan call, so only hand the message over to the logger here.
+    Logger* logger = static_cast<Logger*>(pUserData);
+
+    LogSeverity severity = LogSeverity::Verbose;
     if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
-        std::cerr << "\033[1m\033[38;5;9m";
+        severity = LogSeverity::Error;
     } else if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
-        std::cerr << "\033[1m\033[38;5;11m";
+        severity = LogSeverity::Warning;
     } else if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT) {
-        std::cerr << "\033[2m\033[38;5;45m";
-    } else if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT) {
-        std::cerr << "\033[2m";
+        severity = LogSeverity::Info;
     }
 
+    LogCategory category = LogCategory::General;
+    if (messageType & VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT) {
+        category = LogCategory::Validation;
+    } else if (messageType & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT) {
+        category = LogCategory::Performance;
+    }
 
-    std::cerr << "Validation layer: " << pCallbackData->pMessage << std::endl;
-
-    std::cerr << "\033[0m";
+    logger->logMessage(severity, category, pCallbackData->messageIdNumber, pCallbackData->pMessage);
 
     return VK_FALSE;
 }
 
+// Picks the host time domain to calibrate against, false if the device can't be calibrated at all.
+// CLOCK_MONOTONIC is what steady_clock reads on Linux, so it is preferred.
+static bool chooseHostTimeDomain(VkInstance instance, VkPhysicalDevice physicalDevice, VkTimeDomainEXT& hostDomain) {
+    auto getTimeDomains = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT) vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+    if (getTimeDomains == nullptr) {
+        return false;
+    }
+
+    uint32_t domainCount = 0;
+    getTimeDomains(physicalDevice, &domainCount, nullptr);
+    std::vector<VkTimeDomainEXT> domains(domainCount);
+    if (getTimeDomains(physicalDevice, &domainCount, domains.data()) != VK_SUCCESS) {
+        return false;
+    }
+
+    auto supported = [&](VkTimeDomainEXT domain) {
+        return std::find(domains.begin(), domains.end(), domain) != domains.end();
+    };
+    if (!supported(VK_TIME_DOMAIN_DEVICE_EXT)) {
+        return false;
+    }
+
+    const VkTimeDomainEXT preferred[] = {
+        VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT,
+        VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT,
+        VK_TIME_DOMAIN_CLOCK_MONOTONIC_RAW_EXT,
+    };
+    for (VkTimeDomainEXT domain : preferred) {
+        if (supported(domain)) {
+            hostDomain = domain;
+            return true;
+        }
+    }
+
+    return false;
+}
+
 static std::vector<char> readFile(const std::string& fileName) {
   std::ifstream file(fileName, std::ios::ate | std::ios::binary);
 
@@ -100,6 +191,11 @@ static std::vector<char> readFile(const std::string& fileName) {
   return buffer;
 }
 
+static ShaderReflection reflectShaderFile(const char* path) {
+  std::vector<char> code = readFile(path);
+  return reflectShader(reinterpret_cast<const uint32_t*>(code.data()), code.size() / sizeof(uint32_t));
+}
+
 // uint32_t* readFileBinary(const char* filename, size_t* file_size) {
 //     FILE* file_ptr = fopen(filename, "rb");
 //     if (!file_ptr) {
@@ -181,7 +277,8 @@ bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
 }
 
 void populateDebugMessengerCreateInfo(
-    VkDebugUtilsMessengerCreateInfoEXT& createInfo
+    VkDebugUtilsMessengerCreateInfoEXT& createInfo,
+    Logger* logger
 ) {
   createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
@@ -189,7 +286,7 @@ void populateDebugMessengerCreateInfo(
   // createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
   createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
   createInfo.pfnUserCallback = debugCallback;
-  createInfo.pUserData = nullptr;
+  createInfo.pUserData = logger;
 }
 
 VkResult CreateDebugUtilsMessengerEXT(
@@ -270,7 +367,7 @@ VkShaderModule Mjoelnir::createShaderModule(const std::vector<char>& code) {
   createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
 
   VkShaderModule shaderModule;
-  if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+  if (vkCreateShaderModule(device, &createInfo, allocationCallbacks, &shaderModule) != VK_SUCCESS) {
       throw std::runtime_error("Unable to create shader module");
   }
 
@@ -278,12 +375,7 @@ VkShaderModule Mjoelnir::createShaderModule(const std::vector<char>& code) {
 }
 
 void Mjoelnir::initWindow() {
-  #ifndef NDEBUG
-      printf("\033[38;5;9m[[ DEBUG ]]\033[0m\n");
-  #else
-      printf("\033[38;5;9m[[ RELEASE ]]\033[0m\n");
-  #endif
-  glfwInit();
+  PROFILE_ZONE("initWindow");
 
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
   glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
@@ -291,39 +383,249 @@ void Mjoelnir::initWindow() {
   window = glfwCreateWindow(WIDTH, HEIGHT, "Mjoelnir", nullptr, nullptr);
   glfwSetWindowUserPointer(window, this);
   glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+  glfwSetKeyCallback(window, keyCallback);
+  glfwSetMouseButtonCallback(window, mouseButtonCallback);
+  glfwSetCursorPosCallback(window, cursorPositionCallback);
+  glfwSetScrollCallback(window, scrollCallback);
+  glfwSetWindowFocusCallback(window, windowFocusCallback);
+
+  // GLFW may only be asked on the main thread, the render thread reads the size from here.
+  int width, height;
+  glfwGetFramebufferSize(window, &width, &height);
+  framebufferSize.store(packFramebufferSize(width, height), std::memory_order_release);
+
+  // The other windows only differ in what their framebuffer size goes to, see framebufferResizeCallback().
+  for (auto& viewport : viewportWindows) {
+      viewport->window = glfwCreateWindow(viewport->width, viewport->height, viewport->title.c_str(), nullptr, nullptr);
+      glfwSetWindowUserPointer(viewport->window, this);
+      glfwSetFramebufferSizeCallback(viewport->window, framebufferResizeCallback);
+      glfwSetKeyCallback(viewport->window, keyCallback);
+      glfwSetMouseButtonCallback(viewport->window, mouseButtonCallback);
+      glfwSetCursorPosCallback(viewport->window, cursorPositionCallback);
+      glfwSetScrollCallback(viewport->window, scrollCallback);
+      glfwSetWindowFocusCallback(viewport->window, windowFocusCallback);
+
+      glfwGetFramebufferSize(viewport->window, &width, &height);
+      viewport->framebufferSize.store(packFramebufferSize(width, height), std::memory_order_release);
+  }
+}
+
+uint32_t Mjoelnir::addWindow(const char* title, uint32_t width, uint32_t height) {
+  auto viewport = std::make_unique<ViewportWindow>();
+  viewport->title = title;
+  viewport->width = width;
+  viewport->height = height;
+  viewportWindows.push_back(std::move(viewport));
+
+  return static_cast<uint32_t>(viewportWindows.size());
+}
+
+void Mjoelnir::setWindowView(uint32_t window, float x, float y, float width, float height) {
+  if (window == 0 || window > viewportWindows.size()) {
+      throw std::runtime_error("Unable to set the view of a window that wasn't added");
+  }
+
+  viewportWindows[window - 1]->view.store(packWindowView(x, y, width, height), std::memory_order_relaxed);
 }
 
+// The window callbacks run on the main thread while it pumps events.
+
 void Mjoelnir::framebufferResizeCallback(GLFWwindow* window, int width, int height) {
   auto app = reinterpret_cast<Mjoelnir*>(glfwGetWindowUserPointer(window));
-  app->framebufferResized = true;
+  uint32_t index = app->windowIndex(window);
+  if (index == 0) {
+      app->framebufferSize.store(packFramebufferSize(width, height), std::memory_order_release);
+  } else {
+      app->viewportWindows[index - 1]->framebufferSize.store(packFramebufferSize(width, height), std::memory_order_release);
+  }
+
+  WindowEvent event{};
+  event.type = WindowEventType::FramebufferResize;
+  event.size.width = static_cast<uint32_t>(width);
+  event.size.height = static_cast<uint32_t>(height);
+  app->pushWindowEvent(window, event);
+}
+
+void Mjoelnir::keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+  WindowEvent event{};
+  event.type = WindowEventType::Key;
+  event.key.key = key;
+  event.key.scancode = scancode;
+  event.key.action = action;
+  event.key.mods = mods;
+  reinterpret_cast<Mjoelnir*>(glfwGetWindowUserPointer(window))->pushWindowEvent(window, event);
+}
+
+void Mjoelnir::mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
+  WindowEvent event{};
+  event.type = WindowEventType::MouseButton;
+  event.mouseButton.button = button;
+  event.mouseButton.action = action;
+  event.mouseButton.mods = mods;
+  reinterpret_cast<Mjoelnir*>(glfwGetWindowUserPointer(window))->pushWindowEvent(window, event);
+}
+
+void Mjoelnir::cursorPositionCallback(GLFWwindow* window, double x, double y) {
+  WindowEvent event{};
+  event.type = WindowEventType::CursorPosition;
+  event.position.x = x;
+  event.position.y = y;
+  reinterpret_cast<Mjoelnir*>(glfwGetWindowUserPointer(window))->pushWindowEvent(window, event);
+}
+
+void Mjoelnir::scrollCallback(GLFWwindow* window, double x, double y) {
+  WindowEvent event{};
+  event.type = WindowEventType::Scroll;
+  event.position.x = x;
+  event.position.y = y;
+  reinterpret_cast<Mjoelnir*>(glfwGetWindowUserPointer(window))->pushWindowEvent(window, event);
+}
+
+void Mjoelnir::windowFocusCallback(GLFWwindow* window, int focused) {
+  WindowEvent event{};
+  event.type = WindowEventType::Focus;
+  event.focused = focused == GLFW_TRUE;
+  reinterpret_cast<Mjoelnir*>(glfwGetWindowUserPointer(window))->pushWindowEvent(window, event);
+}
+
+uint32_t Mjoelnir::windowIndex(GLFWwindow* source) const {
+  for (uint32_t i = 0; i < viewportWindows.size(); i++) {
+      if (viewportWindows[i]->window == source) {
+          return i + 1;
+      }
+  }
+
+  return 0;
+}
+
+void Mjoelnir::pushWindowEvent(GLFWwindow* source, WindowEvent& event) {
+  event.timestamp = Profiler::now();
+  event.window = windowIndex(source);
+  windowEvents.push(event);
+}
+
+void Mjoelnir::dispatchWindowEvents() {
+  PROFILE_ZONE("dispatchWindowEvents");
+
+  // Everything up to now is handled, even without a callback, so the queue can't fill up.
+  WindowEvent event;
+  while (windowEvents.pop(event)) {
+      if (windowEventCallback) {
+          windowEventCallback(event);
+      }
+  }
 }
 
 void Mjoelnir::cleanup() {
+  retireDepthResources();
+  retireSceneTarget();
+
+  // The device is idle by now, anything still waiting on a frame to retire can go right away.
+  deletionQueue.flush();
+
   cleanupSwapChain();
 
-  vkDestroyPipeline(device, graphicsPipeline, nullptr);
-  vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-  vkDestroyRenderPass(device, renderPass, nullptr);
+  for (auto& viewport : viewportWindows) {
+      for (auto framebuffer : viewport->framebuffers) {
+          vkDestroyFramebuffer(device, framebuffer, allocationCallbacks);
+      }
+      for (auto imageView : viewport->imageViews) {
+          vkDestroyImageView(device, imageView, allocationCallbacks);
+      }
+      if (viewport->swapChain != VK_NULL_HANDLE) {
+          vkDestroySwapchainKHR(device, viewport->swapChain, allocationCallbacks);
+      }
+      for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+          vkDestroySemaphore(device, viewport->imageAvailableSemaphores[i], allocationCallbacks);
+          vkDestroySemaphore(device, viewport->renderFinishedSemaphores[i], allocationCallbacks);
+      }
+  }
+
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+      destroyInstanceBuffer(i);
+  }
+
+  for (GpuMesh& mesh : meshes) {
+      destroyMesh(mesh);
+  }
+
+  destroyParticles();
+  destroySprites();
+  destroyLights();
+
+  for (ReadbackSlot& slot : readbackSlots) {
+      destroyReadbackSlot(slot);
+  }
+
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+      destroyFrameLocalBuffer(occlusionInstanceBuffers[i]);
+      destroyFrameLocalBuffer(drawCommandBuffers[i]);
+      destroyFrameLocalBuffer(culledInstanceBuffers[i]);
+  }
+  vkDestroyBuffer(device, visibilityBuffer, allocationCallbacks);
+  memoryTracker.free(device, visibilityBufferMemory);
+
+  vkDestroyPipeline(device, occlusionCullPipeline, allocationCallbacks);
+  vkDestroyPipeline(device, depthReducePipeline, allocationCallbacks);
+  vkDestroySampler(device, depthPyramidSampler, allocationCallbacks);
+  vkDestroySampler(device, upscaleSampler, allocationCallbacks);
+
+  for (DescriptorAllocator& allocator : frameDescriptors) {
+      allocator.destroy();
+  }
+
+  reportPipelineCache();
+  for (VkPipeline pipeline : pipelineCache.release()) {
+      vkDestroyPipeline(device, pipeline, allocationCallbacks);
+  }
+  layoutCache.destroy();
+  vkDestroyRenderPass(device, renderPass, allocationCallbacks);
+  vkDestroyRenderPass(device, lateRenderPass, allocationCallbacks);
+  vkDestroyRenderPass(device, presentRenderPass, allocationCallbacks);
 
   for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-      vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-      vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
-      vkDestroyFence(device, inFlightFences[i], nullptr);
+      vkDestroySemaphore(device, imageAvailableSemaphores[i], allocationCallbacks);
+      vkDestroySemaphore(device, renderFinishedSemaphores[i], allocationCallbacks);
+      vkDestroyFence(device, inFlightFences[i], allocationCallbacks);
+  }
+
+  if (asyncComputeEnabled) {
+      vkDestroySemaphore(device, graphicsTimeline, allocationCallbacks);
+      vkDestroySemaphore(device, computeTimeline, allocationCallbacks);
+      vkDestroyCommandPool(device, computeCommandPool, allocationCallbacks);
+  }
+
+  if (timestampQueryPool != VK_NULL_HANDLE) {
+      vkDestroyQueryPool(device, timestampQueryPool, allocationCallbacks);
   }
 
-  vkDestroyCommandPool(device, commandPool, nullptr);
+  vkDestroyCommandPool(device, commandPool, allocationCallbacks);
 
-  vkDestroyDevice(device, nullptr);
+  vkDestroyDevice(device, allocationCallbacks);
 
   if (enableValidationLayers) {
-      DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+      DestroyDebugUtilsMessengerEXT(instance, debugMessenger, allocationCallbacks);
   }
 
-  vkDestroySurfaceKHR(instance, surface, nullptr);
-  vkDestroyInstance(instance, nullptr);
+  vkDestroySurfaceKHR(instance, surface, allocationCallbacks);
+  for (auto& viewport : viewportWindows) {
+      vkDestroySurfaceKHR(instance, viewport->surface, allocationCallbacks);
+  }
+  vkDestroyInstance(instance, allocationCallbacks);
 
+  for (auto& viewport : viewportWindows) {
+      glfwDestroyWindow(viewport->window);
+  }
   glfwDestroyWindow(window);
   glfwTerminate();
+
+  if (enableProfiling) {
+      Profiler::exportChromeTrace("mjoelnir.trace.json");
+  }
+
+  if (enableHostAllocationTracking) {
+      hostAllocator.report(logger);
+  }
 }
 
 void Mjoelnir::drawFrame() {
@@ -334,91 +636,193 @@ void Mjoelnir::drawFrame() {
   // Submit the recorded command buffer
   // Present the swap chain image
 
-  vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+  PROFILE_ZONE("drawFrame");
+
+  dispatchWindowEvents();
+  runSimulation();
+
+  // Sync point for the world, structural changes recorded during the last frame are applied here.
+  {
+      PROFILE_ZONE("World sync");
+      world.sync();
+  }
+  updateCamera();
+  extractRenderables();
+  extractLights();
+  cullRenderables();
+  selectLods();
+
+  uint64_t frameBegin = Profiler::now();
+  cpuFrameTime = lastFrameBegin > 0 ? frameBegin - lastFrameBegin : 0;
+  lastFrameBegin = frameBegin;
+  updateParticles(std::min(static_cast<float>(cpuFrameTime) / 1e9f, MAX_PARTICLE_DELTA_TIME));
+
+  {
+      PROFILE_ZONE("Wait for frame fence");
+      vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+  }
+  readGpuTimestamps(currentFrame);
+  deliverReadback(currentFrame);
+
+  // Nothing allocated from this frame's scratch memory or descriptor pools is in use anymore.
+  frameScratch[currentFrame].reset();
+  frameDescriptors[currentFrame].reset();
+
+  // This frame's fence was signaled by the frame submitted MAX_FRAMES_IN_FLIGHT frames ago, and
+  // everything before it has retired as well.
+  if (frameNumber >= MAX_FRAMES_IN_FLIGHT) {
+      PROFILE_ZONE("Deferred deletions");
+      deletionQueue.collect(frameNumber - MAX_FRAMES_IN_FLIGHT, MAX_DELETIONS_PER_FRAME);
+  }
+
+  memoryTracker.update();
 
   uint32_t imageIndex;
-  VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+  VkResult result;
+  {
+      PROFILE_ZONE("Acquire image");
+      result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+  }
   if (result == VK_ERROR_OUT_OF_DATE_KHR) {
     recreateSwapChain();
     return;
   } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
     throw std::runtime_error("Failed to acquire swapchain image");
   }
+  acquireViewportImages();
 
   vkResetFences(device, 1, &inFlightFences[currentFrame]);
 
+  updateRenderResolution();
+  updateMeshPipeline();
+  updateTransforms();
+  updateOcclusionBuffers();
+  updateSprites();
+  updateLights();
+
+  // The particle benchmark runs every count without the compute queue as well, to compare.
+  asyncComputeActive = asyncComputeEnabled && !(enableParticleBenchmark && particleBenchmark.running() && !particleBenchmark.asyncCompute());
+  frameAsyncCompute[currentFrame] = asyncComputeActive;
+  if (asyncComputeActive) {
+      submitAsyncCompute();
+  }
+
   vkResetCommandBuffer(commandBuffers[currentFrame], 0);
   recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
 
+  // Every window's image is drawn by the one command buffer, so one submit waits for all of them
+  // and one present hands them all over. The main window comes first.
+  frameSubmission.clear();
+  frameSubmission.present(swapChain, imageIndex, imageAvailableSemaphores[currentFrame], renderFinishedSemaphores[currentFrame]);
+  for (const auto& viewport : viewportWindows) {
+      if (viewport->acquired) {
+          frameSubmission.present(viewport->swapChain, viewport->imageIndex, viewport->imageAvailableSemaphores[currentFrame], viewport->renderFinishedSemaphores[currentFrame]);
+      }
+  }
+
+  // With async compute the draws wait for this frame's light lists and particles, everything recorded
+  // before them (uploads, occlusion culling) runs alongside. graphicsTimeline is signaled either way,
+  // the next frame's compute work may wait on it.
+  if (asyncComputeActive) {
+      frameSubmission.wait(
+          computeTimeline,
+          VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+          frameNumber + 1
+      );
+  }
+  if (asyncComputeEnabled) {
+      frameSubmission.signal(graphicsTimeline, frameNumber + 1);
+  }
+
   VkSubmitInfo submitInfo{};
   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
   submitInfo.commandBufferCount = 1;
   submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
+  frameSubmission.fillSubmit(submitInfo, asyncComputeEnabled);
 
-  VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
-  VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-  submitInfo.waitSemaphoreCount = 1;
-  submitInfo.pWaitSemaphores = waitSemaphores;
-  submitInfo.pWaitDstStageMask = waitStages;
-
-  VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-  submitInfo.signalSemaphoreCount = 1;
-  submitInfo.pSignalSemaphores = signalSemaphores;
+  if (timestampQueryPool != VK_NULL_HANDLE) {
+      frameSubmitTimes[currentFrame] = Profiler::now();
+      timestampsPending[currentFrame] = true;
+  }
 
-  if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
-      throw std::runtime_error("Failed to submit draw command buffer");
+  {
+      PROFILE_ZONE("Submit");
+      if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
+          throw std::runtime_error("Failed to submit draw command buffer");
+      }
   }
 
   VkPresentInfoKHR presentInfo{};
   presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+  frameSubmission.fillPresent(presentInfo);
 
-  presentInfo.waitSemaphoreCount = 1;
-  presentInfo.pWaitSemaphores = signalSemaphores;
-
-  VkSwapchainKHR swapChains[] = {swapChain};
-  presentInfo.swapchainCount = 1;
-  presentInfo.pSwapchains = swapChains;
-  presentInfo.pImageIndices = &imageIndex;
+  {
+      PROFILE_ZONE("Present");
+      result = vkQueuePresentKHR(presentQueue, &presentInfo);
+  }
+  if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR && result != VK_ERROR_OUT_OF_DATE_KHR) {
+    throw std::runtime_error("Failed to present swapchain image");
+  }
 
-  presentInfo.pResults = nullptr; // Optional
+  // Every swap chain reports on its own, an outdated one is only recreated for its window.
+  uint32_t presented = 1;
+  for (const auto& viewport : viewportWindows) {
+      if (viewport->acquired) {
+          VkResult viewportResult = frameSubmission.presentResult(presented++);
+          if (viewportResult == VK_ERROR_OUT_OF_DATE_KHR || viewportResult == VK_SUBOPTIMAL_KHR) {
+              viewport->swapChainFramebufferSize = 0;
+          }
+      }
+  }
 
-  result = vkQueuePresentKHR(presentQueue, &presentInfo);
-  if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
-    framebufferResized = false;
+  result = frameSubmission.presentResult(0);
+  bool resized = framebufferSize.load(std::memory_order_acquire) != swapChainFramebufferSize;
+  if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || resized) {
     recreateSwapChain();
   } else if (result != VK_SUCCESS) {
     throw std::runtime_error("Failed to present swapchain image");
   }
 
+  if (timeToFirstFrame == 0) {
+      timeToFirstFrame = Profiler::now() - startupBegin;
+      reportStartup();
+  }
+
+  hostAllocator.endFrame();
+
   currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+  frameNumber++;
 }
 
-SwapChainSupportDetails Mjoelnir::querySwapChainSupport(VkPhysicalDevice device) {
-  SwapChainSupportDetails details;
+SwapChainSupportDetails Mjoelnir::querySwapChainSupport(VkPhysicalDevice device, VkSurfaceKHR targetSurface) {
+  // Lives in the frame's scratch memory, createSwapChain() runs again on every resize.
+  SwapChainSupportDetails details(frameScratch[currentFrame]);
 
-  vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &details.capabilities);
+  vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, targetSurface, &details.capabilities);
 
   uint32_t formatCount;
-  vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
+  vkGetPhysicalDeviceSurfaceFormatsKHR(device, targetSurface, &formatCount, nullptr);
 
   if (formatCount > 0) {
       details.formats.resize(formatCount);
-      vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, details.formats.data());
+      vkGetPhysicalDeviceSurfaceFormatsKHR(device, targetSurface, &formatCount, details.formats.data());
   }
 
   uint32_t presentModeCount;
-  vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, nullptr);
+  vkGetPhysicalDeviceSurfacePresentModesKHR(device, targetSurface, &presentModeCount, nullptr);
 
   if (presentModeCount > 0) {
       details.presentModes.resize(presentModeCount);
-      vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, details.presentModes.data());
+      vkGetPhysicalDeviceSurfacePresentModesKHR(device, targetSurface, &presentModeCount, details.presentModes.data());
   }
 
   return details;
 }
 
 void Mjoelnir::createInstance() {
+  PROFILE_ZONE("createInstance");
+
   if (enableValidationLayers && !checkValidationLayerSupport()) {
       throw std::runtime_error("Validation layers requested, but not available!");
   }
@@ -447,7 +851,7 @@ void Mjoelnir::createInstance() {
       createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
       createInfo.ppEnabledLayerNames = validationLayers.data();
 
-      populateDebugMessengerCreateInfo(debugCreateInfo);
+      populateDebugMessengerCreateInfo(debugCreateInfo, &logger);
       createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*)&debugCreateInfo;
   } else {
       createInfo.enabledLayerCount = 0;
@@ -455,21 +859,23 @@ void Mjoelnir::createInstance() {
       createInfo.pNext = nullptr;
   }
 
-  VkResult result = vkCreateInstance(&createInfo, nullptr, &instance);
+  VkResult result = vkCreateInstance(&createInfo, allocationCallbacks, &instance);
   if (result != VK_SUCCESS) {
       throw std::runtime_error(std::string("Unable to create instance: ").append(string_VkResult(result)));
   }
 }
 
 void Mjoelnir::setupDebugMessenger() {
+  PROFILE_ZONE("setupDebugMessenger");
+
   if (!enableValidationLayers) {
       return;
   }
 
   VkDebugUtilsMessengerCreateInfoEXT createInfo{};
-  populateDebugMessengerCreateInfo(createInfo);
+  populateDebugMessengerCreateInfo(createInfo, &logger);
 
-  if (CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr, &debugMessenger) != VK_SUCCESS) {
+  if (CreateDebugUtilsMessengerEXT(instance, &createInfo, allocationCallbacks, &debugMessenger) != VK_SUCCESS) {
       throw std::runtime_error("Unable to create debug messenger");
   }
 }
@@ -482,24 +888,31 @@ QueueFamilyIndices Mjoelnir::findQueueFamilies(VkPhysicalDevice device) {
 
   // The VkQueueFamilyProperties struct contains some details about the queue family,
   // including the type of operations that are supported and the number of queues that can be created based on that family.
-  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+  ScratchVector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount, ScratchAllocator<VkQueueFamilyProperties>(frameScratch[currentFrame]));
   vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
 
   int i = 0;
   for (const auto& queueFamily : queueFamilies) {
-      // todo: For improved performance, prioritize devices that support both graphics and present.
-      if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-          indices.graphicsFamily = i;
+      if (!indices.isComplete()) {
+          // todo: For improved performance, prioritize devices that support both graphics and present.
+          if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+              indices.graphicsFamily = i;
+          }
+
+          VkBool32 presentSupport = false;
+          vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+
+          if (presentSupport) {
+              indices.presentFamily = i;
+          }
       }
 
-      VkBool32 presentSupport = false;
-      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-
-      if (presentSupport) {
-          indices.presentFamily = i;
+      // Families with graphics run their queues on the same hardware as the graphics queue more often than not.
+      if (!indices.computeFamily.has_value() && (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+          indices.computeFamily = i;
       }
 
-      if (indices.isComplete()) {
+      if (indices.isComplete() && indices.computeFamily.has_value()) {
           break;
       }
 
@@ -509,17 +922,14 @@ QueueFamilyIndices Mjoelnir::findQueueFamilies(VkPhysicalDevice device) {
   return indices;
 }
 
-VkExtent2D Mjoelnir::chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) {
+VkExtent2D Mjoelnir::chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities, uint64_t size) {
   if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max()) {
       return capabilities.currentExtent;
   }
 
-  int width, height;
-  glfwGetFramebufferSize(window, &width, &height);
-
   VkExtent2D actualExtent = {
-    static_cast<uint32_t>(width),
-    static_cast<uint32_t>(height)
+    framebufferWidth(size),
+    framebufferHeight(size)
   };
 
   actualExtent.width = std::clamp(actualExtent.width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
@@ -543,7 +953,7 @@ bool Mjoelnir::isDeviceSuitable(VkPhysicalDevice device) {
 
     bool swapChainAdequate = false;
     if (extensionsSupported) {
-        SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
+        SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device, surface);
         swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
     }
 
@@ -551,6 +961,8 @@ bool Mjoelnir::isDeviceSuitable(VkPhysicalDevice device) {
 }
 
 void Mjoelnir::pickPhysicalDevice() {
+  PROFILE_ZONE("pickPhysicalDevice");
+
   uint32_t deviceCount = 0;
   vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
 
@@ -572,13 +984,23 @@ void Mjoelnir::pickPhysicalDevice() {
   if (physicalDevice == VK_NULL_HANDLE) {
       throw std::runtime_error("Failed to find suitable physical device");
   }
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  maxViewportDimension = static_cast<float>(std::min(properties.limits.maxViewportDimensions[0], properties.limits.maxViewportDimensions[1]));
 }
 
 void Mjoelnir::createLogicalDevice() {
+  PROFILE_ZONE("createLogicalDevice");
+
   QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 
   std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
   std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+  bool asyncComputeCandidate = enableAsyncCompute && indices.computeFamily.has_value();
+  if (asyncComputeCandidate) {
+      uniqueQueueFamilies.insert(indices.computeFamily.value());
+  }
 
   float queuePriority = 1.0f;
   for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -603,8 +1025,73 @@ void Mjoelnir::createLogicalDevice() {
 
   createInfo.pEnabledFeatures = &deviceFeatures;
 
-  createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-  createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+  // Optional extensions are only enabled when the device has them.
+  std::vector<const char*> enabledExtensions = deviceExtensions;
+  uint32_t extensionCount;
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+  std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+
+  for (const auto& extension : availableExtensions) {
+      if (strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) {
+          enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+          memoryBudgetSupported = true;
+      } else if (enableProfiling && strcmp(extension.extensionName, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME) == 0) {
+          // Without a device and a host domain GPU spans fall back to the submit time.
+          if (chooseHostTimeDomain(instance, physicalDevice, hostTimeDomain)) {
+              enabledExtensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+              calibratedTimestampsSupported = true;
+          }
+      } else if (strcmp(extension.extensionName, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME) == 0) {
+          extendedDynamicStateSupported = true;
+      } else if (asyncComputeCandidate && strcmp(extension.extensionName, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) == 0) {
+          asyncComputeEnabled = true;
+      }
+  }
+
+  // The extensions alone aren't enough, the features have to be there as well.
+  VkPhysicalDeviceExtendedDynamicStateFeaturesEXT extendedDynamicStateFeatures{};
+  extendedDynamicStateFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+  VkPhysicalDeviceTimelineSemaphoreFeatures timelineSemaphoreFeatures{};
+  timelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+
+  if (extendedDynamicStateSupported || asyncComputeEnabled) {
+      VkPhysicalDeviceFeatures2 features{};
+      features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+      if (extendedDynamicStateSupported) {
+          extendedDynamicStateFeatures.pNext = features.pNext;
+          features.pNext = &extendedDynamicStateFeatures;
+      }
+      if (asyncComputeEnabled) {
+          timelineSemaphoreFeatures.pNext = features.pNext;
+          features.pNext = &timelineSemaphoreFeatures;
+      }
+
+      auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR) vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR");
+      if (getFeatures2 != nullptr) {
+          getFeatures2(physicalDevice, &features);
+      }
+
+      extendedDynamicStateSupported = extendedDynamicStateSupported && extendedDynamicStateFeatures.extendedDynamicState == VK_TRUE;
+      asyncComputeEnabled = asyncComputeEnabled && timelineSemaphoreFeatures.timelineSemaphore == VK_TRUE;
+  }
+
+  // Only what is actually enabled is chained into the create info.
+  void* enabledFeatures = nullptr;
+  if (extendedDynamicStateSupported) {
+      enabledExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+      extendedDynamicStateFeatures.pNext = enabledFeatures;
+      enabledFeatures = &extendedDynamicStateFeatures;
+  }
+  if (asyncComputeEnabled) {
+      enabledExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+      timelineSemaphoreFeatures.pNext = enabledFeatures;
+      enabledFeatures = &timelineSemaphoreFeatures;
+  }
+  createInfo.pNext = enabledFeatures;
+
+  createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+  createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
   if (enableValidationLayers) {
       createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -613,26 +1100,77 @@ void Mjoelnir::createLogicalDevice() {
       createInfo.enabledLayerCount = 0;
   }
 
-  if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS) {
+  if (vkCreateDevice(physicalDevice, &createInfo, allocationCallbacks, &device) != VK_SUCCESS) {
       throw std::runtime_error("Failed to create logical device");
   }
 
   vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
   vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+
+  graphicsQueueFamily = indices.graphicsFamily.value();
+  if (asyncComputeEnabled) {
+      computeQueueFamily = indices.computeFamily.value();
+      vkGetDeviceQueue(device, computeQueueFamily, 0, &computeQueue);
+      logger.log(LogSeverity::Info, LogCategory::Engine, "Async compute on queue family %u", computeQueueFamily);
+  } else {
+      // Recorded into the graphics command buffer instead, nothing else changes.
+      computeQueueFamily = graphicsQueueFamily;
+      logger.log(LogSeverity::Info, LogCategory::Engine, "No async compute, compute work runs on the graphics queue");
+  }
+
+  if (extendedDynamicStateSupported) {
+      cmdSetCullMode = (PFN_vkCmdSetCullModeEXT) vkGetDeviceProcAddr(device, "vkCmdSetCullModeEXT");
+      cmdSetFrontFace = (PFN_vkCmdSetFrontFaceEXT) vkGetDeviceProcAddr(device, "vkCmdSetFrontFaceEXT");
+      cmdSetPrimitiveTopology = (PFN_vkCmdSetPrimitiveTopologyEXT) vkGetDeviceProcAddr(device, "vkCmdSetPrimitiveTopologyEXT");
+      cmdSetDepthTestEnable = (PFN_vkCmdSetDepthTestEnableEXT) vkGetDeviceProcAddr(device, "vkCmdSetDepthTestEnableEXT");
+      cmdSetDepthWriteEnable = (PFN_vkCmdSetDepthWriteEnableEXT) vkGetDeviceProcAddr(device, "vkCmdSetDepthWriteEnableEXT");
+      cmdSetDepthCompareOp = (PFN_vkCmdSetDepthCompareOpEXT) vkGetDeviceProcAddr(device, "vkCmdSetDepthCompareOpEXT");
+  }
+
+  memoryTracker.init(instance, physicalDevice, memoryBudgetSupported, allocationCallbacks);
+  memoryTracker.addPressureCallback([this](uint32_t heap, const MemoryHeapStats& stats) {
+      static const char* pressureNames[] = {"none", "moderate", "high", "critical"};
+      logger.log(
+          stats.pressure >= MemoryPressure::High ? LogSeverity::Warning : LogSeverity::Info,
+          LogCategory::Engine,
+          "Memory pressure on heap %u is now %s (%llu of %llu MiB budget used)",
+          heap,
+          pressureNames[static_cast<uint32_t>(stats.pressure)],
+          static_cast<unsigned long long>(stats.usage >> 20),
+          static_cast<unsigned long long>(stats.budget >> 20)
+      );
+  });
+
+  deletionQueue.init(device, &memoryTracker, allocationCallbacks);
+  layoutCache.init(device, allocationCallbacks);
+  for (DescriptorAllocator& allocator : frameDescriptors) {
+      allocator.init(device, &layoutCache, allocationCallbacks);
+  }
 }
 
 void Mjoelnir::createSurface() {
-  if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
+  PROFILE_ZONE("createSurface");
+
+  if (glfwCreateWindowSurface(instance, window, allocationCallbacks, &surface) != VK_SUCCESS) {
       throw std::runtime_error("Failed to create window surface");
   }
+
+  for (auto& viewport : viewportWindows) {
+      if (glfwCreateWindowSurface(instance, viewport->window, allocationCallbacks, &viewport->surface) != VK_SUCCESS) {
+          throw std::runtime_error("Failed to create window surface");
+      }
+  }
 }
 
 void Mjoelnir::createSwapChain() {
-  SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
+  PROFILE_ZONE("createSwapChain");
+
+  uint64_t framebufferSizeAtCreation = framebufferSize.load(std::memory_order_acquire);
+  SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice, surface);
 
   VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
   VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
-  VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
+  VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities, framebufferSizeAtCreation);
 
   uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
   // swapChainSupport.capabilities.maxImageCount == 0 means there is no maximum.
@@ -652,6 +1190,12 @@ void Mjoelnir::createSwapChain() {
   createInfo.imageArrayLayers = 1;
   createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
+  // Frame capture copies out of the swap chain images.
+  swapChainReadable = (swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) != 0;
+  if (swapChainReadable) {
+      createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  }
+
   QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
   uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(), indices.presentFamily.value()};
 
@@ -675,14 +1219,19 @@ void Mjoelnir::createSwapChain() {
   createInfo.presentMode = presentMode;
   createInfo.clipped = VK_TRUE;
 
-  createInfo.oldSwapchain = VK_NULL_HANDLE;
+  // Lets the driver hand resources over from the swap chain being replaced, if there is one.
+  createInfo.oldSwapchain = swapChain;
 
-  if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
+  if (vkCreateSwapchainKHR(device, &createInfo, allocationCallbacks, &swapChain) != VK_SUCCESS) {
       throw std::runtime_error("Failed to create swap chain");
   }
 
   swapChainImageFormat = surfaceFormat.format;
   swapChainExtent = extent;
+  // Until the next frame picks its render scale.
+  renderExtent = extent;
+  // Read before the extent was chosen, so a resize that raced with it is picked up next frame.
+  swapChainFramebufferSize = framebufferSizeAtCreation;
 
   vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
   swapChainImages.resize(imageCount);
@@ -691,94 +1240,354 @@ void Mjoelnir::createSwapChain() {
 
 void Mjoelnir::cleanupSwapChain() {
   for (auto framebuffer : swapChainFramebuffers) {
-      vkDestroyFramebuffer(device, framebuffer, nullptr);
+      vkDestroyFramebuffer(device, framebuffer, allocationCallbacks);
   }
 
   for (auto imageView : swapChainImageViews) {
-      vkDestroyImageView(device, imageView, nullptr);
+      vkDestroyImageView(device, imageView, allocationCallbacks);
   }
 
-  vkDestroySwapchainKHR(device, swapChain, nullptr);
+  vkDestroySwapchainKHR(device, swapChain, allocationCallbacks);
 }
 
-void Mjoelnir::recreateSwapChain() {
-  // That’s all it takes to recreate the swap chain!
-  // However, the disadvantage of this approach is that we need to stop all rendering before creating the new swap chain.
-  // It is possible to create a new swap chain while drawing commands on an image from the old swap chain are still in-flight.
-  // You need to pass the previous swap chain to the oldSwapchain field in the VkSwapchainCreateInfoKHR struct and destroy the old swap chain as soon as you’ve finished using it.
-  int width = 0;
-  int height = 0;
+void Mjoelnir::retireSwapChain() {
+  // Frames still in flight may be rendering into these, but a frame's fence only covers its submit.
+  // A present still queued on the old swap chain isn't covered by any fence, and without
+  // VK_EXT_swapchain_maintenance1 there is no present fence to wait for instead. Presents on a
+  // queue are processed in order. So once a frame that presented to the new swap chain has
+  // retired, the old chain's last present was queued ahead of that frame's present. Keeping
+  // everything SWAP_CHAIN_RETIRE_FRAMES past the current frame makes sure such a frame exists.
+  uint64_t lastUsedFrame = frameNumber + SWAP_CHAIN_RETIRE_FRAMES;
+  for (auto framebuffer : swapChainFramebuffers) {
+      deletionQueue.push(lastUsedFrame, DeletionType::Framebuffer, framebuffer);
+  }
 
-  glfwGetFramebufferSize(window, &width, &height);
-  while (width == 0 || height == 0) {
-    glfwGetFramebufferSize(window, &width, &height);
-    glfwWaitEvents();
+  for (auto imageView : swapChainImageViews) {
+      deletionQueue.push(lastUsedFrame, DeletionType::ImageView, imageView);
   }
 
-  vkDeviceWaitIdle(device);
+  deletionQueue.push(lastUsedFrame, DeletionType::Swapchain, swapChain);
+}
 
-  cleanupSwapChain();
+void Mjoelnir::recreateSwapChain() {
+  PROFILE_ZONE("recreateSwapChain");
+
+  // The old swap chain is passed as oldSwapchain and its objects go through the deletion queue,
+  // so frames that are still in flight can finish without having to wait for the device to go idle.
+  // A minimized window has no framebuffer, wait for the main thread to report a new size.
+  uint64_t size = framebufferSize.load(std::memory_order_acquire);
+  while ((framebufferWidth(size) == 0 || framebufferHeight(size) == 0) && rendering.load(std::memory_order_acquire)) {
+    std::this_thread::sleep_for(MINIMIZED_POLL_INTERVAL);
+    size = framebufferSize.load(std::memory_order_acquire);
+  }
+  if (!rendering.load(std::memory_order_acquire)) {
+    return;
+  }
+
+  retireSwapChain();
+  retireDepthResources();
+  retireSceneTarget();
 
   createSwapChain();
   createImageViews();
+  createDepthResources();
+  createSceneTarget();
+  createDepthPyramidDescriptors();
   createFramebuffers();
 }
 
-void Mjoelnir::createImageViews() {
-  swapChainImageViews.resize(swapChainImages.size());
+void Mjoelnir::createViewportSwapChain(ViewportWindow& viewport) {
+  PROFILE_ZONE("createViewportSwapChain");
 
-  for (size_t i = 0; i < swapChainImages.size(); i++) {
-      VkImageViewCreateInfo createInfo{};
-      createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-      createInfo.image = swapChainImages[i];
-      
-      createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-      createInfo.format = swapChainImageFormat;
-      
-      createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-      createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-      createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-      createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+  uint64_t framebufferSizeAtCreation = viewport.framebufferSize.load(std::memory_order_acquire);
+  QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 
-      createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-      createInfo.subresourceRange.baseMipLevel = 0;
-      createInfo.subresourceRange.levelCount = 1;
-      // If you were working on a stereographic 3D application, then you would create a swap chain with multiple layers.
-      // You could then create multiple image views for each image representing the views for the left and right eyes by accessing different layers.
-      createInfo.subresourceRange.baseArrayLayer = 0;
-      createInfo.subresourceRange.layerCount = 1;
+  // The device was picked for the main window, the present queue has to reach this one as well.
+  VkBool32 presentSupport = false;
+  vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, indices.presentFamily.value(), viewport.surface, &presentSupport);
+  if (!presentSupport) {
+      throw std::runtime_error("The present queue can't present to window " + viewport.title);
+  }
 
-      if (vkCreateImageView(device, &createInfo, nullptr, &swapChainImageViews[i]) != VK_SUCCESS) {
-          throw std::runtime_error("Failed to create image view");
+  SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice, viewport.surface);
+
+  // The present pass and the pipelines drawn in it were made for the main window's format.
+  const VkSurfaceFormatKHR* surfaceFormat = nullptr;
+  for (const auto& availableFormat : swapChainSupport.formats) {
+      if (availableFormat.format == swapChainImageFormat) {
+          surfaceFormat = &availableFormat;
+          break;
       }
   }
-}
+  if (surfaceFormat == nullptr) {
+      throw std::runtime_error("Window " + viewport.title + " doesn't support the main window's format");
+  }
 
-void Mjoelnir::createRenderPass() {
-  VkAttachmentDescription colorAttachment{};
-  colorAttachment.format = swapChainImageFormat;
-  // No multisampling yet, stick to 1 bit.
-  colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities, framebufferSizeAtCreation);
 
-  // VK_ATTACHMENT_LOAD_OP_LOAD: Preserve the existing contents of the attachment
-  // VK_ATTACHMENT_LOAD_OP_CLEAR: Clear the values to a constant at the start
-  // VK_ATTACHMENT_LOAD_OP_DONT_CARE: Existing contents are undefined; we don’t care about them
-  colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  // VK_ATTACHMENT_STORE_OP_STORE: Rendered contents will be stored in memory and can be read later
-  // VK_ATTACHMENT_STORE_OP_DONT_CARE: Contents of the framebuffer will be undefined after the rendering operation
-  colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-  // Not using stencil buffers.
-  colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+  if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount) {
+      imageCount = swapChainSupport.capabilities.maxImageCount;
+  }
 
-  colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  VkSwapchainCreateInfoKHR createInfo{};
+  createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+  createInfo.surface = viewport.surface;
+  createInfo.minImageCount = imageCount;
+  createInfo.imageFormat = surfaceFormat->format;
+  createInfo.imageColorSpace = surfaceFormat->colorSpace;
+  createInfo.imageExtent = extent;
+  createInfo.imageArrayLayers = 1;
+  createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
-  VkAttachmentReference colorAttachmentRef{};
-  colorAttachmentRef.attachment = 0;
-  colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+  if (indices.graphicsFamily.value() != indices.presentFamily.value()) {
+      createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+      createInfo.queueFamilyIndexCount = 2;
+      createInfo.pQueueFamilyIndices = queueFamilyIndices;
+  } else {
+      createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  }
 
-  VkSubpassDescription subpass{};
+  createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
+  createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+  createInfo.presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
+  createInfo.clipped = VK_TRUE;
+  createInfo.oldSwapchain = viewport.swapChain;
+
+  VkSwapchainKHR swapChain;
+  if (vkCreateSwapchainKHR(device, &createInfo, allocationCallbacks, &swapChain) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create swap chain");
+  }
+
+  if (viewport.swapChain != VK_NULL_HANDLE) {
+      retireViewportSwapChain(viewport);
+  }
+  viewport.swapChain = swapChain;
+  viewport.extent = extent;
+  viewport.swapChainFramebufferSize = framebufferSizeAtCreation;
+
+  vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
+  viewport.images.resize(imageCount);
+  vkGetSwapchainImagesKHR(device, swapChain, &imageCount, viewport.images.data());
+
+  viewport.imageViews.resize(imageCount);
+  viewport.framebuffers.resize(imageCount);
+  for (uint32_t i = 0; i < imageCount; i++) {
+      viewport.imageViews[i] = createImageView(viewport.images[i], swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 0, 1);
+
+      VkFramebufferCreateInfo framebufferInfo{};
+      framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+      framebufferInfo.renderPass = presentRenderPass;
+      framebufferInfo.attachmentCount = 1;
+      framebufferInfo.pAttachments = &viewport.imageViews[i];
+      framebufferInfo.width = extent.width;
+      framebufferInfo.height = extent.height;
+      framebufferInfo.layers = 1;
+
+      if (vkCreateFramebuffer(device, &framebufferInfo, allocationCallbacks, &viewport.framebuffers[i]) != VK_SUCCESS) {
+          throw std::runtime_error("Unable to create framebuffer");
+      }
+  }
+}
+
+void Mjoelnir::retireViewportSwapChain(ViewportWindow& viewport) {
+  // Same as retireSwapChain(), a present may still be queued on it after the frame fence.
+  uint64_t lastUsedFrame = frameNumber + SWAP_CHAIN_RETIRE_FRAMES;
+  for (auto framebuffer : viewport.framebuffers) {
+      deletionQueue.push(lastUsedFrame, DeletionType::Framebuffer, framebuffer);
+  }
+
+  for (auto imageView : viewport.imageViews) {
+      deletionQueue.push(lastUsedFrame, DeletionType::ImageView, imageView);
+  }
+
+  deletionQueue.push(lastUsedFrame, DeletionType::Swapchain, viewport.swapChain);
+
+  viewport.framebuffers.clear();
+  viewport.imageViews.clear();
+  viewport.swapChain = VK_NULL_HANDLE;
+}
+
+void Mjoelnir::acquireViewportImages() {
+  PROFILE_ZONE("acquireViewportImages");
+
+  for (auto& viewport : viewportWindows) {
+      viewport->acquired = false;
+      if (!viewport->open.load(std::memory_order_acquire)) {
+          continue;
+      }
+
+      // Unlike the main window, a minimized one doesn't hold up the others.
+      uint64_t size = viewport->framebufferSize.load(std::memory_order_acquire);
+      if (framebufferWidth(size) == 0 || framebufferHeight(size) == 0) {
+          continue;
+      }
+
+      if (viewport->swapChain == VK_NULL_HANDLE || size != viewport->swapChainFramebufferSize) {
+          createViewportSwapChain(*viewport);
+      }
+
+      VkResult result = vkAcquireNextImageKHR(device, viewport->swapChain, UINT64_MAX, viewport->imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &viewport->imageIndex);
+      if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+          // Recreated next frame, this one goes without.
+          viewport->swapChainFramebufferSize = 0;
+          continue;
+      } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+          throw std::runtime_error("Failed to acquire swapchain image");
+      }
+
+      viewport->acquired = true;
+  }
+}
+
+void Mjoelnir::recordViewportWindows(VkCommandBuffer commandBuffer) {
+  for (const auto& viewport : viewportWindows) {
+      if (!viewport->acquired) {
+          continue;
+      }
+
+      VkRenderPassBeginInfo renderPassInfo{};
+      renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+      renderPassInfo.renderPass = presentRenderPass;
+      renderPassInfo.framebuffer = viewport->framebuffers[viewport->imageIndex];
+      renderPassInfo.renderArea.offset = {0, 0};
+      renderPassInfo.renderArea.extent = viewport->extent;
+      vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+      // The view's rectangle of the main window, in its pixels.
+      WindowView view = unpackWindowView(viewport->view.load(std::memory_order_relaxed));
+      float mainWidth = static_cast<float>(swapChainExtent.width);
+      float mainHeight = static_cast<float>(swapChainExtent.height);
+      float viewX = view.x * mainWidth;
+      float viewY = view.y * mainHeight;
+      float viewWidth = std::max(view.width * mainWidth, 1.0f);
+      float viewHeight = std::max(view.height * mainHeight, 1.0f);
+
+      // The whole main window is drawn at the view's scale, scissored to the view. The scale is
+      // limited to what a viewport can cover, a view too small for it is shown smaller than the window.
+      VkExtent2D viewExtent = {static_cast<uint32_t>(viewWidth + 0.5f), static_cast<uint32_t>(viewHeight + 0.5f)};
+      VkRect2D area = letterbox(viewExtent, viewport->extent);
+      float scale = std::min(static_cast<float>(area.extent.width) / viewWidth, static_cast<float>(area.extent.height) / viewHeight);
+      scale = std::min(scale, maxViewportDimension / std::max(mainWidth, mainHeight));
+
+      VkExtent2D shown = {std::max(static_cast<uint32_t>(viewWidth * scale), 1u), std::max(static_cast<uint32_t>(viewHeight * scale), 1u)};
+      area.offset.x += static_cast<int32_t>((area.extent.width - std::min(shown.width, area.extent.width)) / 2);
+      area.offset.y += static_cast<int32_t>((area.extent.height - std::min(shown.height, area.extent.height)) / 2);
+      area.extent.width = std::min(shown.width, area.extent.width);
+      area.extent.height = std::min(shown.height, area.extent.height);
+
+      // The present pass doesn't clear, the bars around the letterboxed view are cleared here.
+      if (area.extent.width != viewport->extent.width || area.extent.height != viewport->extent.height) {
+          VkClearAttachment clear{};
+          clear.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+          clear.colorAttachment = 0;
+          clear.clearValue.color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+
+          VkClearRect clearRect{};
+          clearRect.rect = renderPassInfo.renderArea;
+          clearRect.baseArrayLayer = 0;
+          clearRect.layerCount = 1;
+          vkCmdClearAttachments(commandBuffer, 1, &clear, 1, &clearRect);
+      }
+
+      VkViewport viewportArea{};
+      viewportArea.x = static_cast<float>(area.offset.x) - viewX * scale;
+      viewportArea.y = static_cast<float>(area.offset.y) - viewY * scale;
+      viewportArea.width = mainWidth * scale;
+      viewportArea.height = mainHeight * scale;
+      viewportArea.minDepth = 0.0f;
+      viewportArea.maxDepth = 1.0f;
+      vkCmdSetViewport(commandBuffer, 0, 1, &viewportArea);
+      vkCmdSetScissor(commandBuffer, 0, 1, &area);
+
+      // Both draw in the main window's pixels, the viewport scales them to this one.
+      recordUpscale(commandBuffer);
+      recordSpriteDraw(commandBuffer);
+
+      vkCmdEndRenderPass(commandBuffer);
+  }
+}
+
+void Mjoelnir::createImageViews() {
+  PROFILE_ZONE("createImageViews");
+
+  swapChainImageViews.resize(swapChainImages.size());
+
+  for (size_t i = 0; i < swapChainImages.size(); i++) {
+      VkImageViewCreateInfo createInfo{};
+      createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+      createInfo.image = swapChainImages[i];
+      
+      createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+      createInfo.format = swapChainImageFormat;
+      
+      createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+      createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+      createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+      createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+
+      createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      createInfo.subresourceRange.baseMipLevel = 0;
+      createInfo.subresourceRange.levelCount = 1;
+      // If you were working on a stereographic 3D application, then you would create a swap chain with multiple layers.
+      // You could then create multiple image views for each image representing the views for the left and right eyes by accessing different layers.
+      createInfo.subresourceRange.baseArrayLayer = 0;
+      createInfo.subresourceRange.layerCount = 1;
+
+      if (vkCreateImageView(device, &createInfo, allocationCallbacks, &swapChainImageViews[i]) != VK_SUCCESS) {
+          throw std::runtime_error("Failed to create image view");
+      }
+  }
+}
+
+VkFormat Mjoelnir::findDepthFormat() {
+  VkFormat candidates[] = {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT};
+  // The depth pyramid samples it.
+  VkFormatFeatureFlags features = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+
+  for (VkFormat format : candidates) {
+      VkFormatProperties properties;
+      vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+
+      if ((properties.optimalTilingFeatures & features) == features) {
+          return format;
+      }
+  }
+
+  throw std::runtime_error("Failed to find a supported depth format");
+}
+
+void Mjoelnir::createRenderPass() {
+  PROFILE_ZONE("createRenderPass");
+
+  depthFormat = findDepthFormat();
+
+  VkAttachmentDescription colorAttachment{};
+  colorAttachment.format = swapChainImageFormat;
+  // No multisampling yet, stick to 1 bit.
+  colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+
+  // VK_ATTACHMENT_LOAD_OP_LOAD: Preserve the existing contents of the attachment
+  // VK_ATTACHMENT_LOAD_OP_CLEAR: Clear the values to a constant at the start
+  // VK_ATTACHMENT_LOAD_OP_DONT_CARE: Existing contents are undefined; we don’t care about them
+  colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  // VK_ATTACHMENT_STORE_OP_STORE: Rendered contents will be stored in memory and can be read later
+  // VK_ATTACHMENT_STORE_OP_DONT_CARE: Contents of the framebuffer will be undefined after the rendering operation
+  colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  // Not using stencil buffers.
+  colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+  colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  // The scene target, the present pass samples it once the late pass is done.
+  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  VkAttachmentReference colorAttachmentRef{};
+  colorAttachmentRef.attachment = 0;
+  colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  VkSubpassDescription subpass{};
   subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
   subpass.colorAttachmentCount = 1;
   // The index of the attachment in this array is directly referenced from the fragment shader with the layout(location = 0) out vec4 outColor directive!
@@ -789,48 +1598,429 @@ void Mjoelnir::createRenderPass() {
   //     pDepthStencilAttachment: Attachment for depth and stencil data
   //     pPreserveAttachments: Attachments that are not used by this subpass, but for which the data must be preserved
 
+  // Cleared every frame, the late pass and the depth pyramid read it afterwards.
+  VkAttachmentDescription depthAttachment{};
+  depthAttachment.format = depthFormat;
+  depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  VkAttachmentReference depthAttachmentRef{};
+  depthAttachmentRef.attachment = 1;
+  depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+  VkAttachmentDescription attachments[] = {colorAttachment, depthAttachment};
+
   VkRenderPassCreateInfo renderPassInfo{};
   renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
   // The VkAttachmentReference objects reference attachments using the indices of this array.
-  renderPassInfo.attachmentCount = 1;
-  renderPassInfo.pAttachments = &colorAttachment;
+  renderPassInfo.attachmentCount = 2;
+  renderPassInfo.pAttachments = attachments;
   renderPassInfo.subpassCount = 1;
   renderPassInfo.pSubpasses = &subpass;
 
+  // The depth buffer and the scene target are shared by all frames in flight, the last frame has to
+  // be done with them. Its present pass samples the scene target.
   VkSubpassDependency dependency{};
   dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
   dependency.dstSubpass = 0;
-  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.srcAccessMask = 0;
-  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
   renderPassInfo.dependencyCount = 1;
   renderPassInfo.pDependencies = &dependency;
 
-  if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
+  if (vkCreateRenderPass(device, &renderPassInfo, allocationCallbacks, &renderPass) != VK_SUCCESS) {
       throw std::runtime_error("Failed to create render pass");
   }
+
+  // The late pass continues where the early one stopped. Only the load and store operations
+  // differ, so the two are compatible and share pipelines and framebuffers.
+  attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+  attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+  attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+  if (vkCreateRenderPass(device, &renderPassInfo, allocationCallbacks, &lateRenderPass) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create late render pass");
+  }
+
+  // The swap chain image alone, the upscaled scene covers all of it.
+  VkAttachmentDescription presentAttachment = colorAttachment;
+  presentAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  presentAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  presentAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+  VkSubpassDescription presentSubpass{};
+  presentSubpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  presentSubpass.colorAttachmentCount = 1;
+  presentSubpass.pColorAttachments = &colorAttachmentRef;
+
+  // Waits for the image to be acquired, the submit waits on that at this stage.
+  VkSubpassDependency presentDependency{};
+  presentDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+  presentDependency.dstSubpass = 0;
+  presentDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  presentDependency.srcAccessMask = 0;
+  presentDependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  presentDependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+  renderPassInfo.attachmentCount = 1;
+  renderPassInfo.pAttachments = &presentAttachment;
+  renderPassInfo.pSubpasses = &presentSubpass;
+  renderPassInfo.pDependencies = &presentDependency;
+
+  if (vkCreateRenderPass(device, &renderPassInfo, allocationCallbacks, &presentRenderPass) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create present render pass");
+  }
 }
 
-void Mjoelnir::createGraphicsPipeline() {
-  // todo: Need a good way to handle these paths without being so specific.
-  auto vert_shader_code = readFile("/Users/singmyr/dev/mjoelnir/Mjoelnir/src/shaders/shader_vert.spv");
-  auto frag_shader_code = readFile("/Users/singmyr/dev/mjoelnir/Mjoelnir/src/shaders/shader_frag.spv");
+void Mjoelnir::createImage(uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t arrayLayers, VkFormat format, VkImageUsageFlags usage, VkImage& image, VkDeviceMemory& imageMemory) {
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.extent.width = width;
+  imageInfo.extent.height = height;
+  imageInfo.extent.depth = 1;
+  imageInfo.mipLevels = mipLevels;
+  imageInfo.arrayLayers = arrayLayers;
+  imageInfo.format = format;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  imageInfo.usage = usage;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateImage(device, &imageInfo, allocationCallbacks, &image) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to create image");
+  }
+
+  VkMemoryRequirements memoryRequirements;
+  vkGetImageMemoryRequirements(device, image, &memoryRequirements);
 
-  VkShaderModule vert_shader_module = createShaderModule(vert_shader_code);
-  VkShaderModule frag_shader_module = createShaderModule(frag_shader_code);
+  VkMemoryAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = memoryRequirements.size;
+  allocInfo.memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-  // todo: Necessary?
-  // free(vert_shader_code);
-  // free(frag_shader_code);
+  if (memoryTracker.allocate(device, allocInfo, MemoryCategory::Image, &imageMemory) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to allocate image memory");
+  }
+
+  vkBindImageMemory(device, image, imageMemory, 0);
+}
+
+VkImageView Mjoelnir::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect, uint32_t baseMipLevel, uint32_t levelCount) {
+  VkImageViewCreateInfo createInfo{};
+  createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  createInfo.image = image;
+  createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  createInfo.format = format;
+  createInfo.subresourceRange.aspectMask = aspect;
+  createInfo.subresourceRange.baseMipLevel = baseMipLevel;
+  createInfo.subresourceRange.levelCount = levelCount;
+  createInfo.subresourceRange.baseArrayLayer = 0;
+  createInfo.subresourceRange.layerCount = 1;
+
+  VkImageView imageView;
+  if (vkCreateImageView(device, &createInfo, allocationCallbacks, &imageView) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create image view");
+  }
+
+  return imageView;
+}
+
+void Mjoelnir::createDepthResources() {
+  PROFILE_ZONE("createDepthResources");
+
+  createImage(
+      swapChainExtent.width,
+      swapChainExtent.height,
+      1,
+      1,
+      depthFormat,
+      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+      depthImage,
+      depthImageMemory
+  );
+  depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1);
+
+  depthPyramidWidth = depthPyramidSize(swapChainExtent.width);
+  depthPyramidHeight = depthPyramidSize(swapChainExtent.height);
+  depthPyramidLevelCount = depthPyramidLevels(depthPyramidWidth, depthPyramidHeight);
+
+  createImage(
+      depthPyramidWidth,
+      depthPyramidHeight,
+      depthPyramidLevelCount,
+      1,
+      VK_FORMAT_R32_SFLOAT,
+      VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+      depthPyramid,
+      depthPyramidMemory
+  );
+
+  // The culling shader samples all levels, every reduction writes a single one.
+  depthPyramidView = createImageView(depthPyramid, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, 0, depthPyramidLevelCount);
+  depthPyramidMips.resize(depthPyramidLevelCount);
+  for (uint32_t level = 0; level < depthPyramidLevelCount; level++) {
+      depthPyramidMips[level] = createImageView(depthPyramid, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, level, 1);
+  }
+}
+
+void Mjoelnir::retireDepthResources() {
+  // Frames still in flight may be using them.
+  for (VkImageView view : depthPyramidMips) {
+      deletionQueue.push(frameNumber, DeletionType::ImageView, view);
+  }
+  deletionQueue.push(frameNumber, DeletionType::ImageView, depthPyramidView);
+  deletionQueue.push(frameNumber, DeletionType::Image, depthPyramid);
+  deletionQueue.push(frameNumber, DeletionType::DeviceMemory, depthPyramidMemory);
+
+  deletionQueue.push(frameNumber, DeletionType::ImageView, depthImageView);
+  deletionQueue.push(frameNumber, DeletionType::Image, depthImage);
+  deletionQueue.push(frameNumber, DeletionType::DeviceMemory, depthImageMemory);
+
+  // Frees the sets along with it.
+  deletionQueue.push(frameNumber, DeletionType::DescriptorPool, depthReduceDescriptorPool);
+}
+
+void Mjoelnir::createSceneTarget() {
+  PROFILE_ZONE("createSceneTarget");
+
+  // Always the size of the swap chain, lower render scales only use part of it.
+  createImage(
+      swapChainExtent.width,
+      swapChainExtent.height,
+      1,
+      1,
+      swapChainImageFormat,
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+      sceneColorImage,
+      sceneColorMemory
+  );
+  sceneColorView = createImageView(sceneColorImage, swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 0, 1);
+}
+
+void Mjoelnir::retireSceneTarget() {
+  // Frames still in flight may be using them.
+  deletionQueue.push(frameNumber, DeletionType::Framebuffer, sceneFramebuffer);
+  deletionQueue.push(frameNumber, DeletionType::ImageView, sceneColorView);
+  deletionQueue.push(frameNumber, DeletionType::Image, sceneColorImage);
+  deletionQueue.push(frameNumber, DeletionType::DeviceMemory, sceneColorMemory);
+}
+
+void Mjoelnir::createDepthPyramidDescriptors() {
+  PROFILE_ZONE("createDepthPyramidDescriptors");
+
+  VkDescriptorPoolSize poolSizes[2] = {};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[0].descriptorCount = depthPyramidLevelCount;
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  poolSizes[1].descriptorCount = depthPyramidLevelCount;
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = depthPyramidLevelCount;
+  poolInfo.poolSizeCount = 2;
+  poolInfo.pPoolSizes = poolSizes;
+
+  if (vkCreateDescriptorPool(device, &poolInfo, allocationCallbacks, &depthReduceDescriptorPool) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to create depth pyramid descriptor pool");
+  }
+
+  std::vector<VkDescriptorSetLayout> layouts(depthPyramidLevelCount, depthReduceSetLayout);
+
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = depthReduceDescriptorPool;
+  allocInfo.descriptorSetCount = depthPyramidLevelCount;
+  allocInfo.pSetLayouts = layouts.data();
+
+  depthReduceSets.resize(depthPyramidLevelCount);
+  if (vkAllocateDescriptorSets(device, &allocInfo, depthReduceSets.data()) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to allocate depth pyramid descriptor sets");
+  }
+
+  for (uint32_t level = 0; level < depthPyramidLevelCount; level++) {
+      // The first level reduces the depth buffer, every other one the level before it.
+      VkDescriptorImageInfo source{};
+      source.sampler = depthPyramidSampler;
+      source.imageView = level == 0 ? depthImageView : depthPyramidMips[level - 1];
+      source.imageLayout = level == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+      VkDescriptorImageInfo destination{};
+      destination.imageView = depthPyramidMips[level];
+      destination.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+      VkWriteDescriptorSet writes[2] = {};
+      writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[0].dstSet = depthReduceSets[level];
+      writes[0].dstBinding = 0;
+      writes[0].descriptorCount = 1;
+      writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      writes[0].pImageInfo = &source;
+      writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[1].dstSet = depthReduceSets[level];
+      writes[1].dstBinding = 1;
+      writes[1].descriptorCount = 1;
+      writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+      writes[1].pImageInfo = &destination;
+
+      vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+  }
+}
+
+void Mjoelnir::createOcclusionPipelines() {
+  PROFILE_ZONE("createOcclusionPipelines");
+
+  // Exact texels, the pyramid already holds the farthest depth of everything a texel covers.
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.minLod = 0.0f;
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+  if (vkCreateSampler(device, &samplerInfo, allocationCallbacks, &depthPyramidSampler) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to create depth pyramid sampler");
+  }
+
+  const char* reducePath = "/Users/singmyr/dev/mjoelnir/Mjoelnir/src/shaders/depth_reduce_comp.spv";
+  ShaderReflection reduceReflection = reflectShaderFile(reducePath);
+  std::vector<VkDescriptorSetLayout> reduceSetLayouts = reflectedSetLayouts(reduceReflection);
+  depthReduceSetLayout = reduceSetLayouts[0];
+  depthReduceLayout = reflectedPipelineLayout(reduceSetLayouts, reduceReflection, sizeof(DepthReduceConstants));
+
+  depthReducePipeline = createComputePipeline(reducePath, depthReduceLayout);
+
+  // Instances, visibility, draw commands, instance matrices, culled matrices and the depth pyramid.
+  const char* cullPath = "/Users/singmyr/dev/mjoelnir/Mjoelnir/src/shaders/occlusion_cull_comp.spv";
+  ShaderReflection cullReflection = reflectShaderFile(cullPath);
+  std::vector<VkDescriptorSetLayout> cullSetLayouts = reflectedSetLayouts(cullReflection);
+  occlusionSetLayout = cullSetLayouts[0];
+  occlusionLayout = reflectedPipelineLayout(cullSetLayouts, cullReflection, sizeof(OcclusionConstants));
+
+  occlusionCullPipeline = createComputePipeline(cullPath, occlusionLayout);
+
+  // The sets themselves come from frameDescriptors, see updateOcclusionBuffers().
+  occlusionSets.resize(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+}
+
+void Mjoelnir::createVisibilityBuffer(uint32_t capacity) {
+  createBuffer(
+      capacity * sizeof(uint32_t),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      MemoryCategory::Buffer,
+      visibilityBuffer,
+      visibilityBufferMemory
+  );
+
+  visibilityCapacity = capacity;
+  // Cleared on the GPU before the first frame uses it.
+  visibilityCleared = false;
+}
+
+void Mjoelnir::ensureFrameLocalBuffer(FrameLocalBuffer& buffer, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties) {
+  if (buffer.size >= size) {
+      return;
+  }
+
+  VkDeviceSize capacity = buffer.size > 0 ? buffer.size : size;
+  while (capacity < size) {
+      capacity *= 2;
+  }
+
+  destroyFrameLocalBuffer(buffer);
+  createBuffer(capacity, usage, properties, MemoryCategory::Buffer, buffer.buffer, buffer.memory);
+
+  if (properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+      vkMapMemory(device, buffer.memory, 0, capacity, 0, &buffer.mapped);
+  }
+  buffer.size = capacity;
+}
+
+void Mjoelnir::destroyFrameLocalBuffer(FrameLocalBuffer& buffer) {
+  if (buffer.buffer == VK_NULL_HANDLE) {
+      return;
+  }
+
+  if (buffer.mapped != nullptr) {
+      vkUnmapMemory(device, buffer.memory);
+  }
+  vkDestroyBuffer(device, buffer.buffer, allocationCallbacks);
+  memoryTracker.free(device, buffer.memory);
+
+  buffer = FrameLocalBuffer();
+}
+
+VkPipeline Mjoelnir::createPipeline(const PipelineDescription& description) {
+  PROFILE_ZONE("createPipeline");
+
+  // A location the shader reads that nothing feeds is undefined behaviour, catch it here instead.
+  ShaderReflection reflection = reflectShaderFile(description.vertexShader);
+  for (const ReflectedInput& input : reflection.inputs) {
+      bool found = false;
+      for (uint32_t i = 0; i < description.attributeCount; i++) {
+          found = found || description.attributes[i].location == input.location;
+      }
+      if (!found) {
+          throw std::runtime_error(std::string("No vertex attribute for location ").append(std::to_string(input.location)).append(" of ").append(description.vertexShader));
+      }
+  }
+
+  // Likewise a constant set for a variant that neither stage has, it would silently do nothing.
+  const ShaderVariant& variant = description.variant;
+  if (variant.count > 0) {
+      reflection.merge(reflectShaderFile(description.fragmentShader));
+      for (uint32_t i = 0; i < variant.count; i++) {
+          if (!std::binary_search(reflection.specializationConstants.begin(), reflection.specializationConstants.end(), variant.ids[i])) {
+              throw std::runtime_error(std::string("No specialization constant ").append(std::to_string(variant.ids[i])).append(" in ").append(description.vertexShader));
+          }
+      }
+  }
+
+  // Every value is 32 bits, VkBool32 included.
+  VkSpecializationMapEntry specializationEntries[MAX_SHADER_VARIANT_CONSTANTS];
+  for (uint32_t i = 0; i < variant.count; i++) {
+      specializationEntries[i].constantID = variant.ids[i];
+      specializationEntries[i].offset = i * sizeof(uint32_t);
+      specializationEntries[i].size = sizeof(uint32_t);
+  }
+
+  VkSpecializationInfo specializationInfo{};
+  specializationInfo.mapEntryCount = variant.count;
+  specializationInfo.pMapEntries = specializationEntries;
+  specializationInfo.dataSize = variant.count * sizeof(uint32_t);
+  specializationInfo.pData = variant.values;
+
+  // todo: Need a good way to handle these paths without being so specific.
+  VkShaderModule vertShaderModule = createShaderModule(readFile(description.vertexShader));
+  VkShaderModule fragShaderModule = createShaderModule(readFile(description.fragmentShader));
 
   VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
   vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
   vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-  vertShaderStageInfo.module = vert_shader_module;
+  vertShaderStageInfo.module = vertShaderModule;
   vertShaderStageInfo.pName = "main";
-  vertShaderStageInfo.pSpecializationInfo = nullptr;
+  vertShaderStageInfo.pSpecializationInfo = variant.count > 0 ? &specializationInfo : nullptr;
   /*
       pSpecializationInfo
 
@@ -842,18 +2032,18 @@ void Mjoelnir::createGraphicsPipeline() {
   VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
   fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
   fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-  fragShaderStageInfo.module = frag_shader_module;
+  fragShaderStageInfo.module = fragShaderModule;
   fragShaderStageInfo.pName = "main";
-  fragShaderStageInfo.pSpecializationInfo = nullptr;
+  fragShaderStageInfo.pSpecializationInfo = variant.count > 0 ? &specializationInfo : nullptr;
 
   VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
 
   VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
   vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-  vertexInputInfo.vertexBindingDescriptionCount = 0;
-  vertexInputInfo.pVertexBindingDescriptions = nullptr;
-  vertexInputInfo.vertexAttributeDescriptionCount = 0;
-  vertexInputInfo.pVertexAttributeDescriptions = nullptr;
+  vertexInputInfo.vertexBindingDescriptionCount = description.bindingCount;
+  vertexInputInfo.pVertexBindingDescriptions = description.bindings;
+  vertexInputInfo.vertexAttributeDescriptionCount = description.attributeCount;
+  vertexInputInfo.pVertexAttributeDescriptions = description.attributes;
 
   VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
   inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -862,41 +2052,31 @@ void Mjoelnir::createGraphicsPipeline() {
   // VK_PRIMITIVE_TOPOLOGY_LINE_STRIP: the end vertex of every line is used as start vertex for the next line
   // VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST: triangle from every 3 vertices without reuse
   // VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP: the second and third vertex of every triangle are used as first two vertices of the next triangle
-  inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  inputAssembly.topology = description.topology;
   // If you set the primitiveRestartEnable member to VK_TRUE, then it’s possible to break up lines and triangles in the _STRIP topology modes by using a special index of 0xFFFF or 0xFFFFFFFF.
   inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-  VkViewport viewport{};
-  viewport.x = 0.0f;
-  viewport.y = 0.0f;
-  viewport.width = (float)swapChainExtent.width;
-  viewport.height = (float)swapChainExtent.height;
-  viewport.minDepth = 0.0;
-  viewport.maxDepth = 1.0f;
-
-  VkRect2D scissor = {};
-  scissor.offset = {0, 0};
-  scissor.extent = swapChainExtent;
-
   VkDynamicState dynamicStates[] = {
       VK_DYNAMIC_STATE_VIEWPORT,
-      VK_DYNAMIC_STATE_SCISSOR
+      VK_DYNAMIC_STATE_SCISSOR,
+      VK_DYNAMIC_STATE_CULL_MODE_EXT,
+      VK_DYNAMIC_STATE_FRONT_FACE_EXT,
+      VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT,
+      VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE_EXT,
+      VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE_EXT,
+      VK_DYNAMIC_STATE_DEPTH_COMPARE_OP_EXT
   };
-  // VkDynamicState* dynamicStates = malloc(2 * sizeof(VkDynamicState));
-  // dynamicStates[0] = VK_DYNAMIC_STATE_VIEWPORT;
-  // dynamicStates[1] = VK_DYNAMIC_STATE_SCISSOR;
 
+  // Everything past the scissor only with extended dynamic state, bindPipeline() sets it.
   VkPipelineDynamicStateCreateInfo dynamicState{};
   dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-  dynamicState.dynamicStateCount = 2;
+  dynamicState.dynamicStateCount = extendedDynamicStateSupported ? static_cast<uint32_t>(sizeof(dynamicStates) / sizeof(dynamicStates[0])) : BASE_DYNAMIC_STATE_COUNT;
   dynamicState.pDynamicStates = dynamicStates;
 
   VkPipelineViewportStateCreateInfo viewportState{};
   viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
   viewportState.viewportCount = 1;
-  viewportState.pViewports = &viewport;
   viewportState.scissorCount = 1;
-  viewportState.pScissors = &scissor;
 
   VkPipelineRasterizationStateCreateInfo rasterizer{};
   rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -920,8 +2100,8 @@ void Mjoelnir::createGraphicsPipeline() {
   // The cullMode variable determines the type of face culling to use.
   // You can disable culling, cull the front faces, cull the back faces or both.
   // The frontFace variable specifies the vertex order for faces to be considered front-facing and can be clockwise or counterclockwise.
-  rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-  rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+  rasterizer.cullMode = description.cullMode;
+  rasterizer.frontFace = description.frontFace;
 
   rasterizer.depthBiasEnable = VK_FALSE;
   rasterizer.depthBiasConstantFactor = 0.0f; // Optional
@@ -950,30 +2130,34 @@ void Mjoelnir::createGraphicsPipeline() {
   // If blendEnable is set to VK_FALSE, then the new color from the fragment shader is passed through unmodified.
   // Otherwise, the two mixing operations are performed to compute a new color.
   // The resulting color is AND’d with the colorWriteMask to determine which channels are actually passed through.
-  
-  // The most common way to use color blending is to implement alpha blending, where we want the new color to be blended with the old color based on its opacity.
-  // The finalColor should then be computed as follows:
-
-  // finalColor.rgb = newAlpha * newColor + (1 - newAlpha) * oldColor;
-  // finalColor.a = newAlpha.a;
-  // This can be accomplished with the following parameters:
-
-  // colorBlendAttachment.blendEnable = VK_TRUE;
-  // colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-  // colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-  // colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
-  // colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-  // colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-  // colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
   VkPipelineColorBlendAttachmentState colorBlendAttachment{};
   colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-  colorBlendAttachment.blendEnable = VK_FALSE;
-  colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
-  colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-  colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD; // Optional
-  colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
-  colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-  colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD; // Optional
+  colorBlendAttachment.blendEnable = description.blend == PipelineBlend::Opaque ? VK_FALSE : VK_TRUE;
+  colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+  colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+  switch (description.blend) {
+      case PipelineBlend::Opaque:
+          colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+          colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+          colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+          colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+          break;
+      case PipelineBlend::Alpha:
+          // finalColor.rgb = newAlpha * newColor + (1 - newAlpha) * oldColor;
+          colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+          colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+          colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+          colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+          break;
+      case PipelineBlend::Additive:
+          // The order things are drawn in doesn't matter.
+          colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+          colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+          colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+          colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+          break;
+  }
 
   VkPipelineColorBlendStateCreateInfo colorBlending{};
   colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
@@ -986,16 +2170,13 @@ void Mjoelnir::createGraphicsPipeline() {
   colorBlending.blendConstants[2] = 0.0f; // Optional
   colorBlending.blendConstants[3] = 0.0f; // Optional
 
-  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-  pipelineLayoutInfo.setLayoutCount = 0;
-  pipelineLayoutInfo.pSetLayouts = nullptr;
-  pipelineLayoutInfo.pushConstantRangeCount = 0;
-  pipelineLayoutInfo.pPushConstantRanges = nullptr;
-
-  if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
-      throw std::runtime_error("Unable to create pipeline layout");
-  }
+  VkPipelineDepthStencilStateCreateInfo depthStencil{};
+  depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depthStencil.depthTestEnable = description.depthTest ? VK_TRUE : VK_FALSE;
+  depthStencil.depthWriteEnable = description.depthWrite ? VK_TRUE : VK_FALSE;
+  depthStencil.depthCompareOp = description.depthCompareOp;
+  depthStencil.depthBoundsTestEnable = VK_FALSE;
+  depthStencil.stencilTestEnable = VK_FALSE;
 
   VkGraphicsPipelineCreateInfo pipelineInfo{};
   pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
@@ -1007,80 +2188,1797 @@ void Mjoelnir::createGraphicsPipeline() {
   pipelineInfo.pViewportState = &viewportState;
   pipelineInfo.pRasterizationState = &rasterizer;
   pipelineInfo.pMultisampleState = &multisampling;
-  pipelineInfo.pDepthStencilState = nullptr; // Optional
+  pipelineInfo.pDepthStencilState = &depthStencil;
   pipelineInfo.pColorBlendState = &colorBlending;
   pipelineInfo.pDynamicState = &dynamicState;
 
-  pipelineInfo.layout = pipelineLayout;
+  pipelineInfo.layout = description.layout;
 
-  pipelineInfo.renderPass = renderPass;
-  pipelineInfo.subpass = 0;
+  pipelineInfo.renderPass = description.renderPass;
+  pipelineInfo.subpass = description.subpass;
 
   pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
   pipelineInfo.basePipelineIndex = -1; // Optional
 
-  if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
-      throw std::runtime_error("Unable to create graphics pipeline");
-  }
-  
-  vkDestroyShaderModule(device, vert_shader_module, nullptr);
-  vkDestroyShaderModule(device, frag_shader_module, nullptr);
-}
+  VkPipeline pipeline;
+  VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, allocationCallbacks, &pipeline);
 
-void Mjoelnir::createFramebuffers() {
-  swapChainFramebuffers.resize(swapChainImages.size());
+  vkDestroyShaderModule(device, vertShaderModule, allocationCallbacks);
+  vkDestroyShaderModule(device, fragShaderModule, allocationCallbacks);
 
-  for (uint32_t i = 0; i < swapChainImages.size(); i++) {
-      VkImageView attachments[] = {
-          swapChainImageViews[i]
-      };
+  if (result != VK_SUCCESS) {
+      throw std::runtime_error(std::string("Unable to create graphics pipeline for ").append(description.vertexShader));
+  }
 
-      VkFramebufferCreateInfo framebufferInfo = {};
-      framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-      framebufferInfo.renderPass = renderPass;
-      framebufferInfo.attachmentCount = 1;
-      framebufferInfo.pAttachments = attachments;
-      framebufferInfo.width = swapChainExtent.width;
-      framebufferInfo.height = swapChainExtent.height;
-      framebufferInfo.layers = 1;
+  return pipeline;
+}
 
-      if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS) {
-          throw std::runtime_error("Unable to create framebuffer");
-      }
+GraphicsPipeline Mjoelnir::requestPipeline(const PipelineDescription& description) {
+  GraphicsPipeline result{};
+  result.topology = description.topology;
+  result.cullMode = description.cullMode;
+  result.frontFace = description.frontFace;
+  result.depthTest = description.depthTest;
+  result.depthWrite = description.depthWrite;
+  result.depthCompareOp = description.depthCompareOp;
+
+  // With extended dynamic state, descriptions that only differ in dynamic state share a pipeline.
+  PipelineDescription key = extendedDynamicStateSupported ? description.dynamicKey() : description;
+
+  result.pipeline = pipelineCache.find(key);
+  if (result.pipeline != VK_NULL_HANDLE) {
+      return result;
+  }
+
+  // Created outside of the cache's locks, another thread may be creating the same one.
+  VkPipeline pipeline = createPipeline(key);
+  result.pipeline = pipelineCache.insert(key, pipeline);
+  if (result.pipeline != pipeline) {
+      vkDestroyPipeline(device, pipeline, allocationCallbacks);
   }
+
+  return result;
 }
 
-void Mjoelnir::createCommandPool() {
-  QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+void Mjoelnir::bindPipeline(VkCommandBuffer commandBuffer, const GraphicsPipeline& pipeline) {
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipeline);
 
-  VkCommandPoolCreateInfo poolInfo{};
-  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-  poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-  
-  if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
-      throw std::runtime_error("Unable to create command pool");
+  if (extendedDynamicStateSupported) {
+      cmdSetPrimitiveTopology(commandBuffer, pipeline.topology);
+      cmdSetCullMode(commandBuffer, pipeline.cullMode);
+      cmdSetFrontFace(commandBuffer, pipeline.frontFace);
+      cmdSetDepthTestEnable(commandBuffer, pipeline.depthTest ? VK_TRUE : VK_FALSE);
+      cmdSetDepthWriteEnable(commandBuffer, pipeline.depthWrite ? VK_TRUE : VK_FALSE);
+      cmdSetDepthCompareOp(commandBuffer, pipeline.depthCompareOp);
   }
 }
 
-void Mjoelnir::createCommandBuffers() {
-  commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-
-  VkCommandBufferAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.commandPool = commandPool;
-  // VK_COMMAND_BUFFER_LEVEL_PRIMARY: Can be submitted to a queue for execution, but cannot be called from other command buffers.
-  // VK_COMMAND_BUFFER_LEVEL_SECONDARY: Cannot be submitted directly, but can be called from primary command buffers.
-  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+void Mjoelnir::reportPipelineCache() {
+  PipelineCacheStats stats = pipelineCache.stats();
+  logger.log(
+      LogSeverity::Info,
+      LogCategory::Performance,
+      "Pipelines: %u live, %llu requests, %.1f%% cache hits%s",
+      stats.pipelines,
+      static_cast<unsigned long long>(stats.requests),
+      stats.requests > 0 ? 100.0 * static_cast<double>(stats.hits) / static_cast<double>(stats.requests) : 0.0,
+      extendedDynamicStateSupported ? " (extended dynamic state)" : ""
+  );
+
+  LayoutCacheStats layoutStats = layoutCache.stats();
+  logger.log(
+      LogSeverity::Info,
+      LogCategory::Performance,
+      "Layouts: %u descriptor set, %u pipeline, %llu requests, %.1f%% cache hits",
+      layoutStats.setLayouts,
+      layoutStats.pipelineLayouts,
+      static_cast<unsigned long long>(layoutStats.requests),
+      layoutStats.requests > 0 ? 100.0 * static_cast<double>(layoutStats.hits) / static_cast<double>(layoutStats.requests) : 0.0
+  );
+}
 
-  if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
-      throw std::runtime_error("Unable to create command buffer");
+std::vector<VkDescriptorSetLayout> Mjoelnir::reflectedSetLayouts(const ShaderReflection& reflection) {
+  // Sets in between the used ones get an empty layout.
+  std::vector<VkDescriptorSetLayout> setLayouts(reflection.setCount());
+  for (uint32_t set = 0; set < setLayouts.size(); set++) {
+      setLayouts[set] = layoutCache.setLayout(reflection.setBindings(set));
   }
+  return setLayouts;
 }
 
-void Mjoelnir::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
-  VkCommandBufferBeginInfo beginInfo{};
+VkPipelineLayout Mjoelnir::reflectedPipelineLayout(const std::vector<VkDescriptorSetLayout>& setLayouts, const ShaderReflection& reflection, uint32_t pushConstantSize) {
+  // The engine's structs may be padded past the block the shaders declare, never the other way around.
+  if (reflection.pushConstantSize > pushConstantSize) {
+      throw std::runtime_error("Shader push constants are larger than the constants pushed");
+  }
+  if (pushConstantSize > 0 && reflection.pushConstantStages == 0) {
+      throw std::runtime_error("Pushing constants the shaders don't declare");
+  }
+
+  if (pushConstantSize == 0) {
+      return layoutCache.pipelineLayout(setLayouts, nullptr);
+  }
+
+  VkPushConstantRange pushConstantRange{};
+  pushConstantRange.stageFlags = reflection.pushConstantStages;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = pushConstantSize;
+
+  return layoutCache.pipelineLayout(setLayouts, &pushConstantRange);
+}
+
+void Mjoelnir::createGraphicsPipeline() {
+  PROFILE_ZONE("createGraphicsPipeline");
+
+  PipelineDescription description;
+  description.vertexShader = "/Users/singmyr/dev/mjoelnir/Mjoelnir/src/shaders/shader_vert.spv";
+  description.fragmentShader = "/Users/singmyr/dev/mjoelnir/Mjoelnir/src/shaders/shader_frag.spv";
+
+  // The frame's camera and lights in set 0, see lights.glsl, and the dequantization constants of the mesh being drawn.
+  ShaderReflection reflection = reflectShaderFile(description.vertexShader);
+  reflection.merge(reflectShaderFile(description.fragmentShader));
+  std::vector<VkDescriptorSetLayout> setLayouts = reflectedSetLayouts(reflection);
+  meshSetLayout = setLayouts[0];
+  pipelineLayout = reflectedPipelineLayout(setLayouts, reflection, sizeof(MeshQuantization));
+
+  // Binding 0 is the per-instance world matrix written by the transform hierarchy.
+  // A mat4 input takes up four consecutive locations, one per column.
+  VkVertexInputBindingDescription instanceBinding{};
+  instanceBinding.binding = 0;
+  instanceBinding.stride = sizeof(glm::mat4);
+  instanceBinding.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+  description.addBinding(instanceBinding);
+
+  for (uint32_t i = 0; i < 4; i++) {
+      VkVertexInputAttributeDescription instanceAttribute{};
+      instanceAttribute.location = i;
+      instanceAttribute.binding = 0;
+      instanceAttribute.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+      instanceAttribute.offset = i * sizeof(glm::vec4);
+      description.addAttribute(instanceAttribute);
+  }
+
+  // Binding 1 is the mesh itself in its packed form, see PackedVertex.
+  description.addBinding(packedVertexBinding(1));
+
+  VkVertexInputAttributeDescription packedAttributes[PACKED_VERTEX_ATTRIBUTE_COUNT];
+  packedVertexAttributes(1, 4, packedAttributes);
+  for (const VkVertexInputAttributeDescription& attribute : packedAttributes) {
+      description.addAttribute(attribute);
+  }
+
+  description.cullMode = VK_CULL_MODE_BACK_BIT;
+  description.frontFace = VK_FRONT_FACE_CLOCKWISE;
+
+  // Closer fragments win, the depth pyramid is built from what is written here.
+  description.depthTest = true;
+  description.depthWrite = true;
+  description.depthCompareOp = VK_COMPARE_OP_LESS;
+
+  description.renderPass = renderPass;
+  description.layout = pipelineLayout;
+
+  description.variant.setFeature(MESH_SHADER_SHOW_NORMALS, showNormals.load(std::memory_order_relaxed));
+
+  meshPipelineDescription = description;
+  graphicsPipeline = requestPipeline(description);
+}
+
+void Mjoelnir::updateMeshPipeline() {
+  ShaderVariant variant;
+  variant.setFeature(MESH_SHADER_SHOW_NORMALS, showNormals.load(std::memory_order_relaxed));
+  if (variant == meshPipelineDescription.variant) {
+      return;
+  }
+
+  // The first switch to a variant compiles it, switching back is a cache hit. Frames in flight keep
+  // using the old pipeline, which the cache keeps alive.
+  meshPipelineDescription.variant = variant;
+  graphicsPipeline = requestPipeline(meshPipelineDescription);
+}
+
+VkPipeline Mjoelnir::createComputePipeline(const char* path, VkPipelineLayout layout) {
+  VkShaderModule shaderModule = createShaderModule(readFile(path));
+
+  VkComputePipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = shaderModule;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.layout = layout;
+
+  VkPipeline pipeline;
+  VkResult result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, allocationCallbacks, &pipeline);
+  vkDestroyShaderModule(device, shaderModule, allocationCallbacks);
+
+  if (result != VK_SUCCESS) {
+      throw std::runtime_error("Unable to create compute pipeline");
+  }
+
+  return pipeline;
+}
+
+void Mjoelnir::createParticlePipelines() {
+  PROFILE_ZONE("createParticlePipelines");
+
+  const char* kickoffPath = "/Users/singmyr/dev/mjoelnir/Mjoelnir/src/shaders/particles_kickoff_comp.spv";
+  const char* emitPath = "/Users/singmyr/dev/mjoelnir/Mjoelnir/src/shaders/particles_emit_comp.spv";
+  const char* simulatePath = "/Users/singmyr/dev/mjoelnir/Mjoelnir/src/shaders/particles_simulate_comp.spv";
+
+  ShaderReflection computeReflection = reflectShaderFile(kickoffPath);
+  computeReflection.merge(reflectShaderFile(emitPath));
+  computeReflection.merge(reflectShaderFile(simulatePath));
+
+  ShaderReflection drawReflection = reflectShaderFile("/Users/singmyr/dev/mjoelnir/Mjoelnir/src/shaders/particles_vert.spv");
+  drawReflection.merge(reflectShaderFile("/Users/singmyr/dev/mjoelnir/Mjoelnir/src/shaders/particles_frag.spv"));
+
+  // Particles, dead list, alive lists and counters. The draw only reads the particles and the alive lists,
+  // but binds the same set as the compute passes so both layouts share one set layout.
+  ShaderReflection setReflection = computeReflection;
+  setReflection.merge(drawReflection);
+  std::vector<VkDescriptorSetLayout> setLayouts = reflectedSetLayouts(setReflection);
+  particleDescriptorSetLayout = setLayouts[0];
+
+  particleComputeLayout = reflectedPipelineLayout(setLayouts, computeReflection, sizeof(ParticleSimulationConstants));
+  particleKickoffPipeline = createComputePipeline(kickoffPath, particleComputeLayout);
+  particleEmitPipeline = createComputePipeline(emitPath, particleComputeLayout);
+  particleSimulatePipeline = createComputePipeline(simulatePath, particleComputeLayout);
+
+  particleDrawLayout = reflectedPipelineLayout(setLayouts, drawReflection, sizeof(ParticleDrawConstants));
+
+  // No vertex input, the quad's corners come from gl_VertexIndex and the particle from the alive list.
+  PipelineDescription description;
+  description.vertexShader = "/Users/singmyr/dev/mjoelnir/Mjoelnir/src/shaders/particles_vert.spv";
+  description.fragmentShader = "/Users/singmyr/dev/mjoelnir/Mjoelnir/src/shaders/particles_frag.spv";
+
+  // Additive, so the order particles are drawn in doesn't matter.
+  description.blend = PipelineBlend::Additive;
+
+  // Hidden behind geometry, but they don't occlude each other.
+  description.depthTest = true;
+  description.depthWrite = false;
+  description.depthCompareOp = VK_COMPARE_OP_LESS;
+
+  description.renderPass = renderPass;
+  description.layout = particleDrawLayout;
+
+  particleDrawPipeline = requestPipeline(description);
+}
+
+void Mjoelnir::createParticleBuffers() {
+  PROFILE_ZONE("createParticleBuffers");
+
+  // Every device supports at least 65535 groups per dispatch.
+  if (particleCapacity > PARTICLE_GROUP_SIZE * 65535) {
+      throw std::runtime_error("Particle capacity exceeds a single dispatch");
+  }
+
+  createBuffer(
+      particleCapacity * sizeof(GpuParticle),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      MemoryCategory::Buffer,
+      particleBuffer,
+      particleBufferMemory
+  );
+  createBuffer(
+      particleCapacity * sizeof(uint32_t),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      MemoryCategory::Buffer,
+      particleDeadListBuffer,
+      particleDeadListBufferMemory
+  );
+  createBuffer(
+      2 * particleCapacity * sizeof(uint32_t),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      MemoryCategory::Buffer,
+      particleAliveListBuffer,
+      particleAliveListBufferMemory
+  );
+  createBuffer(
+      sizeof(ParticleCounters),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      MemoryCategory::Buffer,
+      particleCounterBuffer,
+      particleCounterBufferMemory
+  );
+
+  // Every particle starts out free, the particles themselves are written when they are emitted.
+  std::vector<uint32_t> deadList(particleCapacity);
+  for (uint32_t i = 0; i < particleCapacity; i++) {
+      deadList[i] = particleCapacity - 1 - i;
+  }
+  uploadBuffer(particleDeadListBuffer, deadList.data(), deadList.size() * sizeof(uint32_t));
+
+  ParticleCounters counters{};
+  counters.deadCount = particleCapacity;
+  counters.draw.vertexCount = PARTICLE_QUAD_VERTICES;
+  uploadBuffer(particleCounterBuffer, &counters, sizeof(counters));
+}
+
+void Mjoelnir::createParticleDescriptors() {
+  PROFILE_ZONE("createParticleDescriptors");
+
+  VkDescriptorPoolSize poolSize{};
+  poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSize.descriptorCount = 4;
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = 1;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+
+  if (vkCreateDescriptorPool(device, &poolInfo, allocationCallbacks, &particleDescriptorPool) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to create particle descriptor pool");
+  }
+
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = particleDescriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &particleDescriptorSetLayout;
+
+  if (vkAllocateDescriptorSets(device, &allocInfo, &particleDescriptorSet) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to allocate particle descriptor set");
+  }
+
+  // A single set is enough for every frame in flight, the barriers in recordParticleSimulation()
+  // and the timeline semaphores in submitAsyncCompute() order the frames.
+  VkDescriptorBufferInfo bufferInfos[4] = {
+      {particleBuffer, 0, VK_WHOLE_SIZE},
+      {particleDeadListBuffer, 0, VK_WHOLE_SIZE},
+      {particleAliveListBuffer, 0, VK_WHOLE_SIZE},
+      {particleCounterBuffer, 0, VK_WHOLE_SIZE},
+  };
+
+  VkWriteDescriptorSet writes[4] = {};
+  for (uint32_t i = 0; i < 4; i++) {
+      writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[i].dstSet = particleDescriptorSet;
+      writes[i].dstBinding = i;
+      writes[i].descriptorCount = 1;
+      writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      writes[i].pBufferInfo = &bufferInfos[i];
+  }
+
+  vkUpdateDescriptorSets(device, 4, writes, 0, nullptr);
+}
+
+void Mjoelnir::destroyParticles() {
+  vkDestroyPipeline(device, particleSimulatePipeline, allocationCallbacks);
+  vkDestroyPipeline(device, particleEmitPipeline, allocationCallbacks);
+  vkDestroyPipeline(device, particleKickoffPipeline, allocationCallbacks);
+  vkDestroyDescriptorPool(device, particleDescriptorPool, allocationCallbacks);
+
+  vkDestroyBuffer(device, particleBuffer, allocationCallbacks);
+  memoryTracker.free(device, particleBufferMemory);
+  vkDestroyBuffer(device, particleDeadListBuffer, allocationCallbacks);
+  memoryTracker.free(device, particleDeadListBufferMemory);
+  vkDestroyBuffer(device, particleAliveListBuffer, allocationCallbacks);
+  memoryTracker.free(device, particleAliveListBufferMemory);
+  vkDestroyBuffer(device, particleCounterBuffer, allocationCallbacks);
+  memoryTracker.free(device, particleCounterBufferMemory);
+}
+
+void Mjoelnir::updateParticles(float deltaTime) {
+  PROFILE_ZONE("updateParticles");
+
+  if (enableParticleBenchmark && particleBenchmark.running()) {
+      particleBenchmark.frame(Profiler::now(), cpuFrameTime, gpuFrameTime, gpuComputeTime);
+
+      if (particleBenchmark.running()) {
+          // Emitting count / lifetime per second keeps count particles alive.
+          particleEmitter.rate = static_cast<float>(particleBenchmark.particleCount()) / particleEmitter.lifetime;
+      } else {
+          particleBenchmark.report(logger);
+          stopRendering();
+      }
+  }
+
+  // The CPU only decides how many particles to emit, the GPU clamps that to the free ones.
+  float emitted = particleEmitter.rate * deltaTime + particleEmitRemainder;
+  uint32_t emitCount = static_cast<uint32_t>(emitted);
+  particleEmitRemainder = emitted - static_cast<float>(emitCount);
+
+  particleConstants.emitterPosition = glm::vec4(particleEmitter.position, particleEmitter.speed);
+  particleConstants.emitterDirection = glm::vec4(glm::normalize(particleEmitter.direction), particleEmitter.spread);
+  particleConstants.gravity = glm::vec4(particleEmitter.gravity, particleEmitter.lifetime);
+  particleConstants.deltaTime = deltaTime;
+  particleConstants.emitCount = emitCount;
+  particleConstants.seed = static_cast<uint32_t>(frameNumber);
+}
+
+void Mjoelnir::recordParticleSimulation(VkCommandBuffer commandBuffer) {
+  auto barrier = [commandBuffer](VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages, VkAccessFlags dstAccess) {
+      VkMemoryBarrier memoryBarrier{};
+      memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+      memoryBarrier.dstAccessMask = dstAccess;
+      vkCmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+  };
+
+  particleConstants.readOffset = particleParity * particleCapacity;
+  particleConstants.writeOffset = (particleParity ^ 1) * particleCapacity;
+  particleParity ^= 1;
+
+  // The previous frame's simulation wrote what this one reads, and its draw read the alive list and
+  // the indirect arguments about to be overwritten. On the compute queue the draw is waited for
+  // through graphicsTimeline, and the compute queue has no vertex stage to name.
+  barrier(
+      asyncComputeActive
+          ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+          : VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+  );
+
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particleComputeLayout, 0, 1, &particleDescriptorSet, 0, nullptr);
+  vkCmdPushConstants(commandBuffer, particleComputeLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ParticleSimulationConstants), &particleConstants);
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particleKickoffPipeline);
+  vkCmdDispatch(commandBuffer, 1, 1, 1);
+
+  barrier(
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT
+  );
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particleEmitPipeline);
+  vkCmdDispatchIndirect(commandBuffer, particleCounterBuffer, offsetof(ParticleCounters, emitDispatch));
+
+  barrier(
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+  );
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particleSimulatePipeline);
+  vkCmdDispatchIndirect(commandBuffer, particleCounterBuffer, offsetof(ParticleCounters, simulateDispatch));
+
+  // The draw reads the survivors and their count, the graphics submit waits on computeTimeline for them
+  // when this ran on the compute queue.
+  if (!asyncComputeActive) {
+      barrier(
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+          VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+          VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT
+      );
+  }
+}
+
+void Mjoelnir::recordParticleDraw(VkCommandBuffer commandBuffer) {
+  bindPipeline(commandBuffer, particleDrawPipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, particleDrawLayout, 0, 1, &particleDescriptorSet, 0, nullptr);
+
+  ParticleDrawConstants constants{};
+  constants.viewProjection = viewProjection;
+  // Square on screen whatever the aspect ratio.
+  float aspect = static_cast<float>(swapChainExtent.height) / static_cast<float>(swapChainExtent.width);
+  constants.size = glm::vec2(particleEmitter.size * aspect, particleEmitter.size);
+  constants.aliveOffset = particleConstants.writeOffset;
+  vkCmdPushConstants(commandBuffer, particleDrawLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ParticleDrawConstants), &constants);
+
+  // The instance count is the number of survivors the simulation counted.
+  vkCmdDrawIndirect(commandBuffer, particleCounterBuffer, offsetof(ParticleCounters, draw), 1, sizeof(VkDrawIndirectCommand));
+}
+
+void Mjoelnir::createSpritePipelines() {
+  PROFILE_ZONE("createSpritePipelines");
+
+  // Linear, the padding around every image keeps neighbors from bleeding in.
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.minLod = 0.0f;
+  samplerInfo.maxLod = 0.0f;
+
+  if (vkCreateSampler(device, &samplerInfo, allocationCallbacks, &spriteSampler) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to create sprite sampler");
+  }
+
+  PipelineDescription description;
+  description.vertexShader = "/Users/singmyr/dev/mjoelnir/Mjoelnir/src/shaders/sprites_vert.spv";
+  description.fragmentShader = "/Users/singmyr/dev/mjoelnir/Mjoelnir/src/shaders/sprites_frag.spv";
+
+  // The atlas, and the screen scale and page pushed by both stages.
+  ShaderReflection reflection = reflectShaderFile(description.vertexShader);
+  reflection.merge(reflectShaderFile(description.fragmentShader));
+  std::vector<VkDescriptorSetLayout> setLayouts = reflectedSetLayouts(reflection);
+  spriteSetLayout = setLayouts[0];
+  spriteLayout = reflectedPipelineLayout(setLayouts, reflection, sizeof(SpriteConstants));
+
+  // One SpriteInstance per instance, the quad's corners come from gl_VertexIndex.
+  VkVertexInputBindingDescription binding{};
+  binding.binding = 0;
+  binding.stride = sizeof(SpriteInstance);
+  binding.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+  description.addBinding(binding);
+
+  description.addAttribute({0, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(SpriteInstance, position)});
+  description.addAttribute({1, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(SpriteInstance, size)});
+  description.addAttribute({2, 0, VK_FORMAT_R16G16B16A16_UNORM, offsetof(SpriteInstance, uv)});
+  description.addAttribute({3, 0, VK_FORMAT_R8G8B8A8_UNORM, offsetof(SpriteInstance, color)});
+  description.addAttribute({4, 0, VK_FORMAT_R32_SFLOAT, offsetof(SpriteInstance, rotation)});
+
+  // An overlay, drawn in submission order on top of the scene.
+  description.depthTest = false;
+  description.depthWrite = false;
+
+  // At full resolution, after the scene has been upscaled.
+  description.renderPass = presentRenderPass;
+  description.layout = spriteLayout;
+
+  description.blend = PipelineBlend::Alpha;
+  spritePipelines[static_cast<size_t>(SpriteBlend::Alpha)] = requestPipeline(description);
+  description.blend = PipelineBlend::Additive;
+  spritePipelines[static_cast<size_t>(SpriteBlend::Additive)] = requestPipeline(description);
+}
+
+void Mjoelnir::createSpriteResources() {
+  PROFILE_ZONE("createSpriteResources");
+
+  // Every page is allocated up front, opening a page only hands out a layer.
+  createImage(
+      SPRITE_ATLAS_PAGE_SIZE,
+      SPRITE_ATLAS_PAGE_SIZE,
+      1,
+      SPRITE_ATLAS_MAX_PAGES,
+      VK_FORMAT_R8G8B8A8_UNORM,
+      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+      spriteAtlasImage,
+      spriteAtlasMemory
+  );
+
+  VkImageViewCreateInfo viewInfo{};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = spriteAtlasImage;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+  viewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+  viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  viewInfo.subresourceRange.baseMipLevel = 0;
+  viewInfo.subresourceRange.levelCount = 1;
+  viewInfo.subresourceRange.baseArrayLayer = 0;
+  viewInfo.subresourceRange.layerCount = SPRITE_ATLAS_MAX_PAGES;
+
+  if (vkCreateImageView(device, &viewInfo, allocationCallbacks, &spriteAtlasView) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to create sprite atlas view");
+  }
+
+  spriteInstanceBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  spriteStagingBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+}
+
+void Mjoelnir::createSpriteDescriptors() {
+  PROFILE_ZONE("createSpriteDescriptors");
+
+  VkDescriptorPoolSize poolSize{};
+  poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSize.descriptorCount = 1;
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = 1;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+
+  if (vkCreateDescriptorPool(device, &poolInfo, allocationCallbacks, &spriteDescriptorPool) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to create sprite descriptor pool");
+  }
+
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = spriteDescriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &spriteSetLayout;
+
+  if (vkAllocateDescriptorSets(device, &allocInfo, &spriteDescriptorSet) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to allocate sprite descriptor set");
+  }
+
+  VkDescriptorImageInfo atlasInfo{};
+  atlasInfo.sampler = spriteSampler;
+  atlasInfo.imageView = spriteAtlasView;
+  atlasInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  VkWriteDescriptorSet write{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = spriteDescriptorSet;
+  write.dstBinding = 0;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  write.pImageInfo = &atlasInfo;
+
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+void Mjoelnir::destroySprites() {
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+      destroyFrameLocalBuffer(spriteInstanceBuffers[i]);
+      destroyFrameLocalBuffer(spriteStagingBuffers[i]);
+  }
+
+  vkDestroyDescriptorPool(device, spriteDescriptorPool, allocationCallbacks);
+  vkDestroySampler(device, spriteSampler, allocationCallbacks);
+
+  vkDestroyImageView(device, spriteAtlasView, allocationCallbacks);
+  vkDestroyImage(device, spriteAtlasImage, allocationCallbacks);
+  memoryTracker.free(device, spriteAtlasMemory);
+}
+
+bool Mjoelnir::addSpriteImage(const uint8_t* pixels, uint32_t width, uint32_t height, SpriteImage& image) {
+  std::lock_guard<std::mutex> lock(spriteUploadMutex);
+
+  SpriteUpload upload;
+  if (!spriteAtlas.allocate(width, height, image, upload.x, upload.y)) {
+      return false;
+  }
+
+  upload.page = image.page;
+  upload.width = width;
+  upload.height = height;
+  upload.pixels.assign(pixels, pixels + static_cast<size_t>(width) * height * 4);
+  spriteUploads.push_back(std::move(upload));
+  return true;
+}
+
+void Mjoelnir::updateSprites() {
+  PROFILE_ZONE("updateSprites");
+
+  // Only called once this frame's fence has signaled, so the GPU is done with the frame's buffers.
+  std::vector<SpriteUpload> uploads;
+  {
+      std::lock_guard<std::mutex> lock(spriteUploadMutex);
+      uploads.swap(spriteUploads);
+  }
+
+  spriteCopies.clear();
+  if (!uploads.empty()) {
+      VkDeviceSize stagingSize = 0;
+      for (const SpriteUpload& upload : uploads) {
+          stagingSize += upload.pixels.size();
+      }
+
+      ensureFrameLocalBuffer(
+          spriteStagingBuffers[currentFrame],
+          stagingSize,
+          VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+      );
+
+      uint8_t* staging = static_cast<uint8_t*>(spriteStagingBuffers[currentFrame].mapped);
+      VkDeviceSize offset = 0;
+      for (const SpriteUpload& upload : uploads) {
+          memcpy(staging + offset, upload.pixels.data(), upload.pixels.size());
+
+          VkBufferImageCopy copy{};
+          copy.bufferOffset = offset;
+          copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+          copy.imageSubresource.mipLevel = 0;
+          copy.imageSubresource.baseArrayLayer = upload.page;
+          copy.imageSubresource.layerCount = 1;
+          copy.imageOffset = {static_cast<int32_t>(upload.x), static_cast<int32_t>(upload.y), 0};
+          copy.imageExtent = {upload.width, upload.height, 1};
+          spriteCopies.push_back(copy);
+
+          offset += upload.pixels.size();
+      }
+  }
+
+  spriteBatch.clear();
+  if (spriteCallback) {
+      spriteCallback(spriteBatch, swapChainExtent.width, swapChainExtent.height);
+  }
+
+  uint32_t spriteCount = spriteBatch.size();
+  if (spriteCount == 0) {
+      return;
+  }
+
+  // Written in draw order straight into the frame's buffer, nothing is copied on the GPU.
+  ensureFrameLocalBuffer(
+      spriteInstanceBuffers[currentFrame],
+      std::max(spriteCount, INITIAL_SPRITE_CAPACITY) * sizeof(SpriteInstance),
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+  );
+  spriteBatch.build(static_cast<SpriteInstance*>(spriteInstanceBuffers[currentFrame].mapped));
+}
+
+void Mjoelnir::recordSpriteUploads(VkCommandBuffer commandBuffer) {
+  if (spriteAtlasInitialized && spriteCopies.empty()) {
+      return;
+  }
+
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = spriteAtlasImage;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = 0;
+  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = SPRITE_ATLAS_MAX_PAGES;
+
+  // Earlier frames may still be sampling the atlas, the images they use aren't touched though.
+  barrier.srcAccessMask = spriteAtlasInitialized ? VK_ACCESS_SHADER_READ_BIT : 0;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = spriteAtlasInitialized ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+  if (!spriteAtlasInitialized) {
+      // Transparent padding, and something defined to sample for images that were never added.
+      VkClearColorValue clearColor = {{0.0f, 0.0f, 0.0f, 0.0f}};
+      vkCmdClearColorImage(commandBuffer, spriteAtlasImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clearColor, 1, &barrier.subresourceRange);
+      spriteAtlasInitialized = true;
+  }
+
+  if (!spriteCopies.empty()) {
+      vkCmdCopyBufferToImage(
+          commandBuffer,
+          spriteStagingBuffers[currentFrame].buffer,
+          spriteAtlasImage,
+          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          static_cast<uint32_t>(spriteCopies.size()),
+          spriteCopies.data()
+      );
+  }
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void Mjoelnir::recordSpriteDraw(VkCommandBuffer commandBuffer) {
+  const std::vector<SpriteDraw>& draws = spriteBatch.draws();
+  if (draws.empty()) {
+      return;
+  }
+
+  VkBuffer instanceBuffer = spriteInstanceBuffers[currentFrame].buffer;
+  VkDeviceSize instanceOffset = 0;
+  vkCmdBindVertexBuffers(commandBuffer, 0, 1, &instanceBuffer, &instanceOffset);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, spriteLayout, 0, 1, &spriteDescriptorSet, 0, nullptr);
+
+  SpriteConstants constants{};
+  constants.screenScale = glm::vec2(2.0f / static_cast<float>(swapChainExtent.width), 2.0f / static_cast<float>(swapChainExtent.height));
+
+  // Runs of the same layer, blend mode and page, the pipeline only changes with the blend mode.
+  SpriteBlend boundBlend = SpriteBlend::Count;
+  for (const SpriteDraw& draw : draws) {
+      if (draw.blend != boundBlend) {
+          bindPipeline(commandBuffer, spritePipelines[static_cast<size_t>(draw.blend)]);
+          boundBlend = draw.blend;
+      }
+
+      constants.page = draw.page;
+      vkCmdPushConstants(commandBuffer, spriteLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(SpriteConstants), &constants);
+      vkCmdDraw(commandBuffer, SPRITE_QUAD_VERTICES, draw.instanceCount, 0, draw.firstInstance);
+  }
+}
+
+void Mjoelnir::createLightPipelines() {
+  PROFILE_ZONE("createLightPipelines");
+
+  // Frame uniforms, lights, cluster counts, cluster lights and cluster bounds.
+  const char* cullPath = "/Users/singmyr/dev/mjoelnir/Mjoelnir/src/shaders/light_cull_comp.spv";
+  ShaderReflection cullReflection = reflectShaderFile(cullPath);
+  std::vector<VkDescriptorSetLayout> cullSetLayouts = reflectedSetLayouts(cullReflection);
+  lightCullSetLayout = cullSetLayouts[0];
+  lightCullLayout = reflectedPipelineLayout(cullSetLayouts, cullReflection, 0);
+
+  lightCullPipeline = createComputePipeline(cullPath, lightCullLayout);
+}
+
+void Mjoelnir::createLightResources() {
+  PROFILE_ZONE("createLightResources");
+
+  frameUniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  lightBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  clusterBoundsBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  clusterCountBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  clusterLightBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  clusterBoundsUploaded.resize(MAX_FRAMES_IN_FLIGHT, UINT64_MAX);
+  meshSets.resize(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+  lightCullSets.resize(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+}
+
+void Mjoelnir::destroyLights() {
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+      destroyFrameLocalBuffer(frameUniformBuffers[i]);
+      destroyFrameLocalBuffer(lightBuffers[i]);
+      destroyFrameLocalBuffer(clusterBoundsBuffers[i]);
+      destroyFrameLocalBuffer(clusterCountBuffers[i]);
+      destroyFrameLocalBuffer(clusterLightBuffers[i]);
+  }
+
+  vkDestroyPipeline(device, lightCullPipeline, allocationCallbacks);
+}
+
+void Mjoelnir::updateLights() {
+  PROFILE_ZONE("updateLights");
+
+  if (clusterBounds.empty() || projectionMatrix != clusterProjection) {
+      clusterDepthParameters = clusterDepth(projectionMatrix);
+      clusterBounds.resize(CLUSTER_COUNT);
+      buildClusterBounds(projectionMatrix, clusterDepthParameters, clusterBounds.data());
+      clusterProjection = projectionMatrix;
+      clusterBoundsVersion++;
+  }
+
+  // Only called once this frame's fence has signaled, so the GPU is done with the frame's buffers.
+  ensureFrameLocalBuffer(
+      frameUniformBuffers[currentFrame],
+      sizeof(FrameUniforms),
+      VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+  );
+  ensureFrameLocalBuffer(
+      lightBuffers[currentFrame],
+      std::max(static_cast<uint32_t>(frameLights.size()), INITIAL_LIGHT_CAPACITY) * sizeof(GpuLight),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+  );
+  ensureFrameLocalBuffer(
+      clusterBoundsBuffers[currentFrame],
+      CLUSTER_COUNT * sizeof(ClusterBounds),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+  );
+  ensureFrameLocalBuffer(
+      clusterCountBuffers[currentFrame],
+      CLUSTER_COUNT * sizeof(uint32_t),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+  );
+  ensureFrameLocalBuffer(
+      clusterLightBuffers[currentFrame],
+      CLUSTER_COUNT * CLUSTER_MAX_LIGHTS * sizeof(uint32_t),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+  );
+
+  FrameUniforms uniforms{};
+  uniforms.view = viewMatrix;
+  uniforms.viewProjection = viewProjection;
+  uniforms.ambient = glm::vec4(ambientLight, 0.0f);
+  uniforms.depthLinearize = clusterDepthParameters.linearize;
+  uniforms.tileScale = glm::vec2(
+      static_cast<float>(CLUSTER_TILES_X) / static_cast<float>(renderExtent.width),
+      static_cast<float>(CLUSTER_TILES_Y) / static_cast<float>(renderExtent.height)
+  );
+  uniforms.sliceScale = clusterDepthParameters.sliceScale;
+  uniforms.sliceBias = clusterDepthParameters.sliceBias;
+  uniforms.logarithmicSlices = clusterDepthParameters.logarithmic ? 1 : 0;
+  uniforms.lightCount = static_cast<uint32_t>(frameLights.size());
+  memcpy(frameUniformBuffers[currentFrame].mapped, &uniforms, sizeof(FrameUniforms));
+
+  if (!frameLights.empty()) {
+      memcpy(lightBuffers[currentFrame].mapped, frameLights.data(), frameLights.size() * sizeof(GpuLight));
+  }
+
+  if (clusterBoundsUploaded[currentFrame] != clusterBoundsVersion) {
+      memcpy(clusterBoundsBuffers[currentFrame].mapped, clusterBounds.data(), CLUSTER_COUNT * sizeof(ClusterBounds));
+      clusterBoundsUploaded[currentFrame] = clusterBoundsVersion;
+  }
+
+  // Any of the buffers may have been recreated, so the frame gets fresh sets every time.
+  meshSets[currentFrame] = frameDescriptors[currentFrame].allocate(meshSetLayout);
+  lightCullSets[currentFrame] = frameDescriptors[currentFrame].allocate(lightCullSetLayout);
+
+  VkDescriptorBufferInfo bufferInfos[5] = {
+      {frameUniformBuffers[currentFrame].buffer, 0, VK_WHOLE_SIZE},
+      {lightBuffers[currentFrame].buffer, 0, VK_WHOLE_SIZE},
+      {clusterCountBuffers[currentFrame].buffer, 0, VK_WHOLE_SIZE},
+      {clusterLightBuffers[currentFrame].buffer, 0, VK_WHOLE_SIZE},
+      {clusterBoundsBuffers[currentFrame].buffer, 0, VK_WHOLE_SIZE},
+  };
+
+  // The mesh set is the first four bindings of the culling set.
+  VkWriteDescriptorSet writes[9] = {};
+  for (uint32_t i = 0; i < 9; i++) {
+      uint32_t binding = i < 4 ? i : i - 4;
+      writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[i].dstSet = i < 4 ? meshSets[currentFrame] : lightCullSets[currentFrame];
+      writes[i].dstBinding = binding;
+      writes[i].descriptorCount = 1;
+      writes[i].descriptorType = binding == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      writes[i].pBufferInfo = &bufferInfos[binding];
+  }
+
+  vkUpdateDescriptorSets(device, 9, writes, 0, nullptr);
+}
+
+void Mjoelnir::recordLightCulling(VkCommandBuffer commandBuffer) {
+  // The cluster lists are per frame in flight, the last frame that read them has signaled its fence.
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lightCullPipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lightCullLayout, 0, 1, &lightCullSets[currentFrame], 0, nullptr);
+  vkCmdDispatch(commandBuffer, (CLUSTER_COUNT + LIGHT_CULL_GROUP_SIZE - 1) / LIGHT_CULL_GROUP_SIZE, 1, 1);
+
+  // On the compute queue the graphics submit waits on computeTimeline instead.
+  if (asyncComputeActive) {
+      return;
+  }
+
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void Mjoelnir::submitAsyncCompute() {
+  PROFILE_ZONE("submitAsyncCompute");
+
+  bool computeTimestamps = timestampQueryPool != VK_NULL_HANDLE && timestampsPerFrame > 2;
+  VkCommandBuffer lightCullCommandBuffer = lightCullCommandBuffers[currentFrame];
+  VkCommandBuffer particleCommandBuffer = particleCommandBuffers[currentFrame];
+
+  auto begin = [this, computeTimestamps](VkCommandBuffer commandBuffer, uint32_t query) {
+      VkCommandBufferBeginInfo beginInfo{};
+      beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+      beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+      vkResetCommandBuffer(commandBuffer, 0);
+      if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+          throw std::runtime_error("Unable to begin recording compute command buffer");
+      }
+
+      if (computeTimestamps) {
+          vkCmdResetQueryPool(commandBuffer, timestampQueryPool, query, 2);
+          vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, query);
+      }
+  };
+  auto end = [this, computeTimestamps](VkCommandBuffer commandBuffer, uint32_t query) {
+      if (computeTimestamps) {
+          vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, query + 1);
+      }
+
+      if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+          throw std::runtime_error("Unable to record compute command buffer");
+      }
+  };
+
+  uint32_t query = currentFrame * timestampsPerFrame + 2;
+  begin(lightCullCommandBuffer, query);
+  recordLightCulling(lightCullCommandBuffer);
+  end(lightCullCommandBuffer, query);
+
+  begin(particleCommandBuffer, query + 2);
+  recordParticleSimulation(particleCommandBuffer);
+  end(particleCommandBuffer, query + 2);
+
+  // Light culling only touches this frame's buffers and starts right away, next to whatever is left of
+  // the previous frame's graphics work.
+  VkSubmitInfo submitInfos[2] = {};
+  submitInfos[0].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfos[0].commandBufferCount = 1;
+  submitInfos[0].pCommandBuffers = &lightCullCommandBuffer;
+
+  // The particles overwrite the counters and the alive list the previous frame's draw reads. The wait
+  // covers every command, so the timestamps don't count the time spent waiting.
+  uint64_t particleWaitValue = frameNumber;
+  uint64_t particleSignalValue = frameNumber + 1;
+  VkPipelineStageFlags particleWaitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+  VkTimelineSemaphoreSubmitInfo particleTimeline{};
+  particleTimeline.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  particleTimeline.waitSemaphoreValueCount = 1;
+  particleTimeline.pWaitSemaphoreValues = &particleWaitValue;
+  particleTimeline.signalSemaphoreValueCount = 1;
+  particleTimeline.pSignalSemaphoreValues = &particleSignalValue;
+
+  // The signal covers light culling as well, it was submitted before.
+  submitInfos[1].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfos[1].pNext = &particleTimeline;
+  submitInfos[1].waitSemaphoreCount = 1;
+  submitInfos[1].pWaitSemaphores = &graphicsTimeline;
+  submitInfos[1].pWaitDstStageMask = &particleWaitStage;
+  submitInfos[1].commandBufferCount = 1;
+  submitInfos[1].pCommandBuffers = &particleCommandBuffer;
+  submitInfos[1].signalSemaphoreCount = 1;
+  submitInfos[1].pSignalSemaphores = &computeTimeline;
+
+  if (vkQueueSubmit(computeQueue, 2, submitInfos, VK_NULL_HANDLE) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to submit compute command buffers");
+  }
+}
+
+void Mjoelnir::createUpscalePipeline() {
+  PROFILE_ZONE("createUpscalePipeline");
+
+  // Bilinear, UpscaleConstants::uvMax keeps it inside the render area.
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.minLod = 0.0f;
+  samplerInfo.maxLod = 0.0f;
+
+  if (vkCreateSampler(device, &samplerInfo, allocationCallbacks, &upscaleSampler) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to create upscale sampler");
+  }
+
+  PipelineDescription description;
+  description.vertexShader = "/Users/singmyr/dev/mjoelnir/Mjoelnir/src/shaders/upscale_vert.spv";
+  description.fragmentShader = "/Users/singmyr/dev/mjoelnir/Mjoelnir/src/shaders/upscale_frag.spv";
+
+  // The scene target, and where the render area is in it.
+  ShaderReflection reflection = reflectShaderFile(description.vertexShader);
+  reflection.merge(reflectShaderFile(description.fragmentShader));
+  std::vector<VkDescriptorSetLayout> setLayouts = reflectedSetLayouts(reflection);
+  upscaleSetLayout = setLayouts[0];
+  upscaleLayout = reflectedPipelineLayout(setLayouts, reflection, sizeof(UpscaleConstants));
+
+  // A single triangle from gl_VertexIndex, nothing to read from buffers.
+  description.renderPass = presentRenderPass;
+  description.layout = upscaleLayout;
+
+  upscalePipeline = requestPipeline(description);
+
+  // The sets themselves come from frameDescriptors, see updateRenderResolution().
+  upscaleSets.resize(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+}
+
+void Mjoelnir::updateRenderResolution() {
+  // The timestamps are all the controller has to go by.
+  float scale = MAX_RENDER_SCALE;
+  if (gpuFrameBudget.load(std::memory_order_relaxed) > 0 && timestampQueryPool != VK_NULL_HANDLE) {
+      scale = resolutionController.renderScale();
+  }
+  renderExtent = scaledExtent(swapChainExtent, scale);
+  frameRenderScales[currentFrame] = scale;
+
+  // The scene target is recreated along with the swap chain, so the frame gets a fresh set every time.
+  upscaleSets[currentFrame] = frameDescriptors[currentFrame].allocate(upscaleSetLayout);
+
+  VkDescriptorImageInfo sceneInfo{};
+  sceneInfo.sampler = upscaleSampler;
+  sceneInfo.imageView = sceneColorView;
+  sceneInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  VkWriteDescriptorSet write{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = upscaleSets[currentFrame];
+  write.dstBinding = 0;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  write.pImageInfo = &sceneInfo;
+
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+void Mjoelnir::recordUpscale(VkCommandBuffer commandBuffer) {
+  bindPipeline(commandBuffer, upscalePipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, upscaleLayout, 0, 1, &upscaleSets[currentFrame], 0, nullptr);
+
+  float width = static_cast<float>(swapChainExtent.width);
+  float height = static_cast<float>(swapChainExtent.height);
+
+  UpscaleConstants constants{};
+  constants.uvScale = glm::vec2(static_cast<float>(renderExtent.width) / width, static_cast<float>(renderExtent.height) / height);
+  constants.uvMax = glm::vec2((static_cast<float>(renderExtent.width) - 0.5f) / width, (static_cast<float>(renderExtent.height) - 0.5f) / height);
+  vkCmdPushConstants(commandBuffer, upscaleLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(UpscaleConstants), &constants);
+
+  vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+}
+
+void Mjoelnir::createFramebuffers() {
+  PROFILE_ZONE("createFramebuffers");
+
+  VkImageView sceneAttachments[] = {
+      sceneColorView,
+      depthImageView
+  };
+
+  VkFramebufferCreateInfo framebufferInfo = {};
+  framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebufferInfo.renderPass = renderPass;
+  framebufferInfo.attachmentCount = 2;
+  framebufferInfo.pAttachments = sceneAttachments;
+  framebufferInfo.width = swapChainExtent.width;
+  framebufferInfo.height = swapChainExtent.height;
+  framebufferInfo.layers = 1;
+
+  if (vkCreateFramebuffer(device, &framebufferInfo, allocationCallbacks, &sceneFramebuffer) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to create scene framebuffer");
+  }
+
+  // Only the present pass draws into the swap chain images.
+  swapChainFramebuffers.resize(swapChainImages.size());
+
+  for (uint32_t i = 0; i < swapChainImages.size(); i++) {
+      framebufferInfo.renderPass = presentRenderPass;
+      framebufferInfo.attachmentCount = 1;
+      framebufferInfo.pAttachments = &swapChainImageViews[i];
+
+      if (vkCreateFramebuffer(device, &framebufferInfo, allocationCallbacks, &swapChainFramebuffers[i]) != VK_SUCCESS) {
+          throw std::runtime_error("Unable to create framebuffer");
+      }
+  }
+}
+
+void Mjoelnir::createCommandPool() {
+  PROFILE_ZONE("createCommandPool");
+
+  QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+  VkCommandPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+  
+  if (vkCreateCommandPool(device, &poolInfo, allocationCallbacks, &commandPool) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to create command pool");
+  }
+
+  if (asyncComputeEnabled) {
+      poolInfo.queueFamilyIndex = computeQueueFamily;
+
+      if (vkCreateCommandPool(device, &poolInfo, allocationCallbacks, &computeCommandPool) != VK_SUCCESS) {
+          throw std::runtime_error("Unable to create compute command pool");
+      }
+  }
+}
+
+uint32_t Mjoelnir::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+      if ((typeFilter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+          return i;
+      }
+  }
+
+  throw std::runtime_error("Failed to find suitable memory type");
+}
+
+void Mjoelnir::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, MemoryCategory category, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+  VkBufferCreateInfo bufferInfo{};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = size;
+  bufferInfo.usage = usage;
+  // Both queues may use any buffer, concurrent sharing saves the ownership transfers.
+  uint32_t queueFamilies[] = {graphicsQueueFamily, computeQueueFamily};
+  if (asyncComputeEnabled) {
+      bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+      bufferInfo.queueFamilyIndexCount = 2;
+      bufferInfo.pQueueFamilyIndices = queueFamilies;
+  } else {
+      bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  }
+
+  if (vkCreateBuffer(device, &bufferInfo, allocationCallbacks, &buffer) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to create buffer");
+  }
+
+  VkMemoryRequirements memoryRequirements;
+  vkGetBufferMemoryRequirements(device, buffer, &memoryRequirements);
+
+  VkMemoryAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = memoryRequirements.size;
+  allocInfo.memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits, properties);
+
+  if (memoryTracker.allocate(device, allocInfo, category, &bufferMemory) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to allocate buffer memory");
+  }
+
+  vkBindBufferMemory(device, buffer, bufferMemory, 0);
+}
+
+void Mjoelnir::createInstanceBuffer(uint32_t frame, uint32_t capacity) {
+  createBuffer(
+      capacity * sizeof(glm::mat4),
+      // The culling shader copies the matrices of the instances that survive.
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      MemoryCategory::Buffer,
+      instanceBuffers[frame],
+      instanceBuffersMemory[frame]
+  );
+
+  // Stays mapped for the lifetime of the buffer, the transform hierarchy writes straight into it.
+  vkMapMemory(device, instanceBuffersMemory[frame], 0, capacity * sizeof(glm::mat4), 0, &instanceBuffersMapped[frame]);
+
+  instanceBufferCapacities[frame] = capacity;
+  // Fresh memory has seen none of the matrices yet.
+  instanceBufferVersions[frame] = 0;
+}
+
+void Mjoelnir::destroyInstanceBuffer(uint32_t frame) {
+  vkUnmapMemory(device, instanceBuffersMemory[frame]);
+  vkDestroyBuffer(device, instanceBuffers[frame], allocationCallbacks);
+  memoryTracker.free(device, instanceBuffersMemory[frame]);
+}
+
+void Mjoelnir::uploadBuffer(VkBuffer buffer, const void* data, VkDeviceSize size) {
+  VkBuffer stagingBuffer;
+  VkDeviceMemory stagingBufferMemory;
+  createBuffer(
+      size,
+      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      MemoryCategory::Staging,
+      stagingBuffer,
+      stagingBufferMemory
+  );
+
+  void* mapped;
+  vkMapMemory(device, stagingBufferMemory, 0, size, 0, &mapped);
+  memcpy(mapped, data, static_cast<size_t>(size));
+  vkUnmapMemory(device, stagingBufferMemory);
+
+  VkCommandBufferAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandPool = commandPool;
+  allocInfo.commandBufferCount = 1;
+
+  VkCommandBuffer commandBuffer;
+  vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+  VkBufferCopy copyRegion{};
+  copyRegion.size = size;
+  vkCmdCopyBuffer(commandBuffer, stagingBuffer, buffer, 1, &copyRegion);
+
+  vkEndCommandBuffer(commandBuffer);
+
+  VkSubmitInfo submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+
+  // Only used while loading, so simply waiting for the copy is fine.
+  vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+  vkQueueWaitIdle(graphicsQueue);
+
+  vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+  vkDestroyBuffer(device, stagingBuffer, allocationCallbacks);
+  memoryTracker.free(device, stagingBufferMemory);
+}
+
+uint32_t Mjoelnir::uploadMesh(const ProcessedMesh& processed) {
+  GpuMesh mesh{};
+  mesh.indexCount = processed.indexCount;
+  mesh.indexType = processed.indexType;
+  mesh.lods = processed.lods;
+  mesh.quantization = processed.quantization;
+  mesh.bounds = processed.bounds;
+
+  VkDeviceSize vertexBytes = processed.vertices.size() * sizeof(PackedVertex);
+  createBuffer(
+      vertexBytes,
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      MemoryCategory::Buffer,
+      mesh.vertexBuffer,
+      mesh.vertexBufferMemory
+  );
+  uploadBuffer(mesh.vertexBuffer, processed.vertices.data(), vertexBytes);
+
+  createBuffer(
+      processed.indices.size(),
+      VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      MemoryCategory::Buffer,
+      mesh.indexBuffer,
+      mesh.indexBufferMemory
+  );
+  uploadBuffer(mesh.indexBuffer, processed.indices.data(), processed.indices.size());
+
+  const MeshStats& stats = processed.stats;
+  logger.log(
+      LogSeverity::Info,
+      LogCategory::Performance,
+      "Mesh %zu: %zu LODs, vertices %zu -> %zu bytes, indices %zu -> %zu bytes (%zu compressed), ACMR %.3f -> %.3f",
+      meshes.size(),
+      processed.lods.size(),
+      stats.sourceVertexBytes,
+      stats.packedVertexBytes,
+      stats.sourceIndexBytes,
+      stats.packedIndexBytes,
+      stats.compressedIndexBytes,
+      stats.acmrBefore,
+      stats.acmrAfter
+  );
+
+  meshes.push_back(mesh);
+  return static_cast<uint32_t>(meshes.size() - 1);
+}
+
+void Mjoelnir::destroyMesh(GpuMesh& mesh) {
+  vkDestroyBuffer(device, mesh.vertexBuffer, allocationCallbacks);
+  memoryTracker.free(device, mesh.vertexBufferMemory);
+  vkDestroyBuffer(device, mesh.indexBuffer, allocationCallbacks);
+  memoryTracker.free(device, mesh.indexBufferMemory);
+}
+
+void Mjoelnir::createMeshes() {
+  PROFILE_ZONE("createMeshes");
+
+  // The triangle that used to live in the vertex shader, its colors come from the UVs.
+  MeshVertex vertices[] = {
+      {glm::vec3(0.0f, -0.5f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(1.0f, 0.0f)},
+      {glm::vec3(0.5f, 0.5f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(0.0f, 1.0f)},
+      {glm::vec3(-0.5f, 0.5f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(0.0f, 0.0f)},
+  };
+  uint32_t indices[] = {0, 1, 2};
+
+  uploadMesh(processMesh(vertices, 3, indices, 3));
+}
+
+void Mjoelnir::createInstanceBuffers() {
+  PROFILE_ZONE("createInstanceBuffers");
+
+  instanceBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  instanceBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+  instanceBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+  instanceBufferCapacities.resize(MAX_FRAMES_IN_FLIGHT);
+  instanceBufferVersions.resize(MAX_FRAMES_IN_FLIGHT);
+
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+      createInstanceBuffer(i, INITIAL_INSTANCE_CAPACITY);
+  }
+
+  occlusionInstanceBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  drawCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  culledInstanceBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  createVisibilityBuffer(INITIAL_INSTANCE_CAPACITY);
+
+  // Everything hangs off this node, it also keeps the triangle on screen while the scene is empty.
+  sceneRoot = transforms.createNode();
+}
+
+void Mjoelnir::updateTransforms() {
+  PROFILE_ZONE("updateTransforms");
+
+  // The hierarchy's matrices come first, the ones of the LOD batches follow them.
+  uint32_t required = transforms.size() + static_cast<uint32_t>(drawInstances.size());
+
+  // Only called once this frame's fence has signaled, so the GPU is done with its instance buffer.
+  if (required > instanceBufferCapacities[currentFrame]) {
+      uint32_t capacity = instanceBufferCapacities[currentFrame];
+      while (capacity < required) {
+          capacity *= 2;
+      }
+
+      destroyInstanceBuffer(currentFrame);
+      createInstanceBuffer(currentFrame, capacity);
+  }
+
+  glm::mat4* mapped = static_cast<glm::mat4*>(instanceBuffersMapped[currentFrame]);
+  transforms.update(&jobs, mapped, instanceBufferVersions[currentFrame]);
+
+  if (!drawInstances.empty()) {
+      memcpy(mapped + transforms.size(), drawInstances.data(), drawInstances.size() * sizeof(glm::mat4));
+  }
+}
+
+void Mjoelnir::createCommandBuffers() {
+  PROFILE_ZONE("createCommandBuffers");
+
+  commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+
+  VkCommandBufferAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = commandPool;
+  // VK_COMMAND_BUFFER_LEVEL_PRIMARY: Can be submitted to a queue for execution, but cannot be called from other command buffers.
+  // VK_COMMAND_BUFFER_LEVEL_SECONDARY: Cannot be submitted directly, but can be called from primary command buffers.
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+
+  if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to create command buffer");
+  }
+
+  if (asyncComputeEnabled) {
+      lightCullCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+      particleCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+      allocInfo.commandPool = computeCommandPool;
+
+      if (vkAllocateCommandBuffers(device, &allocInfo, lightCullCommandBuffers.data()) != VK_SUCCESS ||
+          vkAllocateCommandBuffers(device, &allocInfo, particleCommandBuffers.data()) != VK_SUCCESS
+      ) {
+          throw std::runtime_error("Unable to create compute command buffer");
+      }
+  }
+}
+
+void Mjoelnir::snapshotTransforms() {
+  previousModels.clear();
+
+  world.eachChunk<Transform, MeshRef, Bounds>([this](uint32_t count, Entity*, Transform* transforms, MeshRef*, Bounds*) {
+      for (uint32_t i = 0; i < count; i++) {
+          previousModels.push_back(transforms[i].world);
+      }
+  });
+
+  previousModelsVersion = world.structureVersion();
+}
+
+void Mjoelnir::runSimulation() {
+  PROFILE_ZONE("runSimulation");
+
+  uint32_t ticks = simulationClock.advance(Profiler::now());
+  if (!simulationCallback) {
+      return;
+  }
+
+  float deltaTime = simulationClock.tickSeconds();
+  for (uint32_t i = 0; i < ticks; i++) {
+      snapshotTransforms();
+
+      // On the render thread, an exception reaches renderError like any other. The callback
+      // spreads its work over jobs itself.
+      {
+          PROFILE_ZONE("Simulation tick");
+          simulationCallback(world, jobs, deltaTime);
+      }
+
+      world.sync();
+  }
+}
+
+void Mjoelnir::updateCamera() {
+  {
+      std::lock_guard<std::mutex> lock(cameraMutex);
+      viewMatrix = cameraView;
+      projectionMatrix = cameraProjection;
+      ambientLight = cameraAmbient;
+  }
+
+  viewProjection = projectionMatrix * viewMatrix;
+}
+
+void Mjoelnir::extractRenderables() {
+  PROFILE_ZONE("extractRenderables");
+
+  // Both keep their capacity, reserving for every entity up front means they grow in one step when
+  // the scene does rather than over a few frames of push_back.
+  renderObjects.clear();
+  renderObjects.reserve(world.entityCount());
+
+  world.eachChunk<Transform, MeshRef, Bounds>([this](uint32_t count, Entity*, Transform* transforms, MeshRef* meshes, Bounds* bounds) {
+      for (uint32_t i = 0; i < count; i++) {
+          renderObjects.push_back({transforms[i].world, bounds[i], meshes[i].mesh, meshes[i].material});
+      }
+  });
+
+  // Objects created or destroyed since the last tick break the match with the snapshot, they are
+  // drawn where the last tick left them.
+  if (simulationCallback && previousModelsVersion == world.structureVersion() && previousModels.size() == renderObjects.size()) {
+      float alpha = simulationClock.alpha();
+      for (size_t i = 0; i < renderObjects.size(); i++) {
+          renderObjects[i].model = interpolateTransform(previousModels[i], renderObjects[i].model, alpha);
+      }
+  }
+}
+
+void Mjoelnir::extractLights() {
+  PROFILE_ZONE("extractLights");
+
+  frameLights.clear();
+
+  // Lights aren't interpolated between simulation ticks, they are lit where the last tick left them.
+  Frustum frustum = Frustum::fromMatrix(viewProjection);
+  world.eachChunk<Transform, PointLight>([this, &frustum](uint32_t count, Entity*, Transform* transforms, PointLight* lights) {
+      for (uint32_t i = 0; i < count; i++) {
+          GpuLight packed;
+          if (packPointLight(lights[i], transforms[i].world, viewMatrix, frustum, packed)) {
+              frameLights.push_back(packed);
+          }
+      }
+  });
+  world.eachChunk<Transform, SpotLight>([this, &frustum](uint32_t count, Entity*, Transform* transforms, SpotLight* lights) {
+      for (uint32_t i = 0; i < count; i++) {
+          GpuLight packed;
+          if (packSpotLight(lights[i], transforms[i].world, viewMatrix, frustum, packed)) {
+              frameLights.push_back(packed);
+          }
+      }
+  });
+}
+
+void Mjoelnir::cullRenderables() {
+  PROFILE_ZONE("cullRenderables");
+
+  // Extraction order only changes with the world's structure, until then an index keeps referring
+  // to the same object and moving objects only need a refit.
+  if (world.structureVersion() != sceneBvhVersion || sceneBvh.size() != renderObjects.size()) {
+      sceneBounds.resize(renderObjects.size());
+      for (size_t i = 0; i < renderObjects.size(); i++) {
+          sceneBounds[i] = renderObjects[i].bounds;
+      }
+
+      sceneBvh.build(sceneBounds.data(), static_cast<uint32_t>(sceneBounds.size()));
+      sceneBvhVersion = world.structureVersion();
+  } else {
+      for (uint32_t i = 0; i < renderObjects.size(); i++) {
+          sceneBvh.setBounds(i, renderObjects[i].bounds);
+      }
+      sceneBvh.refit();
+  }
+
+  visibleObjects.clear();
+  sceneBvh.cull(Frustum::fromMatrix(viewProjection), visibleObjects);
+}
+
+void Mjoelnir::selectLods() {
+  PROFILE_ZONE("selectLods");
+
+  drawOrder.clear();
+  drawOrder.reserve(visibleObjects.size());
+  drawBatches.clear();
+  drawInstances.clear();
+  drawOcclusion.clear();
+
+  // Vertical scale of the projection, together with clip space w it turns world units into pixels.
+  // Pixels that are rendered, so lower render scales pick coarser LODs. The scale is last frame's,
+  // this frame's is only picked once its fence has signaled.
+  glm::vec3 projectionY(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1]);
+  float pixelsPerUnit = glm::length(projectionY) * 0.5f * static_cast<float>(renderExtent.height);
+
+  for (uint32_t object : visibleObjects) {
+      const RenderObject& renderObject = renderObjects[object];
+      if (renderObject.mesh >= meshes.size()) {
+          continue;
+      }
+
+      glm::vec3 center = (renderObject.bounds.min + renderObject.bounds.max) * 0.5f;
+      glm::vec4 clip = viewProjection * glm::vec4(center, 1.0f);
+
+      // Anything at or behind the eye gets the full mesh.
+      uint32_t lod = 0;
+      if (clip.w > 0.0f) {
+          const glm::mat4& model = renderObject.model;
+          float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+          lod = selectLod(meshes[renderObject.mesh].lods, scale * pixelsPerUnit / clip.w, LOD_PIXEL_ERROR);
+      }
+
+      uint64_t key = static_cast<uint64_t>(renderObject.mesh) * MESH_MAX_LODS + lod;
+      drawOrder.push_back((key << 32) | object);
+  }
+
+  // Sorting by mesh and LOD makes every batch a contiguous range of instances.
+  std::sort(drawOrder.begin(), drawOrder.end());
+
+  for (uint64_t entry : drawOrder) {
+      uint32_t key = static_cast<uint32_t>(entry >> 32);
+      uint32_t object = static_cast<uint32_t>(entry);
+
+      if (drawBatches.empty() || drawBatches.back().mesh != key / MESH_MAX_LODS || drawBatches.back().lod != key % MESH_MAX_LODS) {
+          drawBatches.push_back({key / MESH_MAX_LODS, key % MESH_MAX_LODS, static_cast<uint32_t>(drawInstances.size()), 0});
+      }
+
+      const RenderObject& renderObject = renderObjects[object];
+      drawBatches.back().instanceCount++;
+      drawInstances.push_back(renderObject.model);
+      drawOcclusion.push_back({
+          glm::vec4(renderObject.bounds.min, 0.0f),
+          glm::vec4(renderObject.bounds.max, 0.0f),
+          static_cast<uint32_t>(drawBatches.size() - 1),
+          object,
+          {0, 0}
+      });
+  }
+}
+
+void Mjoelnir::updateOcclusionBuffers() {
+  PROFILE_ZONE("updateOcclusionBuffers");
+
+  if (renderObjects.size() > visibilityCapacity) {
+      // Frames still in flight may be reading the old one.
+      deletionQueue.push(frameNumber, DeletionType::Buffer, visibilityBuffer);
+      deletionQueue.push(frameNumber, DeletionType::DeviceMemory, visibilityBufferMemory);
+
+      uint32_t capacity = visibilityCapacity;
+      while (capacity < renderObjects.size()) {
+          capacity *= 2;
+      }
+      createVisibilityBuffer(capacity);
+  }
+
+  // Object indices only refer to the same objects until the world's structure changes.
+  if (world.structureVersion() != visibilityVersion) {
+      visibilityVersion = world.structureVersion();
+      visibilityCleared = false;
+  }
+
+  uint32_t instanceCount = static_cast<uint32_t>(drawOcclusion.size());
+  uint32_t batchCount = static_cast<uint32_t>(drawBatches.size());
+
+  // Only called once this frame's fence has signaled, so the GPU is done with the frame's buffers.
+  ensureFrameLocalBuffer(
+      occlusionInstanceBuffers[currentFrame],
+      std::max(instanceCount, 1u) * sizeof(OcclusionInstance),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+  );
+  ensureFrameLocalBuffer(
+      drawCommandBuffers[currentFrame],
+      std::max(2 * batchCount, 1u) * sizeof(VkDrawIndexedIndirectCommand),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+  );
+  ensureFrameLocalBuffer(
+      culledInstanceBuffers[currentFrame],
+      std::max(2 * instanceCount, 1u) * sizeof(glm::mat4),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+  );
+
+  if (instanceCount > 0) {
+      memcpy(occlusionInstanceBuffers[currentFrame].mapped, drawOcclusion.data(), instanceCount * sizeof(OcclusionInstance));
+  }
+
+  // Every batch gets an empty draw per phase, the culling shader fills in the instance counts.
+  // The culled matrices of the second phase follow the ones of the first.
+  VkDrawIndexedIndirectCommand* commands = static_cast<VkDrawIndexedIndirectCommand*>(drawCommandBuffers[currentFrame].mapped);
+  for (uint32_t phase = 0; phase < 2; phase++) {
+      for (uint32_t i = 0; i < batchCount; i++) {
+          const DrawBatch& batch = drawBatches[i];
+          const MeshLod& lod = meshes[batch.mesh].lods[batch.lod];
+
+          VkDrawIndexedIndirectCommand& command = commands[phase * batchCount + i];
+          command.indexCount = lod.indexCount;
+          command.instanceCount = 0;
+          command.firstIndex = lod.firstIndex;
+          command.vertexOffset = 0;
+          command.firstInstance = phase * instanceCount + batch.firstInstance;
+      }
+  }
+
+  // Any of the buffers may have been recreated, so the frame gets a fresh set every time.
+  occlusionSets[currentFrame] = frameDescriptors[currentFrame].allocate(occlusionSetLayout);
+
+  VkDescriptorBufferInfo bufferInfos[5] = {
+      {occlusionInstanceBuffers[currentFrame].buffer, 0, VK_WHOLE_SIZE},
+      {visibilityBuffer, 0, VK_WHOLE_SIZE},
+      {drawCommandBuffers[currentFrame].buffer, 0, VK_WHOLE_SIZE},
+      {instanceBuffers[currentFrame], 0, VK_WHOLE_SIZE},
+      {culledInstanceBuffers[currentFrame].buffer, 0, VK_WHOLE_SIZE},
+  };
+
+  VkDescriptorImageInfo pyramidInfo{};
+  pyramidInfo.sampler = depthPyramidSampler;
+  pyramidInfo.imageView = depthPyramidView;
+  pyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+  VkWriteDescriptorSet writes[6] = {};
+  for (uint32_t i = 0; i < 6; i++) {
+      writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[i].dstSet = occlusionSets[currentFrame];
+      writes[i].dstBinding = i;
+      writes[i].descriptorCount = 1;
+      if (i < 5) {
+          writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+          writes[i].pBufferInfo = &bufferInfos[i];
+      } else {
+          writes[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+          writes[i].pImageInfo = &pyramidInfo;
+      }
+  }
+
+  vkUpdateDescriptorSets(device, 6, writes, 0, nullptr);
+}
+
+void Mjoelnir::recordOcclusionCulling(VkCommandBuffer commandBuffer, uint32_t phase) {
+  OcclusionConstants constants{};
+  constants.viewProjection = viewProjection;
+  constants.pyramidSize = glm::vec2(static_cast<float>(depthPyramidWidth), static_cast<float>(depthPyramidHeight));
+  constants.instanceCount = static_cast<uint32_t>(drawOcclusion.size());
+  constants.batchCount = static_cast<uint32_t>(drawBatches.size());
+  constants.matrixOffset = transforms.size();
+  constants.phase = phase;
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, occlusionCullPipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, occlusionLayout, 0, 1, &occlusionSets[currentFrame], 0, nullptr);
+  vkCmdPushConstants(commandBuffer, occlusionLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(OcclusionConstants), &constants);
+  vkCmdDispatch(commandBuffer, (constants.instanceCount + OCCLUSION_GROUP_SIZE - 1) / OCCLUSION_GROUP_SIZE, 1, 1);
+
+  // The draws read the instance counts and the culled matrices.
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void Mjoelnir::recordDepthPyramid(VkCommandBuffer commandBuffer) {
+  VkImageMemoryBarrier barriers[2] = {};
+
+  // The depth of what the first phase drew is sampled by the first reduction.
+  barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barriers[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  barriers[0].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].image = depthImage;
+  barriers[0].subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+  barriers[0].subresourceRange.baseMipLevel = 0;
+  barriers[0].subresourceRange.levelCount = 1;
+  barriers[0].subresourceRange.baseArrayLayer = 0;
+  barriers[0].subresourceRange.layerCount = 1;
+
+  // Every level is rewritten, so the old contents can go. Last frame's culling has to be done
+  // reading them though.
+  barriers[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barriers[1].srcAccessMask = 0;
+  barriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  barriers[1].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[1].image = depthPyramid;
+  barriers[1].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barriers[1].subresourceRange.baseMipLevel = 0;
+  barriers[1].subresourceRange.levelCount = depthPyramidLevelCount;
+  barriers[1].subresourceRange.baseArrayLayer = 0;
+  barriers[1].subresourceRange.layerCount = 1;
+
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      0, 0, nullptr, 0, nullptr, 2, barriers
+  );
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, depthReducePipeline);
+
+  for (uint32_t level = 0; level < depthPyramidLevelCount; level++) {
+      uint32_t width = std::max(depthPyramidWidth >> level, 1u);
+      uint32_t height = std::max(depthPyramidHeight >> level, 1u);
+
+      // The first level only reduces what was rendered, so the pyramid covers the render area.
+      DepthReduceConstants constants{};
+      constants.sourceWidth = level == 0 ? renderExtent.width : std::max(depthPyramidWidth >> (level - 1), 1u);
+      constants.sourceHeight = level == 0 ? renderExtent.height : std::max(depthPyramidHeight >> (level - 1), 1u);
+
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, depthReduceLayout, 0, 1, &depthReduceSets[level], 0, nullptr);
+      vkCmdPushConstants(commandBuffer, depthReduceLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DepthReduceConstants), &constants);
+      vkCmdDispatch(commandBuffer, (width + DEPTH_REDUCE_GROUP_SIZE - 1) / DEPTH_REDUCE_GROUP_SIZE, (height + DEPTH_REDUCE_GROUP_SIZE - 1) / DEPTH_REDUCE_GROUP_SIZE, 1);
+
+      // The next level reads this one, after the last one the culling shader reads them all.
+      VkMemoryBarrier barrier{};
+      barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+  }
+}
+
+void Mjoelnir::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+  PROFILE_ZONE("recordCommandBuffer");
+
+  VkCommandBufferBeginInfo beginInfo{};
   beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
   // The flags parameter specifies how we’re going to use the command buffer. The following values are available:
   //     VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT: The command buffer will be rerecorded right after executing it once.
@@ -1093,16 +3991,62 @@ void Mjoelnir::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t image
       throw std::runtime_error("Unable to begin recording command buffer");
   }
 
+  if (timestampQueryPool != VK_NULL_HANDLE) {
+      vkCmdResetQueryPool(commandBuffer, timestampQueryPool, currentFrame * timestampsPerFrame, 2);
+      vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, currentFrame * timestampsPerFrame);
+  }
+
+  // Outside of the render pass, compute dispatches aren't allowed inside one.
+  if (!asyncComputeActive) {
+      recordParticleSimulation(commandBuffer);
+  }
+  recordSpriteUploads(commandBuffer);
+  if (!asyncComputeActive) {
+      recordLightCulling(commandBuffer);
+  }
+
+  bool occlusionCulling = !drawOcclusion.empty();
+  if (occlusionCulling) {
+      if (!visibilityCleared) {
+          // Nothing counts as visible last frame, the second phase draws everything that isn't occluded.
+          VkMemoryBarrier barrier{};
+          barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+          barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+          barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+          vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+          vkCmdFillBuffer(commandBuffer, visibilityBuffer, 0, VK_WHOLE_SIZE, 0);
+
+          barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+          barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+          vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+          visibilityCleared = true;
+      } else {
+          // Last frame's second phase wrote the visibility this one reads.
+          VkMemoryBarrier barrier{};
+          barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+          barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+          barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+          vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+      }
+
+      recordOcclusionCulling(commandBuffer, 0);
+  }
+
   VkRenderPassBeginInfo renderPassInfo{};
   renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
   renderPassInfo.renderPass = renderPass;
-  renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+  // Only the render area of the scene target, see resolution.hpp.
+  renderPassInfo.framebuffer = sceneFramebuffer;
   renderPassInfo.renderArea.offset = {0, 0};
-  renderPassInfo.renderArea.extent = swapChainExtent;
+  renderPassInfo.renderArea.extent = renderExtent;
 
-  VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-  renderPassInfo.clearValueCount = 1;
-  renderPassInfo.pClearValues = &clearColor;
+  VkClearValue clearValues[2] = {};
+  clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+  clearValues[1].depthStencil = {1.0f, 0};
+  renderPassInfo.clearValueCount = 2;
+  renderPassInfo.pClearValues = clearValues;
 
   vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
   // The render pass can now begin.
@@ -1116,36 +4060,167 @@ void Mjoelnir::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t image
   //     VK_SUBPASS_CONTENTS_INLINE: The render pass commands will be embedded in the primary command buffer itself and no secondary command buffers will be executed.
   //     VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS: The render pass commands will be executed from secondary command buffers.
 
-  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+  bindPipeline(commandBuffer, graphicsPipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &meshSets[currentFrame], 0, nullptr);
 
   VkViewport viewport = {};
   viewport.x = 0.0f;
   viewport.y = 0.0f;
-  viewport.width = (float)swapChainExtent.width;
-  viewport.height = (float)swapChainExtent.height;
+  viewport.width = (float)renderExtent.width;
+  viewport.height = (float)renderExtent.height;
   viewport.minDepth = 0.0;
   viewport.maxDepth = 1.0f;
   vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
   VkRect2D scissor = {};
   scissor.offset = {0, 0};
-  scissor.extent = swapChainExtent;
+  scissor.extent = renderExtent;
   vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-  // vertexCount: Even though we don’t have a vertex buffer, we technically still have 3 vertices to draw.
+  VkBuffer instanceBuffer = instanceBuffers[currentFrame];
+  VkDeviceSize instanceOffset = 0;
+  vkCmdBindVertexBuffers(commandBuffer, 0, 1, &instanceBuffer, &instanceOffset);
+
+  auto bindMesh = [this, commandBuffer](const GpuMesh& mesh) {
+      VkDeviceSize offset = 0;
+      vkCmdBindVertexBuffers(commandBuffer, 1, 1, &mesh.vertexBuffer, &offset);
+      vkCmdBindIndexBuffer(commandBuffer, mesh.indexBuffer, 0, mesh.indexType);
+      vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshQuantization), &mesh.quantization);
+  };
+
+  // The transform hierarchy, always at full detail.
+  const MeshLod& rootLod = meshes[0].lods[0];
+  bindMesh(meshes[0]);
+
+  // indexCount: Number of indices of the LOD.
   // instanceCount: Used for instanced rendering, use 1 if you’re not doing that.
-  // firstVertex: Used as an offset into the vertex buffer, defines the lowest value of gl_VertexIndex.
+  // firstIndex, vertexOffset: Offsets into the index and vertex buffer.
   // firstInstance: Used as an offset for instanced rendering, defines the lowest value of gl_InstanceIndex.
-  vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+  vkCmdDrawIndexed(commandBuffer, rootLod.indexCount, transforms.size(), rootLod.firstIndex, 0, 0);
+
+  // Visible objects, one indirect draw per mesh and LOD. The culling shader filled in how many
+  // instances survived and copied their matrices into the culled instance buffer.
+  auto drawCulled = [this, commandBuffer, &bindMesh](uint32_t phase) {
+      VkBuffer culledBuffer = culledInstanceBuffers[currentFrame].buffer;
+      VkDeviceSize culledOffset = 0;
+      vkCmdBindVertexBuffers(commandBuffer, 0, 1, &culledBuffer, &culledOffset);
+
+      uint32_t batchCount = static_cast<uint32_t>(drawBatches.size());
+      uint32_t boundMesh = UINT32_MAX;
+      for (uint32_t i = 0; i < batchCount; i++) {
+          const DrawBatch& batch = drawBatches[i];
+          if (batch.mesh != boundMesh) {
+              bindMesh(meshes[batch.mesh]);
+              boundMesh = batch.mesh;
+          }
+
+          VkDeviceSize offset = (phase * batchCount + i) * sizeof(VkDrawIndexedIndirectCommand);
+          vkCmdDrawIndexedIndirect(commandBuffer, drawCommandBuffers[currentFrame].buffer, offset, 1, sizeof(VkDrawIndexedIndirectCommand));
+      }
+  };
+
+  if (occlusionCulling) {
+      drawCulled(0);
+  }
+
+  vkCmdEndRenderPass(commandBuffer);
+
+  if (occlusionCulling) {
+      recordDepthPyramid(commandBuffer);
+      recordOcclusionCulling(commandBuffer, 1);
+
+      // Back to being the depth attachment for the late pass.
+      VkImageMemoryBarrier barrier{};
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+      barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      barrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.image = depthImage;
+      barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+      barrier.subresourceRange.baseMipLevel = 0;
+      barrier.subresourceRange.levelCount = 1;
+      barrier.subresourceRange.baseArrayLayer = 0;
+      barrier.subresourceRange.layerCount = 1;
+      vkCmdPipelineBarrier(
+          commandBuffer,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+          VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+          0, 0, nullptr, 0, nullptr, 1, &barrier
+      );
+  }
+
+  // Keeps what the first pass drew, the pipelines are compatible with it.
+  renderPassInfo.renderPass = lateRenderPass;
+  renderPassInfo.clearValueCount = 0;
+  renderPassInfo.pClearValues = nullptr;
+  vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+  bindPipeline(commandBuffer, graphicsPipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &meshSets[currentFrame], 0, nullptr);
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+  if (occlusionCulling) {
+      drawCulled(1);
+  }
+
+  recordParticleDraw(commandBuffer);
+
+  vkCmdEndRenderPass(commandBuffer);
+
+  // The present pass samples what the scene passes drew.
+  VkImageMemoryBarrier sceneBarrier{};
+  sceneBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  sceneBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  sceneBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  sceneBarrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  sceneBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  sceneBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  sceneBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  sceneBarrier.image = sceneColorImage;
+  sceneBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  sceneBarrier.subresourceRange.baseMipLevel = 0;
+  sceneBarrier.subresourceRange.levelCount = 1;
+  sceneBarrier.subresourceRange.baseArrayLayer = 0;
+  sceneBarrier.subresourceRange.layerCount = 1;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &sceneBarrier);
+
+  // Upscales the scene into the whole swap chain image, sprites go on top at full resolution.
+  renderPassInfo.renderPass = presentRenderPass;
+  renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+  renderPassInfo.renderArea.extent = swapChainExtent;
+  vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+  viewport.width = (float)swapChainExtent.width;
+  viewport.height = (float)swapChainExtent.height;
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+  scissor.extent = swapChainExtent;
+  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+  recordUpscale(commandBuffer);
+  recordSpriteDraw(commandBuffer);
 
   vkCmdEndRenderPass(commandBuffer);
 
+  recordViewportWindows(commandBuffer);
+
+  recordReadback(commandBuffer, imageIndex);
+
+  if (timestampQueryPool != VK_NULL_HANDLE) {
+      vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, currentFrame * timestampsPerFrame + 1);
+  }
+
   if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
       throw std::runtime_error("Unable to record command buffer");
   }
 }
 
 void Mjoelnir::createSyncObjects() {
+  PROFILE_ZONE("createSyncObjects");
+
   imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
   renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
 
@@ -1160,32 +4235,503 @@ void Mjoelnir::createSyncObjects() {
   fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
   for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-      if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-          vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
-          vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS
+      if (vkCreateSemaphore(device, &semaphoreInfo, allocationCallbacks, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
+          vkCreateSemaphore(device, &semaphoreInfo, allocationCallbacks, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
+          vkCreateFence(device, &fenceInfo, allocationCallbacks, &inFlightFences[i]) != VK_SUCCESS
       ) {
           throw std::runtime_error("Failed to create synchronization objects");
       }
   }
+
+  for (auto& viewport : viewportWindows) {
+      viewport->imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+      viewport->renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+
+      for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+          if (vkCreateSemaphore(device, &semaphoreInfo, allocationCallbacks, &viewport->imageAvailableSemaphores[i]) != VK_SUCCESS ||
+              vkCreateSemaphore(device, &semaphoreInfo, allocationCallbacks, &viewport->renderFinishedSemaphores[i]) != VK_SUCCESS
+          ) {
+              throw std::runtime_error("Failed to create synchronization objects");
+          }
+      }
+  }
+
+  if (asyncComputeEnabled) {
+      VkSemaphoreTypeCreateInfo typeInfo{};
+      typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+      typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+      typeInfo.initialValue = 0;
+      semaphoreInfo.pNext = &typeInfo;
+
+      if (vkCreateSemaphore(device, &semaphoreInfo, allocationCallbacks, &graphicsTimeline) != VK_SUCCESS ||
+          vkCreateSemaphore(device, &semaphoreInfo, allocationCallbacks, &computeTimeline) != VK_SUCCESS
+      ) {
+          throw std::runtime_error("Failed to create timeline semaphores");
+      }
+  }
+}
+
+void Mjoelnir::createTimestampQueries() {
+  // Always created, dynamic resolution and the particle benchmark need GPU frame times even
+  // without the profiler. Two timestamps a frame cost next to nothing.
+  QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+
+  uint32_t queueFamilyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+  ScratchVector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount, ScratchAllocator<VkQueueFamilyProperties>(frameScratch[currentFrame]));
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+  uint32_t validBits = queueFamilies[indices.graphicsFamily.value()].timestampValidBits;
+  if (validBits == 0) {
+      // No timestamps on this queue, the trace will only have CPU zones.
+      return;
+  }
+  timestampMask = validBits >= 64 ? UINT64_MAX : (1ull << validBits) - 1;
+
+  // Both queues count the same device clock, so the compute timestamps line up with the graphics ones.
+  uint32_t computeValidBits = asyncComputeEnabled ? queueFamilies[computeQueueFamily].timestampValidBits : 0;
+  if (computeValidBits > 0) {
+      timestampsPerFrame = 6;
+      computeTimestampMask = computeValidBits >= 64 ? UINT64_MAX : (1ull << computeValidBits) - 1;
+  }
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  timestampPeriod = properties.limits.timestampPeriod;
+
+  VkQueryPoolCreateInfo queryPoolInfo{};
+  queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  // Start and end of every frame in flight, and of its compute work.
+  queryPoolInfo.queryCount = MAX_FRAMES_IN_FLIGHT * timestampsPerFrame;
+
+  if (vkCreateQueryPool(device, &queryPoolInfo, allocationCallbacks, &timestampQueryPool) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create timestamp query pool");
+  }
+
+  timestampsPending.assign(MAX_FRAMES_IN_FLIGHT, false);
+  frameAsyncCompute.assign(MAX_FRAMES_IN_FLIGHT, false);
+  frameSubmitTimes.assign(MAX_FRAMES_IN_FLIGHT, 0);
+
+  if (calibratedTimestampsSupported) {
+      getCalibratedTimestamps = (PFN_vkGetCalibratedTimestampsEXT) vkGetDeviceProcAddr(device, "vkGetCalibratedTimestampsEXT");
+      calibrateGpuClock();
+  }
+}
+
+void Mjoelnir::calibrateGpuClock() {
+  if (getCalibratedTimestamps == nullptr) {
+      return;
+  }
+
+  VkCalibratedTimestampInfoEXT timestampInfos[2]{};
+  timestampInfos[0].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+  timestampInfos[0].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+  timestampInfos[1].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+  timestampInfos[1].timeDomain = hostTimeDomain;
+
+  // Both timestamps are taken at the same time. Only CLOCK_MONOTONIC is known to be the profiler's
+  // clock (steady_clock on Linux), the others are bracketed with profiler reads instead, that is
+  // accurate to the length of the call.
+  uint64_t timestamps[2];
+  uint64_t maxDeviation;
+  uint64_t before = Profiler::now();
+  VkResult result = getCalibratedTimestamps(device, 2, timestampInfos, timestamps, &maxDeviation);
+  uint64_t after = Profiler::now();
+
+  if (result != VK_SUCCESS) {
+      return;
+  }
+
+  uint64_t hostTime = before + (after - before) / 2;
+#ifndef _WIN32
+  if (hostTimeDomain == VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT) {
+      hostTime = timestamps[1];
+  }
+#endif
+
+  gpuClockOffset = static_cast<int64_t>(hostTime) - static_cast<int64_t>(static_cast<double>(timestamps[0] & timestampMask) * timestampPeriod);
+  gpuClockCalibrated = true;
+  framesSinceCalibration = 0;
+}
+
+void Mjoelnir::readGpuTimestamps(uint32_t frame) {
+  if (timestampQueryPool == VK_NULL_HANDLE || !timestampsPending[frame]) {
+      return;
+  }
+
+  // The frame's fence has been waited on, and its graphics work waited on its compute work, so the
+  // results are available without stalling. Compute timestamps are only written on the compute queue.
+  uint64_t timestamps[6];
+  uint32_t queryCount = frameAsyncCompute[frame] ? timestampsPerFrame : 2;
+  if (vkGetQueryPoolResults(device, timestampQueryPool, frame * timestampsPerFrame, queryCount, queryCount * sizeof(uint64_t), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+      return;
+  }
+  timestampsPending[frame] = false;
+
+  if (gpuClockCalibrated && ++framesSinceCalibration >= GPU_CLOCK_CALIBRATION_INTERVAL) {
+      calibrateGpuClock();
+  }
+
+  double begin = static_cast<double>(timestamps[0] & timestampMask) * timestampPeriod;
+  double end = static_cast<double>(timestamps[1] & timestampMask) * timestampPeriod;
+
+  // Without calibrated timestamps the best we can do is to pretend the GPU started at submit time.
+  int64_t offset = gpuClockCalibrated ? gpuClockOffset : static_cast<int64_t>(frameSubmitTimes[frame]) - static_cast<int64_t>(begin);
+
+  gpuFrameTime = static_cast<uint64_t>(end - begin);
+  resolutionController.update(gpuFrameTime, frameRenderScales[frame], gpuFrameBudget.load(std::memory_order_relaxed));
+
+  // Light culling and then the particles. Only compared against each other, the compute queue's
+  // timestamps needn't share a time base with the graphics queue's.
+  gpuComputeTime = 0;
+  if (queryCount > 2) {
+      double computeTime = 0.0;
+      for (uint32_t i = 2; i < 6; i += 2) {
+          double computeBegin = static_cast<double>(timestamps[i] & computeTimestampMask) * timestampPeriod;
+          double computeEnd = static_cast<double>(timestamps[i + 1] & computeTimestampMask) * timestampPeriod;
+          computeTime += computeEnd - computeBegin;
+      }
+      gpuComputeTime = static_cast<uint64_t>(computeTime);
+  }
+
+  if (enableProfiling) {
+      Profiler::recordGpu("Frame", static_cast<uint64_t>(static_cast<int64_t>(begin) + offset), static_cast<uint64_t>(static_cast<int64_t>(end) + offset));
+  }
+}
+
+void Mjoelnir::createReadbackSlot(ReadbackSlot& slot, VkDeviceSize size) {
+  VkBufferCreateInfo bufferInfo{};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = size;
+  bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateBuffer(device, &bufferInfo, allocationCallbacks, &slot.buffer) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to create readback buffer");
+  }
+
+  VkMemoryRequirements memoryRequirements;
+  vkGetBufferMemoryRequirements(device, slot.buffer, &memoryRequirements);
+
+  // The CPU reads every byte, so cached memory is preferred even if it has to be invalidated.
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+  VkMemoryPropertyFlags cached = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+  uint32_t memoryType = UINT32_MAX;
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+      if ((memoryRequirements.memoryTypeBits & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & cached) == cached) {
+          memoryType = i;
+          break;
+      }
+  }
+  if (memoryType == UINT32_MAX) {
+      memoryType = findMemoryType(memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  }
+
+  VkMemoryAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = memoryRequirements.size;
+  allocInfo.memoryTypeIndex = memoryType;
+
+  if (memoryTracker.allocate(device, allocInfo, MemoryCategory::Staging, &slot.memory) != VK_SUCCESS) {
+      throw std::runtime_error("Unable to allocate readback memory");
+  }
+
+  vkBindBufferMemory(device, slot.buffer, slot.memory, 0);
+
+  // Stays mapped for the lifetime of the buffer.
+  vkMapMemory(device, slot.memory, 0, size, 0, &slot.mapped);
+
+  slot.size = size;
+  slot.coherent = (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+}
+
+void Mjoelnir::destroyReadbackSlot(ReadbackSlot& slot) {
+  if (slot.buffer == VK_NULL_HANDLE) {
+      return;
+  }
+
+  vkUnmapMemory(device, slot.memory);
+  vkDestroyBuffer(device, slot.buffer, allocationCallbacks);
+  memoryTracker.free(device, slot.memory);
+
+  slot = ReadbackSlot();
+}
+
+void Mjoelnir::recordReadback(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+  uint32_t texelSize = readbackTexelSize(swapChainImageFormat);
+  if (!frameCaptureCallback || !swapChainReadable || texelSize == 0) {
+      return;
+  }
+
+  ReadbackSlot& slot = readbackSlots[currentFrame];
+
+  // Only called once this frame's fence has signaled and its last capture has been delivered.
+  VkDeviceSize size = static_cast<VkDeviceSize>(swapChainExtent.width) * swapChainExtent.height * texelSize;
+  if (slot.size < size) {
+      destroyReadbackSlot(slot);
+      createReadbackSlot(slot, size);
+  }
+
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = swapChainImages[imageIndex];
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = 0;
+  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+  VkBufferImageCopy region{};
+  region.bufferOffset = 0;
+  // Tightly packed.
+  region.bufferRowLength = 0;
+  region.bufferImageHeight = 0;
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.mipLevel = 0;
+  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.layerCount = 1;
+  region.imageOffset = {0, 0, 0};
+  region.imageExtent = {swapChainExtent.width, swapChainExtent.height, 1};
+  vkCmdCopyImageToBuffer(commandBuffer, swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer, 1, &region);
+
+  // Back to where presentation expects it.
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barrier.dstAccessMask = 0;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+  // Makes the copy visible to the host once the fence has signaled.
+  VkBufferMemoryBarrier bufferBarrier{};
+  bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  bufferBarrier.buffer = slot.buffer;
+  bufferBarrier.offset = 0;
+  bufferBarrier.size = size;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+
+  slot.width = swapChainExtent.width;
+  slot.height = swapChainExtent.height;
+  slot.format = swapChainImageFormat;
+  slot.frame = frameNumber;
+  slot.pending = true;
+}
+
+void Mjoelnir::deliverReadback(uint32_t frame) {
+  ReadbackSlot& slot = readbackSlots[frame];
+  if (!slot.pending) {
+      return;
+  }
+
+  PROFILE_ZONE("Deliver frame capture");
+
+  // The frame's fence has been waited on, so the copy is complete.
+  if (!slot.coherent) {
+      VkMappedMemoryRange range{};
+      range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+      range.memory = slot.memory;
+      range.offset = 0;
+      range.size = VK_WHOLE_SIZE;
+      vkInvalidateMappedMemoryRanges(device, 1, &range);
+  }
+
+  FrameCapture capture;
+  capture.pixels = slot.mapped;
+  capture.width = slot.width;
+  capture.height = slot.height;
+  capture.rowPitch = slot.width * readbackTexelSize(slot.format);
+  capture.format = slot.format;
+  capture.frame = slot.frame;
+  frameCaptureCallback(capture);
+
+  slot.pending = false;
+}
+
+void Mjoelnir::startupPhase(const char* name, const std::function<void()>& step) {
+  uint64_t begin = Profiler::now();
+  step();
+  uint64_t end = Profiler::now();
+
+  std::lock_guard<std::mutex> lock(startupMutex);
+  startupPhases.push_back({name, begin, end, JobSystem::threadIndex()});
+}
+
+void Mjoelnir::submitStartupPhase(const char* name, std::function<void()> step) {
+  jobs.submit(startupJobs, [this, name, step = std::move(step)]() {
+      startupPhase(name, step);
+  });
+}
+
+void Mjoelnir::waitForStartupPhases() {
+  jobs.wait(startupJobs);
+}
+
+void Mjoelnir::reportStartup() {
+  std::lock_guard<std::mutex> lock(startupMutex);
+  for (const StartupPhase& phase : startupPhases) {
+      logger.log(
+          LogSeverity::Info,
+          LogCategory::Performance,
+          "Startup: %-22s %8.2f ms -> %8.2f ms (%.2f ms on thread %u)",
+          phase.name,
+          static_cast<double>(phase.begin - startupBegin) / 1e6,
+          static_cast<double>(phase.end - startupBegin) / 1e6,
+          static_cast<double>(phase.end - phase.begin) / 1e6,
+          phase.thread
+      );
+  }
+
+  logger.log(LogSeverity::Info, LogCategory::Performance, "Time to first frame: %.2f ms", static_cast<double>(timeToFirstFrame) / 1e6);
+  reportPipelineCache();
 }
 
 void Mjoelnir::initVulkan() {
-  createInstance();
-  setupDebugMessenger();
-  createSurface();
-  pickPhysicalDevice();
-  createLogicalDevice();
-  createSwapChain();
-  createImageViews();
-  createRenderPass();
-  createGraphicsPipeline();
-  createFramebuffers();
-  createCommandPool();
-  createCommandBuffers();
-  createSyncObjects();
+  PROFILE_ZONE("initVulkan");
+
+  if (enableHostAllocationTracking) {
+      hostAllocator.enable();
+  }
+  allocationCallbacks = hostAllocator.callbacks();
+
+  frameScratch.resize(MAX_FRAMES_IN_FLIGHT);
+  frameDescriptors.resize(MAX_FRAMES_IN_FLIGHT);
+  readbackSlots.resize(MAX_FRAMES_IN_FLIGHT);
+  frameRenderScales.resize(MAX_FRAMES_IN_FLIGHT, MAX_RENDER_SCALE);
+
+  // Room for the largest count of the sweep.
+  if (enableParticleBenchmark) {
+      particleCapacity = PARTICLE_BENCHMARK_COUNTS[sizeof(PARTICLE_BENCHMARK_COUNTS) / sizeof(PARTICLE_BENCHMARK_COUNTS[0]) - 1];
+  }
+
+  #ifndef NDEBUG
+      printf("\033[38;5;9m[[ DEBUG ]]\033[0m\n");
+  #else
+      printf("\033[38;5;9m[[ RELEASE ]]\033[0m\n");
+  #endif
+
+  // Has to happen on the main thread, the instance needs it for its extension list.
+  startupPhase("glfwInit", [this]() {
+      glfwInit();
+  });
+
+  // The instance doesn't need the window, so the two are created side by side. The window stays
+  // on the main thread, some platforms insist on that.
+  submitStartupPhase("createInstance", [this]() {
+      createInstance();
+      setupDebugMessenger();
+  });
+  startupPhase("initWindow", [this]() {
+      initWindow();
+  });
+  waitForStartupPhases();
+
+  startupPhase("createSurface", [this]() {
+      createSurface();
+  });
+  startupPhase("pickPhysicalDevice", [this]() {
+      pickPhysicalDevice();
+  });
+  startupPhase("createLogicalDevice", [this]() {
+      createLogicalDevice();
+  });
+  startupPhase("createSwapChain", [this]() {
+      createSwapChain();
+  });
+  startupPhase("createRenderPass", [this]() {
+      createRenderPass();
+  });
+
+  // Loading the shaders and compiling the pipeline takes the longest and only needs the render pass
+  // (viewport and scissor are dynamic), everything else is set up in the meantime.
+  submitStartupPhase("createGraphicsPipeline", [this]() {
+      createGraphicsPipeline();
+  });
+  submitStartupPhase("createParticlePipelines", [this]() {
+      createParticlePipelines();
+  });
+  submitStartupPhase("createOcclusionPipelines", [this]() {
+      createOcclusionPipelines();
+  });
+  submitStartupPhase("createSpritePipelines", [this]() {
+      createSpritePipelines();
+  });
+  submitStartupPhase("createLightPipelines", [this]() {
+      createLightPipelines();
+  });
+  submitStartupPhase("createUpscalePipeline", [this]() {
+      createUpscalePipeline();
+  });
+  startupPhase("createFramebuffers", [this]() {
+      createImageViews();
+      createDepthResources();
+      createSceneTarget();
+      createFramebuffers();
+  });
+  startupPhase("createCommandBuffers", [this]() {
+      createCommandPool();
+      createCommandBuffers();
+  });
+  startupPhase("createMeshes", [this]() {
+      createMeshes();
+  });
+  startupPhase("createInstanceBuffers", [this]() {
+      createInstanceBuffers();
+  });
+  startupPhase("createParticleBuffers", [this]() {
+      createParticleBuffers();
+  });
+  startupPhase("createSpriteResources", [this]() {
+      createSpriteResources();
+  });
+  startupPhase("createLightResources", [this]() {
+      createLightResources();
+  });
+  startupPhase("createSyncObjects", [this]() {
+      createTimestampQueries();
+      createSyncObjects();
+  });
+  waitForStartupPhases();
+
+  // Needs the descriptor set layout from createParticlePipelines().
+  startupPhase("createParticleDescriptors", [this]() {
+      createParticleDescriptors();
+  });
+
+  // Needs the descriptor set layout and sampler from createOcclusionPipelines().
+  startupPhase("createDepthPyramidDescriptors", [this]() {
+      createDepthPyramidDescriptors();
+  });
+
+  // Needs the descriptor set layout and sampler from createSpritePipelines().
+  startupPhase("createSpriteDescriptors", [this]() {
+      createSpriteDescriptors();
+  });
+
+  if (frameCaptureCallback && (!swapChainReadable || readbackTexelSize(swapChainImageFormat) == 0)) {
+      logger.log(LogSeverity::Warning, LogCategory::Engine, "Frame capture is not supported by this swap chain (format %s)", string_VkFormat(swapChainImageFormat));
+  }
+
+  if (enableParticleBenchmark) {
+      // Every step gets a lifetime (and a bit) to replace the previous step's particles.
+      uint64_t warmUp = static_cast<uint64_t>((particleEmitter.lifetime + 0.5f) * 1e9f);
+      particleBenchmark.start(PARTICLE_BENCHMARK_COUNTS, sizeof(PARTICLE_BENCHMARK_COUNTS) / sizeof(PARTICLE_BENCHMARK_COUNTS[0]), asyncComputeEnabled, warmUp, Profiler::now());
+  }
 }
 
-VkSurfaceFormatKHR Mjoelnir::chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
+VkSurfaceFormatKHR Mjoelnir::chooseSwapSurfaceFormat(const ScratchVector<VkSurfaceFormatKHR>& availableFormats) {
   for (const auto& availableFormat : availableFormats) {
     if (availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
       return availableFormat;
@@ -1197,7 +4743,7 @@ VkSurfaceFormatKHR Mjoelnir::chooseSwapSurfaceFormat(const std::vector<VkSurface
   return availableFormats[0];
 }
 
-VkPresentModeKHR Mjoelnir::chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes) {
+VkPresentModeKHR Mjoelnir::chooseSwapPresentMode(const ScratchVector<VkPresentModeKHR>& availablePresentModes) {
   // VK_PRESENT_MODE_FIFO_KHR preferred on mobile devices?
   // VK_PRESENT_MODE_MAILBOX_KHR = triple buffering
   // VK_PRESENT_MODE_FIFO_KHR = always available
@@ -1208,21 +4754,74 @@ VkPresentModeKHR Mjoelnir::chooseSwapPresentMode(const std::vector<VkPresentMode
     }
   }
 
-  return VK_PRESENT_MODE_IMMEDIATE_KHR;
+  // Always supported and waits for vertical blank, so frames can't outrun the display.
+  return VK_PRESENT_MODE_FIFO_KHR;
 }
 
-void Mjoelnir::mainLoop() {
-  while (!glfwWindowShouldClose(window)) {
-      glfwPollEvents();
-      drawFrame();
+void Mjoelnir::stopRendering() {
+  rendering.store(false, std::memory_order_release);
+  // Wakes the main thread up if it is waiting for events.
+  glfwPostEmptyEvent();
+}
+
+void Mjoelnir::renderLoop() {
+  PROFILE_THREAD_NAME("Render");
+
+  try {
+      while (rendering.load(std::memory_order_acquire)) {
+          frameLimiter.wait(frameInterval.load(std::memory_order_relaxed));
+          drawFrame();
+      }
+  } catch (...) {
+      renderError = std::current_exception();
   }
 
+  stopRendering();
+
   vkDeviceWaitIdle(device);
+
+  // Captures of the last frames in flight, oldest first.
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+      deliverReadback((currentFrame + i) % MAX_FRAMES_IN_FLIGHT);
+  }
+}
+
+void Mjoelnir::mainLoop() {
+  hostAllocator.beginFrames();
+  rendering.store(true, std::memory_order_release);
+  renderThread = std::thread(&Mjoelnir::renderLoop, this);
+
+  // Only pumps events, however long a frame takes.
+  while (!glfwWindowShouldClose(window) && rendering.load(std::memory_order_acquire)) {
+      glfwWaitEvents();
+
+      // Closing another window only hides it, the render thread stops presenting to it.
+      for (auto& viewport : viewportWindows) {
+          if (viewport->open.load(std::memory_order_relaxed) && glfwWindowShouldClose(viewport->window)) {
+              glfwHideWindow(viewport->window);
+              viewport->open.store(false, std::memory_order_release);
+          }
+      }
+  }
+
+  stopRendering();
+  renderThread.join();
+
+  if (windowEvents.droppedEvents() > 0) {
+      logger.log(LogSeverity::Warning, LogCategory::Engine, "%llu window events were dropped, the render thread fell behind", static_cast<unsigned long long>(windowEvents.droppedEvents()));
+  }
 }
 
 void Mjoelnir::run() {
-  initWindow();
+  PROFILE_THREAD_NAME("Main");
+
+  startupBegin = Profiler::now();
+
   initVulkan();
   mainLoop();
   cleanup();
+
+  if (renderError) {
+      std::rethrow_exception(renderError);
+  }
 }
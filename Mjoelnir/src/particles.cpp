@@ -0,0 +1,97 @@
+#include "particles.hpp"
+
+void ParticleBenchmark::start(const uint32_t* particleCounts, size_t count, bool compareAsyncCompute, uint64_t warmUpNs, uint64_t now) {
+    counts.assign(particleCounts, particleCounts + count);
+    passes = compareAsyncCompute ? 2 : 1;
+    results.clear();
+    results.reserve(count * passes);
+    step = 0;
+    warmUp = warmUpNs;
+    stepBegin = now;
+    frames = 0;
+    gpuFrames = 0;
+    cpuTotal = 0;
+    gpuTotal = 0;
+    computeTotal = 0;
+}
+
+void ParticleBenchmark::frame(uint64_t now, uint64_t cpuFrameNs, uint64_t gpuFrameNs, uint64_t computeNs) {
+    if (!running() || now - stepBegin < warmUp) {
+        return;
+    }
+
+    frames++;
+    cpuTotal += cpuFrameNs;
+    if (gpuFrameNs > 0) {
+        gpuFrames++;
+        gpuTotal += gpuFrameNs;
+        computeTotal += computeNs;
+    }
+
+    if (frames < PARTICLE_BENCHMARK_FRAMES) {
+        return;
+    }
+
+    ParticleBenchmarkResult result;
+    result.particleCount = particleCount();
+    result.asyncCompute = passes > 1 && asyncCompute();
+    result.frames = frames;
+    result.cpuFrameMs = static_cast<double>(cpuTotal) / frames / 1e6;
+    result.gpuFrameMs = gpuFrames > 0 ? static_cast<double>(gpuTotal) / gpuFrames / 1e6 : 0.0;
+    result.computeMs = gpuFrames > 0 ? static_cast<double>(computeTotal) / gpuFrames / 1e6 : 0.0;
+    results.push_back(result);
+
+    step++;
+    stepBegin = now;
+    frames = 0;
+    gpuFrames = 0;
+    cpuTotal = 0;
+    gpuTotal = 0;
+    computeTotal = 0;
+}
+
+void ParticleBenchmark::report(Logger& logger) const {
+    for (size_t i = 0; i < results.size(); i++) {
+        const ParticleBenchmarkResult& result = results[i];
+        const char* queue = passes == 1 ? "" : result.asyncCompute ? ", async compute" : ", graphics queue";
+        if (result.gpuFrameMs > 0.0) {
+            logger.log(
+                LogSeverity::Info,
+                LogCategory::Performance,
+                "Particles %8u: %.3f ms CPU, %.3f ms GPU per frame (%.2f ns GPU per particle, %u frames%s)",
+                result.particleCount,
+                result.cpuFrameMs,
+                result.gpuFrameMs,
+                result.gpuFrameMs * 1e6 / result.particleCount,
+                result.frames,
+                queue
+            );
+        } else {
+            logger.log(
+                LogSeverity::Info,
+                LogCategory::Performance,
+                "Particles %8u: %.3f ms CPU per frame, no GPU timestamps (%u frames%s)",
+                result.particleCount,
+                result.cpuFrameMs,
+                result.frames,
+                queue
+            );
+        }
+
+        // The async run comes first, the graphics queue run of the same count right after it. The
+        // time between frames is compared, GPU times from two queues don't share a time base.
+        if (passes > 1 && !result.asyncCompute && i > 0) {
+            const ParticleBenchmarkResult& async = results[i - 1];
+            double gain = result.cpuFrameMs - async.cpuFrameMs;
+            logger.log(
+                LogSeverity::Info,
+                LogCategory::Performance,
+                "Particles %8u: async compute saves %.3f ms per frame (%.1f%%), %.3f ms of work on the compute queue",
+                result.particleCount,
+                gain,
+                result.cpuFrameMs > 0.0 ? gain * 100.0 / result.cpuFrameMs : 0.0,
+                async.computeMs
+            );
+        }
+    }
+}
@@ -0,0 +1,250 @@
+#include "pipelines.hpp"
+
+#include <string.h>
+
+#include <stdexcept>
+
+// FNV-1a, fed one field at a time so padding never takes part.
+static const uint64_t FNV_OFFSET = 14695981039346656037ull;
+static const uint64_t FNV_PRIME = 1099511628211ull;
+
+static void hashBytes(uint64_t& hash, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+}
+
+template<typename T>
+static void hashValue(uint64_t& hash, const T& value) {
+    hashBytes(hash, &value, sizeof(value));
+}
+
+static void hashString(uint64_t& hash, const char* string) {
+    if (string != nullptr) {
+        hashBytes(hash, string, strlen(string));
+    }
+    // Separates the string from whatever comes next.
+    hashValue(hash, static_cast<uint8_t>(0));
+}
+
+static bool sameString(const char* a, const char* b) {
+    if (a == nullptr || b == nullptr) {
+        return a == b;
+    }
+    return strcmp(a, b) == 0;
+}
+
+static VkPrimitiveTopology topologyClass(VkPrimitiveTopology topology) {
+    switch (topology) {
+        case VK_PRIMITIVE_TOPOLOGY_POINT_LIST:
+            return VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+        case VK_PRIMITIVE_TOPOLOGY_LINE_LIST:
+        case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP:
+            return VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+        case VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST:
+        case VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP:
+        case VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN:
+            return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        default:
+            return topology;
+    }
+}
+
+void ShaderVariant::setValue(uint32_t id, uint32_t value) {
+    uint32_t index = 0;
+    while (index < count && ids[index] < id) {
+        index++;
+    }
+
+    if (index < count && ids[index] == id) {
+        values[index] = value;
+        return;
+    }
+
+    if (count == MAX_SHADER_VARIANT_CONSTANTS) {
+        throw std::runtime_error("Too many specialization constants in shader variant");
+    }
+
+    for (uint32_t i = count; i > index; i--) {
+        ids[i] = ids[i - 1];
+        values[i] = values[i - 1];
+    }
+    ids[index] = id;
+    values[index] = value;
+    count++;
+}
+
+bool ShaderVariant::operator==(const ShaderVariant& other) const {
+    if (count != other.count) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (ids[i] != other.ids[i] || values[i] != other.values[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void PipelineDescription::addBinding(const VkVertexInputBindingDescription& binding) {
+    if (bindingCount == MAX_PIPELINE_VERTEX_BINDINGS) {
+        throw std::runtime_error("Too many vertex bindings in pipeline description");
+    }
+    bindings[bindingCount++] = binding;
+}
+
+void PipelineDescription::addAttribute(const VkVertexInputAttributeDescription& attribute) {
+    if (attributeCount == MAX_PIPELINE_VERTEX_ATTRIBUTES) {
+        throw std::runtime_error("Too many vertex attributes in pipeline description");
+    }
+    attributes[attributeCount++] = attribute;
+}
+
+PipelineDescription PipelineDescription::dynamicKey() const {
+    PipelineDescription key = *this;
+    key.topology = topologyClass(topology);
+    key.cullMode = VK_CULL_MODE_NONE;
+    key.frontFace = VK_FRONT_FACE_CLOCKWISE;
+    key.depthTest = false;
+    key.depthWrite = false;
+    key.depthCompareOp = VK_COMPARE_OP_LESS;
+    return key;
+}
+
+bool PipelineDescription::operator==(const PipelineDescription& other) const {
+    if (!sameString(vertexShader, other.vertexShader) || !sameString(fragmentShader, other.fragmentShader)) {
+        return false;
+    }
+
+    if (!(variant == other.variant)) {
+        return false;
+    }
+
+    if (bindingCount != other.bindingCount || attributeCount != other.attributeCount) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < bindingCount; i++) {
+        const VkVertexInputBindingDescription& a = bindings[i];
+        const VkVertexInputBindingDescription& b = other.bindings[i];
+        if (a.binding != b.binding || a.stride != b.stride || a.inputRate != b.inputRate) {
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < attributeCount; i++) {
+        const VkVertexInputAttributeDescription& a = attributes[i];
+        const VkVertexInputAttributeDescription& b = other.attributes[i];
+        if (a.location != b.location || a.binding != b.binding || a.format != b.format || a.offset != b.offset) {
+            return false;
+        }
+    }
+
+    return topology == other.topology
+        && cullMode == other.cullMode
+        && frontFace == other.frontFace
+        && blend == other.blend
+        && depthTest == other.depthTest
+        && depthWrite == other.depthWrite
+        && depthCompareOp == other.depthCompareOp
+        && renderPass == other.renderPass
+        && subpass == other.subpass
+        && layout == other.layout;
+}
+
+size_t PipelineDescriptionHash::operator()(const PipelineDescription& description) const {
+    uint64_t hash = FNV_OFFSET;
+
+    hashString(hash, description.vertexShader);
+    hashString(hash, description.fragmentShader);
+
+    hashValue(hash, description.variant.count);
+    for (uint32_t i = 0; i < description.variant.count; i++) {
+        hashValue(hash, description.variant.ids[i]);
+        hashValue(hash, description.variant.values[i]);
+    }
+
+    hashValue(hash, description.bindingCount);
+    for (uint32_t i = 0; i < description.bindingCount; i++) {
+        const VkVertexInputBindingDescription& binding = description.bindings[i];
+        hashValue(hash, binding.binding);
+        hashValue(hash, binding.stride);
+        hashValue(hash, binding.inputRate);
+    }
+
+    hashValue(hash, description.attributeCount);
+    for (uint32_t i = 0; i < description.attributeCount; i++) {
+        const VkVertexInputAttributeDescription& attribute = description.attributes[i];
+        hashValue(hash, attribute.location);
+        hashValue(hash, attribute.binding);
+        hashValue(hash, attribute.format);
+        hashValue(hash, attribute.offset);
+    }
+
+    hashValue(hash, description.topology);
+    hashValue(hash, description.cullMode);
+    hashValue(hash, description.frontFace);
+    hashValue(hash, description.blend);
+    hashValue(hash, description.depthTest);
+    hashValue(hash, description.depthWrite);
+    hashValue(hash, description.depthCompareOp);
+    hashValue(hash, description.renderPass);
+    hashValue(hash, description.subpass);
+    hashValue(hash, description.layout);
+
+    return static_cast<size_t>(hash);
+}
+
+PipelineCache::Shard& PipelineCache::shard(const PipelineDescription& key) {
+    // The top bits, the maps themselves bucket by the bottom ones.
+    uint64_t hash = PipelineDescriptionHash()(key);
+    return shards[(hash >> 32) % PIPELINE_CACHE_SHARDS];
+}
+
+VkPipeline PipelineCache::find(const PipelineDescription& key) {
+    requests.fetch_add(1, std::memory_order_relaxed);
+
+    Shard& keyShard = shard(key);
+    std::lock_guard<std::mutex> lock(keyShard.mutex);
+
+    auto it = keyShard.pipelines.find(key);
+    if (it == keyShard.pipelines.end()) {
+        return VK_NULL_HANDLE;
+    }
+
+    hits.fetch_add(1, std::memory_order_relaxed);
+    return it->second;
+}
+
+VkPipeline PipelineCache::insert(const PipelineDescription& key, VkPipeline pipeline) {
+    Shard& keyShard = shard(key);
+    std::lock_guard<std::mutex> lock(keyShard.mutex);
+
+    // Keeps the first one if two threads created the same pipeline.
+    return keyShard.pipelines.emplace(key, pipeline).first->second;
+}
+
+PipelineCacheStats PipelineCache::stats() {
+    PipelineCacheStats stats{};
+    for (Shard& cacheShard : shards) {
+        std::lock_guard<std::mutex> lock(cacheShard.mutex);
+        stats.pipelines += static_cast<uint32_t>(cacheShard.pipelines.size());
+    }
+    stats.requests = requests.load(std::memory_order_relaxed);
+    stats.hits = hits.load(std::memory_order_relaxed);
+    return stats;
+}
+
+std::vector<VkPipeline> PipelineCache::release() {
+    std::vector<VkPipeline> pipelines;
+    for (Shard& cacheShard : shards) {
+        std::lock_guard<std::mutex> lock(cacheShard.mutex);
+        for (const auto& entry : cacheShard.pipelines) {
+            pipelines.push_back(entry.second);
+        }
+        cacheShard.pipelines.clear();
+    }
+    return pipelines;
+}
@@ -0,0 +1,106 @@
+#include "presentation.hpp"
+
+#include <algorithm>
+
+void FrameSubmission::clear() {
+    waitSemaphores.clear();
+    waitStages.clear();
+    waitValues.clear();
+    signalSemaphores.clear();
+    signalValues.clear();
+    presentSemaphores.clear();
+    swapChains.clear();
+    imageIndices.clear();
+    results.clear();
+}
+
+void FrameSubmission::wait(VkSemaphore semaphore, VkPipelineStageFlags stages, uint64_t value) {
+    waitSemaphores.push_back(semaphore);
+    waitStages.push_back(stages);
+    waitValues.push_back(value);
+}
+
+void FrameSubmission::signal(VkSemaphore semaphore, uint64_t value) {
+    signalSemaphores.push_back(semaphore);
+    signalValues.push_back(value);
+}
+
+void FrameSubmission::present(VkSwapchainKHR swapChain, uint32_t imageIndex, VkSemaphore imageAvailable, VkSemaphore renderFinished) {
+    // Nothing writes to the image before the present pass.
+    wait(imageAvailable, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+    signal(renderFinished);
+
+    presentSemaphores.push_back(renderFinished);
+    swapChains.push_back(swapChain);
+    imageIndices.push_back(imageIndex);
+    results.push_back(VK_SUCCESS);
+}
+
+void FrameSubmission::fillSubmit(VkSubmitInfo& submitInfo, bool timelineSemaphores) {
+    submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+    submitInfo.pWaitSemaphores = waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
+    submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+    submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+    if (timelineSemaphores) {
+        timelineInfo = {};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+        timelineInfo.pWaitSemaphoreValues = waitValues.data();
+        timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+        timelineInfo.pSignalSemaphoreValues = signalValues.data();
+        submitInfo.pNext = &timelineInfo;
+    }
+}
+
+void FrameSubmission::fillPresent(VkPresentInfoKHR& presentInfo) {
+    presentInfo.waitSemaphoreCount = static_cast<uint32_t>(presentSemaphores.size());
+    presentInfo.pWaitSemaphores = presentSemaphores.data();
+    presentInfo.swapchainCount = static_cast<uint32_t>(swapChains.size());
+    presentInfo.pSwapchains = swapChains.data();
+    presentInfo.pImageIndices = imageIndices.data();
+    presentInfo.pResults = results.data();
+}
+
+VkRect2D letterbox(VkExtent2D content, VkExtent2D target) {
+    VkRect2D rect{};
+    rect.extent = target;
+    if (content.width == 0 || content.height == 0) {
+        return rect;
+    }
+
+    // Compared as cross products, target is wider than content if target.w / target.h > content.w / content.h.
+    uint64_t targetWide = static_cast<uint64_t>(target.width) * content.height;
+    uint64_t contentWide = static_cast<uint64_t>(content.width) * target.height;
+    if (targetWide > contentWide) {
+        rect.extent.width = std::max(static_cast<uint32_t>(contentWide / content.height), 1u);
+    } else {
+        rect.extent.height = std::max(static_cast<uint32_t>(targetWide / content.width), 1u);
+    }
+
+    rect.offset.x = static_cast<int32_t>((target.width - rect.extent.width) / 2);
+    rect.offset.y = static_cast<int32_t>((target.height - rect.extent.height) / 2);
+    return rect;
+}
+
+static uint64_t packFraction(float fraction) {
+    return static_cast<uint64_t>(std::clamp(fraction, 0.0f, 1.0f) * 65535.0f + 0.5f);
+}
+
+uint64_t packWindowView(float x, float y, float width, float height) {
+    width = std::clamp(width, MIN_WINDOW_VIEW, 1.0f);
+    height = std::clamp(height, MIN_WINDOW_VIEW, 1.0f);
+    x = std::clamp(x, 0.0f, 1.0f - width);
+    y = std::clamp(y, 0.0f, 1.0f - height);
+    return (packFraction(x) << 48) | (packFraction(y) << 32) | (packFraction(width) << 16) | packFraction(height);
+}
+
+WindowView unpackWindowView(uint64_t view) {
+    WindowView unpacked{};
+    unpacked.x = static_cast<float>((view >> 48) & 0xffff) / 65535.0f;
+    unpacked.y = static_cast<float>((view >> 32) & 0xffff) / 65535.0f;
+    unpacked.width = static_cast<float>((view >> 16) & 0xffff) / 65535.0f;
+    unpacked.height = static_cast<float>(view & 0xffff) / 65535.0f;
+    return unpacked;
+}
@@ -0,0 +1,162 @@
+#include "profiler.hpp"
+#include <stdio.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+const uint32_t PROFILE_BLOCK_SIZE = 4096;
+// Per thread, anything past this is dropped so a long session can not eat all memory.
+const uint32_t PROFILE_MAX_BLOCKS = 256;
+// Thread id of the GPU track in the exported trace.
+const uint32_t PROFILE_GPU_THREAD = 0xFFFF;
+
+struct ProfileBlock {
+    ProfileEvent events[PROFILE_BLOCK_SIZE];
+};
+
+struct ProfileThread {
+    uint32_t id;
+    std::string name;
+    // Only the owning thread appends, the exporter reads [0, count) under blockMutex.
+    std::atomic<uint64_t> count{0};
+    std::mutex blockMutex;
+    std::vector<std::unique_ptr<ProfileBlock>> blocks;
+};
+
+static std::mutex& threadsMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+static std::vector<std::unique_ptr<ProfileThread>>& threads() {
+    static std::vector<std::unique_ptr<ProfileThread>> list;
+    return list;
+}
+
+static ProfileThread* registerThread(uint32_t id, const char* name) {
+    std::lock_guard<std::mutex> lock(threadsMutex());
+    threads().push_back(std::make_unique<ProfileThread>());
+
+    ProfileThread* thread = threads().back().get();
+    thread->id = id;
+    thread->name = name;
+
+    return thread;
+}
+
+static thread_local ProfileThread* currentThread = nullptr;
+
+static ProfileThread* threadBuffer() {
+    if (currentThread == nullptr) {
+        static std::atomic<uint32_t> nextId{1};
+        uint32_t id = nextId.fetch_add(1, std::memory_order_relaxed);
+        currentThread = registerThread(id, ("Thread " + std::to_string(id)).c_str());
+    }
+
+    return currentThread;
+}
+
+static ProfileThread* gpuBuffer() {
+    static ProfileThread* gpu = registerThread(PROFILE_GPU_THREAD, "GPU");
+    return gpu;
+}
+
+static void append(ProfileThread* thread, const char* name, uint64_t begin, uint64_t end) {
+    uint64_t index = thread->count.load(std::memory_order_relaxed);
+    uint64_t block = index / PROFILE_BLOCK_SIZE;
+    if (block >= PROFILE_MAX_BLOCKS) {
+        return;
+    }
+
+    if (block == thread->blocks.size()) {
+        std::lock_guard<std::mutex> lock(thread->blockMutex);
+        thread->blocks.push_back(std::make_unique<ProfileBlock>());
+    }
+
+    thread->blocks[block]->events[index % PROFILE_BLOCK_SIZE] = {name, begin, end};
+    thread->count.store(index + 1, std::memory_order_release);
+}
+
+void Profiler::record(const char* name, uint64_t begin, uint64_t end) {
+    append(threadBuffer(), name, begin, end);
+}
+
+void Profiler::recordGpu(const char* name, uint64_t begin, uint64_t end) {
+    append(gpuBuffer(), name, begin, end);
+}
+
+void Profiler::setThreadName(const char* name) {
+    ProfileThread* thread = threadBuffer();
+
+    std::lock_guard<std::mutex> lock(threadsMutex());
+    thread->name = name;
+}
+
+static void writeEscaped(FILE* file, const char* text) {
+    for (const char* c = text; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', file);
+        }
+        fputc(*c, file);
+    }
+}
+
+bool Profiler::exportChromeTrace(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == nullptr) {
+        return false;
+    }
+
+    // Make the first event start at zero, the absolute clock value means nothing to the viewer.
+    uint64_t origin = UINT64_MAX;
+
+    std::lock_guard<std::mutex> lock(threadsMutex());
+    for (auto& thread : threads()) {
+        uint64_t count = thread->count.load(std::memory_order_acquire);
+        std::lock_guard<std::mutex> blockLock(thread->blockMutex);
+        for (uint64_t i = 0; i < count; i++) {
+            const ProfileEvent& event = thread->blocks[i / PROFILE_BLOCK_SIZE]->events[i % PROFILE_BLOCK_SIZE];
+            if (event.begin < origin) {
+                origin = event.begin;
+            }
+        }
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    bool first = true;
+    for (auto& thread : threads()) {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"", first ? "" : ",\n", thread->id);
+        writeEscaped(file, thread->name.c_str());
+        fprintf(file, "\"}}");
+        first = false;
+
+        uint64_t count = thread->count.load(std::memory_order_acquire);
+        std::lock_guard<std::mutex> blockLock(thread->blockMutex);
+        for (uint64_t i = 0; i < count; i++) {
+            const ProfileEvent& event = thread->blocks[i / PROFILE_BLOCK_SIZE]->events[i % PROFILE_BLOCK_SIZE];
+
+            // GPU spans can start a little before the first CPU zone after calibration.
+            uint64_t begin = event.begin > origin ? event.begin - origin : 0;
+            uint64_t end = event.end > origin ? event.end - origin : 0;
+
+            fprintf(file, ",\n{\"name\":\"");
+            writeEscaped(file, event.name);
+            fprintf(
+                file,
+                "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                thread->id,
+                static_cast<double>(begin) / 1000.0,
+                static_cast<double>(end > begin ? end - begin : 0) / 1000.0
+            );
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    return true;
+}
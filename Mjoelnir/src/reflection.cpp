@@ -0,0 +1,413 @@
+#include "reflection.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+// The parts of the SPIR-V spec needed here.
+const uint32_t SPIRV_MAGIC = 0x07230203;
+const uint32_t SPIRV_HEADER_WORDS = 5;
+
+enum SpirvOp : uint32_t {
+    OpEntryPoint = 15,
+    OpTypeInt = 21,
+    OpTypeFloat = 22,
+    OpTypeVector = 23,
+    OpTypeMatrix = 24,
+    OpTypeImage = 25,
+    OpTypeSampler = 26,
+    OpTypeSampledImage = 27,
+    OpTypeArray = 28,
+    OpTypeRuntimeArray = 29,
+    OpTypeStruct = 30,
+    OpTypePointer = 32,
+    OpConstant = 43,
+    OpSpecConstantTrue = 48,
+    OpSpecConstantFalse = 49,
+    OpSpecConstant = 50,
+    OpVariable = 59,
+    OpDecorate = 71,
+    OpMemberDecorate = 72,
+};
+
+enum SpirvDecoration : uint32_t {
+    DecorationSpecId = 1,
+    DecorationBlock = 2,
+    DecorationBufferBlock = 3,
+    DecorationArrayStride = 6,
+    DecorationMatrixStride = 7,
+    DecorationBuiltIn = 11,
+    DecorationLocation = 30,
+    DecorationBinding = 33,
+    DecorationDescriptorSet = 34,
+    DecorationOffset = 35,
+};
+
+enum SpirvStorageClass : uint32_t {
+    StorageClassUniformConstant = 0,
+    StorageClassInput = 1,
+    StorageClassUniform = 2,
+    StorageClassPushConstant = 9,
+    StorageClassStorageBuffer = 12,
+};
+
+const uint32_t SPIRV_DIM_BUFFER = 5;
+const uint32_t SPIRV_DIM_SUBPASS_DATA = 6;
+
+// Everything known about one id, most of it only applies to some kinds of ids.
+struct SpirvId {
+    uint32_t op = 0;
+    // Element, component, column, pointee or result type.
+    uint32_t type = 0;
+    // Width of scalars, count of vectors and matrices, storage class of pointers and variables,
+    // value of constants, length id of arrays, dim of images.
+    uint32_t value = 0;
+    // Signedness of integers, sampled of images.
+    uint32_t flags = 0;
+    uint32_t set = UINT32_MAX;
+    uint32_t binding = UINT32_MAX;
+    uint32_t location = UINT32_MAX;
+    uint32_t specId = UINT32_MAX;
+    uint32_t arrayStride = 0;
+    bool block = false;
+    bool bufferBlock = false;
+    bool builtIn = false;
+    std::vector<uint32_t> members;
+    std::vector<uint32_t> memberOffsets;
+    std::vector<uint32_t> memberMatrixStrides;
+};
+
+static uint32_t typeSize(const std::vector<SpirvId>& ids, uint32_t type, uint32_t matrixStride) {
+    const SpirvId& id = ids[type];
+    switch (id.op) {
+        case OpTypeInt:
+        case OpTypeFloat:
+            return id.value / 8;
+        case OpTypeVector:
+            return id.value * typeSize(ids, id.type, 0);
+        case OpTypeMatrix:
+            return id.value * (matrixStride > 0 ? matrixStride : typeSize(ids, id.type, 0));
+        case OpTypeArray:
+            return ids[id.value].value * (id.arrayStride > 0 ? id.arrayStride : typeSize(ids, id.type, matrixStride));
+        case OpTypeStruct: {
+            uint32_t size = 0;
+            for (size_t i = 0; i < id.members.size(); i++) {
+                size = std::max(size, id.memberOffsets[i] + typeSize(ids, id.members[i], id.memberMatrixStrides[i]));
+            }
+            return size;
+        }
+        default:
+            throw std::runtime_error("Unsupported type in SPIR-V block");
+    }
+}
+
+static VkFormat inputFormat(const std::vector<SpirvId>& ids, uint32_t type) {
+    const SpirvId& id = ids[type];
+    uint32_t components = 1;
+    const SpirvId* scalar = &id;
+    if (id.op == OpTypeVector) {
+        components = id.value;
+        scalar = &ids[id.type];
+    }
+
+    if (scalar->value != 32) {
+        throw std::runtime_error("Unsupported vertex input width in SPIR-V");
+    }
+
+    static const VkFormat floatFormats[4] = {VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT};
+    static const VkFormat intFormats[4] = {VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT};
+    static const VkFormat uintFormats[4] = {VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT};
+
+    if (scalar->op == OpTypeFloat) {
+        return floatFormats[components - 1];
+    }
+    return scalar->flags ? intFormats[components - 1] : uintFormats[components - 1];
+}
+
+static VkDescriptorType descriptorType(const std::vector<SpirvId>& ids, uint32_t storageClass, uint32_t type) {
+    const SpirvId& id = ids[type];
+
+    if (storageClass == StorageClassStorageBuffer) {
+        return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    }
+
+    if (storageClass == StorageClassUniform) {
+        // Old style storage buffers are Uniform blocks decorated BufferBlock.
+        return id.bufferBlock ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    }
+
+    switch (id.op) {
+        case OpTypeSampler:
+            return VK_DESCRIPTOR_TYPE_SAMPLER;
+        case OpTypeSampledImage:
+            return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        case OpTypeImage:
+            if (id.value == SPIRV_DIM_SUBPASS_DATA) {
+                return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+            }
+            if (id.value == SPIRV_DIM_BUFFER) {
+                return id.flags == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+            }
+            // Sampled 2 means it is used without a sampler.
+            return id.flags == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        default:
+            throw std::runtime_error("Unsupported descriptor type in SPIR-V");
+    }
+}
+
+ShaderReflection reflectShader(const uint32_t* code, size_t wordCount) {
+    if (wordCount < SPIRV_HEADER_WORDS || code[0] != SPIRV_MAGIC) {
+        throw std::runtime_error("Not SPIR-V");
+    }
+
+    std::vector<SpirvId> ids(code[3]);
+    std::vector<uint32_t> variables;
+    ShaderReflection reflection;
+
+    auto checkId = [&ids](uint32_t id) {
+        if (id >= ids.size()) {
+            throw std::runtime_error("SPIR-V id out of bounds");
+        }
+        return id;
+    };
+
+    for (size_t offset = SPIRV_HEADER_WORDS; offset < wordCount;) {
+        uint32_t op = code[offset] & 0xffff;
+        uint32_t length = code[offset] >> 16;
+        if (length == 0 || offset + length > wordCount) {
+            throw std::runtime_error("Malformed SPIR-V instruction");
+        }
+        const uint32_t* words = code + offset;
+
+        switch (op) {
+            case OpEntryPoint:
+                // Execution models: 0 vertex, 4 fragment, 5 compute.
+                if (words[1] == 0) {
+                    reflection.stages |= VK_SHADER_STAGE_VERTEX_BIT;
+                } else if (words[1] == 4) {
+                    reflection.stages |= VK_SHADER_STAGE_FRAGMENT_BIT;
+                } else if (words[1] == 5) {
+                    reflection.stages |= VK_SHADER_STAGE_COMPUTE_BIT;
+                }
+                break;
+            case OpTypeInt:
+                ids[checkId(words[1])].op = op;
+                ids[words[1]].value = words[2];
+                ids[words[1]].flags = words[3];
+                break;
+            case OpTypeFloat:
+                ids[checkId(words[1])].op = op;
+                ids[words[1]].value = words[2];
+                break;
+            case OpTypeVector:
+            case OpTypeMatrix:
+                ids[checkId(words[1])].op = op;
+                ids[words[1]].type = words[2];
+                ids[words[1]].value = words[3];
+                break;
+            case OpTypeImage:
+                ids[checkId(words[1])].op = op;
+                ids[words[1]].value = words[3];
+                ids[words[1]].flags = words[7];
+                break;
+            case OpTypeSampler:
+                ids[checkId(words[1])].op = op;
+                break;
+            case OpTypeSampledImage:
+            case OpTypeRuntimeArray:
+                ids[checkId(words[1])].op = op;
+                ids[words[1]].type = words[2];
+                break;
+            case OpTypeArray:
+                ids[checkId(words[1])].op = op;
+                ids[words[1]].type = words[2];
+                ids[words[1]].value = checkId(words[3]);
+                break;
+            case OpTypeStruct: {
+                SpirvId& id = ids[checkId(words[1])];
+                id.op = op;
+                id.members.assign(words + 2, words + length);
+                id.memberOffsets.resize(id.members.size(), 0);
+                id.memberMatrixStrides.resize(id.members.size(), 0);
+                break;
+            }
+            case OpTypePointer:
+                ids[checkId(words[1])].op = op;
+                ids[words[1]].value = words[2];
+                ids[words[1]].type = words[3];
+                break;
+            case OpConstant:
+                ids[checkId(words[2])].op = op;
+                ids[words[2]].type = words[1];
+                ids[words[2]].value = words[3];
+                break;
+            case OpSpecConstantTrue:
+            case OpSpecConstantFalse:
+            case OpSpecConstant:
+                // SpecId decorations come first.
+                if (ids[checkId(words[2])].specId != UINT32_MAX) {
+                    reflection.specializationConstants.push_back(ids[words[2]].specId);
+                }
+                break;
+            case OpVariable:
+                ids[checkId(words[2])].op = op;
+                ids[words[2]].type = words[1];
+                ids[words[2]].value = words[3];
+                variables.push_back(words[2]);
+                break;
+            case OpDecorate: {
+                SpirvId& id = ids[checkId(words[1])];
+                switch (words[2]) {
+                    case DecorationBlock: id.block = true; break;
+                    case DecorationBufferBlock: id.bufferBlock = true; break;
+                    case DecorationArrayStride: id.arrayStride = words[3]; break;
+                    case DecorationBuiltIn: id.builtIn = true; break;
+                    case DecorationLocation: id.location = words[3]; break;
+                    case DecorationSpecId: id.specId = words[3]; break;
+                    case DecorationBinding: id.binding = words[3]; break;
+                    case DecorationDescriptorSet: id.set = words[3]; break;
+                }
+                break;
+            }
+            case OpMemberDecorate: {
+                // Decorations come before the types, the member lists may not be known yet.
+                SpirvId& id = ids[checkId(words[1])];
+                uint32_t member = words[2];
+                if (words[3] == DecorationOffset || words[3] == DecorationMatrixStride) {
+                    if (id.memberOffsets.size() <= member) {
+                        id.memberOffsets.resize(member + 1, 0);
+                        id.memberMatrixStrides.resize(member + 1, 0);
+                    }
+                    if (words[3] == DecorationOffset) {
+                        id.memberOffsets[member] = words[4];
+                    } else {
+                        id.memberMatrixStrides[member] = words[4];
+                    }
+                } else if (words[3] == DecorationBuiltIn) {
+                    id.builtIn = true;
+                }
+                break;
+            }
+        }
+
+        offset += length;
+    }
+
+    for (uint32_t variable : variables) {
+        const SpirvId& id = ids[variable];
+        uint32_t storageClass = id.value;
+        uint32_t type = ids[checkId(id.type)].type;
+        checkId(type);
+
+        if (storageClass == StorageClassPushConstant) {
+            reflection.pushConstantStages |= reflection.stages;
+            reflection.pushConstantSize = std::max(reflection.pushConstantSize, typeSize(ids, type, 0));
+        } else if (storageClass == StorageClassInput) {
+            if (!(reflection.stages & VK_SHADER_STAGE_VERTEX_BIT) || id.builtIn || ids[type].builtIn || id.location == UINT32_MAX) {
+                continue;
+            }
+
+            uint32_t count = 1;
+            if (ids[type].op == OpTypeArray) {
+                count = ids[ids[type].value].value;
+                type = ids[type].type;
+            }
+
+            // Matrices take a location per column.
+            uint32_t columns = 1;
+            if (ids[type].op == OpTypeMatrix) {
+                columns = ids[type].value;
+                type = ids[type].type;
+            }
+
+            VkFormat format = inputFormat(ids, type);
+            for (uint32_t i = 0; i < count * columns; i++) {
+                reflection.inputs.push_back({id.location + i, format});
+            }
+        } else if (storageClass == StorageClassUniformConstant || storageClass == StorageClassUniform || storageClass == StorageClassStorageBuffer) {
+            if (id.binding == UINT32_MAX) {
+                continue;
+            }
+
+            uint32_t count = 1;
+            if (ids[type].op == OpTypeArray) {
+                count = ids[ids[type].value].value;
+                type = ids[type].type;
+            } else if (ids[type].op == OpTypeRuntimeArray) {
+                throw std::runtime_error("Unbounded descriptor arrays are not supported");
+            }
+
+            ReflectedBinding binding{};
+            binding.set = id.set == UINT32_MAX ? 0 : id.set;
+            binding.binding = id.binding;
+            binding.type = descriptorType(ids, storageClass, type);
+            binding.count = count;
+            binding.stages = reflection.stages;
+            reflection.bindings.push_back(binding);
+        }
+    }
+
+    std::sort(reflection.bindings.begin(), reflection.bindings.end(), [](const ReflectedBinding& a, const ReflectedBinding& b) {
+        return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+    });
+    std::sort(reflection.inputs.begin(), reflection.inputs.end(), [](const ReflectedInput& a, const ReflectedInput& b) {
+        return a.location < b.location;
+    });
+    std::sort(reflection.specializationConstants.begin(), reflection.specializationConstants.end());
+
+    return reflection;
+}
+
+void ShaderReflection::merge(const ShaderReflection& other) {
+    stages |= other.stages;
+    pushConstantStages |= other.pushConstantStages;
+    pushConstantSize = std::max(pushConstantSize, other.pushConstantSize);
+    inputs.insert(inputs.end(), other.inputs.begin(), other.inputs.end());
+
+    for (uint32_t id : other.specializationConstants) {
+        auto it = std::lower_bound(specializationConstants.begin(), specializationConstants.end(), id);
+        if (it == specializationConstants.end() || *it != id) {
+            specializationConstants.insert(it, id);
+        }
+    }
+
+    for (const ReflectedBinding& binding : other.bindings) {
+        auto it = std::find_if(bindings.begin(), bindings.end(), [&binding](const ReflectedBinding& existing) {
+            return existing.set == binding.set && existing.binding == binding.binding;
+        });
+
+        if (it == bindings.end()) {
+            bindings.push_back(binding);
+            continue;
+        }
+
+        if (it->type != binding.type || it->count != binding.count) {
+            throw std::runtime_error("Shaders disagree on a descriptor binding");
+        }
+        it->stages |= binding.stages;
+    }
+
+    std::sort(bindings.begin(), bindings.end(), [](const ReflectedBinding& a, const ReflectedBinding& b) {
+        return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+    });
+}
+
+uint32_t ShaderReflection::setCount() const {
+    return bindings.empty() ? 0 : bindings.back().set + 1;
+}
+
+std::vector<VkDescriptorSetLayoutBinding> ShaderReflection::setBindings(uint32_t set) const {
+    std::vector<VkDescriptorSetLayoutBinding> result;
+    for (const ReflectedBinding& binding : bindings) {
+        if (binding.set != set) {
+            continue;
+        }
+
+        VkDescriptorSetLayoutBinding layoutBinding{};
+        layoutBinding.binding = binding.binding;
+        layoutBinding.descriptorType = binding.type;
+        layoutBinding.descriptorCount = binding.count;
+        layoutBinding.stageFlags = binding.stages;
+        result.push_back(layoutBinding);
+    }
+    return result;
+}
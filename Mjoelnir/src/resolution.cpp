@@ -0,0 +1,37 @@
+#include "resolution.hpp"
+
+#include <math.h>
+
+#include <algorithm>
+
+void ResolutionController::update(uint64_t gpuTimeNs, float renderedScale, uint64_t budgetNs) {
+    if (budgetNs == 0) {
+        scale = MAX_RENDER_SCALE;
+        averageFullTime = 0.0f;
+        return;
+    }
+
+    // The frame was rendered a few frames ago, at whatever scale was current then.
+    float fullTime = static_cast<float>(gpuTimeNs) / (renderedScale * renderedScale);
+    averageFullTime = averageFullTime > 0.0f ? averageFullTime + (fullTime - averageFullTime) * RENDER_SCALE_SMOOTHING : fullTime;
+    if (averageFullTime <= 0.0f) {
+        return;
+    }
+
+    float target = sqrtf(static_cast<float>(budgetNs) * RENDER_SCALE_HEADROOM / averageFullTime);
+    target = std::min(std::max(target, MIN_RENDER_SCALE), MAX_RENDER_SCALE);
+
+    // The limits are always reached, even if they are closer than the smallest step.
+    float change = target - scale;
+    if (fabsf(change) < RENDER_SCALE_MIN_STEP && target != MIN_RENDER_SCALE && target != MAX_RENDER_SCALE) {
+        return;
+    }
+    scale += std::min(std::max(change, -RENDER_SCALE_MAX_STEP), RENDER_SCALE_MAX_STEP);
+}
+
+VkExtent2D scaledExtent(VkExtent2D extent, float scale) {
+    VkExtent2D scaled;
+    scaled.width = std::min(std::max(static_cast<uint32_t>(static_cast<float>(extent.width) * scale + 0.5f), 1u), extent.width);
+    scaled.height = std::min(std::max(static_cast<uint32_t>(static_cast<float>(extent.height) * scale + 0.5f), 1u), extent.height);
+    return scaled;
+}
@@ -0,0 +1,59 @@
+#include "scratch.hpp"
+
+void* ScratchArena::allocateSlow(size_t size, size_t alignment) {
+    if (!chunks.empty()) {
+        usedBefore += offset;
+    }
+
+    // Grow geometrically so a frame that keeps allocating doesn't add a chunk every few calls.
+    size_t chunkSize = chunks.empty() ? SCRATCH_CHUNK_SIZE : chunks.back().size * 2;
+    if (chunkSize < size + alignment) {
+        chunkSize = size + alignment;
+    }
+
+    Chunk chunk;
+    chunk.memory.reset(new (std::nothrow) uint8_t[chunkSize]);
+    if (chunk.memory == nullptr) {
+        return nullptr;
+    }
+    chunk.size = chunkSize;
+    chunks.push_back(std::move(chunk));
+    chunkAllocations++;
+
+    uintptr_t base = reinterpret_cast<uintptr_t>(chunks.back().memory.get());
+    uintptr_t address = (base + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+    offset = address + size - base;
+
+    return reinterpret_cast<void*>(address);
+}
+
+void ScratchArena::reset() {
+    if (used() > highWater) {
+        highWater = used();
+    }
+
+    // Several chunks means the last frame didn't fit, replace them with one that does.
+    if (chunks.size() > 1) {
+        size_t total = capacity();
+        chunks.clear();
+
+        Chunk chunk;
+        chunk.memory.reset(new (std::nothrow) uint8_t[total]);
+        if (chunk.memory != nullptr) {
+            chunk.size = total;
+            chunks.push_back(std::move(chunk));
+            chunkAllocations++;
+        }
+    }
+
+    offset = 0;
+    usedBefore = 0;
+}
+
+size_t ScratchArena::capacity() const {
+    size_t total = 0;
+    for (const Chunk& chunk : chunks) {
+        total += chunk.size;
+    }
+    return total;
+}
@@ -143,4 +143,5 @@
 #                     For files ending in .hlsl the default is hlsl.
 #                     Otherwise the default is glsl.
 ls *.vert | sed 's/.vert//' | xargs -I % sh -c 'glslc %.vert -Werror -o %_vert.spv'
-ls *.frag | sed 's/.frag//' | xargs -I % sh -c 'glslc %.frag -Werror -o %_frag.spv'
\ No newline at end of file
+ls *.frag | sed 's/.frag//' | xargs -I % sh -c 'glslc %.frag -Werror -o %_frag.spv'
+ls *.comp | sed 's/.comp//' | xargs -I % sh -c 'glslc %.comp -Werror -o %_comp.spv'
\ No newline at end of file
@@ -0,0 +1,78 @@
+// Shared by light culling and the mesh fragment shader, the buffers match FrameUniforms and GpuLight.
+
+#define CLUSTER_TILES_X 16
+#define CLUSTER_TILES_Y 9
+#define CLUSTER_SLICES 24
+#define CLUSTER_COUNT (CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES)
+#define CLUSTER_MAX_LIGHTS 128
+#define LIGHT_CULL_GROUP_SIZE 64
+
+// Only light culling writes the cluster lists.
+#ifdef LIGHT_CULL
+#define CLUSTER_ACCESS writeonly
+#else
+#define CLUSTER_ACCESS readonly
+#endif
+
+struct Light {
+    // View space, w is the range.
+    vec4 positionRange;
+    // w is the cone offset.
+    vec4 color;
+    // Spot axis, w is the cone scale.
+    vec4 direction;
+    // Bounding sphere.
+    vec4 bounds;
+};
+
+layout(set = 0, binding = 0) uniform FrameUniforms {
+    mat4 view;
+    mat4 viewProjection;
+    vec4 ambient;
+    vec4 depthLinearize;
+    vec2 tileScale;
+    float sliceScale;
+    float sliceBias;
+    uint logarithmicSlices;
+    uint lightCount;
+} frame;
+
+layout(std430, set = 0, binding = 1) readonly buffer Lights {
+    Light lights[];
+};
+
+// Lights in every cluster, and their indices in CLUSTER_MAX_LIGHTS slots per cluster.
+layout(std430, set = 0, binding = 2) CLUSTER_ACCESS buffer ClusterCounts {
+    uint clusterCounts[];
+};
+
+layout(std430, set = 0, binding = 3) CLUSTER_ACCESS buffer ClusterLights {
+    uint clusterLights[];
+};
+
+// See ClusterDepth.
+uint clusterIndex(vec3 fragCoord) {
+    uvec2 tile = min(uvec2(fragCoord.xy * frame.tileScale), uvec2(CLUSTER_TILES_X - 1, CLUSTER_TILES_Y - 1));
+
+    vec4 linearize = frame.depthLinearize;
+    float depth = (linearize.x * fragCoord.z + linearize.y) / (linearize.z * fragCoord.z + linearize.w);
+    float slice = (frame.logarithmicSlices != 0 ? log2(max(depth, 1e-6)) : depth) * frame.sliceScale + frame.sliceBias;
+    uint sliceIndex = uint(clamp(slice, 0.0, float(CLUSTER_SLICES - 1)));
+
+    return tile.x + CLUSTER_TILES_X * (tile.y + CLUSTER_TILES_Y * sliceIndex);
+}
+
+vec3 shadeLight(Light light, vec3 position, vec3 normal) {
+    vec3 toLight = light.positionRange.xyz - position;
+    float distanceSquared = dot(toLight, toLight);
+    vec3 direction = toLight * inversesqrt(max(distanceSquared, 1e-8));
+
+    // Inverse square, windowed so it reaches 0 at the range.
+    float ratio = distanceSquared / (light.positionRange.w * light.positionRange.w);
+    float window = clamp(1.0 - ratio * ratio, 0.0, 1.0);
+    float attenuation = window * window / (distanceSquared + 1.0);
+
+    float cone = clamp(dot(light.direction.xyz, -direction) * light.direction.w + light.color.w, 0.0, 1.0);
+
+    return light.color.rgb * (max(dot(normal, direction), 0.0) * attenuation * cone * cone);
+}
@@ -0,0 +1,62 @@
+// Shared by the particle compute passes, the buffers match GpuParticle and ParticleCounters.
+
+#define PARTICLE_GROUP_SIZE 256
+
+struct Particle {
+    // w is the remaining life in seconds.
+    vec4 position;
+    // w is the life the particle started with.
+    vec4 velocity;
+};
+
+layout(std430, set = 0, binding = 0) buffer Particles {
+    Particle particles[];
+};
+
+// Indices of free particles, used as a stack.
+layout(std430, set = 0, binding = 1) buffer DeadList {
+    uint deadList[];
+};
+
+// Two lists of indices of alive particles back to back, one read and one written every frame.
+layout(std430, set = 0, binding = 2) buffer AliveList {
+    uint aliveList[];
+};
+
+layout(std430, set = 0, binding = 3) buffer Counters {
+    uint aliveCount;
+    uint deadCount;
+    uint emitCount;
+    uint aliveAfterSimulation;
+    uint emitDispatch[3];
+    uint simulateDispatch[3];
+    // VkDrawIndirectCommand
+    uint drawVertexCount;
+    uint drawInstanceCount;
+    uint drawFirstVertex;
+    uint drawFirstInstance;
+};
+
+layout(push_constant) uniform ParticleSimulationConstants {
+    vec4 emitterPosition;
+    vec4 emitterDirection;
+    vec4 gravity;
+    float deltaTime;
+    uint emitCount;
+    uint readOffset;
+    uint writeOffset;
+    uint seed;
+} simulation;
+
+uint hash(uint value) {
+    // PCG
+    uint state = value * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// In [0, 1), advances the state.
+float random(inout uint state) {
+    state = hash(state);
+    return float(state >> 8) / 16777216.0;
+}
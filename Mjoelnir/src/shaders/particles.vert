@@ -0,0 +1,42 @@
+#version 450
+
+// Particle storage, see particles.glsl. Only read here.
+struct Particle {
+    vec4 position;
+    vec4 velocity;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Particles {
+    Particle particles[];
+};
+
+layout(std430, set = 0, binding = 2) readonly buffer AliveList {
+    uint aliveList[];
+};
+
+layout(push_constant) uniform ParticleDrawConstants {
+    mat4 viewProjection;
+    vec2 size;
+    uint aliveOffset;
+} draw;
+
+layout(location = 0) out vec2 fragCorner;
+layout(location = 1) out vec4 fragColor;
+
+const vec2 corners[6] = vec2[](
+    vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+    vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0)
+);
+
+void main() {
+    // One instance per alive particle, the instance count comes from the simulation.
+    Particle particle = particles[aliveList[draw.aliveOffset + gl_InstanceIndex]];
+    vec2 corner = corners[gl_VertexIndex];
+
+    vec4 center = draw.viewProjection * vec4(particle.position.xyz, 1.0);
+    gl_Position = center + vec4(corner * draw.size * center.w, 0.0, 0.0);
+
+    float age = 1.0 - particle.position.w / particle.velocity.w;
+    fragCorner = corner;
+    fragColor = vec4(mix(vec3(1.0, 0.8, 0.3), vec3(0.8, 0.1, 0.05), age), 1.0 - age);
+}
@@ -1,9 +1,26 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "lights.glsl"
 
 layout(location = 0) in vec3 fragColor;
+// View space.
+layout(location = 1) in vec3 fragPosition;
+layout(location = 2) in vec3 fragNormal;
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = vec4(fragColor, 1.0);
-}
\ No newline at end of file
+    vec3 normal = normalize(fragNormal);
+
+    // Only the lights binned into this fragment's cluster, see light_cull.comp.
+    uint cluster = clusterIndex(gl_FragCoord.xyz);
+    uint count = clusterCounts[cluster];
+
+    vec3 light = frame.ambient.rgb;
+    for (uint i = 0; i < count; i++) {
+        light += shadeLight(lights[clusterLights[cluster * CLUSTER_MAX_LIGHTS + i]], fragPosition, normal);
+    }
+
+    outColor = vec4(fragColor * light, 1.0);
+}
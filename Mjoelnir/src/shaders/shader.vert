@@ -1,20 +1,52 @@
 #version 450
 
+layout(location = 0) in mat4 instanceModel;
+
+// Packed mesh vertex, see PackedVertex.
+layout(location = 4) in vec3 inPosition;
+layout(location = 5) in vec2 inNormal;
+layout(location = 6) in vec2 inUV;
+
+// See lights.glsl, only the matrices are used here.
+layout(set = 0, binding = 0) uniform FrameUniforms {
+    mat4 view;
+    mat4 viewProjection;
+} frame;
+
+layout(push_constant) uniform MeshQuantization {
+    vec4 offset;
+    vec4 scale;
+} mesh;
+
 layout(location = 0) out vec3 fragColor;
+// View space, for lighting.
+layout(location = 1) out vec3 fragPosition;
+layout(location = 2) out vec3 fragNormal;
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+// MESH_SHADER_SHOW_NORMALS, the branch not taken is compiled out.
+layout(constant_id = 0) const bool SHOW_NORMALS = false;
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+vec3 decodeOctahedral(vec2 encoded) {
+    vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float fold = max(-normal.z, 0.0);
+    normal.x += normal.x >= 0.0 ? -fold : fold;
+    normal.y += normal.y >= 0.0 ? -fold : fold;
+    return normalize(normal);
+}
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
-}
\ No newline at end of file
+    vec3 position = inPosition * mesh.scale.xyz + mesh.offset.xyz;
+
+    vec4 world = instanceModel * vec4(position, 1.0);
+    gl_Position = frame.viewProjection * world;
+
+    vec3 normal = decodeOctahedral(inNormal);
+    fragPosition = (frame.view * world).xyz;
+    fragNormal = mat3(frame.view) * mat3(instanceModel) * normal;
+    // Colors come from the UVs for now, or the normals when debugging them.
+    if (SHOW_NORMALS) {
+        fragColor = normal * 0.5 + 0.5;
+    } else {
+        fragColor = vec3(inUV, 1.0 - inUV.x - inUV.y);
+    }
+}
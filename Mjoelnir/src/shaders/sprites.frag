@@ -0,0 +1,17 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform sampler2DArray atlas;
+
+layout(push_constant) uniform SpriteConstants {
+    vec2 screenScale;
+    uint page;
+} sprite;
+
+layout(location = 0) in vec2 fragUv;
+layout(location = 1) in vec4 fragColor;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    outColor = texture(atlas, vec3(fragUv, float(sprite.page))) * fragColor;
+}
@@ -0,0 +1,36 @@
+#version 450
+
+// One instance per sprite, see SpriteInstance in sprites.hpp.
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec2 inSize;
+layout(location = 2) in vec4 inUv;
+layout(location = 3) in vec4 inColor;
+layout(location = 4) in float inRotation;
+
+layout(push_constant) uniform SpriteConstants {
+    vec2 screenScale;
+    uint page;
+} sprite;
+
+layout(location = 0) out vec2 fragUv;
+layout(location = 1) out vec4 fragColor;
+
+const vec2 corners[6] = vec2[](
+    vec2(-0.5, -0.5), vec2(0.5, -0.5), vec2(0.5, 0.5),
+    vec2(-0.5, -0.5), vec2(0.5, 0.5), vec2(-0.5, 0.5)
+);
+
+void main() {
+    vec2 corner = corners[gl_VertexIndex];
+
+    float s = sin(inRotation);
+    float c = cos(inRotation);
+    vec2 offset = corner * inSize;
+    vec2 position = inPosition + vec2(offset.x * c - offset.y * s, offset.x * s + offset.y * c);
+
+    // Pixels with the origin in the top left corner, which is where Vulkan puts -1, -1.
+    gl_Position = vec4(position * sprite.screenScale - 1.0, 0.0, 1.0);
+
+    fragUv = mix(inUv.xy, inUv.zw, corner + 0.5);
+    fragColor = inColor;
+}
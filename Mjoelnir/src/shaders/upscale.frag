@@ -0,0 +1,16 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform sampler2D scene;
+
+layout(push_constant) uniform UpscaleConstants {
+    vec2 uvScale;
+    vec2 uvMax;
+} upscale;
+
+layout(location = 0) in vec2 fragUv;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    outColor = vec4(texture(scene, min(fragUv * upscale.uvScale, upscale.uvMax)).rgb, 1.0);
+}
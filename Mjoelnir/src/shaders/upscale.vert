@@ -0,0 +1,10 @@
+#version 450
+
+layout(location = 0) out vec2 fragUv;
+
+// A single triangle covering the screen, see UpscaleConstants for how it maps onto the scene.
+void main() {
+    vec2 corner = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+    fragUv = corner;
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,181 @@
+#include "sprites.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "profiler.hpp"
+
+void SpriteBatch::sort() {
+    // Stable LSD radix sort on the key bytes, the submission index below them is already ascending.
+    // Passes over a byte that is the same for every sprite are skipped, usually that leaves one or two.
+    sortScratch.resize(order.size());
+
+    // Histograms of every key byte in a single read.
+    uint32_t counts[4][256] = {};
+    for (uint64_t entry : order) {
+        uint32_t key = static_cast<uint32_t>(entry >> 32);
+        counts[0][key & 0xff]++;
+        counts[1][(key >> 8) & 0xff]++;
+        counts[2][(key >> 16) & 0xff]++;
+        counts[3][key >> 24]++;
+    }
+
+    for (uint32_t pass = 0; pass < 4; pass++) {
+        uint32_t shift = 32 + pass * 8;
+        if (counts[pass][(order[0] >> shift) & 0xff] == order.size()) {
+            continue;
+        }
+
+        uint32_t offsets[256];
+        uint32_t offset = 0;
+        for (uint32_t i = 0; i < 256; i++) {
+            offsets[i] = offset;
+            offset += counts[pass][i];
+        }
+
+        for (uint64_t entry : order) {
+            sortScratch[offsets[(entry >> shift) & 0xff]++] = entry;
+        }
+        order.swap(sortScratch);
+    }
+}
+
+void SpriteBatch::build(SpriteInstance* output) {
+    PROFILE_ZONE("SpriteBatch::build");
+
+    batchDraws.clear();
+    if (instances.empty()) {
+        return;
+    }
+
+    sort();
+
+    uint64_t currentKey = UINT64_MAX;
+    for (uint32_t i = 0; i < order.size(); i++) {
+        uint64_t key = order[i] >> 32;
+        // Written front to back, the instance buffer is usually write combined memory.
+        output[i] = instances[static_cast<uint32_t>(order[i])];
+
+        if (key != currentKey) {
+            batchDraws.push_back({static_cast<SpriteBlend>((key >> 8) & 0xff), static_cast<uint32_t>(key & 0xff), i, 0});
+            currentKey = key;
+        }
+        batchDraws.back().instanceCount++;
+    }
+}
+
+void SkylinePacker::reset(uint32_t packerWidth, uint32_t packerHeight) {
+    width = packerWidth;
+    height = packerHeight;
+    skyline.clear();
+    skyline.push_back({0, 0, packerWidth});
+}
+
+uint32_t SkylinePacker::fit(size_t index, uint32_t rectWidth, uint32_t rectHeight) const {
+    uint32_t x = skyline[index].x;
+    if (x + rectWidth > width) {
+        return UINT32_MAX;
+    }
+
+    // The rectangle rests on the highest segment below it.
+    uint32_t y = 0;
+    uint32_t remaining = rectWidth;
+    for (size_t i = index; remaining > 0; i++) {
+        y = std::max(y, skyline[i].y);
+        remaining -= std::min(remaining, skyline[i].width);
+    }
+
+    return y + rectHeight <= height ? y : UINT32_MAX;
+}
+
+bool SkylinePacker::insert(uint32_t rectWidth, uint32_t rectHeight, uint32_t& x, uint32_t& y) {
+    size_t best = SIZE_MAX;
+    uint32_t bestY = UINT32_MAX;
+    uint32_t bestWidth = UINT32_MAX;
+
+    // Lowest position wins, ties go to the narrower segment so wide gaps stay open.
+    for (size_t i = 0; i < skyline.size(); i++) {
+        uint32_t fitY = fit(i, rectWidth, rectHeight);
+        if (fitY < bestY || (fitY == bestY && fitY != UINT32_MAX && skyline[i].width < bestWidth)) {
+            best = i;
+            bestY = fitY;
+            bestWidth = skyline[i].width;
+        }
+    }
+
+    if (best == SIZE_MAX) {
+        return false;
+    }
+
+    x = skyline[best].x;
+    y = bestY;
+
+    // The new segment covers the rectangle's top, whatever it covers is cut off or removed.
+    skyline.insert(skyline.begin() + best, {x, bestY + rectHeight, rectWidth});
+
+    uint32_t right = x + rectWidth;
+    for (size_t i = best + 1; i < skyline.size();) {
+        Segment& segment = skyline[i];
+        if (segment.x >= right) {
+            break;
+        }
+
+        uint32_t segmentRight = segment.x + segment.width;
+        if (segmentRight <= right) {
+            skyline.erase(skyline.begin() + i);
+            continue;
+        }
+
+        segment.width = segmentRight - right;
+        segment.x = right;
+        break;
+    }
+
+    // Neighbors at the same height are one segment.
+    for (size_t i = 0; i + 1 < skyline.size();) {
+        if (skyline[i].y == skyline[i + 1].y) {
+            skyline[i].width += skyline[i + 1].width;
+            skyline.erase(skyline.begin() + i + 1);
+        } else {
+            i++;
+        }
+    }
+
+    return true;
+}
+
+bool SpriteAtlas::allocate(uint32_t width, uint32_t height, SpriteImage& image, uint32_t& x, uint32_t& y) {
+    uint32_t paddedWidth = width + SPRITE_ATLAS_PADDING * 2;
+    uint32_t paddedHeight = height + SPRITE_ATLAS_PADDING * 2;
+    if (paddedWidth > SPRITE_ATLAS_PAGE_SIZE || paddedHeight > SPRITE_ATLAS_PAGE_SIZE) {
+        return false;
+    }
+
+    uint32_t page = 0;
+    for (; page < pages.size(); page++) {
+        if (pages[page].insert(paddedWidth, paddedHeight, x, y)) {
+            break;
+        }
+    }
+
+    if (page == pages.size()) {
+        if (pages.size() == SPRITE_ATLAS_MAX_PAGES) {
+            return false;
+        }
+
+        pages.emplace_back();
+        pages.back().reset(SPRITE_ATLAS_PAGE_SIZE, SPRITE_ATLAS_PAGE_SIZE);
+        pages.back().insert(paddedWidth, paddedHeight, x, y);
+    }
+
+    x += SPRITE_ATLAS_PADDING;
+    y += SPRITE_ATLAS_PADDING;
+
+    image.page = page;
+    image.uv[0] = static_cast<uint16_t>(static_cast<uint64_t>(x) * 65535 / SPRITE_ATLAS_PAGE_SIZE);
+    image.uv[1] = static_cast<uint16_t>(static_cast<uint64_t>(y) * 65535 / SPRITE_ATLAS_PAGE_SIZE);
+    image.uv[2] = static_cast<uint16_t>(static_cast<uint64_t>(x + width) * 65535 / SPRITE_ATLAS_PAGE_SIZE);
+    image.uv[3] = static_cast<uint16_t>(static_cast<uint64_t>(y + height) * 65535 / SPRITE_ATLAS_PAGE_SIZE);
+    return true;
+}
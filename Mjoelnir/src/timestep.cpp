@@ -0,0 +1,59 @@
+#include "timestep.hpp"
+
+#include <thread>
+
+#include "profiler.hpp"
+
+uint32_t FixedTimestep::advance(uint64_t now) {
+    // The first frame starts the clock.
+    if (lastTime == 0) {
+        lastTime = now;
+        return 0;
+    }
+
+    accumulator += now - lastTime;
+    lastTime = now;
+
+    uint64_t due = accumulator / tick;
+    if (due > MAX_SIMULATION_TICKS_PER_FRAME) {
+        due = MAX_SIMULATION_TICKS_PER_FRAME;
+        accumulator = due * tick;
+    }
+
+    accumulator -= due * tick;
+    ticks += due;
+    return static_cast<uint32_t>(due);
+}
+
+void FrameLimiter::wait(uint64_t intervalNs) {
+    if (intervalNs == 0) {
+        deadline = 0;
+        return;
+    }
+
+    uint64_t now = Profiler::now();
+    if (deadline > now) {
+        if (deadline - now > FRAME_LIMIT_SPIN_NS) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(deadline - now - FRAME_LIMIT_SPIN_NS));
+        }
+        while (Profiler::now() < deadline) {
+            std::this_thread::yield();
+        }
+        now = deadline;
+    }
+
+    // A frame that ran late by less than an interval is made up for, anything later restarts the schedule.
+    if (deadline != 0 && now - deadline < intervalNs) {
+        deadline += intervalNs;
+    } else {
+        deadline = now + intervalNs;
+    }
+}
+
+glm::mat4 interpolateTransform(const glm::mat4& previous, const glm::mat4& current, float alpha) {
+    glm::mat4 result;
+    for (int i = 0; i < 4; i++) {
+        result[i] = previous[i] + (current[i] - previous[i]) * alpha;
+    }
+    return result;
+}
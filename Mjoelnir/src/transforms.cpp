@@ -0,0 +1,236 @@
+#include "transforms.hpp"
+#include <stdexcept>
+
+// Below this many nodes in a level it is cheaper to just do them on the calling thread.
+const uint32_t TRANSFORM_GRAIN_SIZE = 1024;
+
+TransformNode TransformHierarchy::createNode(TransformNode parent) {
+    if (parent != INVALID_TRANSFORM_NODE && (parent >= aliveNodes.size() || !aliveNodes[parent])) {
+        throw std::runtime_error("Transform parent does not exist");
+    }
+
+    TransformNode node;
+    if (!freeNodes.empty()) {
+        node = freeNodes.back();
+        freeNodes.pop_back();
+    } else {
+        node = static_cast<TransformNode>(slotOfNode.size());
+        slotOfNode.push_back(0);
+        parentOfNode.push_back(INVALID_TRANSFORM_NODE);
+        aliveNodes.push_back(false);
+    }
+
+    // Append for now, rebuildOrder() moves it into place before the next update.
+    uint32_t slot = static_cast<uint32_t>(nodeOfSlot.size());
+    slotOfNode[node] = slot;
+    parentOfNode[node] = parent;
+    aliveNodes[node] = true;
+
+    nodeOfSlot.push_back(node);
+    parentSlots.push_back(parent != INVALID_TRANSFORM_NODE ? slotOfNode[parent] : UINT32_MAX);
+    localPositions.push_back(glm::vec3(0.0f));
+    localRotations.push_back(glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+    localScales.push_back(glm::vec3(1.0f));
+    worldMatrices.push_back(glm::mat4(1.0f));
+    dirty.push_back(1);
+    versions.push_back(0);
+
+    orderDirty = true;
+
+    return node;
+}
+
+void TransformHierarchy::destroyNode(TransformNode node) {
+    if (node >= aliveNodes.size() || !aliveNodes[node]) {
+        return;
+    }
+
+    // Descendants are unreachable from the roots now and get released by rebuildOrder().
+    aliveNodes[node] = false;
+    orderDirty = true;
+}
+
+void TransformHierarchy::setParent(TransformNode node, TransformNode parent) {
+    for (TransformNode ancestor = parent; ancestor != INVALID_TRANSFORM_NODE; ancestor = parentOfNode[ancestor]) {
+        if (ancestor == node) {
+            throw std::runtime_error("Unable to parent a transform node to its own descendant");
+        }
+    }
+
+    parentOfNode[node] = parent;
+    dirty[slotOfNode[node]] = 1;
+    orderDirty = true;
+}
+
+void TransformHierarchy::setLocal(TransformNode node, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale) {
+    uint32_t slot = slotOfNode[node];
+    localPositions[slot] = position;
+    localRotations[slot] = rotation;
+    localScales[slot] = scale;
+    dirty[slot] = 1;
+}
+
+void TransformHierarchy::setLocalPosition(TransformNode node, const glm::vec3& position) {
+    uint32_t slot = slotOfNode[node];
+    localPositions[slot] = position;
+    dirty[slot] = 1;
+}
+
+const glm::mat4& TransformHierarchy::world(TransformNode node) const {
+    return worldMatrices[slotOfNode[node]];
+}
+
+template<typename T>
+static void permute(std::vector<T>& values, const std::vector<uint32_t>& order) {
+    std::vector<T> permuted;
+    permuted.reserve(order.size());
+    for (uint32_t slot : order) {
+        permuted.push_back(values[slot]);
+    }
+    values.swap(permuted);
+}
+
+void TransformHierarchy::rebuildOrder() {
+    uint32_t nodeCount = static_cast<uint32_t>(slotOfNode.size());
+
+    // Children of every node as a flat list (offsets + indices), only for live nodes.
+    std::vector<uint32_t> childOffsets(nodeCount + 1, 0);
+    std::vector<TransformNode> roots;
+    for (uint32_t slot = 0; slot < nodeOfSlot.size(); slot++) {
+        TransformNode node = nodeOfSlot[slot];
+        if (!aliveNodes[node]) {
+            continue;
+        }
+
+        TransformNode parent = parentOfNode[node];
+        if (parent == INVALID_TRANSFORM_NODE) {
+            roots.push_back(node);
+        } else {
+            childOffsets[parent + 1]++;
+        }
+    }
+
+    for (uint32_t i = 0; i < nodeCount; i++) {
+        childOffsets[i + 1] += childOffsets[i];
+    }
+
+    std::vector<TransformNode> children(childOffsets[nodeCount]);
+    std::vector<uint32_t> cursor(childOffsets.begin(), childOffsets.end() - 1);
+    for (uint32_t slot = 0; slot < nodeOfSlot.size(); slot++) {
+        TransformNode node = nodeOfSlot[slot];
+        if (aliveNodes[node] && parentOfNode[node] != INVALID_TRANSFORM_NODE) {
+            children[cursor[parentOfNode[node]]++] = node;
+        }
+    }
+
+    // Breadth-first walk from the roots, which also gives us the level boundaries.
+    std::vector<TransformNode> orderedNodes;
+    orderedNodes.reserve(nodeOfSlot.size());
+    orderedNodes.insert(orderedNodes.end(), roots.begin(), roots.end());
+
+    levelOffsets.clear();
+    levelOffsets.push_back(0);
+    uint32_t levelBegin = 0;
+    while (levelBegin < orderedNodes.size()) {
+        uint32_t levelEnd = static_cast<uint32_t>(orderedNodes.size());
+        for (uint32_t i = levelBegin; i < levelEnd; i++) {
+            TransformNode node = orderedNodes[i];
+            for (uint32_t c = childOffsets[node]; c < childOffsets[node + 1]; c++) {
+                if (aliveNodes[children[c]]) {
+                    orderedNodes.push_back(children[c]);
+                }
+            }
+        }
+        levelOffsets.push_back(levelEnd);
+        levelBegin = levelEnd;
+    }
+    // Anything we did not reach was destroyed or lives under a destroyed node.
+    std::vector<bool> reached(nodeCount, false);
+    for (TransformNode node : orderedNodes) {
+        reached[node] = true;
+    }
+    for (uint32_t slot = 0; slot < nodeOfSlot.size(); slot++) {
+        TransformNode node = nodeOfSlot[slot];
+        if (!reached[node]) {
+            aliveNodes[node] = false;
+            parentOfNode[node] = INVALID_TRANSFORM_NODE;
+            freeNodes.push_back(node);
+        }
+    }
+
+    std::vector<uint32_t> order(orderedNodes.size());
+    for (uint32_t i = 0; i < orderedNodes.size(); i++) {
+        order[i] = slotOfNode[orderedNodes[i]];
+    }
+
+    permute(localPositions, order);
+    permute(localRotations, order);
+    permute(localScales, order);
+    permute(worldMatrices, order);
+    nodeOfSlot = orderedNodes;
+
+    for (uint32_t slot = 0; slot < nodeOfSlot.size(); slot++) {
+        slotOfNode[nodeOfSlot[slot]] = slot;
+    }
+
+    parentSlots.resize(nodeOfSlot.size());
+    for (uint32_t slot = 0; slot < nodeOfSlot.size(); slot++) {
+        TransformNode parent = parentOfNode[nodeOfSlot[slot]];
+        parentSlots[slot] = parent != INVALID_TRANSFORM_NODE ? slotOfNode[parent] : UINT32_MAX;
+    }
+
+    // Instance indices moved, so every output buffer needs a full rewrite.
+    dirty.assign(nodeOfSlot.size(), 1);
+    versions.assign(nodeOfSlot.size(), 0);
+
+    orderDirty = false;
+}
+
+void TransformHierarchy::updateRange(uint32_t begin, uint32_t end, glm::mat4* output, uint64_t outputVersion) {
+    for (uint32_t slot = begin; slot < end; slot++) {
+        uint32_t parent = parentSlots[slot];
+
+        // Parents are a level up and already done, their dirty flag still tells us if they changed.
+        if (dirty[slot] || (parent != UINT32_MAX && dirty[parent])) {
+            glm::mat4 local = glm::mat4_cast(localRotations[slot]);
+            local[0] *= localScales[slot].x;
+            local[1] *= localScales[slot].y;
+            local[2] *= localScales[slot].z;
+            local[3] = glm::vec4(localPositions[slot], 1.0f);
+
+            worldMatrices[slot] = parent != UINT32_MAX ? worldMatrices[parent] * local : local;
+            dirty[slot] = 1;
+            versions[slot] = updateCount;
+        }
+
+        if (versions[slot] > outputVersion) {
+            output[slot] = worldMatrices[slot];
+        }
+    }
+}
+
+void TransformHierarchy::update(JobSystem* jobs, glm::mat4* output, uint64_t& outputVersion) {
+    if (orderDirty) {
+        rebuildOrder();
+    }
+
+    updateCount++;
+
+    for (uint32_t level = 0; level + 1 < levelOffsets.size(); level++) {
+        uint32_t levelBegin = levelOffsets[level];
+        uint32_t levelSize = levelOffsets[level + 1] - levelBegin;
+
+        if (jobs == nullptr) {
+            updateRange(levelBegin, levelBegin + levelSize, output, outputVersion);
+            continue;
+        }
+
+        jobs->parallelFor(levelSize, TRANSFORM_GRAIN_SIZE, [this, levelBegin, output, outputVersion](uint32_t begin, uint32_t end) {
+            updateRange(levelBegin + begin, levelBegin + end, output, outputVersion);
+        });
+    }
+
+    // Children have all been visited, the flags can go for the next frame.
+    dirty.assign(dirty.size(), 0);
+    outputVersion = updateCount;
+}
@@ -0,0 +1,228 @@
+// Runs the per-frame work of the job system, the world and a scratch arena through a few frames of
+// warm up, then checks that the frames after it never touch the global heap.
+// The test replaces the global operator new and delete to count allocations, which is why it is
+// built from the engine's sources instead of linking the library.
+
+#include "ecs.hpp"
+#include "jobs.hpp"
+#include "scratch.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+
+const uint32_t WARM_UP_FRAMES = 16;
+const uint32_t STEADY_STATE_FRAMES = 256;
+const uint32_t ENTITY_COUNT = 10000;
+// Entities destroyed and recreated every frame, through the command buffers.
+const uint32_t RESPAWN_INTERVAL = 64;
+
+// What plain operator new guarantees, anything more strictly aligned goes through the aligned forms.
+const size_t DEFAULT_ALIGNMENT = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+static std::atomic<uint64_t> heapAllocations{0};
+
+// The aligned forms keep the pointer malloc() returned right in front of the memory they hand out.
+static void* allocate(size_t size, size_t alignment) {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (alignment <= DEFAULT_ALIGNMENT) {
+        return malloc(size > 0 ? size : 1);
+    }
+
+    void* memory = malloc(size + alignment + sizeof(void*));
+    if (memory == nullptr) {
+        return nullptr;
+    }
+    uintptr_t address = (reinterpret_cast<uintptr_t>(memory) + sizeof(void*) + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+    reinterpret_cast<void**>(address)[-1] = memory;
+    return reinterpret_cast<void*>(address);
+}
+
+static void deallocate(void* memory, size_t alignment) {
+    if (memory == nullptr) {
+        return;
+    }
+
+    if (alignment <= DEFAULT_ALIGNMENT) {
+        free(memory);
+    } else {
+        free(static_cast<void**>(memory)[-1]);
+    }
+}
+
+static void* allocateOrThrow(size_t size, size_t alignment) {
+    void* memory = allocate(size, alignment);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void* operator new(size_t size) {
+    return allocateOrThrow(size, DEFAULT_ALIGNMENT);
+}
+
+void* operator new[](size_t size) {
+    return allocateOrThrow(size, DEFAULT_ALIGNMENT);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return allocateOrThrow(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return allocateOrThrow(size, static_cast<size_t>(alignment));
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size, DEFAULT_ALIGNMENT);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size, DEFAULT_ALIGNMENT);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocate(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* memory) noexcept {
+    deallocate(memory, DEFAULT_ALIGNMENT);
+}
+
+void operator delete[](void* memory) noexcept {
+    deallocate(memory, DEFAULT_ALIGNMENT);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    deallocate(memory, DEFAULT_ALIGNMENT);
+}
+
+void operator delete[](void* memory, size_t) noexcept {
+    deallocate(memory, DEFAULT_ALIGNMENT);
+}
+
+void operator delete(void* memory, std::align_val_t alignment) noexcept {
+    deallocate(memory, static_cast<size_t>(alignment));
+}
+
+void operator delete[](void* memory, std::align_val_t alignment) noexcept {
+    deallocate(memory, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* memory, size_t, std::align_val_t alignment) noexcept {
+    deallocate(memory, static_cast<size_t>(alignment));
+}
+
+void operator delete[](void* memory, size_t, std::align_val_t alignment) noexcept {
+    deallocate(memory, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* memory, const std::nothrow_t&) noexcept {
+    deallocate(memory, DEFAULT_ALIGNMENT);
+}
+
+void operator delete[](void* memory, const std::nothrow_t&) noexcept {
+    deallocate(memory, DEFAULT_ALIGNMENT);
+}
+
+void operator delete(void* memory, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    deallocate(memory, static_cast<size_t>(alignment));
+}
+
+void operator delete[](void* memory, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    deallocate(memory, static_cast<size_t>(alignment));
+}
+
+struct Position {
+    float x, y, z;
+};
+
+struct Velocity {
+    float x, y, z;
+};
+
+struct Age {
+    uint32_t frames;
+};
+
+static void runFrame(JobSystem& jobs, World& world, ScratchArena& arena, float* weights, uint32_t frame) {
+    // Parallel query that records structural changes from the workers.
+    world.parallelEachChunk<Position, Velocity, Age>([&world, frame](uint32_t count, Entity* entities, Position* positions, Velocity* velocities, Age* ages) {
+        for (uint32_t i = 0; i < count; i++) {
+            positions[i].x += velocities[i].x;
+            positions[i].y += velocities[i].y;
+            positions[i].z += velocities[i].z;
+
+            ages[i].frames++;
+            if ((entities[i].index + frame) % RESPAWN_INTERVAL == 0) {
+                CommandBuffer& commands = world.commands();
+                commands.destroyEntity(entities[i]);
+                commands.createEntity(Position{0.0f, 0.0f, 0.0f}, velocities[i], Age{0});
+            }
+        }
+    });
+
+    jobs.parallelFor(ENTITY_COUNT, 256, [weights](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            weights[i] = weights[i] * 0.5f + 1.0f;
+        }
+    });
+
+    // Per frame lists come from the arena.
+    ScratchVector<Entity> old{ScratchAllocator<Entity>(arena)};
+    world.each<Age>([&old](Entity entity, Age& age) {
+        if (age.frames > 8) {
+            old.push_back(entity);
+        }
+    });
+
+    // The thread driving the frames records too.
+    if (!old.empty()) {
+        world.commands().removeComponent<Velocity>(old[frame % old.size()]);
+        world.commands().addComponent(old[frame % old.size()], Velocity{1.0f, 0.0f, 0.0f});
+    }
+
+    world.sync();
+    arena.reset();
+}
+
+int main() {
+    JobSystem jobs(3);
+    World world(&jobs);
+    ScratchArena arena;
+
+    for (uint32_t i = 0; i < ENTITY_COUNT; i++) {
+        float speed = static_cast<float>(i % 7);
+        world.createEntity(Position{0.0f, 0.0f, 0.0f}, Velocity{speed, 0.0f, -speed}, Age{0});
+    }
+    float* weights = new float[ENTITY_COUNT]();
+
+    for (uint32_t frame = 0; frame < WARM_UP_FRAMES; frame++) {
+        runFrame(jobs, world, arena, weights, frame);
+    }
+
+    uint64_t before = heapAllocations.load(std::memory_order_relaxed);
+    for (uint32_t frame = WARM_UP_FRAMES; frame < WARM_UP_FRAMES + STEADY_STATE_FRAMES; frame++) {
+        runFrame(jobs, world, arena, weights, frame);
+    }
+    uint64_t allocations = heapAllocations.load(std::memory_order_relaxed) - before;
+
+    delete[] weights;
+
+    if (allocations > 0) {
+        fprintf(stderr, "%llu heap allocations in %u steady state frames\n", static_cast<unsigned long long>(allocations), STEADY_STATE_FRAMES);
+        return EXIT_FAILURE;
+    }
+
+    printf("No heap allocations in %u steady state frames\n", STEADY_STATE_FRAMES);
+    return EXIT_SUCCESS;
+}